@@ -5,14 +5,40 @@ set SRC_FILES=^
 src\main.cpp ^
 src\gui\window.cpp ^
 src\gui\event.cpp ^
+src\gui\frame_scheduler.cpp ^
+src\gui\input_record.cpp ^
+src\gui\headless.cpp ^
+src\gui\upload_thread.cpp ^
 src\scene.cpp ^
+src\benchmark.cpp ^
 src\graphics\shader_program.cpp ^
+src\graphics\geometry_arena.cpp ^
+src\graphics\render_queue.cpp ^
+src\graphics\instance_buffer.cpp ^
+src\graphics\frustum.cpp ^
+src\graphics\bvh.cpp ^
+src\graphics\simplify.cpp ^
+src\graphics\mesh_optimize.cpp ^
+src\graphics\occlusion.cpp ^
+src\graphics\gpu_timer.cpp ^
+src\graphics\light_grid.cpp ^
+src\graphics\light_textures.cpp ^
+src\graphics\stats_overlay.cpp ^
 src\util\stl_parser.cpp ^
+src\util\mapped_file.cpp ^
+src\util\archive.cpp ^
+src\util\compress.cpp ^
+src\util\asset_streamer.cpp ^
+src\util\job_system.cpp ^
+src\util\profiler.cpp ^
+src\util\counters.cpp ^
+src\util\log.cpp ^
 src\graphics\camera.cpp
 
 set CXX_FLAGS=^
 -m32 ^
 -O2 ^
+-msse2 ^
 -Wall ^
 -Werror ^
 -std=c++14
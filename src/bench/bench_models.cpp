@@ -0,0 +1,74 @@
+#include "bench_models.h"
+#include <string>
+#include "util/log.h"
+#include "util/stl_parser.h"
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+#include "util/obj_loader.h"
+
+const std::vector<const char *> benchModels = {
+        "models/block100.stl",
+        "models/bottle.stl",
+        "models/cube.stl",
+        "models/humanoid.stl",
+        "models/magnolia.stl",
+        "models/space_invader_magnet.stl",
+        "models/sphere.stl",
+        "models/tiler_3d.stl",
+        "models/unit_circle_2x2.stl",
+        "models/suzanne.obj",
+        "models/nanosuit/nanosuit.obj",
+};
+
+bool LoadBenchMesh(const char *filename, MeshData_t &mesh)
+{
+    std::string name = filename;
+    if (name.substr(name.find_last_of('.')) == ".stl") {
+        std::vector<STLSolid_t> solids;
+        if (!ParseSTLFile(filename, solids)) {
+            return false;
+        }
+        for (size_t i=0; i<solids.size(); i++) {
+            ConvertSolidToNormalVertexElements(solids[i], mesh.normals,
+                    mesh.vertices, mesh.elements);
+        }
+        return true;
+    }
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string warn;
+    std::string err;
+    if (!LoadObjAsset(filename, &attrib, &shapes, &materials, &warn,
+            &err)) {
+        Error("Failed to load obj model '%s'", filename);
+        return false;
+    }
+    const bool textured = attrib.texcoords.size() > 0;
+    for (size_t s=0; s<shapes.size(); s++) {
+        for (size_t i=0; i<shapes[s].mesh.indices.size(); i++) {
+            tinyobj::index_t idx = shapes[s].mesh.indices[i];
+            mesh.elements.push_back(mesh.vertices.size());
+            mesh.vertices.push_back(glm::vec3(
+                    attrib.vertices[3*idx.vertex_index],
+                    attrib.vertices[3*idx.vertex_index+1],
+                    attrib.vertices[3*idx.vertex_index+2]));
+            glm::vec3 normal = glm::vec3(0.0f);
+            if (idx.normal_index >= 0) {
+                normal = glm::vec3(attrib.normals[3*idx.normal_index],
+                        attrib.normals[3*idx.normal_index+1],
+                        attrib.normals[3*idx.normal_index+2]);
+            }
+            mesh.normals.push_back(normal);
+            if (textured) {
+                glm::vec2 uv = glm::vec2(0.0f);
+                if (idx.texcoord_index >= 0) {
+                    uv = glm::vec2(attrib.texcoords[2*idx.texcoord_index],
+                            attrib.texcoords[2*idx.texcoord_index+1]);
+                }
+                mesh.uvs.push_back(uv);
+            }
+        }
+    }
+    return true;
+}
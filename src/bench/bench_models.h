@@ -0,0 +1,13 @@
+#ifndef BENCH_MODELS_H
+#define BENCH_MODELS_H
+#include <vector>
+#include "graphics/mesh.h"
+
+// Every model in res/, as copied to build/models
+extern const std::vector<const char *> benchModels;
+
+// Loads a model the way the scene does, one vertex per corner, with
+// every shape of an OBJ file put into a single mesh
+bool LoadBenchMesh(const char *filename, MeshData_t &mesh);
+
+#endif
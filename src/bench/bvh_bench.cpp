@@ -0,0 +1,247 @@
+// Build time and query throughput of the BVH over the meshes in res/.
+// Run it from the build directory like the main program, `make bench`
+// copies the models next to it.
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "graphics/bvh.h"
+#include "graphics/frustum.h"
+#include "graphics/mesh.h"
+#include "util/job_system.h"
+#include "util/log.h"
+#include "bench/bench_models.h"
+
+#define RAYS_PER_MODEL 200000
+#define RAYS_CHECKED 2000 // Against brute force
+#define BUILD_RUNS 5
+#define SCENE_OBJECTS 100000
+#define SCENE_EXTENT 1000.0f
+#define QUERY_RUNS 50
+
+typedef std::chrono::steady_clock Clock;
+
+static double MillisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+}
+
+// xorshift32, the same sequence on every run and platform
+static uint32_t rngState = 2463534242u;
+
+static float RandomFloat()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return (rngState >> 8) * (1.0f / 16777216.0f);
+}
+
+static glm::vec3 RandomInBox(const BoundingBox_t &box)
+{
+    return box.min + (box.max - box.min)
+            * glm::vec3(RandomFloat(), RandomFloat(), RandomFloat());
+}
+
+static bool BruteForceRaycast(const MeshData_t &mesh, const Ray_t &ray,
+        float &tHit)
+{
+    bool found = false;
+    tHit = FLT_MAX;
+    for (size_t i=0; i+2<mesh.elements.size(); i+=3) {
+        glm::vec3 v0 = mesh.vertices[mesh.elements[i]];
+        glm::vec3 e1 = mesh.vertices[mesh.elements[i+1]] - v0;
+        glm::vec3 e2 = mesh.vertices[mesh.elements[i+2]] - v0;
+        glm::vec3 p = glm::cross(ray.direction, e2);
+        float det = glm::dot(e1, p);
+        if (fabsf(det) < 1e-12f) {
+            continue;
+        }
+        glm::vec3 s = ray.origin - v0;
+        float u = glm::dot(s, p) / det;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(ray.direction, q) / det;
+        float t = glm::dot(e2, q) / det;
+        if (u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= 0.0f && t < tHit) {
+            tHit = t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void BenchMesh(const char *filename)
+{
+    MeshData_t mesh;
+    if (!LoadBenchMesh(filename, mesh) || mesh.elements.size() < 3) {
+        Warning("Skipping '%s'", filename);
+        return;
+    }
+    MeshBvh bvh;
+    double serialMs = DBL_MAX;
+    double parallelMs = DBL_MAX;
+    for (int run=0; run<BUILD_RUNS; run++) {
+        Clock::time_point start = Clock::now();
+        bvh.Build(mesh, false);
+        serialMs = std::min(serialMs, MillisecondsSince(start));
+        start = Clock::now();
+        bvh.Build(mesh);
+        parallelMs = std::min(parallelMs, MillisecondsSince(start));
+    }
+    BvhStats_t stats = bvh.GetBvh().GetStats();
+
+    // Rays start on a sphere around the model and aim at a random
+    // point inside its box, most of them hit something
+    BoundingBox_t box = ComputeBoundingBox(mesh.vertices);
+    glm::vec3 center = 0.5f*(box.min + box.max);
+    float radius = glm::length(box.max - box.min);
+    std::vector<Ray_t> rays(RAYS_PER_MODEL);
+    for (size_t i=0; i<rays.size(); i++) {
+        glm::vec3 d = glm::vec3(RandomFloat(), RandomFloat(), RandomFloat())
+                - glm::vec3(0.5f);
+        if (glm::length(d) < 1e-3f) {
+            d = glm::vec3(1.0f, 0.0f, 0.0f);
+        }
+        rays[i].origin = center + radius*glm::normalize(d);
+        rays[i].direction = RandomInBox(box) - rays[i].origin;
+    }
+    size_t hits = 0;
+    Clock::time_point start = Clock::now();
+    for (size_t i=0; i<rays.size(); i++) {
+        RayHit_t hit;
+        hits += bvh.Raycast(rays[i], hit);
+    }
+    double rayMs = MillisecondsSince(start);
+
+    size_t mismatches = 0;
+    for (size_t i=0; i<RAYS_CHECKED && i<rays.size(); i++) {
+        RayHit_t hit;
+        float t;
+        bool found = bvh.Raycast(rays[i], hit);
+        if (found != BruteForceRaycast(mesh, rays[i], t)
+                || (found && fabsf(hit.t - t) > 1e-4f*std::max(1.0f, t))) {
+            mismatches++;
+        }
+    }
+
+    printf("%-34s %8lu %8.2f %8.2f %7lu %5u %7.1f %8.2f %5.1f%% %lu\n",
+            filename, (unsigned long)(mesh.elements.size()/3), serialMs,
+            parallelMs, (unsigned long)stats.numNodes, stats.maxDepth,
+            stats.sahCost, rays.size() / (rayMs * 1000.0),
+            100.0 * hits / rays.size(), (unsigned long)mismatches);
+}
+
+// Object level: boxes scattered through a volume, queried with a
+// camera at the center turning around the vertical axis
+static void BenchScene()
+{
+    std::vector<BoundingBox_t> boxes(SCENE_OBJECTS);
+    BoundsSoA soa;
+    BoundingBox_t volume;
+    volume.min = glm::vec3(-0.5f*SCENE_EXTENT);
+    volume.max = glm::vec3(0.5f*SCENE_EXTENT);
+    for (size_t i=0; i<boxes.size(); i++) {
+        glm::vec3 size = glm::vec3(1.0f) + 4.0f*glm::vec3(RandomFloat(),
+                RandomFloat(), RandomFloat());
+        boxes[i].min = RandomInBox(volume);
+        boxes[i].max = boxes[i].min + size;
+        BoundingSphere_t sphere;
+        sphere.center = 0.5f*(boxes[i].min + boxes[i].max);
+        sphere.radius = 0.5f*glm::length(size);
+        soa.Add(boxes[i], sphere);
+    }
+
+    Bvh bvh;
+    double serialMs = DBL_MAX;
+    double parallelMs = DBL_MAX;
+    for (int run=0; run<BUILD_RUNS; run++) {
+        Clock::time_point start = Clock::now();
+        bvh.Build(boxes, false);
+        serialMs = std::min(serialMs, MillisecondsSince(start));
+        start = Clock::now();
+        bvh.Build(boxes);
+        parallelMs = std::min(parallelMs, MillisecondsSince(start));
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f/9.0f,
+            1.0f, 0.5f*SCENE_EXTENT);
+    std::vector<uint32_t> visible;
+    std::vector<uint32_t> flat(soa.GetPaddedSize());
+    double bvhMs = 0.0;
+    double flatMs = 0.0;
+    size_t numVisible = 0;
+    size_t mismatches = 0;
+    for (int run=0; run<QUERY_RUNS; run++) {
+        float angle = run * 2.0f * 3.14159265f / QUERY_RUNS;
+        glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(cosf(angle),
+                0.0f, sinf(angle)), glm::vec3(0.0f, 1.0f, 0.0f));
+        Frustum_t frustum = ExtractFrustumPlanes(projection * view);
+
+        visible.clear();
+        Clock::time_point start = Clock::now();
+        bvh.QueryFrustum(frustum, visible);
+        bvhMs += MillisecondsSince(start);
+
+        start = Clock::now();
+        size_t numFlat = CullBoundingBoxes(frustum, soa, &flat[0]);
+        flatMs += MillisecondsSince(start);
+
+        std::sort(visible.begin(), visible.end());
+        numVisible += visible.size();
+        if (visible.size() != numFlat
+                || !std::equal(visible.begin(), visible.end(), flat.begin())) {
+            mismatches++;
+        }
+    }
+
+    // Everything drifts a little, refit instead of rebuilding
+    for (size_t i=0; i<boxes.size(); i++) {
+        glm::vec3 offset = 2.0f*glm::vec3(RandomFloat(), RandomFloat(),
+                RandomFloat()) - glm::vec3(1.0f);
+        boxes[i].min += offset;
+        boxes[i].max += offset;
+        soa.Set(i, boxes[i], soa.GetSphere(i));
+    }
+    Clock::time_point start = Clock::now();
+    bvh.Refit(boxes);
+    double refitMs = MillisecondsSince(start);
+
+    Frustum_t frustum = ExtractFrustumPlanes(projection);
+    visible.clear();
+    bvh.QueryFrustum(frustum, visible);
+    std::sort(visible.begin(), visible.end());
+    size_t numFlat = CullBoundingBoxes(frustum, soa, &flat[0]);
+    if (visible.size() != numFlat
+            || !std::equal(visible.begin(), visible.end(), flat.begin())) {
+        mismatches++;
+    }
+
+    printf("\n%d objects: build %.2f ms (1 thread) %.2f ms (%u threads), "
+            "refit %.2f ms\n", SCENE_OBJECTS, serialMs, parallelMs,
+            GetNumJobThreads(), refitMs);
+    printf("frustum query: bvh %.1f us, flat SIMD %.1f us, "
+            "%lu visible on average, %lu mismatches\n",
+            1000.0 * bvhMs / QUERY_RUNS, 1000.0 * flatMs / QUERY_RUNS,
+            (unsigned long)(numVisible / QUERY_RUNS),
+            (unsigned long)mismatches);
+}
+
+int main(int argc, char **argv)
+{
+    // Optional thread count for the parallel builds, 0 picks one
+    StartJobSystem(argc > 1 ? atoi(argv[1]) : 0);
+    printf("%-34s %8s %8s %8s %7s %5s %7s %8s %6s %s\n", "model", "tris",
+            "build1", "buildN", "nodes", "depth", "sah", "Mrays/s", "hit",
+            "bad");
+    for (size_t i=0; i<benchModels.size(); i++) {
+        BenchMesh(benchModels[i]);
+    }
+    BenchScene();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,157 @@
+// Scheduling overhead and scaling of the job system for 1 thread up to
+// the number of cores, or the count given on the command line. Every
+// pass checks its result so a lost or doubled job fails the run.
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "util/job_system.h"
+
+#define EMPTY_JOBS 100000
+#define CHAIN_JOBS 10000
+#define LOOP_ITEMS (1 << 20)
+#define LOOP_WORK 64 // Rounds of hashing per item
+#define RUNS 5
+
+typedef std::chrono::steady_clock Clock;
+
+static double MillisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+}
+
+// Fastest of RUNS, false if any run got the wrong answer
+template <typename Fn>
+static bool Best(Fn run, double &bestMs)
+{
+    bestMs = 1e30;
+    for (int r=0; r<RUNS; r++) {
+        Clock::time_point start = Clock::now();
+        const bool ok = run();
+        bestMs = std::min(bestMs, MillisecondsSince(start));
+        if (!ok) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Cost of queuing, running and counting a job that does nothing
+static bool EmptyJobs(double &ms)
+{
+    return Best([]() {
+        std::atomic<uint32_t> count(0);
+        JobCounter_t counter;
+        for (int i=0; i<EMPTY_JOBS; i++) {
+            RunJob([&count]() {
+                count.fetch_add(1, std::memory_order_relaxed);
+            }, &counter);
+        }
+        WaitForJobs(counter);
+        return count.load() == EMPTY_JOBS;
+    }, ms);
+}
+
+// Every job waits on the one before it, so each hop pays the latency
+// of a dependency being released
+static bool JobChain(double &ms)
+{
+    return Best([]() {
+        std::vector<JobCounter_t> counters(CHAIN_JOBS);
+        std::atomic<uint32_t> next(0);
+        bool inOrder = true;
+        for (int i=0; i<CHAIN_JOBS; i++) {
+            RunJob([&next, &inOrder, i]() {
+                inOrder = inOrder && next.fetch_add(1) == (uint32_t)i;
+            }, &counters[i], i > 0 ? &counters[i-1] : NULL);
+        }
+        WaitForJobs(counters[CHAIN_JOBS-1]);
+        return inOrder && next.load() == CHAIN_JOBS;
+    }, ms);
+}
+
+// xorshift32 rounds, integer so every thread gets the same bits
+static uint32_t Work(size_t i)
+{
+    uint32_t x = (uint32_t)i + 1;
+    for (int k=0; k<LOOP_WORK; k++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+static bool Loop(size_t grain, const std::vector<uint32_t> &expected,
+        std::vector<uint32_t> &out, double &ms)
+{
+    return Best([&]() {
+        std::fill(out.begin(), out.end(), 0);
+        ParallelFor(0, out.size(), grain, [&out](size_t begin, size_t end) {
+            for (size_t i=begin; i<end; i++) {
+                out[i] = Work(i);
+            }
+        });
+        return out == expected;
+    }, ms);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned maxThreads = std::max(2u, std::thread::hardware_concurrency());
+    if (argc > 1 && atoi(argv[1]) > 0) {
+        maxThreads = atoi(argv[1]);
+    }
+    std::vector<uint32_t> expected(LOOP_ITEMS);
+    for (size_t i=0; i<expected.size(); i++) {
+        expected[i] = Work(i);
+    }
+    std::vector<uint32_t> out(LOOP_ITEMS);
+    static const size_t grains[] = { 16, 256, 4096, 0 };
+    const size_t numGrains = sizeof(grains)/sizeof(grains[0]);
+    double serialMs = 0.0;
+
+    printf("%7s %10s %10s", "threads", "empty ns", "chain ns");
+    for (size_t g=0; g<numGrains; g++) {
+        char name[32];
+        snprintf(name, sizeof(name), grains[g] ? "grain %lu" : "grain auto",
+                (unsigned long)grains[g]);
+        printf(" %11s", name);
+    }
+    printf("\n");
+    unsigned threads = 1;
+    while (true) {
+        StartJobSystem(threads);
+        double emptyMs;
+        double chainMs;
+        if (!EmptyJobs(emptyMs) || !JobChain(chainMs)) {
+            printf("jobs went missing on %u threads\n", threads);
+            return EXIT_FAILURE;
+        }
+        printf("%7u %10.1f %10.1f", threads, 1e6 * emptyMs / EMPTY_JOBS,
+                1e6 * chainMs / CHAIN_JOBS);
+        for (size_t g=0; g<numGrains; g++) {
+            double loopMs;
+            if (!Loop(grains[g], expected, out, loopMs)) {
+                printf("\nwrong loop results on %u threads\n", threads);
+                return EXIT_FAILURE;
+            }
+            if (threads == 1 && g == 0) {
+                serialMs = loopMs;
+            }
+            printf(" %5.1fms %3.1fx", loopMs, serialMs / loopMs);
+        }
+        printf("\n");
+        StopJobSystem();
+        if (threads == maxThreads) {
+            break;
+        }
+        threads = std::min(threads*2, maxThreads);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,154 @@
+// Cost of binning point and spot lights into the clustered lighting
+// grid for growing light counts, and how many lights a cluster ends
+// up with. Points are scattered within reach of every light, each
+// must fall in a cluster that lists the light.
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "graphics/light_grid.h"
+#include "util/job_system.h"
+
+#define FOV_Y 45.0f
+#define ASPECT (16.0f/9.0f)
+#define Z_NEAR 1.0f
+#define Z_FAR 1000.0f
+#define BUILD_RUNS 50
+#define SAMPLES_PER_LIGHT 64
+
+typedef std::chrono::steady_clock Clock;
+
+// xorshift32, the same sequence on every run and platform
+static uint32_t rngState = 2463534242u;
+
+static float RandomFloat()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return (rngState >> 8) * (1.0f / 16777216.0f);
+}
+
+// Lights scattered over a floor in front of the camera, a third of
+// them spot lights pointing down
+static void MakeLights(size_t count, std::vector<ShaderLight_t> &lights)
+{
+    lights.clear();
+    for (size_t i=0; i<count; i++) {
+        ShaderLight_t light;
+        light.position = glm::vec3(RandomFloat()*100.0f - 50.0f,
+                RandomFloat()*4.0f, -RandomFloat()*100.0f);
+        light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+        light.ambient = glm::vec3(0.0f);
+        light.diffuse = glm::vec3(RandomFloat(), RandomFloat(),
+                RandomFloat());
+        light.specular = light.diffuse;
+        light.innerCutOff = cosf(glm::radians(20.0f));
+        light.outerCutOff = cosf(glm::radians(30.0f));
+        light.constant = 1.0f;
+        light.linear = 0.7f;
+        light.quadratic = 1.8f;
+        light.type = (i % 3 == 0) ? 2 : 1;
+        lights.push_back(light);
+    }
+}
+
+// Points within reach of each light that land in a cluster whose list
+// leaves the light out, the shader would light them wrongly
+static size_t CountMissing(const LightGrid &grid,
+        const std::vector<ShaderLight_t> &lights, const glm::mat4 &view)
+{
+    const std::vector<uint32_t> &clusters = grid.GetClusters();
+    const std::vector<uint32_t> &indices = grid.GetIndices();
+    const float tanY = tanf(0.5f * glm::radians(FOV_Y));
+    const float tanX = tanY * ASPECT;
+    size_t missing = 0;
+    for (size_t i=0; i<lights.size(); i++) {
+        const float range = LightRange(lights[i]);
+        for (int sample=0; sample<SAMPLES_PER_LIGHT; sample++) {
+            glm::vec3 offset;
+            do {
+                offset = glm::vec3(RandomFloat(), RandomFloat(),
+                        RandomFloat()) * 2.0f - 1.0f;
+            } while (glm::dot(offset, offset) > 1.0f);
+            // Half the samples right at the edge of the light's reach
+            if (sample % 2 == 0 && glm::dot(offset, offset) > 0.0f) {
+                offset = glm::normalize(offset) * 0.999f;
+            }
+            const glm::vec4 p = view * glm::vec4(lights[i].position
+                    + offset*range, 1.0f);
+            const float depth = -p.z;
+            const float ndcX = p.x / (depth * tanX);
+            const float ndcY = p.y / (depth * tanY);
+            if (depth < Z_NEAR || depth > Z_FAR || fabsf(ndcX) > 1.0f
+                    || fabsf(ndcY) > 1.0f) {
+                continue;
+            }
+            // Found the way model.frs finds it
+            const int x = std::min(LIGHT_GRID_X - 1,
+                    (int)((ndcX + 1.0f) * 0.5f * LIGHT_GRID_X));
+            const int y = std::min(LIGHT_GRID_Y - 1,
+                    (int)((ndcY + 1.0f) * 0.5f * LIGHT_GRID_Y));
+            const int z = std::min(LIGHT_GRID_Z - 1, std::max(0,
+                    (int)(logf(depth) * grid.GetSliceScale()
+                    + grid.GetSliceBias())));
+            const int c = (z*LIGHT_GRID_Y + y)*LIGHT_GRID_X + x;
+            const uint32_t *first = indices.data() + clusters[2*c];
+            const uint32_t *last = first + clusters[2*c + 1];
+            if (std::find(first, last, (uint32_t)i) == last) {
+                missing++;
+            }
+        }
+    }
+    return missing;
+}
+
+static double BuildMicroseconds(LightGrid &grid,
+        const std::vector<ShaderLight_t> &lights, const glm::mat4 &view)
+{
+    grid.Build(lights, view);
+    Clock::time_point start = Clock::now();
+    for (int run=0; run<BUILD_RUNS; run++) {
+        grid.Build(lights, view);
+    }
+    return std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count() / BUILD_RUNS;
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t counts[] = { 16, 128, 512, 2048, 8192 };
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 6.0f, 10.0f),
+            glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    std::vector<ShaderLight_t> lights;
+    StartJobSystem();
+    printf("%dx%dx%d clusters\n", LIGHT_GRID_X, LIGHT_GRID_Y, LIGHT_GRID_Z);
+    for (size_t n=0; n<sizeof(counts)/sizeof(counts[0]); n++) {
+        MakeLights(counts[n], lights);
+        LightGrid single(1);
+        LightGrid multi(0);
+        single.SetProjection(glm::radians(FOV_Y), ASPECT, Z_NEAR, Z_FAR);
+        multi.SetProjection(glm::radians(FOV_Y), ASPECT, Z_NEAR, Z_FAR);
+        const double singleUs = BuildMicroseconds(single, lights, view);
+        const double multiUs = BuildMicroseconds(multi, lights, view);
+        const LightGridStats_t &stats = multi.GetStats();
+        const size_t missing = CountMissing(multi, lights, view);
+        printf("%5lu lights: %4lu in view, 1 thread %8.1f us, threaded "
+                "%8.1f us\n", (unsigned long)counts[n],
+                (unsigned long)stats.numLights, singleUs, multiUs);
+        printf("  %4lu clusters lit, %.1f lights each, %lu at most, "
+                "points missed %lu\n", (unsigned long)stats.numOccupied,
+                stats.numOccupied > 0
+                        ? (double)stats.numIndices / stats.numOccupied : 0.0,
+                (unsigned long)stats.maxPerCluster, (unsigned long)missing);
+        if (missing > 0) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
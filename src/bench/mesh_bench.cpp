@@ -0,0 +1,82 @@
+// Post-transform cache efficiency of every mesh in res/ before and
+// after each index optimization stage, and how long the stages take.
+// Run it from the build directory like the main program.
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "graphics/mesh.h"
+#include "graphics/mesh_optimize.h"
+#include "util/log.h"
+#include "bench/bench_models.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static double MillisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start)
+            .count();
+}
+
+static void PrintStats(const char *stage, const MeshData_t &mesh,
+        double milliseconds)
+{
+    VertexCacheStats_t stats = AnalyzeVertexCache(mesh.elements,
+            mesh.vertices.size());
+    printf("  %-10s %8lu verts  ACMR %5.3f  ATVR %5.3f  %8.3f ms\n", stage,
+            (unsigned long)mesh.vertices.size(), stats.acmr, stats.atvr,
+            milliseconds);
+}
+
+int main(int argc, char **argv)
+{
+    double totalMs = 0.0;
+    float acmrBefore = 0.0f;
+    float acmrAfter = 0.0f;
+    size_t numMeshes = 0;
+    for (size_t i=0; i<benchModels.size(); i++) {
+        MeshData_t mesh;
+        if (!LoadBenchMesh(benchModels[i], mesh) || mesh.elements.size() < 3) {
+            Warning("Skipping '%s'", benchModels[i]);
+            continue;
+        }
+        printf("%s: %lu triangles\n", benchModels[i],
+                (unsigned long)mesh.elements.size()/3);
+        PrintStats("loaded", mesh, 0.0);
+
+        Clock::time_point start = Clock::now();
+        WeldMesh(mesh);
+        double weldMs = MillisecondsSince(start);
+        PrintStats("welded", mesh, weldMs);
+        const float before = AnalyzeVertexCache(mesh.elements,
+                mesh.vertices.size()).acmr;
+
+        start = Clock::now();
+        OptimizeVertexCache(mesh.elements, mesh.vertices.size());
+        double cacheMs = MillisecondsSince(start);
+        PrintStats("cache", mesh, cacheMs);
+
+        start = Clock::now();
+        const bool reordered = OptimizeOverdraw(mesh.elements, mesh.vertices);
+        double overdrawMs = MillisecondsSince(start);
+        // Rejected orders leave the cache order as it was
+        PrintStats(reordered ? "overdraw" : "rejected", mesh, overdrawMs);
+
+        start = Clock::now();
+        OptimizeVertexFetch(mesh);
+        double fetchMs = MillisecondsSince(start);
+        PrintStats("fetch", mesh, fetchMs);
+
+        totalMs += weldMs + cacheMs + overdrawMs + fetchMs;
+        acmrBefore += before;
+        acmrAfter += AnalyzeVertexCache(mesh.elements,
+                mesh.vertices.size()).acmr;
+        numMeshes++;
+    }
+    if (numMeshes > 0) {
+        printf("\n%lu meshes, mean ACMR %.3f welded, %.3f optimized, "
+                "%.2f ms total\n", (unsigned long)numMeshes,
+                acmrBefore / numMeshes, acmrAfter / numMeshes, totalMs);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,286 @@
+// Cull rate and cost of the software occlusion culler. Each model in
+// res/ is put in front of a cloud of boxes, plus a closed housing with
+// parts inside it. Every box the culler hides is checked against a
+// plain per pixel depth buffer of the same occluders, which must hide
+// it too. Run it from the build directory like the main program.
+#include <cstdio>
+#include <cstdlib>
+#include <cfloat>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "graphics/frustum.h"
+#include "graphics/mesh.h"
+#include "graphics/occlusion.h"
+#include "util/job_system.h"
+#include "util/log.h"
+#include "bench/bench_models.h"
+
+#define SCENE_BOXES 5000
+#define FRAME_RUNS 50
+
+struct BenchOccluder_t {
+    OccluderMesh_t mesh;
+    glm::mat4 model;
+};
+
+// xorshift32, the same sequence on every run and platform
+static uint32_t rngState = 2463534242u;
+
+static float RandomFloat()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return (rngState >> 8) * (1.0f / 16777216.0f);
+}
+
+// Closed box, counter-clockwise seen from outside
+static void AddBoxMesh(OccluderMesh_t &mesh, const glm::vec3 &lo,
+        const glm::vec3 &hi)
+{
+    static const int faces[6][4] = {
+        { 0, 2, 3, 1 }, { 4, 5, 7, 6 }, // -z, +z
+        { 0, 1, 5, 4 }, { 2, 6, 7, 3 }, // -y, +y
+        { 0, 4, 6, 2 }, { 1, 3, 7, 5 }, // -x, +x
+    };
+    const GLuint base = mesh.vertices.size();
+    for (int c=0; c<8; c++) {
+        mesh.vertices.push_back(glm::vec3((c & 1) ? hi.x : lo.x,
+                (c & 2) ? hi.y : lo.y, (c & 4) ? hi.z : lo.z));
+    }
+    for (int f=0; f<6; f++) {
+        const GLuint quad[6] = { 0, 1, 2, 0, 2, 3 };
+        for (int k=0; k<6; k++) {
+            mesh.elements.push_back(base + faces[f][quad[k]]);
+        }
+    }
+}
+
+// Depth per pixel of the same occluders, sampled at pixel centers
+static void ReferenceDepth(const std::vector<BenchOccluder_t> &occluders,
+        const glm::mat4 &viewProjection, std::vector<float> &depth)
+{
+    depth.assign(OCCLUSION_WIDTH*OCCLUSION_HEIGHT, 1.0f);
+    for (size_t o=0; o<occluders.size(); o++) {
+        const OccluderMesh_t &mesh = occluders[o].mesh;
+        const glm::mat4 transform = viewProjection * occluders[o].model;
+        for (size_t e=0; e+2<mesh.elements.size(); e+=3) {
+            glm::vec3 s[3];
+            bool clipped = false;
+            for (int k=0; k<3; k++) {
+                glm::vec4 c = transform
+                        * glm::vec4(mesh.vertices[mesh.elements[e+k]], 1.0f);
+                if (c.w <= FLT_EPSILON || c.z < -c.w) {
+                    clipped = true;
+                }
+                s[k] = glm::vec3((c.x/c.w*0.5f + 0.5f) * OCCLUSION_WIDTH,
+                        (c.y/c.w*0.5f + 0.5f) * OCCLUSION_HEIGHT,
+                        c.z/c.w*0.5f + 0.5f);
+            }
+            const float det = (s[1].x - s[0].x)*(s[2].y - s[0].y)
+                    - (s[2].x - s[0].x)*(s[1].y - s[0].y);
+            if (clipped || !(det > 0.0f)) {
+                continue;
+            }
+            const glm::vec3 lo = glm::min(s[0], glm::min(s[1], s[2]));
+            const glm::vec3 hi = glm::max(s[0], glm::max(s[1], s[2]));
+            const int x0 = std::max((int)floorf(lo.x), 0);
+            const int x1 = std::min((int)ceilf(hi.x), OCCLUSION_WIDTH);
+            const int y0 = std::max((int)floorf(lo.y), 0);
+            const int y1 = std::min((int)ceilf(hi.y), OCCLUSION_HEIGHT);
+            for (int y=y0; y<y1; y++) {
+                for (int x=x0; x<x1; x++) {
+                    const glm::vec2 p(x + 0.5f, y + 0.5f);
+                    float w[3];
+                    for (int k=0; k<3; k++) {
+                        const glm::vec3 &a = s[k];
+                        const glm::vec3 &b = s[(k + 1) % 3];
+                        w[k] = (b.x - a.x)*(p.y - a.y)
+                                - (b.y - a.y)*(p.x - a.x);
+                    }
+                    // Centers on an edge count as covered, so pixels on
+                    // the seam between two triangles aren't left empty
+                    if (w[0] < 0.0f || w[1] < 0.0f || w[2] < 0.0f) {
+                        continue;
+                    }
+                    // w[k] weighs the vertex opposite edge k
+                    const float z = (w[1]*s[0].z + w[2]*s[1].z + w[0]*s[2].z)
+                            / det;
+                    float &d = depth[y*OCCLUSION_WIDTH + x];
+                    d = std::min(d, z);
+                }
+            }
+        }
+    }
+}
+
+static bool ReferenceVisible(const std::vector<float> &depth,
+        const glm::mat4 &viewProjection, const BoundingBox_t &box)
+{
+    glm::vec3 lo(FLT_MAX);
+    glm::vec3 hi(-FLT_MAX);
+    for (int c=0; c<8; c++) {
+        glm::vec4 clip = viewProjection * glm::vec4((c & 1) ? box.max.x
+                : box.min.x, (c & 2) ? box.max.y : box.min.y,
+                (c & 4) ? box.max.z : box.min.z, 1.0f);
+        if (clip.w <= FLT_EPSILON || clip.z < -clip.w) {
+            return true;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        lo = glm::min(lo, ndc);
+        hi = glm::max(hi, ndc);
+    }
+    const int x0 = std::max((int)floorf((lo.x*0.5f + 0.5f)*OCCLUSION_WIDTH), 0);
+    const int x1 = std::min((int)ceilf((hi.x*0.5f + 0.5f)*OCCLUSION_WIDTH),
+            OCCLUSION_WIDTH);
+    const int y0 = std::max((int)floorf((lo.y*0.5f + 0.5f)*OCCLUSION_HEIGHT),
+            0);
+    const int y1 = std::min((int)ceilf((hi.y*0.5f + 0.5f)*OCCLUSION_HEIGHT),
+            OCCLUSION_HEIGHT);
+    const float boxDepth = lo.z*0.5f + 0.5f;
+    for (int y=y0; y<y1; y++) {
+        for (int x=x0; x<x1; x++) {
+            if (!(boxDepth > depth[y*OCCLUSION_WIDTH + x])) {
+                return true;
+            }
+        }
+    }
+    return x0 >= x1 || y0 >= y1;
+}
+
+static void BenchScene(const char *name,
+        const std::vector<BenchOccluder_t> &occluders,
+        const BoundsSoA &bounds, const glm::mat4 &viewProjection,
+        unsigned int numThreads)
+{
+    Frustum_t frustum = ExtractFrustumPlanes(viewProjection);
+    std::vector<uint32_t> inFrustum(bounds.GetPaddedSize());
+    inFrustum.resize(CullBoundingBoxes(frustum, bounds, &inFrustum[0]));
+
+    size_t triangles = 0;
+    for (size_t o=0; o<occluders.size(); o++) {
+        triangles += occluders[o].mesh.elements.size() / 3;
+    }
+    printf("%s: %lu occluder triangles, %lu boxes in view\n", name,
+            (unsigned long)triangles, (unsigned long)inFrustum.size());
+
+    std::vector<uint32_t> visible;
+    unsigned int threadCounts[2] = { 1, numThreads };
+    for (int t=0; t<(numThreads > 1 ? 2 : 1); t++) {
+        OcclusionCuller culler(threadCounts[t]);
+        double rasterUs = 0.0;
+        double testUs = 0.0;
+        for (int run=0; run<FRAME_RUNS; run++) {
+            culler.BeginFrame(viewProjection);
+            for (size_t o=0; o<occluders.size(); o++) {
+                culler.AddOccluder(occluders[o].mesh, occluders[o].model);
+            }
+            culler.RasterizeOccluders();
+            visible = inFrustum;
+            culler.CullOccluded(bounds, visible);
+            rasterUs += culler.GetStats().rasterMicroseconds;
+            testUs += culler.GetStats().testMicroseconds;
+        }
+        const OcclusionStats_t &stats = culler.GetStats();
+        printf("  %u thread(s): raster %8.1f us, test %7.1f us, "
+                "%lu/%lu culled (%.1f%%)\n", threadCounts[t],
+                rasterUs / FRAME_RUNS, testUs / FRAME_RUNS,
+                (unsigned long)stats.numOccluded,
+                (unsigned long)stats.numTested,
+                stats.numTested ? 100.0 * stats.numOccluded / stats.numTested
+                    : 0.0);
+    }
+
+    std::vector<float> reference;
+    ReferenceDepth(occluders, viewProjection, reference);
+    std::vector<char> kept(bounds.GetSize(), 0);
+    for (size_t i=0; i<visible.size(); i++) {
+        kept[visible[i]] = 1;
+    }
+    size_t referenceCulled = 0;
+    size_t wrong = 0;
+    for (size_t i=0; i<inFrustum.size(); i++) {
+        const uint32_t b = inFrustum[i];
+        const bool referenceVisible = ReferenceVisible(reference,
+                viewProjection, bounds.GetBox(b));
+        referenceCulled += !referenceVisible;
+        wrong += referenceVisible && !kept[b];
+    }
+    printf("  per pixel depth culls %lu, boxes culled but visible: %lu\n",
+            (unsigned long)referenceCulled, (unsigned long)wrong);
+}
+
+static void AddRandomBoxes(BoundsSoA &bounds, const BoundingBox_t &region,
+        size_t count, float maxSize)
+{
+    for (size_t i=0; i<count; i++) {
+        glm::vec3 center = region.min + (region.max - region.min)
+                * glm::vec3(RandomFloat(), RandomFloat(), RandomFloat());
+        glm::vec3 half = glm::vec3(RandomFloat(), RandomFloat(),
+                RandomFloat()) * (0.5f * maxSize);
+        BoundingBox_t box = { center - half, center + half };
+        BoundingSphere_t sphere = { center, glm::length(half) };
+        bounds.Add(box, sphere);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 1) {
+        numThreads = std::max(1, atoi(argv[1]));
+    }
+    StartJobSystem(numThreads);
+    const glm::mat4 projection = glm::perspective(glm::radians(60.0f), 2.0f,
+            0.1f, 1000.0f);
+    const glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f,
+            0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::mat4 viewProjection = projection * view;
+
+    // Closed housing with parts inside and a few outside
+    {
+        std::vector<BenchOccluder_t> occluders(1);
+        AddBoxMesh(occluders[0].mesh, glm::vec3(-8.0f, -5.0f, -40.0f),
+                glm::vec3(8.0f, 5.0f, -25.0f));
+        occluders[0].model = glm::mat4(1.0f);
+        BoundsSoA bounds;
+        BoundingBox_t inside = { glm::vec3(-7.0f, -4.0f, -39.0f),
+                glm::vec3(7.0f, 4.0f, -26.0f) };
+        BoundingBox_t around = { glm::vec3(-30.0f, -15.0f, -60.0f),
+                glm::vec3(30.0f, 15.0f, -10.0f) };
+        AddRandomBoxes(bounds, inside, SCENE_BOXES/2, 1.0f);
+        AddRandomBoxes(bounds, around, SCENE_BOXES/2, 1.0f);
+        BenchScene("housing", occluders, bounds, viewProjection, numThreads);
+    }
+
+    for (size_t i=0; i<benchModels.size(); i++) {
+        MeshData_t mesh;
+        if (!LoadBenchMesh(benchModels[i], mesh) || mesh.elements.size() < 3) {
+            Warning("Skipping '%s'", benchModels[i]);
+            continue;
+        }
+        // Scaled to about 20 units across, 30 units in front of the
+        // camera, with the boxes around and behind it
+        std::vector<BenchOccluder_t> occluders(1);
+        occluders[0].mesh.vertices = mesh.vertices;
+        occluders[0].mesh.elements = mesh.elements;
+        BoundingBox_t box = ComputeBoundingBox(mesh.vertices);
+        const float size = std::max(glm::length(box.max - box.min), 1e-6f);
+        occluders[0].model = glm::translate(glm::mat4(1.0f),
+                glm::vec3(0.0f, 0.0f, -30.0f))
+                * glm::scale(glm::mat4(1.0f), glm::vec3(20.0f / size))
+                * glm::translate(glm::mat4(1.0f),
+                    -0.5f*(box.min + box.max));
+        BoundsSoA bounds;
+        BoundingBox_t region = { glm::vec3(-12.0f, -8.0f, -80.0f),
+                glm::vec3(12.0f, 8.0f, -20.0f) };
+        AddRandomBoxes(bounds, region, SCENE_BOXES, 1.0f);
+        BenchScene(benchModels[i], occluders, bounds, viewProjection,
+                numThreads);
+    }
+    return EXIT_SUCCESS;
+}
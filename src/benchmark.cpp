@@ -0,0 +1,316 @@
+#include "benchmark.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <GL/glew.h>
+#include "SDL.h"
+#include "scene.h"
+#include "gui/window.h"
+#include "util/stats.h"
+#include "util/json.h"
+#include "util/counters.h"
+#include "util/job_system.h"
+#include "util/log.h"
+#include "util/profiler.h"
+
+// The orbit looks down on the scene at this angle, from just far
+// enough for its bounding sphere to fit the view
+#define BENCH_ORBIT_ELEVATION 25.0f
+#define BENCH_ORBIT_MARGIN 1.1f
+
+// A scene to benchmark. --grid NxM turns every model of it into an
+// N x M grid `gridSpacing` apart and resizes its grids.
+struct BenchScene_t {
+    SceneDesc_t scene;
+    float gridSpacing;
+};
+
+static const BenchScene_t benchScenes[] = {
+    { { "nanosuit", { "models/nanosuit/nanosuit.obj" }, {}, {} }, 10.0f },
+    { { "suzanne-grid", {}, { { "models/suzanne.obj", 20, 20, 4.0f } }, {} },
+            4.0f },
+    { { "cube-grid", {}, { { "models/cube.stl", 100, 100, 3.0f } }, {} },
+            3.0f },
+    { { "lights", { "models/nanosuit/nanosuit.obj" },
+            { { "models/suzanne.obj", 10, 10, 4.0f } },
+            { { 20, 20, 4.0f, 1.5f } } }, 10.0f },
+};
+
+static const size_t numBenchScenes = sizeof(benchScenes)
+        / sizeof(benchScenes[0]);
+
+void PrintBenchScenes()
+{
+    for (size_t i=0; i<numBenchScenes; i++) {
+        Info("  %s", benchScenes[i].scene.name);
+    }
+}
+
+static const BenchScene_t* FindBenchScene(const char *name)
+{
+    for (size_t i=0; i<numBenchScenes; i++) {
+        if (strcmp(benchScenes[i].scene.name, name) == 0) {
+            return &benchScenes[i];
+        }
+    }
+    return NULL;
+}
+
+static double MillisecondsBetween(uint64_t start, uint64_t end)
+{
+    return (end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+static void WriteJsonSummary(FILE *file, const char *name,
+        const std::vector<double> &samples, bool last=false)
+{
+    fprintf(file, "    \"%s\": ", name);
+    if (samples.size() == 0) {
+        fprintf(file, "null%s\n", last ? "" : ",");
+        return;
+    }
+    TimeSummary_t summary = SummarizeTimes(samples);
+    fprintf(file, "{ \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, "
+            "\"p99\": %.4f, \"max\": %.4f }%s\n", summary.mean, summary.p50,
+            summary.p95, summary.p99, summary.max, last ? "" : ",");
+}
+
+struct BenchSamples_t {
+    std::vector<double> cpuMs; // Until SceneRender returns
+    std::vector<double> frameMs; // Until the GPU is done
+    std::vector<double> gpuMs;
+    std::vector<double> numVisible;
+    std::vector<double> numDrawCalls;
+    std::vector<double> numTriangles;
+    std::vector<double> numStateChanges;
+    std::vector<double> numProgramBinds;
+    std::vector<double> numTextureBinds;
+    std::vector<double> numUploads;
+    std::vector<double> uploadBytes;
+};
+
+static bool WriteBenchJson(const BenchOptions_t &options,
+        double contextMs, const SceneLoadStats_t &load, double serialMs,
+        const BenchSamples_t &samples)
+{
+    FILE *file = stdout;
+    if (options.jsonFile) {
+        file = fopen(options.jsonFile, "w");
+        if (file == NULL) {
+            Error("Could not open '%s' for the results", options.jsonFile);
+            return false;
+        }
+    }
+    fprintf(file, "{\n  \"scene\": ");
+    WriteJsonString(file, options.scene);
+    if (options.gridColumns > 0) {
+        fprintf(file, ",\n  \"grid\": [%d, %d]", options.gridColumns,
+                options.gridRows);
+    } else {
+        fprintf(file, ",\n  \"grid\": null");
+    }
+    fprintf(file, ",\n  \"resolution\": [%d, %d],\n", options.width,
+            options.height);
+    fprintf(file, "  \"frames\": %u,\n  \"warmup_frames\": %d,\n",
+            options.numFrames, BENCH_WARMUP_FRAMES);
+    fprintf(file, "  \"threads\": %u,\n", GetNumJobThreads());
+    fprintf(file, "  \"depth_prepass\": %s,\n  \"renderer\": ",
+            options.depthPrepass ? "true" : "false");
+    WriteJsonString(file, (const char *)glGetString(GL_RENDERER));
+    fprintf(file, ",\n  \"gl_version\": ");
+    WriteJsonString(file, (const char *)glGetString(GL_VERSION));
+    fprintf(file, ",\n  \"objects\": %lu,\n  \"triangles\": %lu,\n"
+            "  \"lights\": %lu,\n", (unsigned long)load.numObjects,
+            (unsigned long)load.numTriangles, (unsigned long)load.numLights);
+    fprintf(file, "  \"load_ms\": {\n    \"context\": %.3f,\n"
+            "    \"parse\": %.3f,\n    \"textures\": %.3f,\n"
+            "    \"optimize\": %.3f,\n    \"upload\": %.3f,\n"
+            "    \"bvh\": %.3f,\n    \"shaders\": %.3f,\n"
+            "    \"ready\": %.3f,\n    \"total\": %.3f,\n"
+            "    \"upload_thread\": %.3f,\n    \"serial\": %.3f\n  },\n",
+            contextMs, load.parseMs, load.textureMs, load.optimizeMs,
+            load.uploadMs, load.bvhMs, load.shaderMs, load.readyMs,
+            load.totalMs, load.uploadThreadMs, serialMs);
+    fprintf(file, "  \"load_speedup\": %.3f,\n",
+            load.totalMs > 0.0 ? serialMs / load.totalMs : 1.0);
+    fprintf(file, "  \"frame_ms\": {\n");
+    WriteJsonSummary(file, "cpu", samples.cpuMs);
+    WriteJsonSummary(file, "frame", samples.frameMs);
+    WriteJsonSummary(file, "gpu", samples.gpuMs, true);
+    fprintf(file, "  },\n  \"per_frame\": {\n");
+    WriteJsonSummary(file, "visible_objects", samples.numVisible);
+    WriteJsonSummary(file, "draw_calls", samples.numDrawCalls);
+    WriteJsonSummary(file, "triangles", samples.numTriangles);
+    WriteJsonSummary(file, "state_changes", samples.numStateChanges);
+    WriteJsonSummary(file, "program_binds", samples.numProgramBinds);
+    WriteJsonSummary(file, "texture_binds", samples.numTextureBinds);
+    WriteJsonSummary(file, "buffer_uploads", samples.numUploads);
+    WriteJsonSummary(file, "upload_bytes", samples.uploadBytes, true);
+    fprintf(file, "  }\n}\n");
+
+    bool ok = !ferror(file);
+    if (file != stdout) {
+        ok = fclose(file) == 0 && ok;
+    }
+    if (!ok) {
+        Error("Failed writing the results");
+    }
+    return ok;
+}
+
+static SceneDesc_t MakeBenchScene(const BenchScene_t &bench,
+        const BenchOptions_t &options)
+{
+    SceneDesc_t desc = bench.scene;
+    if (options.gridColumns <= 0) {
+        return desc;
+    }
+    for (size_t i=0; i<desc.modelGrids.size(); i++) {
+        desc.modelGrids[i].columns = options.gridColumns;
+        desc.modelGrids[i].rows = options.gridRows;
+    }
+    for (size_t i=0; i<desc.models.size(); i++) {
+        ModelGrid_t grid = { desc.models[i], options.gridColumns,
+                options.gridRows, bench.gridSpacing };
+        desc.modelGrids.push_back(grid);
+    }
+    desc.models.clear();
+    return desc;
+}
+
+// Loads the scene again with every job on this thread and no upload
+// thread, for the time the parallel load is compared to. It comes
+// second and finds the files cached and the shaders built, so the
+// speedup it gives is on the low side.
+static bool LoadSerialBaseline(const BenchScene_t &bench,
+        const BenchOptions_t &options, double &serialMs)
+{
+    const unsigned numThreads = GetNumJobThreads();
+    SceneUnload();
+    StopJobSystem();
+    StartJobSystem(1);
+    SceneSetUploadThread(false);
+    const bool ok = SceneInit(MakeBenchScene(bench, options))
+            && SceneFinishLoading();
+    serialMs = SceneGetLoadStats().totalMs;
+    StopJobSystem();
+    StartJobSystem(numThreads);
+    return ok;
+}
+
+static void DrawBenchFrames(const BenchOptions_t &options,
+        BenchSamples_t &samples)
+{
+    glm::vec3 min, max;
+    SceneGetBounds(min, max);
+    const glm::vec3 center = 0.5f*(min + max);
+    const float radius = std::max(0.5f*glm::length(max - min), 1.0f);
+    const float distance = BENCH_ORBIT_MARGIN * radius
+            / sinf(0.5f*glm::radians(FOV));
+    const float elevation = glm::radians(BENCH_ORBIT_ELEVATION);
+
+    const uint32_t numFrames = BENCH_WARMUP_FRAMES + options.numFrames;
+    for (uint32_t i=0; i<numFrames; i++) {
+        PROFILE_END_FRAME();
+        PROFILE_SCOPE("Frame");
+        const bool measured = i >= BENCH_WARMUP_FRAMES;
+        const float angle = measured ? 2.0f*glm::pi<float>()
+                * (i - BENCH_WARMUP_FRAMES) / options.numFrames : 0.0f;
+        SceneSetCamera(center + distance*glm::vec3(cosf(elevation)
+                * sinf(angle), sinf(elevation), cosf(elevation)
+                * cosf(angle)), center);
+
+        const uint64_t frameStart = SDL_GetPerformanceCounter();
+        ClearDepthBuffer();
+        SceneRender();
+        const uint64_t submitted = SDL_GetPerformanceCounter();
+        if (i+1 == numFrames && options.saveFile) {
+            SaveFramebuffer(options.saveFile);
+        }
+        {
+            PROFILE_SCOPE("Swap");
+            SwapBuffer();
+            glFinish();
+        }
+        const uint64_t frameEnd = SDL_GetPerformanceCounter();
+        CountersEndFrame();
+        if (!measured) {
+            continue;
+        }
+
+        samples.cpuMs.push_back(MillisecondsBetween(frameStart, submitted));
+        samples.frameMs.push_back(MillisecondsBetween(frameStart, frameEnd));
+        double prepassMs, shadingMs;
+        SceneGetPassTimes(prepassMs, shadingMs);
+        if (shadingMs >= 0.0) {
+            samples.gpuMs.push_back(std::max(prepassMs, 0.0) + shadingMs);
+        }
+        const SceneFrameStats_t &stats = SceneGetFrameStats();
+        samples.numVisible.push_back(stats.numVisible);
+        samples.numDrawCalls.push_back(stats.numDrawCalls);
+        samples.numTriangles.push_back(stats.numTriangles);
+        samples.numStateChanges.push_back(stats.numStateChanges);
+        const uint32_t *counters = GetLastFrameCounters().values;
+        samples.numProgramBinds.push_back(counters[COUNTER_PROGRAM_BINDS]);
+        samples.numTextureBinds.push_back(counters[COUNTER_TEXTURE_BINDS]);
+        samples.numUploads.push_back(counters[COUNTER_BUFFER_UPLOADS]);
+        samples.uploadBytes.push_back(counters[COUNTER_UPLOAD_BYTES]);
+    }
+}
+
+bool RunBenchmark(const BenchOptions_t &options)
+{
+    const BenchScene_t *bench = FindBenchScene(options.scene);
+    if (bench == NULL) {
+        Error("No benchmark scene '%s', there are:", options.scene);
+        PrintBenchScenes();
+        return false;
+    }
+    if (options.numFrames == 0) {
+        Error("Benchmarks need at least one frame");
+        return false;
+    }
+    const uint64_t start = SDL_GetPerformanceCounter();
+    if (!CreateHeadlessWindow(options.width, options.height)) {
+        Error("Failed to create a headless context");
+        return false;
+    }
+    const double contextMs = MillisecondsBetween(start,
+            SDL_GetPerformanceCounter());
+    if (options.traceFile && !PROFILE_BEGIN_CAPTURE(options.traceFile,
+            BENCH_WARMUP_FRAMES + options.numFrames)) {
+        Warning("Not tracing, the build lacks the profiler (make PROFILE=1)");
+    }
+    if (!SceneInit(MakeBenchScene(*bench, options))
+            || !SceneFinishLoading()) {
+        Error("Failed to load benchmark scene '%s'", options.scene);
+        SceneShutdown();
+        DestroyWindow();
+        return false;
+    }
+    const SceneLoadStats_t load = SceneGetLoadStats();
+    double serialMs = load.totalMs;
+    if ((GetNumJobThreads() > 1 || load.uploadThreadMs > 0.0)
+            && !LoadSerialBaseline(*bench, options, serialMs)) {
+        Error("Failed to load benchmark scene '%s' serially", options.scene);
+        SceneShutdown();
+        DestroyWindow();
+        return false;
+    }
+    SceneWindowResize(options.width, options.height);
+    SceneSetDepthPrepass(options.depthPrepass);
+
+    BenchSamples_t samples;
+    DrawBenchFrames(options, samples);
+    Info("Benchmarked %u frames of '%s'", options.numFrames, options.scene);
+    const bool ok = WriteBenchJson(options, contextMs, load, serialMs,
+            samples);
+    PROFILE_END_CAPTURE();
+    SceneShutdown();
+    DestroyWindow();
+    return ok;
+}
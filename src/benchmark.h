@@ -0,0 +1,30 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+#include <cstdint>
+
+// Frames drawn before any are measured, they pay for first use costs
+// like shader compiles in the driver
+#define BENCH_WARMUP_FRAMES 10
+
+struct BenchOptions_t {
+    const char *scene; // One of the names PrintBenchScenes lists
+    int32_t width;
+    int32_t height;
+    uint32_t numFrames; // Measured ones, one orbit of the scene
+    int gridColumns; // 0 keeps the scene's own layout
+    int gridRows;
+    bool depthPrepass;
+    const char *jsonFile; // NULL writes to stdout
+    const char *saveFile; // Last frame as PPM unless NULL
+    const char *traceFile; // Profiler capture of the run unless NULL
+};
+
+void PrintBenchScenes();
+
+// Loads the scene without a window, draws the frames while the camera
+// orbits it and writes the load and frame numbers as JSON. With more
+// than one job thread or the upload thread the scene is loaded again
+// on this thread alone, for load_ms.serial and load_speedup.
+bool RunBenchmark(const BenchOptions_t &options);
+
+#endif
@@ -0,0 +1,447 @@
+#include "bvh.h"
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include "util/job_system.h"
+
+#define BVH_BINS 16
+#define BVH_MAX_LEAF_SIZE 8
+// Deeper nodes are made leaves, keeps traversal stacks fixed size
+#define BVH_MAX_DEPTH 60
+#define BVH_STACK_SIZE (BVH_MAX_DEPTH + 4)
+// Cost of visiting a node relative to testing one primitive
+#define BVH_TRAVERSAL_COST 1.0f
+// Smaller subtrees aren't worth a job
+#define BVH_JOB_MIN_PRIMITIVES 4096
+
+struct Bvh::BuildState_t {
+    const std::vector<BoundingBox_t> *boxes;
+    std::vector<glm::vec3> centroids;
+    std::atomic<uint32_t> nodesUsed;
+    bool parallel;
+    std::atomic<uint32_t> maxDepth;
+};
+
+static float HalfArea(const glm::vec3 &min, const glm::vec3 &max)
+{
+    glm::vec3 e = max - min;
+    return e.x*e.y + e.y*e.z + e.z*e.x;
+}
+
+void Bvh::Build(const std::vector<BoundingBox_t> &boxes, bool parallel)
+{
+    Clear();
+    if (boxes.size() == 0) {
+        return;
+    }
+    BuildState_t state;
+    state.boxes = &boxes;
+    state.centroids.resize(boxes.size());
+    for (size_t i=0; i<boxes.size(); i++) {
+        state.centroids[i] = 0.5f*(boxes[i].min + boxes[i].max);
+    }
+    state.nodesUsed = 1;
+    state.parallel = parallel;
+    state.maxDepth = 0;
+
+    m_indices.resize(boxes.size());
+    for (size_t i=0; i<boxes.size(); i++) {
+        m_indices[i] = i;
+    }
+    // A binary tree with non-empty leaves never has more nodes than
+    // this, allocating it up front lets jobs hand out node indices
+    // with an atomic add
+    m_nodes.resize(2*boxes.size() - 1);
+    m_nodes[0].leftFirst = 0;
+    m_nodes[0].count = boxes.size();
+    Subdivide(state, 0, 0);
+    m_nodes.resize(state.nodesUsed);
+    m_maxDepth = state.maxDepth;
+
+    m_boxes.resize(boxes.size());
+    for (size_t i=0; i<m_indices.size(); i++) {
+        m_boxes[i] = boxes[m_indices[i]];
+    }
+}
+
+void Bvh::Subdivide(BuildState_t &state, uint32_t node, uint32_t depth)
+{
+    const std::vector<BoundingBox_t> &boxes = *state.boxes;
+    BvhNode_t &n = m_nodes[node];
+    const uint32_t first = n.leftFirst;
+    const uint32_t count = n.count;
+
+    glm::vec3 centroidMin = glm::vec3(FLT_MAX);
+    glm::vec3 centroidMax = glm::vec3(-FLT_MAX);
+    n.min = glm::vec3(FLT_MAX);
+    n.max = glm::vec3(-FLT_MAX);
+    for (uint32_t i=first; i<first+count; i++) {
+        const BoundingBox_t &box = boxes[m_indices[i]];
+        n.min = glm::min(n.min, box.min);
+        n.max = glm::max(n.max, box.max);
+        centroidMin = glm::min(centroidMin, state.centroids[m_indices[i]]);
+        centroidMax = glm::max(centroidMax, state.centroids[m_indices[i]]);
+    }
+
+    uint32_t seen = state.maxDepth;
+    while (depth > seen && !state.maxDepth.compare_exchange_weak(seen, depth)) {
+    }
+    if (count <= 2 || depth >= BVH_MAX_DEPTH) {
+        return;
+    }
+
+    // Bin the centroids along each axis and sweep the bins from both
+    // ends to find the cheapest of the BVH_BINS-1 planes between them
+    int bestAxis = -1;
+    int bestSplit = 0;
+    float bestCost = FLT_MAX;
+    for (int axis=0; axis<3; axis++) {
+        float extent = centroidMax[axis] - centroidMin[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+        const float scale = BVH_BINS / extent;
+        uint32_t binCounts[BVH_BINS] = { 0 };
+        glm::vec3 binMin[BVH_BINS];
+        glm::vec3 binMax[BVH_BINS];
+        for (int b=0; b<BVH_BINS; b++) {
+            binMin[b] = glm::vec3(FLT_MAX);
+            binMax[b] = glm::vec3(-FLT_MAX);
+        }
+        for (uint32_t i=first; i<first+count; i++) {
+            const uint32_t prim = m_indices[i];
+            int b = std::min(BVH_BINS - 1, (int)((state.centroids[prim][axis]
+                    - centroidMin[axis]) * scale));
+            binCounts[b]++;
+            binMin[b] = glm::min(binMin[b], boxes[prim].min);
+            binMax[b] = glm::max(binMax[b], boxes[prim].max);
+        }
+        float leftArea[BVH_BINS - 1];
+        uint32_t leftCount[BVH_BINS - 1];
+        glm::vec3 min = glm::vec3(FLT_MAX);
+        glm::vec3 max = glm::vec3(-FLT_MAX);
+        uint32_t sum = 0;
+        for (int b=0; b<BVH_BINS-1; b++) {
+            sum += binCounts[b];
+            min = glm::min(min, binMin[b]);
+            max = glm::max(max, binMax[b]);
+            leftCount[b] = sum;
+            leftArea[b] = sum ? HalfArea(min, max) : 0.0f;
+        }
+        min = glm::vec3(FLT_MAX);
+        max = glm::vec3(-FLT_MAX);
+        sum = 0;
+        for (int b=BVH_BINS-1; b>0; b--) {
+            sum += binCounts[b];
+            min = glm::min(min, binMin[b]);
+            max = glm::max(max, binMax[b]);
+            if (leftCount[b-1] == 0 || sum == 0) {
+                continue;
+            }
+            float cost = leftArea[b-1]*leftCount[b-1] + HalfArea(min, max)*sum;
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;
+            }
+        }
+    }
+
+    uint32_t mid = first + count/2;
+    if (bestAxis >= 0) {
+        const float leafCost = HalfArea(n.min, n.max) * count;
+        bestCost += BVH_TRAVERSAL_COST * HalfArea(n.min, n.max);
+        if (bestCost >= leafCost && count <= BVH_MAX_LEAF_SIZE) {
+            return;
+        }
+        const float axisMin = centroidMin[bestAxis];
+        const float scale = BVH_BINS
+                / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        uint32_t *begin = &m_indices[first];
+        mid = std::partition(begin, begin + count, [&](uint32_t prim) {
+            float c = state.centroids[prim][bestAxis];
+            int b = std::min(BVH_BINS - 1, (int)((c - axisMin) * scale));
+            return b < bestSplit;
+        }) - &m_indices[0];
+    } else if (count <= BVH_MAX_LEAF_SIZE) {
+        return; // Every centroid in the same spot, nothing to split on
+    }
+    if (mid == first || mid == first + count) {
+        mid = first + count/2;
+    }
+
+    const uint32_t left = state.nodesUsed.fetch_add(2);
+    m_nodes[left].leftFirst = first;
+    m_nodes[left].count = mid - first;
+    m_nodes[left+1].leftFirst = mid;
+    m_nodes[left+1].count = first + count - mid;
+    n.leftFirst = left;
+    n.count = 0;
+
+    // The left half is queued for an idle thread to steal while this
+    // one carries on with the right
+    if (state.parallel && count >= BVH_JOB_MIN_PRIMITIVES) {
+        JobCounter_t counter;
+        RunJob([this, &state, left, depth]() {
+            Subdivide(state, left, depth + 1);
+        }, &counter);
+        Subdivide(state, left + 1, depth + 1);
+        WaitForJobs(counter);
+        return;
+    }
+    Subdivide(state, left, depth + 1);
+    Subdivide(state, left + 1, depth + 1);
+}
+
+void Bvh::UpdateNodeBounds(uint32_t node)
+{
+    BvhNode_t &n = m_nodes[node];
+    if (n.count == 0) {
+        const BvhNode_t &left = m_nodes[n.leftFirst];
+        const BvhNode_t &right = m_nodes[n.leftFirst + 1];
+        n.min = glm::min(left.min, right.min);
+        n.max = glm::max(left.max, right.max);
+        return;
+    }
+    n.min = glm::vec3(FLT_MAX);
+    n.max = glm::vec3(-FLT_MAX);
+    for (uint32_t i=n.leftFirst; i<n.leftFirst+n.count; i++) {
+        n.min = glm::min(n.min, m_boxes[i].min);
+        n.max = glm::max(n.max, m_boxes[i].max);
+    }
+}
+
+void Bvh::Refit(const std::vector<BoundingBox_t> &boxes)
+{
+    if (boxes.size() != m_indices.size()) {
+        return;
+    }
+    for (size_t i=0; i<m_indices.size(); i++) {
+        m_boxes[i] = boxes[m_indices[i]];
+    }
+    for (size_t node=m_nodes.size(); node>0; node--) {
+        UpdateNodeBounds(node - 1);
+    }
+}
+
+enum BoxClass_t {
+    BOX_OUTSIDE,
+    BOX_INTERSECTS,
+    BOX_INSIDE,
+};
+
+static BoxClass_t ClassifyBox(const Frustum_t &frustum,
+        const glm::vec3 &min, const glm::vec3 &max)
+{
+    BoxClass_t result = BOX_INSIDE;
+    for (int p=0; p<6; p++) {
+        const glm::vec4 &plane = frustum.planes[p];
+        // Corners furthest along and against the plane normal
+        glm::vec3 pVertex = glm::vec3(plane.x >= 0.0f ? max.x : min.x,
+                plane.y >= 0.0f ? max.y : min.y,
+                plane.z >= 0.0f ? max.z : min.z);
+        glm::vec3 nVertex = glm::vec3(plane.x >= 0.0f ? min.x : max.x,
+                plane.y >= 0.0f ? min.y : max.y,
+                plane.z >= 0.0f ? min.z : max.z);
+        if (glm::dot(glm::vec3(plane), pVertex) + plane.w < 0.0f) {
+            return BOX_OUTSIDE;
+        }
+        if (glm::dot(glm::vec3(plane), nVertex) + plane.w < 0.0f) {
+            result = BOX_INTERSECTS;
+        }
+    }
+    return result;
+}
+
+#define BVH_INSIDE_BIT 0x80000000u
+
+size_t Bvh::QueryFrustum(const Frustum_t &frustum,
+        std::vector<uint32_t> &visible) const
+{
+    if (m_nodes.size() == 0) {
+        return 0;
+    }
+    const size_t before = visible.size();
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const uint32_t entry = stack[--top];
+        const BvhNode_t &n = m_nodes[entry & ~BVH_INSIDE_BIT];
+        uint32_t inside = entry & BVH_INSIDE_BIT;
+        if (!inside) {
+            BoxClass_t c = ClassifyBox(frustum, n.min, n.max);
+            if (c == BOX_OUTSIDE) {
+                continue;
+            }
+            inside = c == BOX_INSIDE ? BVH_INSIDE_BIT : 0;
+        }
+        if (n.count == 0) {
+            stack[top++] = n.leftFirst | inside;
+            stack[top++] = (n.leftFirst + 1) | inside;
+            continue;
+        }
+        for (uint32_t i=n.leftFirst; i<n.leftFirst+n.count; i++) {
+            if (inside || ClassifyBox(frustum, m_boxes[i].min,
+                    m_boxes[i].max) != BOX_OUTSIDE) {
+                visible.push_back(m_indices[i]);
+            }
+        }
+    }
+    return visible.size() - before;
+}
+
+void Bvh::Clear()
+{
+    m_nodes.clear();
+    m_indices.clear();
+    m_boxes.clear();
+    m_maxDepth = 0;
+}
+
+const std::vector<BvhNode_t>& Bvh::GetNodes() const
+{
+    return m_nodes;
+}
+
+const std::vector<uint32_t>& Bvh::GetIndices() const
+{
+    return m_indices;
+}
+
+BvhStats_t Bvh::GetStats() const
+{
+    BvhStats_t stats = { m_nodes.size(), 0, m_maxDepth, 0.0f };
+    if (m_nodes.size() == 0) {
+        return stats;
+    }
+    const float rootArea = HalfArea(m_nodes[0].min, m_nodes[0].max);
+    for (size_t i=0; i<m_nodes.size(); i++) {
+        const BvhNode_t &n = m_nodes[i];
+        float area = rootArea > 0.0f ? HalfArea(n.min, n.max) / rootArea : 1.0f;
+        if (n.count > 0) {
+            stats.numLeaves++;
+            stats.sahCost += area * n.count;
+        } else {
+            stats.sahCost += area * BVH_TRAVERSAL_COST;
+        }
+    }
+    return stats;
+}
+
+void MeshBvh::Build(const MeshData_t &mesh, bool parallel)
+{
+    const size_t numTriangles = mesh.elements.size() / 3;
+    std::vector<BoundingBox_t> boxes(numTriangles);
+    for (size_t t=0; t<numTriangles; t++) {
+        const glm::vec3 &a = mesh.vertices[mesh.elements[3*t]];
+        const glm::vec3 &b = mesh.vertices[mesh.elements[3*t+1]];
+        const glm::vec3 &c = mesh.vertices[mesh.elements[3*t+2]];
+        boxes[t].min = glm::min(a, glm::min(b, c));
+        boxes[t].max = glm::max(a, glm::max(b, c));
+    }
+    m_bvh.Build(boxes, parallel);
+
+    const std::vector<uint32_t> &indices = m_bvh.GetIndices();
+    m_triangles.resize(indices.size());
+    for (size_t i=0; i<indices.size(); i++) {
+        const uint32_t t = indices[i];
+        const glm::vec3 &a = mesh.vertices[mesh.elements[3*t]];
+        m_triangles[i].v0 = a;
+        m_triangles[i].edge1 = mesh.vertices[mesh.elements[3*t+1]] - a;
+        m_triangles[i].edge2 = mesh.vertices[mesh.elements[3*t+2]] - a;
+    }
+}
+
+// Entry distance of the ray into the box, FLT_MAX when it misses or
+// only enters beyond tMax
+static inline float IntersectBox(const BvhNode_t &n, const glm::vec3 &origin,
+        const glm::vec3 &invDirection, float tMax)
+{
+    glm::vec3 t1 = (n.min - origin) * invDirection;
+    glm::vec3 t2 = (n.max - origin) * invDirection;
+    glm::vec3 tNear = glm::min(t1, t2);
+    glm::vec3 tFar = glm::max(t1, t2);
+    float enter = std::max(std::max(tNear.x, tNear.y), tNear.z);
+    float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+    if (exit >= enter && exit >= 0.0f && enter < tMax) {
+        return enter;
+    }
+    return FLT_MAX;
+}
+
+bool MeshBvh::Raycast(const Ray_t &ray, RayHit_t &hit, float tMax) const
+{
+    const std::vector<BvhNode_t> &nodes = m_bvh.GetNodes();
+    if (nodes.size() == 0) {
+        return false;
+    }
+    const glm::vec3 invDirection = 1.0f / ray.direction;
+    bool found = false;
+    uint32_t stack[BVH_STACK_SIZE];
+    int top = 0;
+    if (IntersectBox(nodes[0], ray.origin, invDirection, tMax) == FLT_MAX) {
+        return false;
+    }
+    stack[top++] = 0;
+    while (top > 0) {
+        const BvhNode_t &n = nodes[stack[--top]];
+        if (n.count > 0) {
+            // Moller-Trumbore
+            for (uint32_t i=n.leftFirst; i<n.leftFirst+n.count; i++) {
+                const Triangle_t &tri = m_triangles[i];
+                glm::vec3 p = glm::cross(ray.direction, tri.edge2);
+                float det = glm::dot(tri.edge1, p);
+                if (fabsf(det) < 1e-12f) {
+                    continue;
+                }
+                float invDet = 1.0f / det;
+                glm::vec3 s = ray.origin - tri.v0;
+                float u = glm::dot(s, p) * invDet;
+                if (u < 0.0f || u > 1.0f) {
+                    continue;
+                }
+                glm::vec3 q = glm::cross(s, tri.edge1);
+                float v = glm::dot(ray.direction, q) * invDet;
+                if (v < 0.0f || u + v > 1.0f) {
+                    continue;
+                }
+                float t = glm::dot(tri.edge2, q) * invDet;
+                if (t >= 0.0f && t < tMax) {
+                    tMax = t;
+                    hit.t = t;
+                    hit.triangle = m_bvh.GetIndices()[i];
+                    hit.u = u;
+                    hit.v = v;
+                    found = true;
+                }
+            }
+            continue;
+        }
+        // Visit the nearer child first so later boxes get rejected
+        // against a shorter ray
+        uint32_t closer = n.leftFirst;
+        uint32_t further = n.leftFirst + 1;
+        float dCloser = IntersectBox(nodes[closer], ray.origin, invDirection,
+                tMax);
+        float dFurther = IntersectBox(nodes[further], ray.origin, invDirection,
+                tMax);
+        if (dFurther < dCloser) {
+            std::swap(closer, further);
+            std::swap(dCloser, dFurther);
+        }
+        if (dFurther != FLT_MAX) {
+            stack[top++] = further;
+        }
+        if (dCloser != FLT_MAX) {
+            stack[top++] = closer;
+        }
+    }
+    return found;
+}
+
+const Bvh& MeshBvh::GetBvh() const
+{
+    return m_bvh;
+}
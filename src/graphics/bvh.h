@@ -0,0 +1,109 @@
+#ifndef BVH_H
+#define BVH_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "graphics/frustum.h"
+#include "graphics/mesh.h"
+
+// 32 bytes, two nodes to a cache line. Both children of a node are
+// stored next to each other so only the first one's index is kept.
+struct BvhNode_t {
+    glm::vec3 min;
+    uint32_t leftFirst; // First child if count == 0, else first primitive
+    glm::vec3 max;
+    uint32_t count;     // Primitives in a leaf, 0 for interior nodes
+};
+
+struct BvhStats_t {
+    size_t numNodes;
+    size_t numLeaves;
+    uint32_t maxDepth;
+    float sahCost; // Relative to the root's area
+};
+
+class Bvh
+{
+    // Binary tree over the bounding boxes of a set of primitives,
+    // built top down with a binned surface area heuristic. Nodes sit
+    // in one array with every parent ahead of its children, so
+    // refitting is a single reverse pass.
+public:
+    // With `parallel` the upper levels are split as jobs, see
+    // util/job_system.h
+    void Build(const std::vector<BoundingBox_t> &boxes, bool parallel=true);
+
+    // Recomputes node bounds after primitives moved, `boxes` must
+    // have the same size as the boxes the tree was built from. The
+    // tree gets less efficient the further things move from where
+    // they were at build time.
+    void Refit(const std::vector<BoundingBox_t> &boxes);
+
+    // Appends the index of every primitive whose box isn't outside
+    // the frustum to `visible` and returns how many were added.
+    // Subtrees entirely inside the frustum are added without testing.
+    size_t QueryFrustum(const Frustum_t &frustum,
+            std::vector<uint32_t> &visible) const;
+
+    void Clear();
+
+    const std::vector<BvhNode_t>& GetNodes() const;
+
+    // Primitive indices in leaf order, leaves point into this
+    const std::vector<uint32_t>& GetIndices() const;
+
+    BvhStats_t GetStats() const;
+
+private:
+    struct BuildState_t;
+
+    void Subdivide(BuildState_t &state, uint32_t node, uint32_t depth);
+
+    void UpdateNodeBounds(uint32_t node);
+
+    std::vector<BvhNode_t> m_nodes;
+
+    std::vector<uint32_t> m_indices;
+
+    std::vector<BoundingBox_t> m_boxes; // In leaf order, like m_indices
+
+    uint32_t m_maxDepth = 0;
+};
+
+struct Ray_t {
+    glm::vec3 origin;
+    glm::vec3 direction; // Doesn't have to be normalized
+};
+
+struct RayHit_t {
+    float t; // Hit point is origin + t*direction
+    uint32_t triangle; // Index of the first element / 3
+    float u, v; // Barycentrics of the second and third vertex
+};
+
+class MeshBvh
+{
+    // Triangle level tree for ray queries against a single mesh. The
+    // triangles are copied in leaf order so a leaf reads one
+    // contiguous run of memory.
+public:
+    void Build(const MeshData_t &mesh, bool parallel=true);
+
+    // Closest hit with t in [0, tMax), false when nothing was hit
+    bool Raycast(const Ray_t &ray, RayHit_t &hit,
+            float tMax=3.402823466e+38f) const;
+
+    const Bvh& GetBvh() const;
+
+private:
+    struct Triangle_t {
+        glm::vec3 v0, edge1, edge2;
+    };
+
+    Bvh m_bvh;
+
+    std::vector<Triangle_t> m_triangles;
+};
+
+#endif
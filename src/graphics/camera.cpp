@@ -1,5 +1,6 @@
 #include "camera.h"
 #include "SDL.h"
+#include <algorithm>
 #include <glm/gtc/matrix_transform.hpp>
 
 
@@ -13,75 +14,117 @@ void CameraView::KeyboardInput(int code, int state)
     m_downKeys.erase(code);
 }
 
-void CameraView::DoPhysics(float delaTimeTicks)
+void CameraView::DoPhysics(float deltaSeconds)
 {
-    m_position += glm::vec3(0.0f, m_velocity.y*delaTimeTicks, 0.0f);
-    m_velocity -= glm::vec3(0.0f, GRAVITY*GRAVITY_MUL*delaTimeTicks, 0.0f);
-    if (m_velocity.y < -TERMINAL_VEL) {
-        m_velocity = glm::vec3(m_velocity.x, -TERMINAL_VEL, m_velocity.z);
+    glm::vec3 &position = m_current.position;
+    glm::vec3 &velocity = m_current.velocity;
+    position += glm::vec3(0.0f, velocity.y*deltaSeconds, 0.0f);
+    velocity -= glm::vec3(0.0f, GRAVITY*GRAVITY_MUL*deltaSeconds, 0.0f);
+    if (velocity.y < -TERMINAL_VEL) {
+        velocity = glm::vec3(velocity.x, -TERMINAL_VEL, velocity.z);
     }
-    if (m_position.y <= m_floor && m_velocity.y < 0.0) {
-        m_position = glm::vec3(m_position.x, m_floor, m_position.z);
-        m_velocity = glm::vec3(m_velocity.x, 0.0f, m_velocity.z);
+    if (position.y <= m_current.floor && velocity.y < 0.0) {
+        position = glm::vec3(position.x, m_current.floor, position.z);
+        velocity = glm::vec3(velocity.x, 0.0f, velocity.z);
     }
 }
 
-void CameraView::MoveCamera()
+void CameraView::Step(float deltaSeconds)
 {
-    // TODO Magic number removal
-    const float t = SDL_GetTicks()/1000.0;
-    float speedMod = CAMERA_MOVE_SPEED * (t-m_lastMoveTicks);
+    const float speedMod = CAMERA_MOVE_SPEED * deltaSeconds;
+    glm::vec3 &position = m_current.position;
+    const glm::vec3 forward = glm::vec3(sin(m_rotation.y), 0.0f,
+            cos(m_rotation.y)) * speedMod;
+    const glm::vec3 left = glm::vec3(cos(m_rotation.y), 0.0f,
+            -sin(m_rotation.y)) * speedMod;
 
     if (m_downKeys.count(SDL_SCANCODE_W)) {
-        m_position += glm::vec3(sin(m_rotation.y) * speedMod, 0.0f, cos(m_rotation.y) * speedMod);
+        position += forward;
     }
     if (m_downKeys.count(SDL_SCANCODE_S)) {
-        m_position -= glm::vec3(sin(m_rotation.y) * speedMod, 0.0f, cos(m_rotation.y) * speedMod);
+        position -= forward;
     }
     if (m_downKeys.count(SDL_SCANCODE_A)) {
-        m_position += glm::vec3(cos(m_rotation.y) * speedMod, 0.0f, -sin(m_rotation.y) * speedMod);
+        position += left;
     }
     if (m_downKeys.count(SDL_SCANCODE_D)) {
-        m_position -= glm::vec3(cos(m_rotation.y) * speedMod, 0.0f, -sin(m_rotation.y) * speedMod);
+        position -= left;
     }
     if (m_downKeys.count(SDL_SCANCODE_E)) {
-        m_floor += speedMod;
+        m_current.floor += speedMod;
     }
     if (m_downKeys.count(SDL_SCANCODE_Q)) {
-        m_floor -= speedMod;
+        m_current.floor -= speedMod;
     }
     if (m_downKeys.count(SDL_SCANCODE_R)) {
-        m_floor = DEFAULT_FLOOR_Y;
+        m_current.floor = DEFAULT_FLOOR_Y;
     }
     if (m_downKeys.count(SDL_SCANCODE_SPACE)) {
-        if (m_position.y <= m_floor+0.00001) {
-            m_velocity = glm::vec3(m_velocity.x, JUMP_AMOUNT, m_velocity.z);
+        if (position.y <= m_current.floor+0.00001) {
+            m_current.velocity = glm::vec3(m_current.velocity.x,
+                    JUMP_AMOUNT, m_current.velocity.z);
         }
     }
 
-    DoPhysics(t-m_lastMoveTicks);
+    DoPhysics(deltaSeconds);
+}
+
+void CameraView::Update()
+{
+    const uint64_t counter = SDL_GetPerformanceCounter();
+    if (m_lastCounter != 0) {
+        Advance((double)(counter - m_lastCounter)
+                / SDL_GetPerformanceFrequency());
+    }
+    m_lastCounter = counter;
+}
 
-    m_lastMoveTicks = t;
+void CameraView::Advance(double seconds)
+{
+    const double step = 1.0 / CAMERA_STEP_HZ;
+    m_accumulator += std::min(seconds, CAMERA_MAX_UPDATE_SECONDS);
+    while (m_accumulator >= step) {
+        m_previous = m_current;
+        Step((float)step);
+        m_accumulator -= step;
+    }
+    m_alpha = (float)(m_accumulator / step);
+}
+
+void CameraView::LookAt(const glm::vec3 &position, const glm::vec3 &target)
+{
+    const glm::vec3 dir = target - position;
+    const float horizontal = glm::length(glm::vec2(dir.x, dir.z));
+    m_current.position = position;
+    m_current.velocity = glm::vec3(0.0f);
+    m_current.floor = position.y;
+    m_previous = m_current;
+    m_accumulator = 0.0;
+    m_alpha = 0.0f;
+    // See GetViewMatrix for how the angles make the direction
+    const float maxAngle = 89.9f*PI/180.0f;
+    m_rotation = glm::vec3(glm::clamp(atan2f(-dir.y, horizontal), -maxAngle,
+            maxAngle), atan2f(dir.x, dir.z), 0.0f);
 }
 
-glm::vec3 CameraView::GetRotation()
+glm::vec3 CameraView::GetRotation() const
 {
     return m_rotation;
 }
 
-glm::mat4 CameraView::GetViewMatrix()
+glm::mat4 CameraView::GetViewMatrix() const
 {
     glm::vec3 right = glm::vec3(sin(m_rotation.y - PI/2.0f), 0,
             cos(m_rotation.y - PI/2.0f));
     glm::vec3 dir = glm::vec3(sin(m_rotation.y), -tan(m_rotation.x), cos(m_rotation.y));
-    m_up = glm::cross(right, dir);
-    MoveCamera();
-    return glm::lookAt(m_position, m_position+dir, m_up);
+    glm::vec3 up = glm::cross(right, dir);
+    glm::vec3 position = GetPosition();
+    return glm::lookAt(position, position+dir, up);
 }
 
-glm::vec3 CameraView::GetPosition()
+glm::vec3 CameraView::GetPosition() const
 {
-    return m_position;
+    return glm::mix(m_previous.position, m_current.position, m_alpha);
 }
 
 void CameraView::MouseMotion(int deltaX, int deltaY)
@@ -1,6 +1,7 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 #include <set>
+#include <cstdint>
 #include <glm/glm.hpp>
 #include <util/log.h>
 
@@ -13,26 +14,53 @@
 #define TERMINAL_VEL GRAVITY*100.0f
 #define DEFAULT_FLOOR_Y 2.0f
 #define CAMERA_MOVE_SPEED 17.0f
+// Movement and physics steps per second
+#define CAMERA_STEP_HZ 120.0
+// Most time a single Update catches up on, after a long stall the
+// camera skips ahead rather than running hundreds of steps at once
+#define CAMERA_MAX_UPDATE_SECONDS 0.25
+
+// What a simulation step changes
+struct CameraState_t {
+    glm::vec3 position;
+    glm::vec3 velocity;
+    float floor; // y coordinate floor
+};
 
 class CameraView
 {
+    // Keys move the camera in fixed steps of 1/CAMERA_STEP_HZ seconds
+    // so it ends up in the same place however fast frames are drawn.
+    // Frames see the position interpolated between the last two
+    // steps. Mouse look is applied at once, it has no physics.
 public:
     void KeyboardInput(int code, int state);
     void MouseMotion(int deltaX, int deltaY);
-    glm::mat4 GetViewMatrix();
-    glm::vec3 GetPosition();
-    glm::vec3 GetRotation();
+    // Catches the simulation up with the performance counter, once
+    // a frame before anything reads the view
+    void Update();
+    // Runs the steps that fit in `seconds` plus what the last call
+    // left over
+    void Advance(double seconds);
+    // Moves straight to `position` facing `target`, the floor comes
+    // along so the camera doesn't fall
+    void LookAt(const glm::vec3 &position, const glm::vec3 &target);
+    // These have no side effects
+    glm::mat4 GetViewMatrix() const;
+    glm::vec3 GetPosition() const;
+    glm::vec3 GetRotation() const;
 private:
-    glm::vec3 m_position = glm::vec3(0.0f, DEFAULT_FLOOR_Y, 20.0f);
-    glm::vec3 m_up = glm::vec3(0.0f, 1.0f, 0.0f);
+    CameraState_t m_current = { glm::vec3(0.0f, DEFAULT_FLOOR_Y, 20.0f),
+            glm::vec3(0.0f), DEFAULT_FLOOR_Y };
+    CameraState_t m_previous = m_current;
     glm::vec3 m_rotation = glm::vec3(0.0f, PI, 0.0f);
-    glm::vec3 m_velocity = glm::vec3(0.0f, 0.0f, 0.0f);
     std::set<int> m_downKeys;
-    float m_lastMoveTicks = 0.0f;
-    float m_floor = DEFAULT_FLOOR_Y; // y coordinate floor
+    uint64_t m_lastCounter = 0; // 0 until the first Update
+    double m_accumulator = 0.0; // Seconds not yet stepped
+    float m_alpha = 0.0f; // How far the frame is from m_previous
 
-    void DoPhysics(float deltaTimeTicks);
-    void MoveCamera();
+    void DoPhysics(float deltaSeconds);
+    void Step(float deltaSeconds);
 };
 
 
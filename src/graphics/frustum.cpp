@@ -0,0 +1,260 @@
+#include "frustum.h"
+#include <cfloat>
+#include <algorithm>
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The kernel loads this many boxes at a time
+#define BOUNDS_PADDING 8
+
+BoundingBox_t ComputeBoundingBox(const std::vector<glm::vec3> &points)
+{
+    BoundingBox_t box;
+    box.min = glm::vec3(FLT_MAX);
+    box.max = glm::vec3(-FLT_MAX);
+    for (size_t i=0; i<points.size(); i++) {
+        box.min = glm::min(box.min, points[i]);
+        box.max = glm::max(box.max, points[i]);
+    }
+    if (points.size() == 0) {
+        box.min = glm::vec3(0.0f);
+        box.max = glm::vec3(0.0f);
+    }
+    return box;
+}
+
+BoundingSphere_t ComputeBoundingSphere(const std::vector<glm::vec3> &points,
+        const BoundingBox_t &box)
+{
+    BoundingSphere_t sphere;
+    sphere.center = 0.5f*(box.min + box.max);
+    float radius2 = 0.0f;
+    for (size_t i=0; i<points.size(); i++) {
+        glm::vec3 d = points[i] - sphere.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    sphere.radius = sqrtf(radius2);
+    return sphere;
+}
+
+// Arvo's method, each row of the matrix scales the extents
+BoundingBox_t TransformBoundingBox(const BoundingBox_t &box,
+        const glm::mat4 &transform)
+{
+    BoundingBox_t out;
+    out.min = glm::vec3(transform[3]);
+    out.max = out.min;
+    for (int col=0; col<3; col++) {
+        for (int row=0; row<3; row++) {
+            float a = transform[col][row] * box.min[col];
+            float b = transform[col][row] * box.max[col];
+            out.min[row] += std::min(a, b);
+            out.max[row] += std::max(a, b);
+        }
+    }
+    return out;
+}
+
+BoundingBox_t MergeBoundingBoxes(const BoundingBox_t &a,
+        const BoundingBox_t &b)
+{
+    BoundingBox_t out;
+    out.min = glm::min(a.min, b.min);
+    out.max = glm::max(a.max, b.max);
+    return out;
+}
+
+// Gribb/Hartmann, the planes are rows of the combined matrix added to
+// or subtracted from the w row. glm is column major so row i is
+// (m[0][i], m[1][i], m[2][i], m[3][i]).
+Frustum_t ExtractFrustumPlanes(const glm::mat4 &m)
+{
+    Frustum_t frustum;
+    glm::vec4 rowX = glm::vec4(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 rowY = glm::vec4(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 rowZ = glm::vec4(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 rowW = glm::vec4(m[0][3], m[1][3], m[2][3], m[3][3]);
+    frustum.planes[0] = rowW + rowX;
+    frustum.planes[1] = rowW - rowX;
+    frustum.planes[2] = rowW + rowY;
+    frustum.planes[3] = rowW - rowY;
+    frustum.planes[4] = rowW + rowZ;
+    frustum.planes[5] = rowW - rowZ;
+    for (int i=0; i<6; i++) {
+        float length = glm::length(glm::vec3(frustum.planes[i]));
+        if (length > 0.0f) {
+            frustum.planes[i] /= length;
+        }
+    }
+    return frustum;
+}
+
+size_t BoundsSoA::Add(const BoundingBox_t &box, const BoundingSphere_t &sphere)
+{
+    m_size++;
+    Pad();
+    Set(m_size-1, box, sphere);
+    return m_size-1;
+}
+
+void BoundsSoA::Set(size_t i, const BoundingBox_t &box,
+        const BoundingSphere_t &sphere)
+{
+    minX[i] = box.min.x;
+    minY[i] = box.min.y;
+    minZ[i] = box.min.z;
+    maxX[i] = box.max.x;
+    maxY[i] = box.max.y;
+    maxZ[i] = box.max.z;
+    centerX[i] = sphere.center.x;
+    centerY[i] = sphere.center.y;
+    centerZ[i] = sphere.center.z;
+    radius[i] = sphere.radius;
+}
+
+BoundingBox_t BoundsSoA::GetBox(size_t i) const
+{
+    BoundingBox_t box;
+    box.min = glm::vec3(minX[i], minY[i], minZ[i]);
+    box.max = glm::vec3(maxX[i], maxY[i], maxZ[i]);
+    return box;
+}
+
+BoundingSphere_t BoundsSoA::GetSphere(size_t i) const
+{
+    BoundingSphere_t sphere;
+    sphere.center = glm::vec3(centerX[i], centerY[i], centerZ[i]);
+    sphere.radius = radius[i];
+    return sphere;
+}
+
+void BoundsSoA::Clear()
+{
+    m_size = 0;
+    Pad();
+}
+
+size_t BoundsSoA::GetSize() const
+{
+    return m_size;
+}
+
+size_t BoundsSoA::GetPaddedSize() const
+{
+    return minX.size();
+}
+
+void BoundsSoA::Pad()
+{
+    size_t padded = (m_size + BOUNDS_PADDING - 1) / BOUNDS_PADDING
+            * BOUNDS_PADDING;
+    std::vector<float> *arrays[] = { &minX, &minY, &minZ, &maxX, &maxY,
+            &maxZ, &centerX, &centerY, &centerZ, &radius };
+    for (size_t a=0; a<sizeof(arrays)/sizeof(arrays[0]); a++) {
+        arrays[a]->resize(padded, 0.0f);
+    }
+}
+
+// A box is outside a plane when the corner furthest along the plane
+// normal is behind it. Which corner that is only depends on the signs
+// of the normal, so it's picked once per plane instead of per box.
+size_t CullBoundingBoxes(const Frustum_t &frustum, const BoundsSoA &bounds,
+        uint32_t *visible)
+{
+    const size_t n = bounds.GetSize();
+    if (n == 0) {
+        return 0;
+    }
+    uint32_t *out = visible;
+    const float *px[6];
+    const float *py[6];
+    const float *pz[6];
+    for (int p=0; p<6; p++) {
+        const glm::vec4 &plane = frustum.planes[p];
+        px[p] = plane.x >= 0.0f ? &bounds.maxX[0] : &bounds.minX[0];
+        py[p] = plane.y >= 0.0f ? &bounds.maxY[0] : &bounds.minY[0];
+        pz[p] = plane.z >= 0.0f ? &bounds.maxZ[0] : &bounds.minZ[0];
+    }
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p=0; p<6; p++) {
+        planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+    }
+    const __m256 zero = _mm256_setzero_ps();
+    for (; i<n; i+=8) {
+        __m256 outside = zero;
+        for (int p=0; p<6; p++) {
+            __m256 d = _mm256_add_ps(
+                    _mm256_add_ps(
+                        _mm256_mul_ps(_mm256_loadu_ps(px[p]+i), planeX[p]),
+                        _mm256_mul_ps(_mm256_loadu_ps(py[p]+i), planeY[p])),
+                    _mm256_add_ps(
+                        _mm256_mul_ps(_mm256_loadu_ps(pz[p]+i), planeZ[p]),
+                        planeW[p]));
+            outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, zero, _CMP_LT_OQ));
+            if (_mm256_movemask_ps(outside) == 0xFF) {
+                break; // All 8 rejected
+            }
+        }
+        unsigned int mask = ~_mm256_movemask_ps(outside) & 0xFF;
+        while (mask) {
+            *out++ = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#elif defined(__SSE2__)
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+    for (int p=0; p<6; p++) {
+        planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+        planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+        planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+        planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+    }
+    const __m128 zero = _mm_setzero_ps();
+    for (; i<n; i+=4) {
+        __m128 outside = zero;
+        for (int p=0; p<6; p++) {
+            __m128 d = _mm_add_ps(
+                    _mm_add_ps(
+                        _mm_mul_ps(_mm_loadu_ps(px[p]+i), planeX[p]),
+                        _mm_mul_ps(_mm_loadu_ps(py[p]+i), planeY[p])),
+                    _mm_add_ps(
+                        _mm_mul_ps(_mm_loadu_ps(pz[p]+i), planeZ[p]),
+                        planeW[p]));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, zero));
+            if (_mm_movemask_ps(outside) == 0xF) {
+                break; // All 4 rejected
+            }
+        }
+        unsigned int mask = ~_mm_movemask_ps(outside) & 0xF;
+        while (mask) {
+            *out++ = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#else
+    for (; i<n; i++) {
+        bool outside = false;
+        for (int p=0; p<6 && !outside; p++) {
+            const glm::vec4 &plane = frustum.planes[p];
+            float d = px[p][i]*plane.x + py[p][i]*plane.y + pz[p][i]*plane.z
+                    + plane.w;
+            outside = d < 0.0f;
+        }
+        if (!outside) {
+            *out++ = i;
+        }
+    }
+#endif
+    // Padding entries past the end may have been written, drop them
+    size_t count = out - visible;
+    while (count > 0 && visible[count - 1] >= n) {
+        count--;
+    }
+    return count;
+}
@@ -0,0 +1,78 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+struct BoundingBox_t {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere_t {
+    glm::vec3 center;
+    float radius;
+};
+
+BoundingBox_t ComputeBoundingBox(const std::vector<glm::vec3> &points);
+
+// Centered on the box, just big enough to hold every point
+BoundingSphere_t ComputeBoundingSphere(const std::vector<glm::vec3> &points,
+        const BoundingBox_t &box);
+
+// Box around the 8 transformed corners of `box`
+BoundingBox_t TransformBoundingBox(const BoundingBox_t &box,
+        const glm::mat4 &transform);
+
+BoundingBox_t MergeBoundingBoxes(const BoundingBox_t &a,
+        const BoundingBox_t &b);
+
+// Planes face inwards, a point p is inside when
+// dot(plane.xyz, p) + plane.w >= 0 for all six of them
+struct Frustum_t {
+    glm::vec4 planes[6]; // left, right, bottom, top, near, far
+};
+
+Frustum_t ExtractFrustumPlanes(const glm::mat4 &viewProjection);
+
+class BoundsSoA
+{
+    // World space bounding boxes and spheres laid out one component
+    // per array so the culling kernel can load several boxes with a
+    // single vector load.
+public:
+    size_t Add(const BoundingBox_t &box, const BoundingSphere_t &sphere);
+
+    void Set(size_t i, const BoundingBox_t &box,
+            const BoundingSphere_t &sphere);
+
+    BoundingBox_t GetBox(size_t i) const;
+
+    BoundingSphere_t GetSphere(size_t i) const;
+
+    void Clear();
+
+    size_t GetSize() const;
+
+    size_t GetPaddedSize() const;
+
+    // Arrays are padded with empty boxes to a multiple of 8 entries
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+    std::vector<float> centerX, centerY, centerZ, radius;
+
+private:
+    void Pad();
+
+    size_t m_size = 0;
+};
+
+// Writes the index of every box that isn't completely outside one of
+// the frustum planes to `visible` and returns how many were written.
+// Boxes touching the frustum count as visible. `visible` must have
+// room for GetPaddedSize() entries.
+size_t CullBoundingBoxes(const Frustum_t &frustum, const BoundsSoA &bounds,
+        uint32_t *visible);
+
+#endif
@@ -0,0 +1,790 @@
+#include "geometry_arena.h"
+#include <algorithm>
+#include "graphics/instance_buffer.h"
+#include "graphics/mesh_optimize.h"
+#include "util/counters.h"
+#include "util/log.h"
+#include "util/profiler.h"
+
+#define ARENA_INITIAL_VERTICES 0x10000
+#define ARENA_INITIAL_ELEMENT_BYTES 0x40000
+
+RangeAllocator::RangeAllocator(size_t capacity)
+{
+    Reset(capacity);
+}
+
+void RangeAllocator::Reset(size_t capacity)
+{
+    m_capacity = capacity;
+    m_used = 0;
+    m_free.clear();
+    m_allocated.clear();
+    if (capacity > 0) {
+        m_free.emplace(0, capacity);
+    }
+}
+
+// First fit, the free list is small for the number of meshes we load
+bool RangeAllocator::Allocate(size_t size, size_t alignment, size_t &offset)
+{
+    if (size == 0) {
+        return false;
+    }
+    if (alignment == 0) {
+        alignment = 1;
+    }
+    for (auto it=m_free.begin(); it!=m_free.end(); it++) {
+        size_t start = it->first;
+        size_t aligned = (start + alignment - 1) / alignment * alignment;
+        size_t padding = aligned - start;
+        if (it->second < size + padding) {
+            continue;
+        }
+        size_t remaining = it->second - size - padding;
+        m_free.erase(it);
+        if (padding > 0) {
+            m_free.emplace(start, padding);
+        }
+        if (remaining > 0) {
+            m_free.emplace(aligned + size, remaining);
+        }
+        m_allocated.emplace(aligned, size);
+        m_used += size;
+        offset = aligned;
+        return true;
+    }
+    return false;
+}
+
+void RangeAllocator::Free(size_t offset)
+{
+    auto it = m_allocated.find(offset);
+    if (it == m_allocated.end()) {
+        Warning("Tried to free unallocated range at offset %lu",
+                (unsigned long)offset);
+        return;
+    }
+    size_t size = it->second;
+    m_allocated.erase(it);
+    m_used -= size;
+    Release(offset, size);
+}
+
+// Inserts a free range and merges it with the ranges either side
+void RangeAllocator::Release(size_t offset, size_t size)
+{
+    auto next = m_free.lower_bound(offset);
+    if (next != m_free.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            offset = prev->first;
+            size += prev->second;
+            m_free.erase(prev);
+        }
+    }
+    if (next != m_free.end() && offset + size == next->first) {
+        size += next->second;
+        m_free.erase(next);
+    }
+    m_free.emplace(offset, size);
+}
+
+void RangeAllocator::Grow(size_t newCapacity)
+{
+    if (newCapacity <= m_capacity) {
+        return;
+    }
+    size_t oldCapacity = m_capacity;
+    m_capacity = newCapacity;
+    Release(oldCapacity, newCapacity - oldCapacity);
+}
+
+size_t RangeAllocator::GetCapacity() const
+{
+    return m_capacity;
+}
+
+size_t RangeAllocator::GetUsed() const
+{
+    return m_used;
+}
+
+size_t RangeAllocator::GetLargestFree() const
+{
+    size_t largest = 0;
+    for (auto it=m_free.begin(); it!=m_free.end(); it++) {
+        largest = std::max(largest, it->second);
+    }
+    return largest;
+}
+
+size_t RangeAllocator::GetTrailingFree() const
+{
+    if (m_free.size() == 0) {
+        return 0;
+    }
+    auto last = std::prev(m_free.end());
+    if (last->first + last->second != m_capacity) {
+        return 0;
+    }
+    return last->second;
+}
+
+size_t RangeAllocator::GetNumFreeRanges() const
+{
+    return m_free.size();
+}
+
+static GLsizei ElementSize(GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE:
+        return 1;
+    case GL_UNSIGNED_SHORT:
+        return 2;
+    default:
+        return 4;
+    }
+}
+
+// Buffers are only ever bound to the copy targets outside of
+// SetupVertexArray so that uploads can't disturb a bound VAO
+static GLuint CreateArenaBuffer(GLsizeiptr size)
+{
+    GLuint buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
+
+static void UploadArenaBuffer(GLuint buffer, GLintptr offset,
+        GLsizeiptr size, const void *data)
+{
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, size);
+}
+
+static void CopyArenaBuffer(GLuint src, GLintptr srcOffset, GLuint dst,
+        GLintptr dstOffset, GLsizeiptr size)
+{
+    if (src == 0 || dst == 0 || size == 0) {
+        return;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, src);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, dst);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+            srcOffset, dstOffset, size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GeometryArena::CreatePool(Pool_t &pool, VertexFormat_t format,
+        size_t vertexCapacity, size_t elementCapacity)
+{
+    pool.vertexBuffer = CreateArenaBuffer(vertexCapacity*sizeof(glm::vec3));
+    pool.normalBuffer = CreateArenaBuffer(vertexCapacity*sizeof(glm::vec3));
+    if (format == VERTEX_FORMAT_PNT) {
+        pool.uvBuffer = CreateArenaBuffer(vertexCapacity*sizeof(glm::vec2));
+    }
+    pool.elementBuffer = CreateArenaBuffer(elementCapacity);
+    if (pool.vertexArray == 0) {
+        glGenVertexArrays(1, &pool.vertexArray);
+        glGenVertexArrays(1, &pool.positionArray);
+    }
+}
+
+void GeometryArena::SetupVertexArray(GLuint vertexArray, Pool_t &pool,
+        VertexFormat_t format, GLuint instanceBuffer, bool positionOnly)
+{
+    glBindVertexArray(vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    glVertexAttribPointer(ATTRIB_LOCATION_VERTEX, 3, GL_FLOAT, GL_FALSE,
+            sizeof(GLfloat)*3, (void *)0);
+    glEnableVertexAttribArray(ATTRIB_LOCATION_VERTEX);
+    if (positionOnly) {
+        glDisableVertexAttribArray(ATTRIB_LOCATION_NORMAL);
+        glDisableVertexAttribArray(ATTRIB_LOCATION_UV);
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, pool.normalBuffer);
+        glVertexAttribPointer(ATTRIB_LOCATION_NORMAL, 3, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat)*3, (void *)0);
+        glEnableVertexAttribArray(ATTRIB_LOCATION_NORMAL);
+    }
+    if (format == VERTEX_FORMAT_PNT && !positionOnly) {
+        glBindBuffer(GL_ARRAY_BUFFER, pool.uvBuffer);
+        glVertexAttribPointer(ATTRIB_LOCATION_UV, 2, GL_FLOAT, GL_FALSE,
+                sizeof(GLfloat)*2, (void *)0);
+        glEnableVertexAttribArray(ATTRIB_LOCATION_UV);
+    } else {
+        glDisableVertexAttribArray(ATTRIB_LOCATION_UV);
+    }
+    if (instanceBuffer != 0) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        for (int column=0; column<4; column++) {
+            GLuint location = ATTRIB_LOCATION_INSTANCE_MODEL + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE,
+                    sizeof(InstanceData_t),
+                    (void *)(offsetof(InstanceData_t, model)
+                        + sizeof(glm::vec4)*column));
+            glVertexAttribDivisor(location, 1);
+            glEnableVertexAttribArray(location);
+        }
+        if (!positionOnly) {
+            glVertexAttribPointer(ATTRIB_LOCATION_INSTANCE_COLOR, 4,
+                    GL_FLOAT, GL_FALSE, sizeof(InstanceData_t),
+                    (void *)offsetof(InstanceData_t, color));
+            glVertexAttribDivisor(ATTRIB_LOCATION_INSTANCE_COLOR, 1);
+            glEnableVertexAttribArray(ATTRIB_LOCATION_INSTANCE_COLOR);
+        }
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.elementBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    m_boundArray = 0;
+}
+
+// Buffers of a pool were replaced, every VAO reading from them has
+// to be pointed at the new ones
+void GeometryArena::SetupVertexArrays(VertexFormat_t format)
+{
+    Pool_t &pool = m_pools[format];
+    SetupVertexArray(pool.vertexArray, pool, format);
+    SetupVertexArray(pool.positionArray, pool, format, 0, true);
+    for (auto it=m_instancedArrays.begin(); it!=m_instancedArrays.end();
+            it++) {
+        if (std::get<0>(it->first) == format) {
+            SetupVertexArray(it->second, pool, format, std::get<1>(it->first),
+                    std::get<2>(it->first));
+        }
+    }
+}
+
+void GeometryArena::DestroyPool(Pool_t &pool)
+{
+    // It is safe to call any glDelete function on 0
+    glDeleteBuffers(1, &pool.vertexBuffer);
+    pool.vertexBuffer = 0;
+    glDeleteBuffers(1, &pool.normalBuffer);
+    pool.normalBuffer = 0;
+    glDeleteBuffers(1, &pool.uvBuffer);
+    pool.uvBuffer = 0;
+    glDeleteBuffers(1, &pool.elementBuffer);
+    pool.elementBuffer = 0;
+}
+
+// Makes sure the pool can fit another mesh, growing its buffers when
+// needed. Growing copies the old contents on the GPU, the ranges
+// already handed out keep their offsets.
+bool GeometryArena::Reserve(Pool_t &pool, VertexFormat_t format,
+        size_t numVertices, size_t elementBytes)
+{
+    if (pool.vertexArray == 0) {
+        size_t vertexCapacity = std::max((size_t)ARENA_INITIAL_VERTICES,
+                numVertices);
+        size_t elementCapacity = std::max((size_t)ARENA_INITIAL_ELEMENT_BYTES,
+                elementBytes);
+        pool.vertices.Reset(vertexCapacity);
+        pool.elements.Reset(elementCapacity);
+        CreatePool(pool, format, vertexCapacity, elementCapacity);
+        SetupVertexArrays(format);
+        return true;
+    }
+
+    size_t oldVertices = pool.vertices.GetCapacity();
+    size_t oldElements = pool.elements.GetCapacity();
+    size_t newVertices = oldVertices;
+    size_t newElements = oldElements;
+    // Growing only extends the free range at the end of the pool.
+    // Alignment padding may waste up to 3 bytes of element space.
+    while (std::max(pool.vertices.GetLargestFree(),
+            pool.vertices.GetTrailingFree() + (newVertices - oldVertices))
+            < numVertices) {
+        newVertices *= 2;
+    }
+    while (std::max(pool.elements.GetLargestFree(),
+            pool.elements.GetTrailingFree() + (newElements - oldElements))
+            < elementBytes + sizeof(GLuint)) {
+        newElements *= 2;
+    }
+    if (newVertices == oldVertices && newElements == oldElements) {
+        return true;
+    }
+
+    Debug("Growing geometry arena pool %d to %lu vertices, %lu element bytes",
+            (int)format, (unsigned long)newVertices,
+            (unsigned long)newElements);
+    Pool_t old = pool;
+    pool.vertexBuffer = 0;
+    pool.normalBuffer = 0;
+    pool.uvBuffer = 0;
+    pool.elementBuffer = 0;
+    CreatePool(pool, format, newVertices, newElements);
+    CopyArenaBuffer(old.vertexBuffer, 0, pool.vertexBuffer, 0,
+            oldVertices*sizeof(glm::vec3));
+    CopyArenaBuffer(old.normalBuffer, 0, pool.normalBuffer, 0,
+            oldVertices*sizeof(glm::vec3));
+    CopyArenaBuffer(old.uvBuffer, 0, pool.uvBuffer, 0,
+            oldVertices*sizeof(glm::vec2));
+    CopyArenaBuffer(old.elementBuffer, 0, pool.elementBuffer, 0,
+            oldElements);
+    DestroyPool(old);
+    pool.vertices.Grow(newVertices);
+    pool.elements.Grow(newElements);
+    SetupVertexArrays(format);
+    return true;
+}
+
+// Checks `mesh` and fills in everything of its range but where it goes
+static bool DescribeMesh(const MeshData_t &mesh, MeshRange_t &range)
+{
+    if (mesh.vertices.size() == 0 || mesh.elements.size() == 0) {
+        Warning("Refusing to add empty mesh to geometry arena");
+        return false;
+    }
+    if (mesh.normals.size() != mesh.vertices.size()) {
+        Warning("vertices.size() != normals.size(): (%lu, %lu)",
+                (unsigned long)mesh.vertices.size(),
+                (unsigned long)mesh.normals.size());
+        return false;
+    }
+    VertexFormat_t format = VERTEX_FORMAT_PN;
+    if (mesh.uvs.size() > 0) {
+        if (mesh.uvs.size() != mesh.vertices.size()) {
+            Warning("vertices.size() != uvs.size(): (%lu, %lu)",
+                    (unsigned long)mesh.vertices.size(),
+                    (unsigned long)mesh.uvs.size());
+            return false;
+        }
+        format = VERTEX_FORMAT_PNT;
+    }
+
+    range.format = format;
+    range.baseVertex = 0;
+    range.numVertices = mesh.vertices.size();
+    range.numElements = mesh.elements.size();
+    range.elementOffset = 0;
+    range.elementType = ChooseElementType(range.numVertices);
+    return true;
+}
+
+// Where each attribute of a staged mesh starts in its buffer
+static void GetStagedOffsets(const MeshRange_t &range, GLintptr &normals,
+        GLintptr &uvs, GLintptr &elements)
+{
+    normals = range.numVertices*sizeof(glm::vec3);
+    uvs = 2*normals;
+    elements = uvs;
+    if (range.format == VERTEX_FORMAT_PNT) {
+        elements += range.numVertices*sizeof(glm::vec2);
+    }
+}
+
+bool StageMesh(const MeshData_t &mesh, StagedMesh_t &staged)
+{
+    if (!DescribeMesh(mesh, staged.range)) {
+        return false;
+    }
+    const MeshRange_t &range = staged.range;
+    GLintptr normals, uvs, elements;
+    GetStagedOffsets(range, normals, uvs, elements);
+    std::vector<uint8_t> packed;
+    PackElements(mesh.elements, range.elementType, packed);
+    const GLsizeiptr size = elements + packed.size();
+    glGenBuffers(1, &staged.buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, staged.buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_COPY);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, normals, &mesh.vertices[0]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, normals, normals,
+            &mesh.normals[0]);
+    if (range.format == VERTEX_FORMAT_PNT) {
+        glBufferSubData(GL_COPY_WRITE_BUFFER, uvs, elements - uvs,
+                &mesh.uvs[0]);
+    }
+    glBufferSubData(GL_COPY_WRITE_BUFFER, elements, packed.size(),
+            &packed[0]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, size);
+    return true;
+}
+
+void ReleaseStagedMesh(StagedMesh_t &staged)
+{
+    glDeleteBuffers(1, &staged.buffer);
+    staged.buffer = 0;
+}
+
+// Finds room for a described mesh and sets where it goes
+bool GeometryArena::AllocateRange(MeshRange_t &range)
+{
+    const GLsizei elementSize = ElementSize(range.elementType);
+    const size_t elementBytes = range.numElements*elementSize;
+    Pool_t &pool = m_pools[range.format];
+    if (!Reserve(pool, range.format, range.numVertices, elementBytes)) {
+        return false;
+    }
+    size_t vertexOffset = 0;
+    size_t elementOffset = 0;
+    if (!pool.vertices.Allocate(range.numVertices, 1, vertexOffset)) {
+        Error("Geometry arena failed to allocate %d vertices",
+                range.numVertices);
+        return false;
+    }
+    if (!pool.elements.Allocate(elementBytes, elementSize, elementOffset)) {
+        Error("Geometry arena failed to allocate %d elements",
+                range.numElements);
+        pool.vertices.Free(vertexOffset);
+        return false;
+    }
+    range.baseVertex = vertexOffset;
+    range.elementOffset = elementOffset;
+    return true;
+}
+
+MeshHandle GeometryArena::StoreRange(const MeshRange_t &range)
+{
+    MeshHandle handle;
+    if (m_freeHandles.size() > 0) {
+        handle = m_freeHandles.back();
+        m_freeHandles.pop_back();
+        m_meshes[handle] = range;
+        m_meshAlive[handle] = true;
+    } else {
+        handle = m_meshes.size();
+        m_meshes.push_back(range);
+        m_meshAlive.push_back(true);
+    }
+    return handle;
+}
+
+MeshHandle GeometryArena::AddMesh(const MeshData_t &mesh)
+{
+    MeshRange_t range;
+    if (!DescribeMesh(mesh, range) || !AllocateRange(range)) {
+        return INVALID_MESH_HANDLE;
+    }
+    Pool_t &pool = m_pools[range.format];
+    const GLintptr vertexOffset = range.baseVertex;
+    UploadArenaBuffer(pool.vertexBuffer, vertexOffset*sizeof(glm::vec3),
+            range.numVertices*sizeof(glm::vec3), &mesh.vertices[0]);
+    UploadArenaBuffer(pool.normalBuffer, vertexOffset*sizeof(glm::vec3),
+            range.numVertices*sizeof(glm::vec3), &mesh.normals[0]);
+    if (range.format == VERTEX_FORMAT_PNT) {
+        UploadArenaBuffer(pool.uvBuffer, vertexOffset*sizeof(glm::vec2),
+                range.numVertices*sizeof(glm::vec2), &mesh.uvs[0]);
+    }
+    PackElements(mesh.elements, range.elementType, m_packedElements);
+    UploadArenaBuffer(pool.elementBuffer, range.elementOffset,
+            m_packedElements.size(), &m_packedElements[0]);
+    return StoreRange(range);
+}
+
+MeshHandle GeometryArena::AddStagedMesh(StagedMesh_t &staged)
+{
+    MeshRange_t range = staged.range;
+    if (staged.buffer == 0 || !AllocateRange(range)) {
+        ReleaseStagedMesh(staged);
+        return INVALID_MESH_HANDLE;
+    }
+    Pool_t &pool = m_pools[range.format];
+    const GLintptr vertexOffset = range.baseVertex;
+    GLintptr normals, uvs, elements;
+    GetStagedOffsets(range, normals, uvs, elements);
+    CopyArenaBuffer(staged.buffer, 0, pool.vertexBuffer,
+            vertexOffset*sizeof(glm::vec3), normals);
+    CopyArenaBuffer(staged.buffer, normals, pool.normalBuffer,
+            vertexOffset*sizeof(glm::vec3), normals);
+    if (range.format == VERTEX_FORMAT_PNT) {
+        CopyArenaBuffer(staged.buffer, uvs, pool.uvBuffer,
+                vertexOffset*sizeof(glm::vec2), elements - uvs);
+    }
+    CopyArenaBuffer(staged.buffer, elements, pool.elementBuffer,
+            range.elementOffset,
+            range.numElements*ElementSize(range.elementType));
+    ReleaseStagedMesh(staged);
+    return StoreRange(range);
+}
+
+void GeometryArena::RemoveMesh(MeshHandle handle)
+{
+    if (handle >= m_meshes.size() || !m_meshAlive[handle]) {
+        Warning("Tried to remove invalid mesh handle %u", handle);
+        return;
+    }
+    const MeshRange_t &range = m_meshes[handle];
+    Pool_t &pool = m_pools[range.format];
+    pool.vertices.Free(range.baseVertex);
+    pool.elements.Free(range.elementOffset);
+    m_meshAlive[handle] = false;
+    m_freeHandles.push_back(handle);
+}
+
+const MeshRange_t& GeometryArena::GetMeshRange(MeshHandle handle) const
+{
+    return m_meshes[handle];
+}
+
+void GeometryArena::Bind(VertexFormat_t format, bool positionOnly)
+{
+    const GLuint vertexArray = positionOnly ? m_pools[format].positionArray
+            : m_pools[format].vertexArray;
+    if (m_boundArray == vertexArray) {
+        return;
+    }
+    glBindVertexArray(vertexArray);
+    m_boundArray = vertexArray;
+}
+
+void GeometryArena::BindInstanced(VertexFormat_t format,
+        GLuint instanceBuffer, bool positionOnly)
+{
+    std::tuple<int, GLuint, bool> key = std::make_tuple((int)format,
+            instanceBuffer, positionOnly);
+    auto it = m_instancedArrays.find(key);
+    if (it == m_instancedArrays.end()) {
+        GLuint vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        SetupVertexArray(vertexArray, m_pools[format], format,
+                instanceBuffer, positionOnly);
+        it = m_instancedArrays.emplace(key, vertexArray).first;
+    }
+    if (m_boundArray == it->second) {
+        return;
+    }
+    glBindVertexArray(it->second);
+    m_boundArray = it->second;
+}
+
+void GeometryArena::Unbind()
+{
+    glBindVertexArray(0);
+    m_boundArray = 0;
+}
+
+void GeometryArena::Draw(MeshHandle handle)
+{
+    PROFILE_FUNCTION();
+    const MeshRange_t &range = m_meshes[handle];
+    Bind(range.format);
+    glDrawElementsBaseVertex(GL_TRIANGLES, range.numElements,
+            range.elementType, (void *)range.elementOffset, range.baseVertex);
+    CounterAdd(COUNTER_DRAW_CALLS);
+    CounterAdd(COUNTER_TRIANGLES, range.numElements/3);
+}
+
+void GeometryArena::DrawBatch(const std::vector<MeshHandle> &handles)
+{
+    if (handles.size() == 0) {
+        return;
+    }
+    if (handles.size() == 1) {
+        Draw(handles[0]);
+        return;
+    }
+    PROFILE_FUNCTION();
+    const GLenum elementType = m_meshes[handles[0]].elementType;
+    const bool indirect = GLEW_ARB_multi_draw_indirect != 0;
+    size_t numElements = 0;
+    for (size_t i=0; i<handles.size(); i++) {
+        numElements += m_meshes[handles[i]].numElements;
+    }
+    CounterAdd(COUNTER_DRAW_CALLS);
+    CounterAdd(COUNTER_TRIANGLES, numElements/3);
+
+    if (indirect) {
+        const GLsizei elementSize = ElementSize(elementType);
+        m_indirectCommands.resize(handles.size());
+        for (size_t i=0; i<handles.size(); i++) {
+            const MeshRange_t &range = m_meshes[handles[i]];
+            DrawElementsIndirectCommand_t &cmd = m_indirectCommands[i];
+            cmd.count = range.numElements;
+            cmd.instanceCount = 1;
+            cmd.firstIndex = range.elementOffset / elementSize;
+            cmd.baseVertex = range.baseVertex;
+            cmd.baseInstance = 0;
+        }
+        if (m_indirectBuffer == 0) {
+            glGenBuffers(1, &m_indirectBuffer);
+        }
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_indirectBuffer);
+        // Orphan the previous frame's commands instead of waiting on them
+        glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                sizeof(DrawElementsIndirectCommand_t)*handles.size(),
+                &m_indirectCommands[0], GL_STREAM_DRAW);
+        CounterAdd(COUNTER_BUFFER_UPLOADS);
+        CounterAdd(COUNTER_UPLOAD_BYTES,
+                sizeof(DrawElementsIndirectCommand_t)*handles.size());
+        glMultiDrawElementsIndirect(GL_TRIANGLES, elementType, (void *)0,
+                handles.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        return;
+    }
+
+    m_batchCounts.resize(handles.size());
+    m_batchOffsets.resize(handles.size());
+    m_batchBaseVertices.resize(handles.size());
+    for (size_t i=0; i<handles.size(); i++) {
+        const MeshRange_t &range = m_meshes[handles[i]];
+        m_batchCounts[i] = range.numElements;
+        m_batchOffsets[i] = (const void *)range.elementOffset;
+        m_batchBaseVertices[i] = range.baseVertex;
+    }
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, &m_batchCounts[0],
+            elementType, (void **)&m_batchOffsets[0], handles.size(),
+            &m_batchBaseVertices[0]);
+}
+
+void GeometryArena::DrawInstanced(MeshHandle handle, GLsizei numInstances)
+{
+    PROFILE_FUNCTION();
+    const MeshRange_t &range = m_meshes[handle];
+    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, range.numElements,
+            range.elementType, (void *)range.elementOffset, numInstances,
+            range.baseVertex);
+    CounterAdd(COUNTER_DRAW_CALLS);
+    CounterAdd(COUNTER_TRIANGLES, range.numElements/3*numInstances);
+}
+
+void GeometryArena::ReleaseInstanced(GLuint instanceBuffer)
+{
+    for (auto it=m_instancedArrays.begin(); it!=m_instancedArrays.end();) {
+        if (std::get<1>(it->first) != instanceBuffer) {
+            it++;
+            continue;
+        }
+        if (m_boundArray == it->second) {
+            Unbind();
+        }
+        glDeleteVertexArrays(1, &it->second);
+        it = m_instancedArrays.erase(it);
+    }
+}
+
+void GeometryArena::Compact()
+{
+    for (int format=0; format<VERTEX_FORMAT_COUNT; format++) {
+        Pool_t &pool = m_pools[format];
+        if (pool.vertexArray == 0) {
+            continue;
+        }
+        if (pool.vertices.GetNumFreeRanges() <= 1
+                && pool.elements.GetNumFreeRanges() <= 1) {
+            continue; // Nothing to close up
+        }
+        std::vector<MeshHandle> live;
+        for (MeshHandle h=0; h<m_meshes.size(); h++) {
+            if (m_meshAlive[h] && m_meshes[h].format == format) {
+                live.push_back(h);
+            }
+        }
+        // Keep the relative order so memory stays in load order
+        std::sort(live.begin(), live.end(), [this](MeshHandle a,
+                MeshHandle b) {
+            return m_meshes[a].baseVertex < m_meshes[b].baseVertex;
+        });
+
+        Pool_t old = pool;
+        size_t vertexCapacity = pool.vertices.GetCapacity();
+        size_t elementCapacity = pool.elements.GetCapacity();
+        pool.vertexBuffer = 0;
+        pool.normalBuffer = 0;
+        pool.uvBuffer = 0;
+        pool.elementBuffer = 0;
+        pool.vertices.Reset(vertexCapacity);
+        pool.elements.Reset(elementCapacity);
+        CreatePool(pool, (VertexFormat_t)format, vertexCapacity,
+                elementCapacity);
+        for (MeshHandle h : live) {
+            MeshRange_t &range = m_meshes[h];
+            const GLsizei elementSize = ElementSize(range.elementType);
+            const size_t elementBytes = range.numElements*elementSize;
+            size_t vertexOffset = 0;
+            size_t elementOffset = 0;
+            pool.vertices.Allocate(range.numVertices, 1, vertexOffset);
+            pool.elements.Allocate(elementBytes, elementSize, elementOffset);
+            CopyArenaBuffer(old.vertexBuffer,
+                    range.baseVertex*sizeof(glm::vec3), pool.vertexBuffer,
+                    vertexOffset*sizeof(glm::vec3),
+                    range.numVertices*sizeof(glm::vec3));
+            CopyArenaBuffer(old.normalBuffer,
+                    range.baseVertex*sizeof(glm::vec3), pool.normalBuffer,
+                    vertexOffset*sizeof(glm::vec3),
+                    range.numVertices*sizeof(glm::vec3));
+            CopyArenaBuffer(old.uvBuffer, range.baseVertex*sizeof(glm::vec2),
+                    pool.uvBuffer, vertexOffset*sizeof(glm::vec2),
+                    range.numVertices*sizeof(glm::vec2));
+            CopyArenaBuffer(old.elementBuffer, range.elementOffset,
+                    pool.elementBuffer, elementOffset, elementBytes);
+            range.baseVertex = vertexOffset;
+            range.elementOffset = elementOffset;
+        }
+        DestroyPool(old);
+        SetupVertexArrays((VertexFormat_t)format);
+    }
+}
+
+void GeometryArena::LogStats()
+{
+    size_t numMeshes = 0;
+    size_t numShort = 0;
+    size_t bytesSaved = 0;
+    for (MeshHandle h=0; h<m_meshes.size(); h++) {
+        if (!m_meshAlive[h]) {
+            continue;
+        }
+        numMeshes++;
+        if (m_meshes[h].elementType == GL_UNSIGNED_SHORT) {
+            numShort++;
+            bytesSaved += m_meshes[h].numElements*sizeof(GLushort);
+        }
+    }
+    Debug("Arena: %lu/%lu meshes use 16-bit elements, %lu bytes saved",
+            (unsigned long)numShort, (unsigned long)numMeshes,
+            (unsigned long)bytesSaved);
+    for (int format=0; format<VERTEX_FORMAT_COUNT; format++) {
+        Pool_t &pool = m_pools[format];
+        if (pool.vertexArray == 0) {
+            continue;
+        }
+        Debug("Arena pool %d: %lu/%lu vertices, %lu/%lu element bytes, "
+                "%lu free ranges", format,
+                (unsigned long)pool.vertices.GetUsed(),
+                (unsigned long)pool.vertices.GetCapacity(),
+                (unsigned long)pool.elements.GetUsed(),
+                (unsigned long)pool.elements.GetCapacity(),
+                (unsigned long)(pool.vertices.GetNumFreeRanges()
+                        + pool.elements.GetNumFreeRanges()));
+    }
+}
+
+GeometryArena::~GeometryArena()
+{
+    // Nothing was made without a context, and GL may not even be
+    // loaded when the program quits early
+    for (int format=0; format<VERTEX_FORMAT_COUNT; format++) {
+        Pool_t &pool = m_pools[format];
+        if (pool.vertexArray == 0) {
+            continue;
+        }
+        DestroyPool(pool);
+        glDeleteVertexArrays(1, &pool.vertexArray);
+        pool.vertexArray = 0;
+        glDeleteVertexArrays(1, &pool.positionArray);
+        pool.positionArray = 0;
+    }
+    for (auto it=m_instancedArrays.begin(); it!=m_instancedArrays.end();
+            it++) {
+        glDeleteVertexArrays(1, &it->second);
+    }
+    m_instancedArrays.clear();
+    if (m_indirectBuffer != 0) {
+        glDeleteBuffers(1, &m_indirectBuffer);
+        m_indirectBuffer = 0;
+    }
+}
@@ -0,0 +1,211 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+#include <cstdint>
+#include <cstddef>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <GL/glew.h>
+#include "graphics/mesh.h"
+
+// Hands out [offset, offset+size) ranges from a linear address space.
+// Free ranges are kept sorted by offset so a released range is merged
+// with its neighbours straight away and the free list never fragments
+// into runs of adjacent blocks.
+class RangeAllocator
+{
+public:
+    RangeAllocator(size_t capacity=0);
+
+    bool Allocate(size_t size, size_t alignment, size_t &offset);
+
+    void Free(size_t offset);
+
+    // Extends the address space, the new tail becomes free space
+    void Grow(size_t newCapacity);
+
+    void Reset(size_t capacity);
+
+    size_t GetCapacity() const;
+
+    size_t GetUsed() const;
+
+    size_t GetLargestFree() const;
+
+    size_t GetTrailingFree() const;
+
+    size_t GetNumFreeRanges() const;
+
+private:
+    void Release(size_t offset, size_t size);
+
+    size_t m_capacity = 0;
+
+    size_t m_used = 0;
+
+    std::map<size_t, size_t> m_free; // offset -> size
+
+    std::map<size_t, size_t> m_allocated; // offset -> size
+};
+
+// Each vertex format gets its own set of buffers and a single VAO
+enum VertexFormat_t {
+    VERTEX_FORMAT_PN = 0, // position, normal
+    VERTEX_FORMAT_PNT,    // position, normal, uv
+    VERTEX_FORMAT_COUNT
+};
+
+typedef uint32_t MeshHandle;
+
+#define INVALID_MESH_HANDLE 0xFFFFFFFF
+
+// Where a mesh lives inside the arena. Elements are stored relative
+// to the first vertex of the mesh so they never need rewriting when
+// the vertices move, `baseVertex` is added at draw time. That also
+// lets any mesh under 65536 vertices use 16-bit elements.
+struct MeshRange_t {
+    VertexFormat_t format;
+    GLint baseVertex;
+    GLsizei numVertices;
+    GLsizei numElements;
+    GLintptr elementOffset; // In bytes
+    GLenum elementType;
+};
+
+// Matches the layout glMultiDrawElementsIndirect expects
+struct DrawElementsIndirectCommand_t {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// A mesh in a buffer of its own, copied there by StageMesh on any
+// context that shares objects with the arena's. The range's offsets
+// are only set once the arena adds it.
+struct StagedMesh_t {
+    GLuint buffer = 0;
+    MeshRange_t range;
+};
+
+// Writes `mesh` into a new buffer laid out for AddStagedMesh, false
+// if the arena would refuse it
+bool StageMesh(const MeshData_t &mesh, StagedMesh_t &staged);
+
+void ReleaseStagedMesh(StagedMesh_t &staged);
+
+class GeometryArena
+{
+    // A few large shared vertex/element buffers that every mesh is
+    // sub-allocated from. Binding one format's VAO is enough to draw
+    // any number of meshes of that format.
+public:
+    GeometryArena() = default;
+
+    MeshHandle AddMesh(const MeshData_t &mesh);
+
+    // Adds a mesh staged once its upload has finished, copying it on
+    // the GPU. The staging buffer is released either way.
+    MeshHandle AddStagedMesh(StagedMesh_t &staged);
+
+    // Frees the mesh's ranges, its handle may be handed out again
+    void RemoveMesh(MeshHandle handle);
+
+    const MeshRange_t& GetMeshRange(MeshHandle handle) const;
+
+    // Binds the VAO of `format` if it isn't bound already. Position
+    // only VAOs read nothing but the tightly packed positions, for
+    // passes that only write depth.
+    void Bind(VertexFormat_t format, bool positionOnly=false);
+
+    // Binds a VAO of `format` that also sources per instance
+    // attributes from `instanceBuffer`, see instance_buffer.h
+    void BindInstanced(VertexFormat_t format, GLuint instanceBuffer,
+            bool positionOnly=false);
+
+    void Unbind();
+
+    void Draw(MeshHandle handle);
+
+    // Draws all meshes with one call. Meshes must share a format and
+    // an element type and the format must be bound.
+    void DrawBatch(const std::vector<MeshHandle> &handles);
+
+    // Draws `numInstances` copies of a mesh, the VAO bound with
+    // BindInstanced decides where the instance attributes come from
+    void DrawInstanced(MeshHandle handle, GLsizei numInstances);
+
+    // Forgets the VAOs made for `instanceBuffer`, before it is deleted
+    // and its name can come back as another buffer
+    void ReleaseInstanced(GLuint instanceBuffer);
+
+    // Moves every live mesh to the front of its buffers, releasing
+    // all the holes left by removed meshes
+    void Compact();
+
+    void LogStats();
+
+    // Copies are not allowed
+    GeometryArena(const GeometryArena &) = delete;
+    GeometryArena& operator=(const GeometryArena &) = delete;
+
+    ~GeometryArena();
+
+private:
+    struct Pool_t {
+        GLuint vertexArray = 0;
+        GLuint positionArray = 0;
+        GLuint vertexBuffer = 0;
+        GLuint normalBuffer = 0;
+        GLuint uvBuffer = 0;
+        GLuint elementBuffer = 0;
+        RangeAllocator vertices; // In vertices
+        RangeAllocator elements; // In bytes
+    };
+
+    bool Reserve(Pool_t &pool, VertexFormat_t format,
+            size_t numVertices, size_t elementBytes);
+
+    bool AllocateRange(MeshRange_t &range);
+
+    MeshHandle StoreRange(const MeshRange_t &range);
+
+    void CreatePool(Pool_t &pool, VertexFormat_t format,
+            size_t vertexCapacity, size_t elementCapacity);
+
+    void SetupVertexArray(GLuint vertexArray, Pool_t &pool,
+            VertexFormat_t format, GLuint instanceBuffer=0,
+            bool positionOnly=false);
+
+    void SetupVertexArrays(VertexFormat_t format);
+
+    void DestroyPool(Pool_t &pool);
+
+    Pool_t m_pools[VERTEX_FORMAT_COUNT];
+
+    std::vector<MeshRange_t> m_meshes;
+
+    std::vector<bool> m_meshAlive;
+
+    std::vector<MeshHandle> m_freeHandles;
+
+    GLuint m_indirectBuffer = 0;
+
+    std::vector<DrawElementsIndirectCommand_t> m_indirectCommands;
+
+    std::vector<uint8_t> m_packedElements; // Upload staging
+
+    std::vector<GLsizei> m_batchCounts;
+
+    std::vector<const void *> m_batchOffsets;
+
+    std::vector<GLint> m_batchBaseVertices;
+
+    // (format, instance buffer, position only) -> VAO
+    std::map<std::tuple<int, GLuint, bool>, GLuint> m_instancedArrays;
+
+    GLuint m_boundArray = 0;
+};
+
+#endif
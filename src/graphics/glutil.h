@@ -5,18 +5,19 @@
 #include <limits>
 #include "util/log.h"
 
-static inline bool CompileShader(GLenum shaderObject, const std::string &src,
-        const int64_t &len)
+// `src` need not be null terminated
+static inline bool CompileShader(GLenum shaderObject, const char *src,
+        size_t len)
 {
-    // int64_t = 64bit
     // GLint >=32bit
-    GLint filesizeMax = std::numeric_limits<GLint>::max();
-    if (len >= filesizeMax) {
-        Error("Shader file is too big (%lld >= %d)", len, filesizeMax);
+    const GLint filesizeMax = std::numeric_limits<GLint>::max();
+    if (len >= (size_t)filesizeMax) {
+        Error("Shader file is too big (%zu >= %d)", len, filesizeMax);
         return false;
     }
-    glShaderSource(shaderObject, 1, (const GLchar **)&src,
-            (GLint *)&len);
+    const GLchar *source = src;
+    const GLint length = len;
+    glShaderSource(shaderObject, 1, &source, &length);
     glCompileShader(shaderObject);
     GLint isCompiled = 0;
     glGetShaderiv(shaderObject, GL_COMPILE_STATUS, &isCompiled);
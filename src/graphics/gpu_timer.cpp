@@ -0,0 +1,66 @@
+#include "gpu_timer.h"
+
+static bool TimerQueriesSupported()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+void GpuTimer::Begin()
+{
+    if (!TimerQueriesSupported() || m_running) {
+        return;
+    }
+    if (m_queries[0] == 0) {
+        glGenQueries(GPU_TIMER_QUERIES, m_queries);
+    }
+    Poll();
+    if (m_pending[m_next]) {
+        return; // The GPU is too far behind, skip this one
+    }
+    glBeginQuery(GL_TIME_ELAPSED, m_queries[m_next]);
+    m_running = true;
+}
+
+void GpuTimer::End()
+{
+    if (!m_running) {
+        return;
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+    m_pending[m_next] = true;
+    m_next = (m_next + 1) % GPU_TIMER_QUERIES;
+    m_running = false;
+}
+
+double GpuTimer::GetMilliseconds()
+{
+    Poll();
+    return m_milliseconds;
+}
+
+void GpuTimer::Poll()
+{
+    for (uint32_t i=0; i<GPU_TIMER_QUERIES; i++) {
+        const uint32_t q = (m_next + i) % GPU_TIMER_QUERIES;
+        if (!m_pending[q]) {
+            continue;
+        }
+        GLint available = 0;
+        glGetQueryObjectiv(m_queries[q], GL_QUERY_RESULT_AVAILABLE,
+                &available);
+        if (!available) {
+            return; // Later queries can't be done either
+        }
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(m_queries[q], GL_QUERY_RESULT, &nanoseconds);
+        m_milliseconds = nanoseconds / 1000000.0;
+        m_pending[q] = false;
+    }
+}
+
+GpuTimer::~GpuTimer()
+{
+    if (m_queries[0] != 0) {
+        glDeleteQueries(GPU_TIMER_QUERIES, m_queries);
+    }
+}
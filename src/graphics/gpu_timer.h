@@ -0,0 +1,48 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+#include <cstdint>
+#include <GL/glew.h>
+
+// Queries in flight per timer. Results are read this many frames
+// late at the most, a timer whose oldest query still isn't done
+// skips measuring instead of waiting for the GPU.
+#define GPU_TIMER_QUERIES 4
+
+class GpuTimer
+{
+    // Measures GPU time spent between Begin() and End() with
+    // GL_TIME_ELAPSED queries. Only one timer can be running at a
+    // time, GL allows a single elapsed time query to be active.
+public:
+    GpuTimer() = default;
+
+    void Begin();
+
+    void End();
+
+    // Latest finished measurement, negative until one has arrived or
+    // when timer queries aren't supported
+    double GetMilliseconds();
+
+    // Copies are not allowed
+    GpuTimer(const GpuTimer &) = delete;
+    GpuTimer& operator=(const GpuTimer &) = delete;
+
+    ~GpuTimer();
+
+private:
+    // Reads every query that has finished, oldest first
+    void Poll();
+
+    GLuint m_queries[GPU_TIMER_QUERIES] = { 0 };
+
+    bool m_pending[GPU_TIMER_QUERIES] = { false };
+
+    uint32_t m_next = 0;
+
+    bool m_running = false;
+
+    double m_milliseconds = -1.0;
+};
+
+#endif
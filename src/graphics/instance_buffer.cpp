@@ -0,0 +1,117 @@
+#include "instance_buffer.h"
+#include <algorithm>
+#include "util/counters.h"
+#include "util/log.h"
+
+// 64 instances * 80 bytes, small enough that moving one part of a
+// large array doesn't resend much, big enough to keep calls few
+#define INSTANCE_BLOCK_SIZE 64
+
+size_t InstanceBuffer::Add(const glm::mat4 &model, const glm::vec4 &color)
+{
+    InstanceData_t instance;
+    instance.model = model;
+    instance.color = color;
+    m_instances.push_back(instance);
+    size_t numBlocks = (m_instances.size() + INSTANCE_BLOCK_SIZE - 1)
+            / INSTANCE_BLOCK_SIZE;
+    m_dirtyBlocks.resize(numBlocks, false);
+    MarkDirty(m_instances.size()-1);
+    return m_instances.size()-1;
+}
+
+void InstanceBuffer::SetTransform(size_t instance, const glm::mat4 &model)
+{
+    m_instances[instance].model = model;
+    MarkDirty(instance);
+}
+
+void InstanceBuffer::SetColor(size_t instance, const glm::vec4 &color)
+{
+    m_instances[instance].color = color;
+    MarkDirty(instance);
+}
+
+const InstanceData_t& InstanceBuffer::Get(size_t instance) const
+{
+    return m_instances[instance];
+}
+
+void InstanceBuffer::Clear()
+{
+    m_instances.clear();
+    m_dirtyBlocks.clear();
+    m_anyDirty = false;
+}
+
+size_t InstanceBuffer::GetCount() const
+{
+    return m_instances.size();
+}
+
+GLuint InstanceBuffer::GetBuffer() const
+{
+    return m_buffer;
+}
+
+size_t InstanceBuffer::GetLastUploadSize() const
+{
+    return m_lastUploadSize;
+}
+
+void InstanceBuffer::MarkDirty(size_t instance)
+{
+    m_dirtyBlocks[instance / INSTANCE_BLOCK_SIZE] = true;
+    m_anyDirty = true;
+}
+
+void InstanceBuffer::Upload()
+{
+    m_lastUploadSize = 0;
+    if (m_buffer == 0) {
+        glGenBuffers(1, &m_buffer);
+    }
+    if (!m_anyDirty || m_instances.size() == 0) {
+        return;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (m_instances.size() > m_capacity) {
+        // Storage is respecified under the same name, VAOs that point
+        // at the buffer stay valid but everything has to be resent
+        m_capacity = m_instances.size() + m_instances.size()/2;
+        glBufferData(GL_COPY_WRITE_BUFFER, m_capacity*sizeof(InstanceData_t),
+                NULL, GL_DYNAMIC_DRAW);
+        m_dirtyBlocks.assign(m_dirtyBlocks.size(), true);
+    }
+    // Send every run of consecutive dirty blocks with one call
+    size_t block = 0;
+    while (block < m_dirtyBlocks.size()) {
+        if (!m_dirtyBlocks[block]) {
+            block++;
+            continue;
+        }
+        size_t end = block;
+        while (end < m_dirtyBlocks.size() && m_dirtyBlocks[end]) {
+            m_dirtyBlocks[end] = false;
+            end++;
+        }
+        size_t first = block*INSTANCE_BLOCK_SIZE;
+        size_t last = std::min(end*INSTANCE_BLOCK_SIZE, m_instances.size());
+        size_t size = (last-first)*sizeof(InstanceData_t);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, first*sizeof(InstanceData_t),
+                size, &m_instances[first]);
+        m_lastUploadSize += size;
+        CounterAdd(COUNTER_BUFFER_UPLOADS);
+        CounterAdd(COUNTER_UPLOAD_BYTES, size);
+        block = end;
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    m_anyDirty = false;
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+    // It is safe to call any glDelete function on 0
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef INSTANCE_BUFFER_H
+#define INSTANCE_BUFFER_H
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+// Per instance vertex attributes, advanced once per instance
+#define ATTRIB_LOCATION_INSTANCE_MODEL 3 // mat4 takes 3, 4, 5 and 6
+#define ATTRIB_LOCATION_INSTANCE_COLOR 7
+
+struct InstanceData_t {
+    glm::mat4 model;
+    glm::vec4 color; // Multiplies the shaded color, alpha included
+};
+
+class InstanceBuffer
+{
+    // CPU copy of every instance's transform and color plus the GL
+    // buffer they are streamed to. Changes mark fixed size blocks as
+    // dirty and Upload() only sends those blocks.
+public:
+    InstanceBuffer() = default;
+
+    size_t Add(const glm::mat4 &model,
+            const glm::vec4 &color=glm::vec4(1.0f));
+
+    void SetTransform(size_t instance, const glm::mat4 &model);
+
+    void SetColor(size_t instance, const glm::vec4 &color);
+
+    const InstanceData_t& Get(size_t instance) const;
+
+    void Clear();
+
+    size_t GetCount() const;
+
+    // Creates the buffer on first use and sends the dirty blocks
+    void Upload();
+
+    GLuint GetBuffer() const;
+
+    // Number of bytes sent by the last Upload()
+    size_t GetLastUploadSize() const;
+
+    // Copies are not allowed
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer& operator=(const InstanceBuffer &) = delete;
+
+    ~InstanceBuffer();
+
+private:
+    void MarkDirty(size_t instance);
+
+    std::vector<InstanceData_t> m_instances;
+
+    std::vector<bool> m_dirtyBlocks;
+
+    bool m_anyDirty = false;
+
+    GLuint m_buffer = 0;
+
+    size_t m_capacity = 0; // In instances
+
+    size_t m_lastUploadSize = 0;
+};
+
+#endif
@@ -0,0 +1,288 @@
+#include "light_grid.h"
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+#include "util/job_system.h"
+#include "util/profiler.h"
+
+// Lights a bounds job takes, fewer cost more to schedule than to do
+#define LIGHT_GRID_BOUNDS_GRAIN 64
+
+typedef std::chrono::steady_clock Clock;
+
+float LightRange(const ShaderLight_t &light)
+{
+    const glm::vec3 brightest = glm::max(light.ambient,
+            glm::max(light.diffuse, light.specular));
+    const float brightness = std::max(brightest.x,
+            std::max(brightest.y, brightest.z));
+    // Solve constant + linear*d + quadratic*d^2 = brightness / cutoff
+    const float c = light.constant - brightness / LIGHT_CUTOFF;
+    if (c >= 0.0f) {
+        return 0.0f; // Never bright enough to see
+    }
+    if (light.quadratic > 0.0f) {
+        const float b = light.linear;
+        const float a = light.quadratic;
+        return (-b + sqrtf(b*b - 4.0f*a*c)) / (2.0f*a);
+    }
+    if (light.linear > 0.0f) {
+        return -c / light.linear;
+    }
+    return FLT_MAX;
+}
+
+LightGrid::LightGrid(unsigned numThreads)
+{
+    m_threaded = numThreads != 1;
+    m_clusterMin.resize(LIGHT_GRID_CLUSTERS);
+    m_clusterMax.resize(LIGHT_GRID_CLUSTERS);
+    m_lists.resize(LIGHT_GRID_CLUSTERS);
+    m_clusters.resize(2*LIGHT_GRID_CLUSTERS, 0);
+    m_view = glm::mat4(1.0f);
+}
+
+void LightGrid::SetProjection(float fovY, float aspect, float zNear,
+        float zFar)
+{
+    if (fovY == m_fovY && aspect == m_aspect && zNear == m_zNear
+            && zFar == m_zFar) {
+        return;
+    }
+    m_fovY = fovY;
+    m_aspect = aspect;
+    m_zNear = zNear;
+    m_zFar = zFar;
+    m_tanHalfY = tanf(0.5f * fovY);
+    m_tanHalfX = m_tanHalfY * aspect;
+    const float logRatio = logf(zFar / zNear);
+    m_sliceScale = LIGHT_GRID_Z / logRatio;
+    m_sliceBias = -LIGHT_GRID_Z * logf(zNear) / logRatio;
+
+    for (int z=0; z<=LIGHT_GRID_Z; z++) {
+        m_sliceDepths[z] = zNear * powf(zFar / zNear, (float)z / LIGHT_GRID_Z);
+    }
+    for (int z=0; z<LIGHT_GRID_Z; z++) {
+        const float depth0 = m_sliceDepths[z];
+        const float depth1 = m_sliceDepths[z+1];
+        for (int y=0; y<LIGHT_GRID_Y; y++) {
+            const float ndcY0 = -1.0f + 2.0f * y / LIGHT_GRID_Y;
+            const float ndcY1 = -1.0f + 2.0f * (y+1) / LIGHT_GRID_Y;
+            for (int x=0; x<LIGHT_GRID_X; x++) {
+                const float ndcX0 = -1.0f + 2.0f * x / LIGHT_GRID_X;
+                const float ndcX1 = -1.0f + 2.0f * (x+1) / LIGHT_GRID_X;
+                // The froxel widens with depth, its box spans the
+                // corners at both ends
+                glm::vec3 lo = glm::vec3(FLT_MAX);
+                glm::vec3 hi = glm::vec3(-FLT_MAX);
+                const float depths[2] = { depth0, depth1 };
+                for (int d=0; d<2; d++) {
+                    const float sx = depths[d] * m_tanHalfX;
+                    const float sy = depths[d] * m_tanHalfY;
+                    lo = glm::min(lo, glm::vec3(std::min(ndcX0*sx, ndcX1*sx),
+                            std::min(ndcY0*sy, ndcY1*sy), depths[d]));
+                    hi = glm::max(hi, glm::vec3(std::max(ndcX0*sx, ndcX1*sx),
+                            std::max(ndcY0*sy, ndcY1*sy), depths[d]));
+                }
+                const int cluster = (z*LIGHT_GRID_Y + y)*LIGHT_GRID_X + x;
+                m_clusterMin[cluster] = lo;
+                m_clusterMax[cluster] = hi;
+            }
+        }
+    }
+}
+
+int LightGrid::SliceOf(float depth) const
+{
+    if (depth <= m_zNear) {
+        return 0;
+    }
+    const float slice = logf(depth) * m_sliceScale + m_sliceBias;
+    return std::min(LIGHT_GRID_Z - 1, std::max(0, (int)slice));
+}
+
+void LightGrid::Build(const std::vector<ShaderLight_t> &lights,
+        const glm::mat4 &view)
+{
+    Clock::time_point start = Clock::now();
+    m_lights = &lights;
+    m_view = view;
+    m_bounds.resize(lights.size());
+    if (m_fovY > 0.0f) {
+        ParallelFor(0, lights.size(),
+                m_threaded ? LIGHT_GRID_BOUNDS_GRAIN : SIZE_MAX,
+                [this](size_t begin, size_t end) {
+                    PROFILE_SCOPE("Light bounds");
+                    ComputeBounds(begin, end);
+                });
+        ParallelFor(0, LIGHT_GRID_Z, m_threaded ? 1 : SIZE_MAX,
+                [this](size_t begin, size_t end) {
+                    PROFILE_SCOPE("Light binning");
+                    BinSlices(begin, end);
+                });
+    } else {
+        for (size_t i=0; i<m_lists.size(); i++) {
+            m_lists[i].clear();
+        }
+    }
+    m_lights = nullptr;
+
+    m_stats = { 0, 0, 0, 0, 0.0 };
+    for (size_t i=0; i<m_bounds.size(); i++) {
+        if (m_bounds[i].z0 <= m_bounds[i].z1) {
+            m_stats.numLights++;
+        }
+    }
+    m_indices.clear();
+    for (size_t c=0; c<m_lists.size(); c++) {
+        const std::vector<uint32_t> &list = m_lists[c];
+        m_clusters[2*c] = (uint32_t)m_indices.size();
+        m_clusters[2*c + 1] = (uint32_t)list.size();
+        m_indices.insert(m_indices.end(), list.begin(), list.end());
+        m_stats.maxPerCluster = std::max(m_stats.maxPerCluster, list.size());
+        if (list.size() > 0) {
+            m_stats.numOccupied++;
+        }
+    }
+    m_stats.numIndices = m_indices.size();
+    m_stats.binMicroseconds = std::chrono::duration<double, std::micro>(
+            Clock::now() - start).count();
+}
+
+void LightGrid::ComputeBounds(size_t begin, size_t end)
+{
+    const std::vector<ShaderLight_t> &lights = *m_lights;
+    for (size_t i=begin; i<end; i++) {
+        LightBounds_t &bounds = m_bounds[i];
+        bounds.z0 = 1;
+        bounds.z1 = 0;
+        const ShaderLight_t &light = lights[i];
+        if (light.type != 1 && light.type != 2) {
+            continue; // Directional lights reach every fragment
+        }
+        // Spot lights are bounded by the sphere their cone sweeps
+        const float radius = LightRange(light);
+        if (radius <= 0.0f) {
+            continue;
+        }
+        const glm::vec4 p = m_view * glm::vec4(light.position, 1.0f);
+        const glm::vec3 center = glm::vec3(p.x, p.y, -p.z);
+        const float depthMin = std::max(center.z - radius, m_zNear);
+        const float depthMax = std::min(center.z + radius, m_zFar);
+        if (depthMin > depthMax) {
+            continue;
+        }
+        if (!TileRange(center, radius, depthMin, depthMax, bounds.tiles)) {
+            continue;
+        }
+        bounds.center = center;
+        bounds.radius = radius;
+        bounds.z0 = SliceOf(depthMin);
+        bounds.z1 = SliceOf(depthMax);
+    }
+}
+
+// Tiles covered by the box of half width `halfWidth` around `center`
+// between two depths, x / depth is extreme at the box's corners
+bool LightGrid::TileRange(const glm::vec3 &center, float halfWidth,
+        float depth0, float depth1, int tiles[4]) const
+{
+    float ndcX[2] = { FLT_MAX, -FLT_MAX };
+    float ndcY[2] = { FLT_MAX, -FLT_MAX };
+    const float depths[2] = { depth0, depth1 };
+    for (int d=0; d<2; d++) {
+        for (int s=-1; s<=1; s+=2) {
+            const float x = (center.x + s*halfWidth)
+                    / (depths[d] * m_tanHalfX);
+            const float y = (center.y + s*halfWidth)
+                    / (depths[d] * m_tanHalfY);
+            ndcX[0] = std::min(ndcX[0], x);
+            ndcX[1] = std::max(ndcX[1], x);
+            ndcY[0] = std::min(ndcY[0], y);
+            ndcY[1] = std::max(ndcY[1], y);
+        }
+    }
+    if (ndcX[0] > 1.0f || ndcX[1] < -1.0f
+            || ndcY[0] > 1.0f || ndcY[1] < -1.0f) {
+        return false;
+    }
+    for (int e=0; e<2; e++) {
+        const float x = std::min(1.0f, std::max(-1.0f, ndcX[e]));
+        const float y = std::min(1.0f, std::max(-1.0f, ndcY[e]));
+        tiles[e] = std::min(LIGHT_GRID_X - 1,
+                (int)((x + 1.0f) * 0.5f * LIGHT_GRID_X));
+        tiles[2+e] = std::min(LIGHT_GRID_Y - 1,
+                (int)((y + 1.0f) * 0.5f * LIGHT_GRID_Y));
+    }
+    return true;
+}
+
+// Each job owns whole slices so no cluster list is written by two
+// threads, idle threads steal what is left of the crowded near ones
+void LightGrid::BinSlices(int z0, int z1)
+{
+    for (int z=z0; z<z1; z++) {
+        const int first = z*LIGHT_GRID_X*LIGHT_GRID_Y;
+        for (int c=first; c<first + LIGHT_GRID_X*LIGHT_GRID_Y; c++) {
+            m_lists[c].clear();
+        }
+        for (size_t i=0; i<m_bounds.size(); i++) {
+            const LightBounds_t &bounds = m_bounds[i];
+            if (z < bounds.z0 || z > bounds.z1) {
+                continue;
+            }
+            // The sphere is narrower where it crosses this slice than
+            // at its middle unless the middle is inside the slice
+            const glm::vec3 &center = bounds.center;
+            const float radiusSq = bounds.radius * bounds.radius;
+            const float depth0 = std::max(m_sliceDepths[z],
+                    center.z - bounds.radius);
+            const float depth1 = std::min(m_sliceDepths[z+1],
+                    center.z + bounds.radius);
+            const float gap = std::max(0.0f, std::max(depth0 - center.z,
+                    center.z - depth1));
+            int tiles[4];
+            if (!TileRange(center, sqrtf(std::max(0.0f, radiusSq - gap*gap)),
+                    depth0, depth1, tiles)) {
+                continue;
+            }
+            for (int y=tiles[2]; y<=tiles[3]; y++) {
+                for (int x=tiles[0]; x<=tiles[1]; x++) {
+                    const int c = first + y*LIGHT_GRID_X + x;
+                    const glm::vec3 d = glm::max(glm::vec3(0.0f),
+                            glm::max(m_clusterMin[c] - bounds.center,
+                            bounds.center - m_clusterMax[c]));
+                    if (glm::dot(d, d) <= radiusSq) {
+                        m_lists[c].push_back((uint32_t)i);
+                    }
+                }
+            }
+        }
+    }
+}
+
+const std::vector<uint32_t>& LightGrid::GetClusters() const
+{
+    return m_clusters;
+}
+
+const std::vector<uint32_t>& LightGrid::GetIndices() const
+{
+    return m_indices;
+}
+
+float LightGrid::GetSliceScale() const
+{
+    return m_sliceScale;
+}
+
+float LightGrid::GetSliceBias() const
+{
+    return m_sliceBias;
+}
+
+const LightGridStats_t& LightGrid::GetStats() const
+{
+    return m_stats;
+}
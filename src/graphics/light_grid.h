@@ -0,0 +1,122 @@
+#ifndef LIGHT_GRID_H
+#define LIGHT_GRID_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include "graphics/shader_program.h"
+
+// Clusters across, up and into the screen, model.frs has the same
+#define LIGHT_GRID_X 16
+#define LIGHT_GRID_Y 9
+#define LIGHT_GRID_Z 24
+#define LIGHT_GRID_CLUSTERS (LIGHT_GRID_X * LIGHT_GRID_Y * LIGHT_GRID_Z)
+// A light stops reaching where its attenuated brightest color falls
+// below this
+#define LIGHT_CUTOFF (1.0f/256.0f)
+
+struct LightGridStats_t {
+    size_t numLights; // Point and spot lights that reached a cluster
+    size_t numIndices;
+    size_t maxPerCluster;
+    size_t numOccupied; // Clusters with at least one light
+    double binMicroseconds;
+};
+
+// Distance at which `light` drops below LIGHT_CUTOFF, FLT_MAX if it
+// never does
+float LightRange(const ShaderLight_t &light);
+
+class LightGrid
+{
+    // Clustered light culling (Olsson, Billeter & Assarsson 2012).
+    // The view frustum is cut into a grid of froxels, screen tiles
+    // split into depth slices spaced exponentially between the near
+    // and far planes, and every point and spot light is listed in the
+    // froxels its range sphere touches. Each fragment then only goes
+    // over the lights of the one froxel it falls in.
+public:
+    // 1 thread keeps the work on the calling thread, anything else
+    // shares it out on the job system
+    LightGrid(unsigned numThreads=0);
+
+    // Perspective projection the clusters follow, `fovY` in radians
+    void SetProjection(float fovY, float aspect, float zNear, float zFar);
+
+    // Lists every point and spot light of `lights` in the clusters it
+    // reaches, `view` takes them from world to view space. Lights
+    // and then depth slices are split into jobs.
+    void Build(const std::vector<ShaderLight_t> &lights,
+            const glm::mat4 &view);
+
+    // (first index, count) pairs into GetIndices, one per cluster with
+    // x varying fastest then y then the depth slice
+    const std::vector<uint32_t>& GetClusters() const;
+
+    // Indices into the lights passed to Build
+    const std::vector<uint32_t>& GetIndices() const;
+
+    // A fragment at view depth d is in slice log(d)*scale + bias
+    float GetSliceScale() const;
+
+    float GetSliceBias() const;
+
+    const LightGridStats_t& GetStats() const;
+
+    // Copies are not allowed
+    LightGrid(const LightGrid &) = delete;
+    LightGrid& operator=(const LightGrid &) = delete;
+
+private:
+    // View space sphere of a light and the clusters around it, depth
+    // is the distance in front of the camera
+    struct LightBounds_t {
+        glm::vec3 center; // x, y, depth
+        float radius;
+        int tiles[4]; // x0, x1, y0, y1 inclusive
+        int z0, z1; // z0 > z1 when the light reaches no cluster
+    };
+
+    void ComputeBounds(size_t begin, size_t end);
+
+    void BinSlices(int z0, int z1);
+
+    // False if it is all off screen
+    bool TileRange(const glm::vec3 &center, float halfWidth, float depth0,
+            float depth1, int tiles[4]) const;
+
+    int SliceOf(float depth) const;
+
+    bool m_threaded = true;
+
+    float m_fovY = 0.0f;
+    float m_aspect = 0.0f;
+    float m_zNear = 0.0f;
+    float m_zFar = 0.0f;
+    float m_tanHalfX = 1.0f;
+    float m_tanHalfY = 1.0f;
+    float m_sliceScale = 0.0f;
+    float m_sliceBias = 0.0f;
+    float m_sliceDepths[LIGHT_GRID_Z + 1];
+
+    // View space bounds of every cluster, x, y and depth
+    std::vector<glm::vec3> m_clusterMin;
+    std::vector<glm::vec3> m_clusterMax;
+
+    const std::vector<ShaderLight_t> *m_lights = nullptr;
+
+    glm::mat4 m_view;
+
+    std::vector<LightBounds_t> m_bounds;
+
+    // Lights of each cluster, kept between frames to reuse memory
+    std::vector<std::vector<uint32_t>> m_lists;
+
+    std::vector<uint32_t> m_clusters;
+
+    std::vector<uint32_t> m_indices;
+
+    LightGridStats_t m_stats = { 0, 0, 0, 0, 0.0 };
+};
+
+#endif
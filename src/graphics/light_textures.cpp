@@ -0,0 +1,94 @@
+#include "light_textures.h"
+#include <algorithm>
+#include "util/counters.h"
+
+static bool TextureBuffersSupported()
+{
+    return GLEW_VERSION_3_1 || GLEW_ARB_texture_buffer_object;
+}
+
+bool LightTextures::Upload(const std::vector<ShaderLight_t> &lights,
+        const LightGrid &grid)
+{
+    if (!TextureBuffersSupported()) {
+        return false;
+    }
+    if (m_maxTexels == 0) {
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxTexels);
+    }
+    const std::vector<uint32_t> &indices = grid.GetIndices();
+    if (lights.size()*LIGHT_TEXELS > (size_t)m_maxTexels
+            || indices.size() > (size_t)m_maxTexels) {
+        return false;
+    }
+
+    m_packed.clear();
+    for (size_t i=0; i<lights.size(); i++) {
+        const ShaderLight_t &l = lights[i];
+        m_packed.push_back(glm::vec4(l.position, (float)l.type));
+        m_packed.push_back(glm::vec4(l.direction, l.innerCutOff));
+        m_packed.push_back(glm::vec4(l.ambient, l.outerCutOff));
+        m_packed.push_back(glm::vec4(l.diffuse, l.constant));
+        m_packed.push_back(glm::vec4(l.specular, l.linear));
+        m_packed.push_back(glm::vec4(l.quadratic, 0.0f, 0.0f, 0.0f));
+    }
+    // Empty buffers can't back a texture, keep one unused entry
+    if (m_packed.size() == 0) {
+        m_packed.push_back(glm::vec4(0.0f));
+    }
+    const uint32_t none = 0;
+    UploadBuffer(m_lights, GL_RGBA32F, m_packed.data(),
+            m_packed.size()*sizeof(glm::vec4));
+    UploadBuffer(m_clusters, GL_RG32UI, grid.GetClusters().data(),
+            grid.GetClusters().size()*sizeof(uint32_t));
+    UploadBuffer(m_indices, GL_R32UI,
+            indices.size() > 0 ? indices.data() : &none,
+            std::max((size_t)1, indices.size())*sizeof(uint32_t));
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    return true;
+}
+
+// Orphans the old storage so the driver needn't wait for draws still
+// reading last frame's lists
+void LightTextures::UploadBuffer(Buffer_t &buffer, GLenum format,
+        const void *data, size_t size)
+{
+    if (buffer.buffer == 0) {
+        glGenBuffers(1, &buffer.buffer);
+        glGenTextures(1, &buffer.texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer.buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, buffer.texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, buffer.buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    glBindBuffer(GL_TEXTURE_BUFFER, buffer.buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, size);
+}
+
+void LightTextures::Bind()
+{
+    glActiveTexture(GL_TEXTURE0 + LIGHT_DATA_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_lights.texture);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_CLUSTER_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_clusters.texture);
+    glActiveTexture(GL_TEXTURE0 + LIGHT_INDEX_UNIT);
+    glBindTexture(GL_TEXTURE_BUFFER, m_indices.texture);
+    glActiveTexture(GL_TEXTURE0);
+    CounterAdd(COUNTER_TEXTURE_BINDS, 3);
+}
+
+LightTextures::~LightTextures()
+{
+    if (m_lights.buffer == 0) {
+        return;
+    }
+    const GLuint buffers[3] = { m_lights.buffer, m_clusters.buffer,
+            m_indices.buffer };
+    const GLuint textures[3] = { m_lights.texture, m_clusters.texture,
+            m_indices.texture };
+    glDeleteBuffers(3, buffers);
+    glDeleteTextures(3, textures);
+}
@@ -0,0 +1,61 @@
+#ifndef LIGHT_TEXTURES_H
+#define LIGHT_TEXTURES_H
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include "graphics/shader_program.h"
+#include "graphics/light_grid.h"
+
+// Texture units the clustered lights are read from, after the
+// material's diffuse and specular samplers
+#define LIGHT_DATA_UNIT 2
+#define LIGHT_CLUSTER_UNIT 3
+#define LIGHT_INDEX_UNIT 4
+// RGBA32F texels per light, model.frs has the same
+#define LIGHT_TEXELS 6
+
+class LightTextures
+{
+    // Texture buffers holding every clustered light and the lists a
+    // LightGrid built for them, streamed again every frame:
+    //   lights   RGBA32F  LIGHT_TEXELS per light
+    //   clusters RG32UI   first index and count per cluster
+    //   indices  R32UI    light numbers
+public:
+    LightTextures() = default;
+
+    // Creates the buffers on first use. False when texture buffers
+    // aren't supported or the lists don't fit in one.
+    bool Upload(const std::vector<ShaderLight_t> &lights,
+            const LightGrid &grid);
+
+    // Binds the buffers to their LIGHT_*_UNIT texture units
+    void Bind();
+
+    // Copies are not allowed
+    LightTextures(const LightTextures &) = delete;
+    LightTextures& operator=(const LightTextures &) = delete;
+
+    ~LightTextures();
+
+private:
+    struct Buffer_t {
+        GLuint buffer;
+        GLuint texture;
+    };
+
+    void UploadBuffer(Buffer_t &buffer, GLenum format, const void *data,
+            size_t size);
+
+    Buffer_t m_lights = { 0, 0 };
+
+    Buffer_t m_clusters = { 0, 0 };
+
+    Buffer_t m_indices = { 0, 0 };
+
+    GLint m_maxTexels = 0;
+
+    std::vector<glm::vec4> m_packed;
+};
+
+#endif
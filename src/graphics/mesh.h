@@ -0,0 +1,24 @@
+#ifndef MESH_H
+#define MESH_H
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+
+// Fixed vertex attribute slots, bound before a program is linked so
+// that one VAO can be shared by every program that draws models
+#define ATTRIB_LOCATION_VERTEX 0
+#define ATTRIB_LOCATION_NORMAL 1
+#define ATTRIB_LOCATION_UV 2
+// Per vertex color of overlays, past the instance attributes
+#define ATTRIB_LOCATION_COLOR 8
+
+// CPU side copy of a mesh as produced by the model loaders. Every
+// attribute vector is indexed by the values stored in `elements`.
+struct MeshData_t {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec3> normals;
+    std::vector<glm::vec2> uvs; // Empty when the model has no texture
+    std::vector<GLuint> elements;
+};
+
+#endif
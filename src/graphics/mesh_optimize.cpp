@@ -0,0 +1,444 @@
+#include "mesh_optimize.h"
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+VertexCacheStats_t AnalyzeVertexCache(const std::vector<GLuint> &elements,
+        size_t numVertices, size_t cacheSize)
+{
+    VertexCacheStats_t stats = { 0.0f, 0.0f };
+    if (elements.size() < 3 || numVertices == 0) {
+        return stats;
+    }
+    // A vertex is cached while fewer than cacheSize misses happened
+    // since it was last loaded
+    std::vector<size_t> loadedAt(numVertices, SIZE_MAX);
+    std::vector<bool> used(numVertices, false);
+    size_t misses = 0;
+    size_t numUsed = 0;
+    for (size_t i=0; i<elements.size(); i++) {
+        const GLuint v = elements[i];
+        if (loadedAt[v] == SIZE_MAX || misses - loadedAt[v] >= cacheSize) {
+            loadedAt[v] = misses;
+            misses++;
+        }
+        if (!used[v]) {
+            used[v] = true;
+            numUsed++;
+        }
+    }
+    stats.acmr = (float)misses / (elements.size() / 3);
+    stats.atvr = (float)misses / numUsed;
+    return stats;
+}
+
+struct VertexKey_t {
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec2 uv;
+
+    bool operator==(const VertexKey_t &other) const
+    {
+        return memcmp(this, &other, sizeof(VertexKey_t)) == 0;
+    }
+};
+
+struct VertexKeyHash {
+    size_t operator()(const VertexKey_t &key) const
+    {
+        uint32_t words[sizeof(VertexKey_t)/4];
+        memcpy(words, &key, sizeof(VertexKey_t));
+        uint32_t h = 2166136261u;
+        for (size_t i=0; i<sizeof(words)/sizeof(words[0]); i++) {
+            h = (h ^ words[i]) * 16777619u;
+        }
+        return h;
+    }
+};
+
+void WeldMesh(MeshData_t &mesh)
+{
+    const bool textured = mesh.uvs.size() > 0;
+    std::unordered_map<VertexKey_t, GLuint, VertexKeyHash> welded;
+    welded.reserve(mesh.vertices.size());
+    std::vector<GLuint> remap(mesh.vertices.size());
+    MeshData_t out;
+    for (size_t v=0; v<mesh.vertices.size(); v++) {
+        VertexKey_t key;
+        memset((void *)&key, 0, sizeof(VertexKey_t));
+        key.position = mesh.vertices[v];
+        key.normal = mesh.normals[v];
+        if (textured) {
+            key.uv = mesh.uvs[v];
+        }
+        auto it = welded.emplace(key, (GLuint)out.vertices.size());
+        if (it.second) {
+            out.vertices.push_back(mesh.vertices[v]);
+            out.normals.push_back(mesh.normals[v]);
+            if (textured) {
+                out.uvs.push_back(mesh.uvs[v]);
+            }
+        }
+        remap[v] = it.first->second;
+    }
+    for (size_t i=0; i<mesh.elements.size(); i++) {
+        mesh.elements[i] = remap[mesh.elements[i]];
+    }
+    mesh.vertices.swap(out.vertices);
+    mesh.normals.swap(out.normals);
+    mesh.uvs.swap(out.uvs);
+}
+
+void OptimizeVertexCache(std::vector<GLuint> &elements, size_t numVertices,
+        size_t cacheSize)
+{
+    const size_t numTriangles = elements.size() / 3;
+    if (numTriangles == 0 || numVertices == 0) {
+        return;
+    }
+    // Triangles using each vertex, offsets[v] to offsets[v+1]
+    std::vector<uint32_t> offsets(numVertices + 1, 0);
+    for (size_t i=0; i<numTriangles*3; i++) {
+        offsets[elements[i] + 1]++;
+    }
+    for (size_t v=0; v<numVertices; v++) {
+        offsets[v+1] += offsets[v];
+    }
+    std::vector<uint32_t> adjacency(numTriangles*3);
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i=0; i<numTriangles*3; i++) {
+        adjacency[fill[elements[i]]++] = i / 3;
+    }
+    std::vector<uint32_t> live(numVertices); // Triangles not emitted yet
+    for (size_t v=0; v<numVertices; v++) {
+        live[v] = offsets[v+1] - offsets[v];
+    }
+
+    std::vector<size_t> cachedAt(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<uint32_t> deadEnds;
+    std::vector<uint32_t> candidates;
+    std::vector<GLuint> out;
+    out.reserve(numTriangles*3);
+    size_t time = cacheSize + 1;
+    size_t cursor = 0;
+    int64_t fan = -1;
+    while (cursor < numVertices && live[cursor] == 0) {
+        cursor++;
+    }
+    if (cursor < numVertices) {
+        fan = cursor;
+    }
+    while (fan >= 0) {
+        candidates.clear();
+        for (uint32_t a=offsets[fan]; a<offsets[fan+1]; a++) {
+            const uint32_t t = adjacency[a];
+            if (emitted[t]) {
+                continue;
+            }
+            emitted[t] = true;
+            for (int j=0; j<3; j++) {
+                const GLuint v = elements[3*t+j];
+                out.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cachedAt[v] > cacheSize) {
+                    cachedAt[v] = time;
+                    time++;
+                }
+            }
+        }
+        // Next fan: the candidate that will still be in the cache
+        // after its remaining triangles are emitted, oldest first
+        fan = -1;
+        int64_t best = -1;
+        for (size_t c=0; c<candidates.size(); c++) {
+            const GLuint v = candidates[c];
+            if (live[v] == 0) {
+                continue;
+            }
+            int64_t priority = 0;
+            if (time - cachedAt[v] + 2*live[v] <= cacheSize) {
+                priority = time - cachedAt[v];
+            }
+            if (priority > best) {
+                best = priority;
+                fan = v;
+            }
+        }
+        if (fan >= 0) {
+            continue;
+        }
+        // Dead end, go back to a recently used vertex or else the
+        // next one in input order that still has triangles
+        while (deadEnds.size() > 0 && fan < 0) {
+            const GLuint v = deadEnds.back();
+            deadEnds.pop_back();
+            if (live[v] > 0) {
+                fan = v;
+            }
+        }
+        while (fan < 0 && cursor < numVertices) {
+            if (live[cursor] > 0) {
+                fan = cursor;
+            }
+            cursor++;
+        }
+    }
+    out.insert(out.end(), elements.begin() + numTriangles*3, elements.end());
+    elements.swap(out);
+}
+
+struct Cluster_t {
+    size_t first; // Triangle
+    size_t count;
+    float sortKey;
+};
+
+// FIFO cache state for walking a triangle list
+struct CacheSimulation_t {
+    std::vector<size_t> loadedAt; // Miss count when each was loaded
+    size_t misses;
+    size_t coldFrom; // Loads before this don't count as cached
+
+    int AddTriangle(const GLuint *triangle, size_t cacheSize)
+    {
+        int triangleMisses = 0;
+        for (int j=0; j<3; j++) {
+            const GLuint v = triangle[j];
+            const bool cached = loadedAt[v] != SIZE_MAX
+                    && loadedAt[v] >= coldFrom
+                    && misses - loadedAt[v] < cacheSize;
+            if (!cached) {
+                loadedAt[v] = misses;
+                misses++;
+                triangleMisses++;
+            }
+        }
+        return triangleMisses;
+    }
+};
+
+bool OptimizeOverdraw(std::vector<GLuint> &elements,
+        const std::vector<glm::vec3> &vertices, float threshold,
+        size_t cacheSize)
+{
+    const size_t numTriangles = elements.size() / 3;
+    if (numTriangles < 2) {
+        return false;
+    }
+    // Hard boundaries where a triangle misses on all three vertices,
+    // the cache has effectively been flushed there so cutting costs
+    // nothing
+    CacheSimulation_t cache;
+    cache.loadedAt.assign(vertices.size(), SIZE_MAX);
+    cache.misses = 0;
+    cache.coldFrom = 0;
+    std::vector<size_t> hard;
+    for (size_t t=0; t<numTriangles; t++) {
+        if (cache.AddTriangle(&elements[3*t], cacheSize) == 3) {
+            hard.push_back(t);
+        }
+    }
+    hard.push_back(numTriangles);
+
+    // Soft boundaries inside those, wherever the cluster so far has a
+    // miss rate within `threshold` of the whole hard cluster's. The
+    // cache starts cold after each cut as the next cluster may end up
+    // drawn after anything.
+    std::vector<Cluster_t> clusters;
+    for (size_t h=0; h+1<hard.size(); h++) {
+        cache.coldFrom = cache.misses;
+        size_t before = cache.misses;
+        for (size_t t=hard[h]; t<hard[h+1]; t++) {
+            cache.AddTriangle(&elements[3*t], cacheSize);
+        }
+        const float limit = threshold * (cache.misses - before)
+                / (hard[h+1] - hard[h]);
+
+        cache.coldFrom = cache.misses;
+        Cluster_t cluster = { hard[h], 0, 0.0f };
+        size_t clusterMisses = 0;
+        for (size_t t=hard[h]; t<hard[h+1]; t++) {
+            clusterMisses += cache.AddTriangle(&elements[3*t], cacheSize);
+            cluster.count++;
+            if (cluster.count >= cacheSize
+                    && (float)clusterMisses / cluster.count <= limit) {
+                clusters.push_back(cluster);
+                cluster.first = t + 1;
+                cluster.count = 0;
+                clusterMisses = 0;
+                cache.coldFrom = cache.misses;
+            }
+        }
+        if (cluster.count > 0) {
+            clusters.push_back(cluster);
+        }
+    }
+    if (clusters.size() < 2) {
+        return false;
+    }
+
+    // Clusters facing away from the middle of the mesh are on the
+    // outside and likely to cover the rest
+    glm::vec3 meshCenter = glm::vec3(0.0f);
+    float meshArea = 0.0f;
+    std::vector<glm::vec3> centers(clusters.size());
+    std::vector<glm::vec3> normals(clusters.size());
+    for (size_t c=0; c<clusters.size(); c++) {
+        glm::vec3 center = glm::vec3(0.0f);
+        glm::vec3 normal = glm::vec3(0.0f);
+        float area = 0.0f;
+        const size_t end = clusters[c].first + clusters[c].count;
+        for (size_t t=clusters[c].first; t<end; t++) {
+            const glm::vec3 &p0 = vertices[elements[3*t]];
+            const glm::vec3 &p1 = vertices[elements[3*t+1]];
+            const glm::vec3 &p2 = vertices[elements[3*t+2]];
+            glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+            float triangleArea = glm::length(n);
+            center += (p0 + p1 + p2) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        meshCenter += center;
+        meshArea += area;
+        centers[c] = area > 0.0f ? center / area : center;
+        float length = glm::length(normal);
+        normals[c] = length > 0.0f ? normal / length : normal;
+    }
+    if (meshArea > 0.0f) {
+        meshCenter /= meshArea;
+    }
+    for (size_t c=0; c<clusters.size(); c++) {
+        clusters[c].sortKey = glm::dot(centers[c] - meshCenter, normals[c]);
+    }
+    std::stable_sort(clusters.begin(), clusters.end(),
+            [](const Cluster_t &a, const Cluster_t &b) {
+                return a.sortKey > b.sortKey;
+            });
+
+    std::vector<GLuint> out;
+    out.reserve(elements.size());
+    for (size_t c=0; c<clusters.size(); c++) {
+        out.insert(out.end(), elements.begin() + 3*clusters[c].first,
+                elements.begin() + 3*(clusters[c].first + clusters[c].count));
+    }
+    out.insert(out.end(), elements.begin() + numTriangles*3, elements.end());
+    // Cold starts add up over the clusters, past the threshold the
+    // cache loses more than the overdraw saves
+    const float acmr = AnalyzeVertexCache(elements, vertices.size(),
+            cacheSize).acmr;
+    if (AnalyzeVertexCache(out, vertices.size(), cacheSize).acmr
+            > threshold * acmr) {
+        return false;
+    }
+    elements.swap(out);
+    return true;
+}
+
+void OptimizeVertexFetch(MeshData_t &mesh)
+{
+    const bool textured = mesh.uvs.size() > 0;
+    std::vector<GLuint> remap(mesh.vertices.size(), UINT32_MAX);
+    MeshData_t out;
+    out.vertices.reserve(mesh.vertices.size());
+    out.normals.reserve(mesh.vertices.size());
+    for (size_t i=0; i<mesh.elements.size(); i++) {
+        GLuint &e = mesh.elements[i];
+        if (remap[e] == UINT32_MAX) {
+            remap[e] = out.vertices.size();
+            out.vertices.push_back(mesh.vertices[e]);
+            out.normals.push_back(mesh.normals[e]);
+            if (textured) {
+                out.uvs.push_back(mesh.uvs[e]);
+            }
+        }
+        e = remap[e];
+    }
+    // Vertices no element refers to are dropped
+    mesh.vertices.swap(out.vertices);
+    mesh.normals.swap(out.normals);
+    mesh.uvs.swap(out.uvs);
+}
+
+MeshOptimizeStats_t OptimizeMesh(MeshData_t &mesh)
+{
+    MeshOptimizeStats_t stats;
+    stats.verticesBefore = mesh.vertices.size();
+    WeldMesh(mesh);
+    stats.verticesAfter = mesh.vertices.size();
+    stats.before = AnalyzeVertexCache(mesh.elements, mesh.vertices.size());
+    OptimizeVertexCache(mesh.elements, mesh.vertices.size());
+    stats.cacheOrder = AnalyzeVertexCache(mesh.elements,
+            mesh.vertices.size());
+    stats.overdrawOrder = OptimizeOverdraw(mesh.elements, mesh.vertices);
+    OptimizeVertexFetch(mesh);
+    stats.after = AnalyzeVertexCache(mesh.elements, mesh.vertices.size());
+    return stats;
+}
+
+GLenum ChooseElementType(size_t numVertices)
+{
+    if (numVertices < SHORT_ELEMENT_LIMIT) {
+        return GL_UNSIGNED_SHORT;
+    }
+    return GL_UNSIGNED_INT;
+}
+
+void PackElements(const std::vector<GLuint> &elements, GLenum type,
+        std::vector<uint8_t> &out)
+{
+    if (type != GL_UNSIGNED_SHORT) {
+        out.resize(elements.size()*sizeof(GLuint));
+        if (elements.size() > 0) {
+            memcpy(&out[0], &elements[0], out.size());
+        }
+        return;
+    }
+    out.resize(elements.size()*sizeof(GLushort));
+    for (size_t i=0; i<elements.size(); i++) {
+        const GLushort e = (GLushort)elements[i];
+        memcpy(&out[i*sizeof(GLushort)], &e, sizeof(GLushort));
+    }
+}
+
+void SplitMesh(const MeshData_t &mesh, size_t maxVertices,
+        std::vector<MeshData_t> &chunks)
+{
+    chunks.clear();
+    if (mesh.elements.size() < 3 || maxVertices < 3) {
+        return;
+    }
+    const bool textured = mesh.uvs.size() > 0;
+    // remap is only valid for vertices stamped with the current chunk
+    std::vector<uint32_t> remap(mesh.vertices.size(), 0);
+    std::vector<uint32_t> stamp(mesh.vertices.size(), UINT32_MAX);
+    uint32_t chunk = 0;
+    chunks.emplace_back();
+    for (size_t t=0; t+2<mesh.elements.size(); t+=3) {
+        size_t newVertices = 0;
+        for (int k=0; k<3; k++) {
+            newVertices += stamp[mesh.elements[t+k]] != chunk;
+        }
+        if (chunks.back().vertices.size() + newVertices > maxVertices) {
+            chunks.emplace_back();
+            chunk++;
+        }
+        MeshData_t &out = chunks.back();
+        for (int k=0; k<3; k++) {
+            const GLuint e = mesh.elements[t+k];
+            if (stamp[e] != chunk) {
+                stamp[e] = chunk;
+                remap[e] = out.vertices.size();
+                out.vertices.push_back(mesh.vertices[e]);
+                out.normals.push_back(mesh.normals[e]);
+                if (textured) {
+                    out.uvs.push_back(mesh.uvs[e]);
+                }
+            }
+            out.elements.push_back(remap[e]);
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef MESH_OPTIMIZE_H
+#define MESH_OPTIMIZE_H
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "graphics/mesh.h"
+
+// Entries in the simulated post-transform cache, FIFO like most
+// hardware
+#define VERTEX_CACHE_SIZE 16
+
+struct VertexCacheStats_t {
+    float acmr; // Average cache misses per triangle, 0.5 to 3
+    float atvr; // Average transforms per vertex, 1 is ideal
+};
+
+// Simulates drawing `elements` through a FIFO cache of `cacheSize`
+VertexCacheStats_t AnalyzeVertexCache(const std::vector<GLuint> &elements,
+        size_t numVertices, size_t cacheSize=VERTEX_CACHE_SIZE);
+
+// Merges vertices whose position, normal and uv are all identical
+void WeldMesh(MeshData_t &mesh);
+
+// Tipsify (Sander, Nehab & Barczak 2007), fans triangles around
+// vertices that are still in the cache
+void OptimizeVertexCache(std::vector<GLuint> &elements, size_t numVertices,
+        size_t cacheSize=VERTEX_CACHE_SIZE);
+
+// Cuts the cache optimized order into clusters at points where the
+// cache starts over anyway, or where a cluster's miss rate is within
+// `threshold` of the whole mesh's, then draws outward facing clusters
+// first so they hide the ones behind them. A higher threshold allows
+// more reordering at the cost of cache efficiency. The new order is
+// thrown away if its ACMR ends up over `threshold` times the old one,
+// false then.
+bool OptimizeOverdraw(std::vector<GLuint> &elements,
+        const std::vector<glm::vec3> &vertices, float threshold=1.05f,
+        size_t cacheSize=VERTEX_CACHE_SIZE);
+
+// Renumbers vertices in the order the elements first use them so the
+// vertex fetch reads memory front to back
+void OptimizeVertexFetch(MeshData_t &mesh);
+
+struct MeshOptimizeStats_t {
+    size_t verticesBefore;
+    size_t verticesAfter; // After welding
+    VertexCacheStats_t before; // Welded, in the original order
+    VertexCacheStats_t cacheOrder; // After OptimizeVertexCache
+    VertexCacheStats_t after;
+    bool overdrawOrder; // False if OptimizeOverdraw kept the cache order
+};
+
+// All of the above in order
+MeshOptimizeStats_t OptimizeMesh(MeshData_t &mesh);
+
+// Meshes with fewer vertices than this can be drawn with 16-bit elements
+#define SHORT_ELEMENT_LIMIT 65536
+
+// GL_UNSIGNED_SHORT when every element fits, GL_UNSIGNED_INT otherwise
+GLenum ChooseElementType(size_t numVertices);
+
+// Copies `elements` into `out` at the width of `type`
+void PackElements(const std::vector<GLuint> &elements, GLenum type,
+        std::vector<uint8_t> &out);
+
+// Cuts `mesh` into pieces of at most `maxVertices` vertices each,
+// taking triangles in their current order so a cache optimized mesh
+// stays cache optimized. Every piece gets its own vertices in the
+// order its elements first use them.
+void SplitMesh(const MeshData_t &mesh, size_t maxVertices,
+        std::vector<MeshData_t> &chunks);
+
+#endif
@@ -0,0 +1,459 @@
+#include "occlusion.h"
+#include <cmath>
+#include <cfloat>
+#include <chrono>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "util/job_system.h"
+#include "util/profiler.h"
+
+// Occluders a setup job takes
+#define OCCLUSION_SETUP_GRAIN 4
+// Tile rows a raster job takes, every job walks every triangle
+#define OCCLUSION_BAND_ROWS 4
+
+#define FULL_TILE_MASK 0xFFFFFFFFu
+
+typedef std::chrono::steady_clock Clock;
+
+static double MicrosecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(Clock::now() - start)
+            .count();
+}
+
+OcclusionCuller::OcclusionCuller(unsigned numThreads)
+{
+    m_threaded = numThreads != 1;
+    m_depth0.resize(OCCLUSION_TILES_X*OCCLUSION_TILES_Y, 1.0f);
+    m_depth1.resize(OCCLUSION_TILES_X*OCCLUSION_TILES_Y, 0.0f);
+    m_mask.resize(OCCLUSION_TILES_X*OCCLUSION_TILES_Y, 0);
+    m_viewProjection = glm::mat4(1.0f);
+}
+
+void OcclusionCuller::BeginFrame(const glm::mat4 &viewProjection)
+{
+    m_viewProjection = viewProjection;
+    m_occluders.clear();
+    std::fill(m_depth0.begin(), m_depth0.end(), 1.0f);
+    std::fill(m_depth1.begin(), m_depth1.end(), 0.0f);
+    std::fill(m_mask.begin(), m_mask.end(), 0);
+    m_stats = { 0, 0, 0, 0, 0.0, 0.0 };
+}
+
+void OcclusionCuller::AddOccluder(const OccluderMesh_t &mesh,
+        const glm::mat4 &model)
+{
+    if (mesh.elements.size() < 3) {
+        return;
+    }
+    Occluder_t occluder;
+    occluder.mesh = &mesh;
+    occluder.transform = m_viewProjection * model;
+    m_occluders.push_back(occluder);
+}
+
+void OcclusionCuller::RasterizeOccluders()
+{
+    Clock::time_point start = Clock::now();
+    m_stats.numOccluders = m_occluders.size();
+    if (m_occluders.size() > 0) {
+        if (m_triangles.size() < m_occluders.size()) {
+            m_triangles.resize(m_occluders.size());
+        }
+        ParallelFor(0, m_occluders.size(),
+                m_threaded ? OCCLUSION_SETUP_GRAIN : SIZE_MAX,
+                [this](size_t begin, size_t end) {
+                    PROFILE_SCOPE("Occluder setup");
+                    SetupTriangles(begin, end);
+                });
+        ParallelFor(0, OCCLUSION_TILES_Y,
+                m_threaded ? OCCLUSION_BAND_ROWS : SIZE_MAX,
+                [this](size_t begin, size_t end) {
+                    PROFILE_SCOPE("Occluder raster");
+                    RasterizeBand(begin, end);
+                });
+        for (size_t i=0; i<m_occluders.size(); i++) {
+            m_stats.numTriangles += m_triangles[i].size();
+        }
+    }
+    m_stats.rasterMicroseconds = MicrosecondsSince(start);
+}
+
+// Every occluder fills its own list of screen space triangles, so the
+// raster order is the same however the jobs were split
+void OcclusionCuller::SetupTriangles(size_t begin, size_t end)
+{
+    std::vector<glm::vec4> clip;
+    for (size_t o=begin; o<end; o++) {
+        std::vector<Triangle_t> &triangles = m_triangles[o];
+        triangles.clear();
+        const OccluderMesh_t &mesh = *m_occluders[o].mesh;
+        const glm::mat4 &transform = m_occluders[o].transform;
+        clip.resize(mesh.vertices.size());
+        for (size_t v=0; v<mesh.vertices.size(); v++) {
+            clip[v] = transform * glm::vec4(mesh.vertices[v], 1.0f);
+        }
+        for (size_t e=0; e+2<mesh.elements.size(); e+=3) {
+            float x[3], y[3], z[3];
+            bool clipped = false;
+            for (int k=0; k<3; k++) {
+                const glm::vec4 &c = clip[mesh.elements[e+k]];
+                // Anything crossing the near plane is left out, fewer
+                // occluders only ever means less culling
+                if (c.w <= FLT_EPSILON || c.z < -c.w) {
+                    clipped = true;
+                    break;
+                }
+                const float invW = 1.0f / c.w;
+                x[k] = (c.x*invW*0.5f + 0.5f) * OCCLUSION_WIDTH;
+                y[k] = (c.y*invW*0.5f + 0.5f) * OCCLUSION_HEIGHT;
+                z[k] = c.z*invW*0.5f + 0.5f;
+            }
+            if (clipped) {
+                continue;
+            }
+            const float det = (x[1] - x[0])*(y[2] - y[0])
+                    - (x[2] - x[0])*(y[1] - y[0]);
+            if (!(det > 0.0f)) {
+                continue; // Back facing or degenerate
+            }
+            Triangle_t tri;
+            tri.minX = std::max(std::min(x[0], std::min(x[1], x[2])), 0.0f);
+            tri.minY = std::max(std::min(y[0], std::min(y[1], y[2])), 0.0f);
+            tri.maxX = std::min(std::max(x[0], std::max(x[1], x[2])),
+                    (float)OCCLUSION_WIDTH);
+            tri.maxY = std::min(std::max(y[0], std::max(y[1], y[2])),
+                    (float)OCCLUSION_HEIGHT);
+            tri.maxDepth = std::max(z[0], std::max(z[1], z[2]));
+            if (tri.minX >= tri.maxX || tri.minY >= tri.maxY
+                    || tri.maxDepth >= 1.0f) {
+                continue;
+            }
+            for (int k=0; k<3; k++) {
+                const int j = (k + 1) % 3;
+                tri.edgeA[k] = y[k] - y[j];
+                tri.edgeB[k] = x[j] - x[k];
+                tri.edgeC[k] = -(tri.edgeA[k]*x[k] + tri.edgeB[k]*y[k]);
+            }
+            const float invDet = 1.0f / det;
+            tri.depthA = ((z[1] - z[0])*(y[2] - y[0])
+                    - (z[2] - z[0])*(y[1] - y[0])) * invDet;
+            tri.depthB = ((z[2] - z[0])*(x[1] - x[0])
+                    - (z[1] - z[0])*(x[2] - x[0])) * invDet;
+            tri.depthC = z[0] - tri.depthA*x[0] - tri.depthB*y[0];
+            triangles.push_back(tri);
+        }
+    }
+}
+
+// Each job owns a band of tile rows so no tile is ever written by two
+// threads, every job walks every triangle list
+void OcclusionCuller::RasterizeBand(int tileY0, int tileY1)
+{
+    const float bandMinY = tileY0 * OCCLUSION_TILE_HEIGHT;
+    const float bandMaxY = tileY1 * OCCLUSION_TILE_HEIGHT;
+    for (size_t l=0; l<m_occluders.size(); l++) {
+        const std::vector<Triangle_t> &triangles = m_triangles[l];
+        for (size_t t=0; t<triangles.size(); t++) {
+            if (triangles[t].maxY <= bandMinY
+                    || triangles[t].minY >= bandMaxY) {
+                continue;
+            }
+            RasterizeTriangle(triangles[t], tileY0, tileY1);
+        }
+    }
+}
+
+// One bit per pixel whose center is strictly inside all three edges,
+// bit 8*row + column
+static uint32_t TileCoverage(const float *edgeA, const float *edgeB,
+        const float *edgeC, float tileX, float tileY)
+{
+    uint32_t coverage = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 px0 = _mm_add_ps(_mm_set1_ps(tileX), offsets);
+    const __m128 px1 = _mm_add_ps(px0, _mm_set1_ps(4.0f));
+    __m128 left[3], right[3], stepY[3];
+    for (int k=0; k<3; k++) {
+        const __m128 a = _mm_set1_ps(edgeA[k]);
+        const __m128 row = _mm_set1_ps(edgeB[k]*(tileY + 0.5f) + edgeC[k]);
+        left[k] = _mm_add_ps(_mm_mul_ps(a, px0), row);
+        right[k] = _mm_add_ps(_mm_mul_ps(a, px1), row);
+        stepY[k] = _mm_set1_ps(edgeB[k]);
+    }
+    for (int r=0; r<OCCLUSION_TILE_HEIGHT; r++) {
+        __m128 inLeft = _mm_and_ps(_mm_cmpgt_ps(left[0], zero),
+                _mm_and_ps(_mm_cmpgt_ps(left[1], zero),
+                    _mm_cmpgt_ps(left[2], zero)));
+        __m128 inRight = _mm_and_ps(_mm_cmpgt_ps(right[0], zero),
+                _mm_and_ps(_mm_cmpgt_ps(right[1], zero),
+                    _mm_cmpgt_ps(right[2], zero)));
+        const uint32_t bits = _mm_movemask_ps(inLeft)
+                | (_mm_movemask_ps(inRight) << 4);
+        coverage |= bits << (r*OCCLUSION_TILE_WIDTH);
+        for (int k=0; k<3; k++) {
+            left[k] = _mm_add_ps(left[k], stepY[k]);
+            right[k] = _mm_add_ps(right[k], stepY[k]);
+        }
+    }
+#else
+    for (int r=0; r<OCCLUSION_TILE_HEIGHT; r++) {
+        const float py = tileY + r + 0.5f;
+        for (int c=0; c<OCCLUSION_TILE_WIDTH; c++) {
+            const float px = tileX + c + 0.5f;
+            bool inside = true;
+            for (int k=0; k<3 && inside; k++) {
+                inside = edgeA[k]*px + edgeB[k]*py + edgeC[k] > 0.0f;
+            }
+            if (inside) {
+                coverage |= 1u << (r*OCCLUSION_TILE_WIDTH + c);
+            }
+        }
+    }
+#endif
+    return coverage;
+}
+
+void OcclusionCuller::RasterizeTriangle(const Triangle_t &tri, int tileY0,
+        int tileY1)
+{
+    const int tx0 = (int)tri.minX / OCCLUSION_TILE_WIDTH;
+    const int tx1 = std::min((int)std::ceil(tri.maxX) - 1,
+            OCCLUSION_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+    const int ty0 = std::max((int)tri.minY / OCCLUSION_TILE_HEIGHT, tileY0);
+    const int ty1 = std::min(std::min((int)std::ceil(tri.maxY) - 1,
+            OCCLUSION_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT, tileY1 - 1);
+    for (int ty=ty0; ty<=ty1; ty++) {
+        const float tileY = (float)(ty*OCCLUSION_TILE_HEIGHT);
+        // Depth is linear over the triangle, so its farthest point in
+        // the part of the tile the triangle's bounds cover is a corner
+        const float y0 = std::max(tileY, tri.minY);
+        const float y1 = std::min(tileY + OCCLUSION_TILE_HEIGHT, tri.maxY);
+        for (int tx=tx0; tx<=tx1; tx++) {
+            const float tileX = (float)(tx*OCCLUSION_TILE_WIDTH);
+            const uint32_t coverage = TileCoverage(tri.edgeA, tri.edgeB,
+                    tri.edgeC, tileX, tileY);
+            if (coverage == 0) {
+                continue;
+            }
+            const float x0 = std::max(tileX, tri.minX);
+            const float x1 = std::min(tileX + OCCLUSION_TILE_WIDTH, tri.maxX);
+            const float dx = tri.depthA * (tri.depthA > 0.0f ? x1 : x0);
+            const float dy = tri.depthB * (tri.depthB > 0.0f ? y1 : y0);
+            const float depth = std::min(dx + dy + tri.depthC, tri.maxDepth);
+            UpdateTile(ty*OCCLUSION_TILES_X + tx, coverage, depth);
+        }
+    }
+}
+
+void OcclusionCuller::UpdateTile(int tile, uint32_t coverage, float depth)
+{
+    if (depth >= m_depth0[tile]) {
+        return; // Behind everything already in the tile
+    }
+    float &depth1 = m_depth1[tile];
+    uint32_t &mask = m_mask[tile];
+    // A triangle much nearer than the working layer starts it over,
+    // merging would push the layer's depth too far back to be useful
+    if (depth1 - depth > m_depth0[tile] - depth1) {
+        depth1 = 0.0f;
+        mask = 0;
+    }
+    depth1 = std::max(depth1, depth);
+    mask |= coverage;
+    if (mask == FULL_TILE_MASK) {
+        m_depth0[tile] = std::min(m_depth0[tile], depth1);
+        depth1 = 0.0f;
+        mask = 0;
+    }
+}
+
+bool OcclusionCuller::TestBox(const BoundingBox_t &box) const
+{
+    float minX, minY, minZ, maxX, maxY;
+#if defined(__SSE2__)
+    const glm::mat4 &m = m_viewProjection;
+    const __m128 xs = _mm_setr_ps(box.min.x, box.max.x, box.min.x, box.max.x);
+    const __m128 ys = _mm_setr_ps(box.min.y, box.min.y, box.max.y, box.max.y);
+    __m128 lo = _mm_set1_ps(FLT_MAX);
+    __m128 hiX = _mm_set1_ps(-FLT_MAX);
+    __m128 hiY = hiX;
+    __m128 loX = lo;
+    __m128 loY = lo;
+    __m128 loZ = lo;
+    for (int h=0; h<2; h++) {
+        const __m128 zs = _mm_set1_ps(h == 0 ? box.min.z : box.max.z);
+        __m128 clip[4];
+        for (int row=0; row<4; row++) {
+            clip[row] = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(xs, _mm_set1_ps(m[0][row])),
+                        _mm_mul_ps(ys, _mm_set1_ps(m[1][row]))),
+                    _mm_add_ps(_mm_mul_ps(zs, _mm_set1_ps(m[2][row])),
+                        _mm_set1_ps(m[3][row])));
+        }
+        // A box reaching past the near plane can't be projected
+        const __m128 nearW = _mm_cmple_ps(clip[3], _mm_set1_ps(FLT_EPSILON));
+        const __m128 nearZ = _mm_cmplt_ps(clip[2],
+                _mm_sub_ps(_mm_setzero_ps(), clip[3]));
+        if (_mm_movemask_ps(_mm_or_ps(nearW, nearZ)) != 0) {
+            return true;
+        }
+        const __m128 invW = _mm_div_ps(_mm_set1_ps(1.0f), clip[3]);
+        const __m128 ndcX = _mm_mul_ps(clip[0], invW);
+        const __m128 ndcY = _mm_mul_ps(clip[1], invW);
+        loX = _mm_min_ps(loX, ndcX);
+        hiX = _mm_max_ps(hiX, ndcX);
+        loY = _mm_min_ps(loY, ndcY);
+        hiY = _mm_max_ps(hiY, ndcY);
+        loZ = _mm_min_ps(loZ, _mm_mul_ps(clip[2], invW));
+    }
+    float lanes[5][4];
+    _mm_storeu_ps(lanes[0], loX);
+    _mm_storeu_ps(lanes[1], loY);
+    _mm_storeu_ps(lanes[2], loZ);
+    _mm_storeu_ps(lanes[3], hiX);
+    _mm_storeu_ps(lanes[4], hiY);
+    minX = std::min(std::min(lanes[0][0], lanes[0][1]),
+            std::min(lanes[0][2], lanes[0][3]));
+    minY = std::min(std::min(lanes[1][0], lanes[1][1]),
+            std::min(lanes[1][2], lanes[1][3]));
+    minZ = std::min(std::min(lanes[2][0], lanes[2][1]),
+            std::min(lanes[2][2], lanes[2][3]));
+    maxX = std::max(std::max(lanes[3][0], lanes[3][1]),
+            std::max(lanes[3][2], lanes[3][3]));
+    maxY = std::max(std::max(lanes[4][0], lanes[4][1]),
+            std::max(lanes[4][2], lanes[4][3]));
+#else
+    minX = minY = minZ = FLT_MAX;
+    maxX = maxY = -FLT_MAX;
+    for (int c=0; c<8; c++) {
+        glm::vec4 corner((c & 1) ? box.max.x : box.min.x,
+                (c & 2) ? box.max.y : box.min.y,
+                (c & 4) ? box.max.z : box.min.z, 1.0f);
+        glm::vec4 clip = m_viewProjection * corner;
+        if (clip.w <= FLT_EPSILON || clip.z < -clip.w) {
+            return true;
+        }
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        minX = std::min(minX, ndc.x);
+        minY = std::min(minY, ndc.y);
+        minZ = std::min(minZ, ndc.z);
+        maxX = std::max(maxX, ndc.x);
+        maxY = std::max(maxY, ndc.y);
+    }
+#endif
+    // Every pixel the box touches, not just the ones whose center it
+    // covers
+    const int px0 = std::max((int)std::floor((minX*0.5f + 0.5f)
+            * OCCLUSION_WIDTH), 0);
+    const int px1 = std::min((int)std::ceil((maxX*0.5f + 0.5f)
+            * OCCLUSION_WIDTH) - 1, OCCLUSION_WIDTH - 1);
+    const int py0 = std::max((int)std::floor((minY*0.5f + 0.5f)
+            * OCCLUSION_HEIGHT), 0);
+    const int py1 = std::min((int)std::ceil((maxY*0.5f + 0.5f)
+            * OCCLUSION_HEIGHT) - 1, OCCLUSION_HEIGHT - 1);
+    if (px0 > px1 || py0 > py1) {
+        return true; // Off screen, that's for frustum culling to decide
+    }
+    const float depth = minZ*0.5f + 0.5f;
+
+    const int tx0 = px0 / OCCLUSION_TILE_WIDTH;
+    const int tx1 = px1 / OCCLUSION_TILE_WIDTH;
+    const int ty0 = py0 / OCCLUSION_TILE_HEIGHT;
+    const int ty1 = py1 / OCCLUSION_TILE_HEIGHT;
+    for (int ty=ty0; ty<=ty1; ty++) {
+        uint32_t rowBits = 0;
+        for (int r=0; r<OCCLUSION_TILE_HEIGHT; r++) {
+            const int py = ty*OCCLUSION_TILE_HEIGHT + r;
+            if (py >= py0 && py <= py1) {
+                rowBits |= 1u << r;
+            }
+        }
+        const float *depth0 = &m_depth0[ty*OCCLUSION_TILES_X];
+        int tx = tx0;
+        while (tx <= tx1) {
+            // Tiles the query is behind of in the first layer need no
+            // further look, check four at a time
+            uint32_t hidden = 0;
+            int lanes = std::min(tx1 - tx + 1, 4);
+#if defined(__SSE2__)
+            if (lanes == 4) {
+                hidden = _mm_movemask_ps(_mm_cmpgt_ps(_mm_set1_ps(depth),
+                        _mm_loadu_ps(depth0 + tx)));
+            } else
+#endif
+            {
+                for (int i=0; i<lanes; i++) {
+                    hidden |= (depth > depth0[tx + i]) << i;
+                }
+            }
+            for (int i=0; i<lanes; i++, tx++) {
+                if (hidden & (1u << i)) {
+                    continue;
+                }
+                const int lo = std::max(px0 - tx*OCCLUSION_TILE_WIDTH, 0);
+                const int hi = std::min(px1 - tx*OCCLUSION_TILE_WIDTH,
+                        OCCLUSION_TILE_WIDTH - 1);
+                const uint32_t colBits = (0xFFu >> (7 - hi)) & (0xFFu << lo);
+                uint32_t rect = 0;
+                for (int r=0; r<OCCLUSION_TILE_HEIGHT; r++) {
+                    if (rowBits & (1u << r)) {
+                        rect |= colBits << (r*OCCLUSION_TILE_WIDTH);
+                    }
+                }
+                const int tile = ty*OCCLUSION_TILES_X + tx;
+                if ((rect & ~m_mask[tile]) == 0 && depth > m_depth1[tile]) {
+                    continue; // Behind the working layer
+                }
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+size_t OcclusionCuller::CullOccluded(const BoundsSoA &bounds,
+        std::vector<uint32_t> &visible)
+{
+    Clock::time_point start = Clock::now();
+    size_t kept = 0;
+    for (size_t i=0; i<visible.size(); i++) {
+        if (TestBox(bounds.GetBox(visible[i]))) {
+            visible[kept++] = visible[i];
+        }
+    }
+    const size_t culled = visible.size() - kept;
+    visible.resize(kept);
+    m_stats.numTested += kept + culled;
+    m_stats.numOccluded += culled;
+    m_stats.testMicroseconds += MicrosecondsSince(start);
+    return culled;
+}
+
+const OcclusionStats_t& OcclusionCuller::GetStats() const
+{
+    return m_stats;
+}
+
+void OcclusionCuller::ResolveDepth(std::vector<float> &depth) const
+{
+    depth.resize(OCCLUSION_WIDTH*OCCLUSION_HEIGHT);
+    for (int y=0; y<OCCLUSION_HEIGHT; y++) {
+        for (int x=0; x<OCCLUSION_WIDTH; x++) {
+            const int tile = (y / OCCLUSION_TILE_HEIGHT)*OCCLUSION_TILES_X
+                    + x / OCCLUSION_TILE_WIDTH;
+            const int bit = (y % OCCLUSION_TILE_HEIGHT)*OCCLUSION_TILE_WIDTH
+                    + x % OCCLUSION_TILE_WIDTH;
+            float d = m_depth0[tile];
+            if (m_mask[tile] & (1u << bit)) {
+                d = std::min(d, m_depth1[tile]);
+            }
+            depth[y*OCCLUSION_WIDTH + x] = d;
+        }
+    }
+}
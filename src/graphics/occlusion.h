@@ -0,0 +1,118 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include "graphics/frustum.h"
+
+// Resolution of the occlusion buffer, it always covers the whole
+// viewport whatever the window's aspect ratio
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+// One coverage bit per pixel of a tile
+#define OCCLUSION_TILE_WIDTH 8
+#define OCCLUSION_TILE_HEIGHT 4
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH)
+#define OCCLUSION_TILES_Y (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT)
+
+struct OcclusionStats_t {
+    size_t numOccluders;
+    size_t numTriangles; // Occluder triangles that reached the rasterizer
+    size_t numTested;
+    size_t numOccluded;
+    double rasterMicroseconds;
+    double testMicroseconds;
+};
+
+// Positions and triangles of an occluder, usually a coarse LOD
+struct OccluderMesh_t {
+    std::vector<glm::vec3> vertices;
+    std::vector<GLuint> elements;
+};
+
+class OcclusionCuller
+{
+    // Masked software occlusion culling (Hasselgren, Andersson &
+    // Akenine-Moller 2016). Instead of a depth per pixel every 8x4
+    // tile keeps a depth all of its pixels are known to be nearer
+    // than, plus a working layer with a coverage mask and its own
+    // depth that replaces the first once the mask fills up. Depth is
+    // NDC z scaled to [0, 1] with 0 nearest, and only ever rounded
+    // away from the camera, so nothing that might be visible is
+    // culled except where occluders are coarser than what is drawn.
+public:
+    // 1 thread keeps the work on the calling thread, anything else
+    // shares it out on the job system
+    OcclusionCuller(unsigned numThreads=0);
+
+    // Clears the buffer and sets the world to clip space transform
+    void BeginFrame(const glm::mat4 &viewProjection);
+
+    // Queues `mesh` transformed by `model` to be drawn into the
+    // buffer. It must stay alive until RasterizeOccluders returns.
+    void AddOccluder(const OccluderMesh_t &mesh, const glm::mat4 &model);
+
+    // Draws every queued occluder, the screen is split into bands of
+    // tile rows that are rasterized in parallel
+    void RasterizeOccluders();
+
+    // False if `box` (world space) is certainly hidden
+    bool TestBox(const BoundingBox_t &box) const;
+
+    // Removes every box in `bounds` that `visible` refers to and is
+    // hidden, keeping the order of the rest. Returns how many went.
+    size_t CullOccluded(const BoundsSoA &bounds,
+            std::vector<uint32_t> &visible);
+
+    const OcclusionStats_t& GetStats() const;
+
+    // Nearest depth each pixel is known to be behind, for debugging
+    void ResolveDepth(std::vector<float> &depth) const;
+
+    // Copies are not allowed
+    OcclusionCuller(const OcclusionCuller &) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller &) = delete;
+
+private:
+    // Screen space edge and depth plane equations, a*x + b*y + c
+    struct Triangle_t {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        float maxDepth;
+        float minX, minY, maxX, maxY; // Pixel bounds, clamped to screen
+    };
+
+    struct Occluder_t {
+        const OccluderMesh_t *mesh;
+        glm::mat4 transform; // Model to clip space
+    };
+
+    // Transforms and sets up the triangles of occluders [begin, end)
+    void SetupTriangles(size_t begin, size_t end);
+
+    void RasterizeBand(int tileY0, int tileY1);
+
+    void RasterizeTriangle(const Triangle_t &tri, int tileY0, int tileY1);
+
+    void UpdateTile(int tile, uint32_t coverage, float depth);
+
+    bool m_threaded = true;
+
+    glm::mat4 m_viewProjection;
+
+    std::vector<Occluder_t> m_occluders;
+
+    // Set up triangles, one list per occluder
+    std::vector<std::vector<Triangle_t>> m_triangles;
+
+    // Per tile, see the class comment
+    std::vector<float> m_depth0;
+    std::vector<float> m_depth1;
+    std::vector<uint32_t> m_mask;
+
+    OcclusionStats_t m_stats = { 0, 0, 0, 0, 0.0, 0.0 };
+};
+
+#endif
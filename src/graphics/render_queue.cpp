@@ -0,0 +1,177 @@
+#include "render_queue.h"
+#include <cstring>
+
+#define KEY_PASS_BITS 2
+#define KEY_PROGRAM_BITS 8
+#define KEY_FORMAT_BITS 2
+#define KEY_MATERIAL_BITS 14
+#define KEY_TEXTURE_BITS 14
+#define KEY_DEPTH_BITS 24
+
+#define KEY_MASK(bits) ((((uint64_t)1) << (bits)) - 1)
+
+// Both layouts put the pass first so opaque draws always come first
+#define KEY_PASS_SHIFT (64 - KEY_PASS_BITS)
+// Opaque layout
+#define KEY_PROGRAM_SHIFT (KEY_PASS_SHIFT - KEY_PROGRAM_BITS)
+#define KEY_FORMAT_SHIFT (KEY_PROGRAM_SHIFT - KEY_FORMAT_BITS)
+#define KEY_MATERIAL_SHIFT (KEY_FORMAT_SHIFT - KEY_MATERIAL_BITS)
+#define KEY_TEXTURE_SHIFT (KEY_MATERIAL_SHIFT - KEY_TEXTURE_BITS)
+#define KEY_DEPTH_SHIFT (KEY_TEXTURE_SHIFT - KEY_DEPTH_BITS)
+// Blended layout, depth moves up behind the pass and everything
+// else shifts down by the width of the depth field
+#define KEY_BLENDED_DEPTH_SHIFT (KEY_PASS_SHIFT - KEY_DEPTH_BITS)
+#define KEY_BLENDED_OFFSET KEY_DEPTH_BITS
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+static uint64_t QuantizeDepth(float depth)
+{
+    if (!(depth > 0.0f)) { // Also catches NaN
+        return 0;
+    }
+    if (depth >= 1.0f) {
+        return KEY_MASK(KEY_DEPTH_BITS);
+    }
+    return (uint64_t)(depth * (float)KEY_MASK(KEY_DEPTH_BITS));
+}
+
+uint64_t EncodeDrawKey(const DrawKeyFields_t &fields)
+{
+    uint64_t state = 0;
+    state |= (fields.program & KEY_MASK(KEY_PROGRAM_BITS)) << KEY_PROGRAM_SHIFT;
+    state |= (fields.format & KEY_MASK(KEY_FORMAT_BITS)) << KEY_FORMAT_SHIFT;
+    state |= (fields.material & KEY_MASK(KEY_MATERIAL_BITS))
+            << KEY_MATERIAL_SHIFT;
+    state |= (fields.texture & KEY_MASK(KEY_TEXTURE_BITS)) << KEY_TEXTURE_SHIFT;
+
+    uint64_t key = (fields.pass & KEY_MASK(KEY_PASS_BITS)) << KEY_PASS_SHIFT;
+    uint64_t depth = QuantizeDepth(fields.depth);
+    if (fields.pass == RENDER_PASS_BLENDED) {
+        // Farthest first
+        key |= (KEY_MASK(KEY_DEPTH_BITS) - depth) << KEY_BLENDED_DEPTH_SHIFT;
+        key |= state >> KEY_BLENDED_OFFSET;
+    } else {
+        key |= state;
+        key |= depth << KEY_DEPTH_SHIFT;
+    }
+    return key;
+}
+
+DrawKeyFields_t DecodeDrawKey(uint64_t key)
+{
+    DrawKeyFields_t fields;
+    fields.pass = (key >> KEY_PASS_SHIFT) & KEY_MASK(KEY_PASS_BITS);
+    uint64_t depth;
+    if (fields.pass == RENDER_PASS_BLENDED) {
+        depth = KEY_MASK(KEY_DEPTH_BITS)
+                - ((key >> KEY_BLENDED_DEPTH_SHIFT) & KEY_MASK(KEY_DEPTH_BITS));
+        key <<= KEY_BLENDED_OFFSET;
+    } else {
+        depth = (key >> KEY_DEPTH_SHIFT) & KEY_MASK(KEY_DEPTH_BITS);
+    }
+    fields.program = (key >> KEY_PROGRAM_SHIFT) & KEY_MASK(KEY_PROGRAM_BITS);
+    fields.format = (key >> KEY_FORMAT_SHIFT) & KEY_MASK(KEY_FORMAT_BITS);
+    fields.material = (key >> KEY_MATERIAL_SHIFT) & KEY_MASK(KEY_MATERIAL_BITS);
+    fields.texture = (key >> KEY_TEXTURE_SHIFT) & KEY_MASK(KEY_TEXTURE_BITS);
+    fields.depth = (float)depth / (float)KEY_MASK(KEY_DEPTH_BITS);
+    return fields;
+}
+
+void RenderQueue::Clear()
+{
+    m_items.clear();
+}
+
+void RenderQueue::Push(uint64_t key, uint32_t draw)
+{
+    RenderQueueItem_t item;
+    item.key = key;
+    item.draw = draw;
+    m_items.push_back(item);
+}
+
+size_t RenderQueue::CountStateChanges(
+        const std::vector<RenderQueueItem_t> &items)
+{
+    size_t changes = 0;
+    DrawKeyFields_t prev;
+    for (size_t i=0; i<items.size(); i++) {
+        DrawKeyFields_t curr = DecodeDrawKey(items[i].key);
+        if (i == 0) {
+            changes += 5; // Every field is bound for the first draw
+        } else {
+            changes += (curr.pass != prev.pass);
+            changes += (curr.program != prev.program);
+            changes += (curr.format != prev.format);
+            changes += (curr.material != prev.material);
+            changes += (curr.texture != prev.texture);
+        }
+        prev = curr;
+    }
+    return changes;
+}
+
+// Least significant byte first, a counting sort per byte. Bytes that
+// are the same in every key are skipped, with few materials most of
+// the upper bytes are.
+void RenderQueue::Sort()
+{
+    m_stats.numDraws = m_items.size();
+    m_stats.stateChangesUnsorted = CountStateChanges(m_items);
+
+    const size_t n = m_items.size();
+    if (n > 1) {
+        size_t counts[8][RADIX_BUCKETS];
+        memset(counts, 0, sizeof(counts));
+        for (size_t i=0; i<n; i++) {
+            uint64_t key = m_items[i].key;
+            for (int pass=0; pass<8; pass++) {
+                counts[pass][(key >> (pass*RADIX_BITS)) & (RADIX_BUCKETS-1)]++;
+            }
+        }
+        m_scratch.resize(n);
+        RenderQueueItem_t *src = &m_items[0];
+        RenderQueueItem_t *dst = &m_scratch[0];
+        for (int pass=0; pass<8; pass++) {
+            size_t *count = counts[pass];
+            const int shift = pass*RADIX_BITS;
+            if (count[(src[0].key >> shift) & (RADIX_BUCKETS-1)] == n) {
+                continue;
+            }
+            size_t offset = 0;
+            for (int b=0; b<RADIX_BUCKETS; b++) {
+                size_t c = count[b];
+                count[b] = offset;
+                offset += c;
+            }
+            for (size_t i=0; i<n; i++) {
+                dst[count[(src[i].key >> shift) & (RADIX_BUCKETS-1)]++] = src[i];
+            }
+            RenderQueueItem_t *tmp = src;
+            src = dst;
+            dst = tmp;
+        }
+        if (src != &m_items[0]) {
+            m_items.swap(m_scratch);
+        }
+    }
+
+    m_stats.stateChangesSorted = CountStateChanges(m_items);
+}
+
+size_t RenderQueue::GetSize() const
+{
+    return m_items.size();
+}
+
+const RenderQueueItem_t& RenderQueue::operator[](size_t i) const
+{
+    return m_items[i];
+}
+
+const RenderQueueStats_t& RenderQueue::GetStats() const
+{
+    return m_stats;
+}
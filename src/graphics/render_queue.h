@@ -0,0 +1,78 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Passes are drawn in this order
+enum RenderPass_t {
+    RENDER_PASS_OPAQUE = 0,  // Front to back, lets early-z reject
+    RENDER_PASS_BLENDED = 1, // Back to front, no depth writes
+    RENDER_PASS_COUNT
+};
+
+// Everything a draw needs bound. Values wider than their field in
+// the key are masked, they only have to tell draws apart.
+struct DrawKeyFields_t {
+    uint32_t pass;
+    uint32_t program;
+    uint32_t format;
+    uint32_t material;
+    uint32_t texture;
+    float depth; // 0 at the camera, 1 at the far plane
+};
+
+// 64 bit keys, most significant field first
+// opaque:  pass:2 program:8 format:2 material:14 texture:14 depth:24
+// blended: pass:2 ~depth:24 program:8 format:2 material:14 texture:14
+uint64_t EncodeDrawKey(const DrawKeyFields_t &fields);
+
+DrawKeyFields_t DecodeDrawKey(uint64_t key);
+
+static inline uint32_t GetDrawKeyPass(uint64_t key)
+{
+    return (uint32_t)(key >> 62);
+}
+
+struct RenderQueueItem_t {
+    uint64_t key;
+    uint32_t draw; // Caller's index of the draw record
+};
+
+struct RenderQueueStats_t {
+    size_t numDraws;
+    size_t stateChangesUnsorted; // Counted in submission order
+    size_t stateChangesSorted;
+};
+
+class RenderQueue
+{
+    // Collects one key per visible draw each frame and orders them
+    // with an LSD radix sort so that draws sharing state end up next
+    // to each other.
+public:
+    void Clear();
+
+    void Push(uint64_t key, uint32_t draw);
+
+    void Sort();
+
+    size_t GetSize() const;
+
+    const RenderQueueItem_t& operator[](size_t i) const;
+
+    const RenderQueueStats_t& GetStats() const;
+
+    // Number of pass/program/format/material/texture changes needed
+    // to submit `items` in order
+    static size_t CountStateChanges(const std::vector<RenderQueueItem_t> &items);
+
+private:
+    std::vector<RenderQueueItem_t> m_items;
+
+    std::vector<RenderQueueItem_t> m_scratch;
+
+    RenderQueueStats_t m_stats = { 0, 0, 0 };
+};
+
+#endif
@@ -4,37 +4,40 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include "graphics/glutil.h"
-#include "util/file.h"
+#include "graphics/mesh.h"
+#include "graphics/instance_buffer.h"
+#include "graphics/light_textures.h"
+#include "util/archive.h"
+#include "util/counters.h"
+#include "util/profiler.h"
+
+// Program currently in use, glUseProgram is skipped when it wouldn't
+// change anything
+static GLuint currentProgram = 0;
+
+static void UseProgramObject(GLuint program)
+{
+    if (program == currentProgram) {
+        return;
+    }
+    glUseProgram(program);
+    currentProgram = program;
+    if (program != 0) {
+        CounterAdd(COUNTER_PROGRAM_BINDS);
+    }
+}
 
 ShaderProgram::ShaderProgram(const char *name)
 {
     m_name = name;
-    m_numElements = 0;
     m_modelMatrix = glm::mat4(1.0f);
     m_viewMatrix = glm::mat4(1.0f);
     m_projectionMatrix = glm::mat4(1.0f);
     m_program = 0;
-    m_vertexBuffer = 0;
-    m_normalBuffer = 0;
-    m_uvBuffer = 0;
-    m_elementBuffer = 0;
     memset((void *)&m_material, 0, sizeof(ShaderMaterial_t));
     //m_lights.reset();
 }
 
-// GL_STATIC_DRAW:  the data will most likely not change at
-//                  all or very rarely.
-// GL_DYNAMIC_DRAW: the data is likely to change a lot.
-// GL_STREAM_DRAW:  the data will change every time it is drawn.
-GLuint ShaderProgram::CreateBuffer(GLenum type, void *data, GLsizei size, GLenum storageHint)
-{
-    GLuint buffer;
-    glGenBuffersARB(1, &buffer);
-    glBindBufferARB(type, buffer);
-    glBufferDataARB(type, size, data, storageHint);
-    return buffer;
-}
-
 void ShaderProgram::SetLight(const std::string &name, ShaderLight_t &light)
 {
     GLint locationInShader = glGetUniformLocationARB(m_program, "lights[0].type");
@@ -49,7 +52,7 @@ void ShaderProgram::SetLight(const std::string &name, ShaderLight_t &light)
         Warning("No light '%s' was inserted", name.c_str());
         return;
     }
-    BindVAO();
+    Use();
     int i = 0;
     std::string currVarPrefix;
     std::string currVar;
@@ -79,55 +82,6 @@ void ShaderProgram::SetLight(const std::string &name, ShaderLight_t &light)
         SetUniformInt(currVar, it->second.type);
     }
     SetUniformInt("numLights", (GLint)m_lights.size());
-    UnbindVAO();
-}
-
-void ShaderProgram::SetVertexBuffer(void *data, GLsizei size, GLenum storageHint)
-{
-    glDeleteBuffers(1, &m_vertexBuffer);
-    m_vertexBuffer = CreateBuffer(GL_ARRAY_BUFFER, data, size, storageHint);
-    BindVAO();
-    // facetVertex
-    GLint locationInShader = glGetAttribLocationARB(m_program, "facetVertex");
-    if (locationInShader > -1) {
-        glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-        glVertexAttribPointerARB(locationInShader, 3, GL_FLOAT, GL_FALSE,
-                sizeof(GLfloat)*3, (void *)0);
-        glEnableVertexAttribArrayARB(locationInShader);
-    }
-    UnbindVAO();
-}
-
-void ShaderProgram::SetNormalBuffer(void *data, GLsizei size, GLenum storageHint)
-{
-    glDeleteBuffers(1, &m_normalBuffer);
-    m_normalBuffer = CreateBuffer(GL_ARRAY_BUFFER, data, size, storageHint);
-    BindVAO();
-    // facetNormal
-    GLint locationInShader = glGetAttribLocationARB(m_program, "facetNormal");
-    if (locationInShader > -1) {
-        glBindBuffer(GL_ARRAY_BUFFER, m_normalBuffer);
-        glVertexAttribPointerARB(locationInShader, 3, GL_FLOAT, GL_FALSE,
-                sizeof(GLfloat)*3, (void *)0);
-        glEnableVertexAttribArrayARB(locationInShader);
-    }
-    UnbindVAO();
-}
-
-void ShaderProgram::SetUVBuffer(void *data, GLsizei size, GLenum storageHint)
-{
-    glDeleteBuffers(1, &m_uvBuffer);
-    m_uvBuffer = CreateBuffer(GL_ARRAY_BUFFER, data, size, storageHint);
-    BindVAO();
-    // facetUV
-    GLint locationInShader = glGetAttribLocationARB(m_program, "facetUV");
-    if (locationInShader > -1) {
-        glBindBuffer(GL_ARRAY_BUFFER, m_uvBuffer);
-        glVertexAttribPointerARB(locationInShader, 2, GL_FLOAT, GL_FALSE,
-                sizeof(GLfloat)*2, (void *)0);
-        glEnableVertexAttribArrayARB(locationInShader);
-    }
-    UnbindVAO();
 }
 
 void ShaderProgram::SetShininess(GLfloat shininess)
@@ -135,35 +89,46 @@ void ShaderProgram::SetShininess(GLfloat shininess)
     m_material.shininess = shininess;
 }
 
-void ShaderProgram::SetElementBuffer(int num, void *data, GLsizei size,
-        GLenum storageHint)
-{
-    glDeleteBuffers(1, &m_elementBuffer);
-    m_numElements = num;
-    m_elementBuffer = CreateBuffer(GL_ELEMENT_ARRAY_BUFFER, data, size,
-            storageHint);
-    BindVAO();
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_elementBuffer);
-    UnbindVAO();
-}
-
 void ShaderProgram::SetViewMatrix(const glm::mat4 &view, const glm::vec3 &camPos)
 {
     m_viewMatrix = view;
     m_cameraPosition = camPos;
-    BindVAO();
+    Use();
     SetUniformMat4("view", m_viewMatrix);
     SetUniformVec3("cameraPosition", m_cameraPosition);
-    UnbindVAO();
 }
 
-void ShaderProgram::SetUniformFloat(const std::string &varName, GLfloat f)
+void ShaderProgram::SetViewMatrix(const glm::mat4 &view)
 {
+    m_viewMatrix = view;
+    Use();
+    SetUniformMat4("view", m_viewMatrix);
+}
+
+// Uniform locations don't change after linking, looking them up
+// once keeps per draw uniform updates cheap. Missing uniforms are
+// only reported the first time.
+GLint ShaderProgram::GetUniformLocation(const std::string &varName,
+        const char *typeName)
+{
+    auto it = m_uniformLocations.find(varName);
+    if (it != m_uniformLocations.end()) {
+        return it->second;
+    }
     GLint locationInShader = glGetUniformLocationARB(m_program,
             varName.c_str());
     if (locationInShader < 0) {
-        Warning("Could not find GLfloat uniform '%s' in shader '%s'", varName.c_str(),
-                m_name.c_str());
+        Warning("Could not find %s uniform '%s' in shader '%s'", typeName,
+                varName.c_str(), m_name.c_str());
+    }
+    m_uniformLocations.emplace(varName, locationInShader);
+    return locationInShader;
+}
+
+void ShaderProgram::SetUniformFloat(const std::string &varName, GLfloat f)
+{
+    GLint locationInShader = GetUniformLocation(varName, "GLfloat");
+    if (locationInShader < 0) {
         return;
     }
     glUniform1f(locationInShader, f);
@@ -171,23 +136,27 @@ void ShaderProgram::SetUniformFloat(const std::string &varName, GLfloat f)
 
 void ShaderProgram::SetUniformUInt(const std::string &varName, GLuint u)
 {
-    GLint locationInShader = glGetUniformLocationARB(m_program,
-            varName.c_str());
+    GLint locationInShader = GetUniformLocation(varName, "GLuint");
     if (locationInShader < 0) {
-        Warning("Could not find GLuint uniform '%s' in shader '%s'", varName.c_str(),
-                m_name.c_str());
         return;
     }
     glUniform1ui(locationInShader, u);
 }
 
+void ShaderProgram::SetUniformVec2(const std::string &varName,
+        const glm::vec2 &v)
+{
+    GLint locationInShader = GetUniformLocation(varName, "vec2");
+    if (locationInShader < 0) {
+        return;
+    }
+    glUniform2fv(locationInShader, 1, glm::value_ptr(v));
+}
+
 void ShaderProgram::SetUniformVec3(const std::string &varName, glm::vec3 &v)
 {
-    GLint locationInShader = glGetUniformLocationARB(m_program,
-            varName.c_str());
+    GLint locationInShader = GetUniformLocation(varName, "vec3");
     if (locationInShader < 0) {
-        Warning("Could not find vec3 uniform '%s' in shader '%s'", varName.c_str(),
-                m_name.c_str());
         return;
     }
     glUniform3fv(locationInShader, 1, glm::value_ptr(v));
@@ -195,11 +164,8 @@ void ShaderProgram::SetUniformVec3(const std::string &varName, glm::vec3 &v)
 
 void ShaderProgram::SetUniformInt(const std::string &varName, GLint i)
 {
-    GLint locationInShader = glGetUniformLocationARB(m_program,
-            varName.c_str());
+    GLint locationInShader = GetUniformLocation(varName, "GLint");
     if (locationInShader < 0) {
-        Warning("Could not find GLint uniform '%s' in shader '%s'", varName.c_str(),
-                m_name.c_str());
         return;
     }
     glUniform1i(locationInShader, i);
@@ -208,11 +174,8 @@ void ShaderProgram::SetUniformInt(const std::string &varName, GLint i)
 
 void ShaderProgram::SetUniformMat4(const std::string &varName, glm::mat4 &mat)
 {
-    GLint locationInShader = glGetUniformLocationARB(m_program,
-            varName.c_str());
+    GLint locationInShader = GetUniformLocation(varName, "mat4");
     if (locationInShader < 0) {
-        Warning("Could not find mat4 uniform '%s' in shader '%s'",
-                varName.c_str(), m_name.c_str());
         return;
     }
     glUniformMatrix4fv(locationInShader, 1, GL_FALSE, glm::value_ptr(mat));
@@ -221,15 +184,17 @@ void ShaderProgram::SetUniformMat4(const std::string &varName, glm::mat4 &mat)
 void ShaderProgram::SetMaterial(ShaderMaterial_t &material)
 {
     m_material = material;
-    BindVAO();
+    Use();
+    // Samplers take the texture unit, not the texture name
     // GLint diffuseSampler; // TEXTURE0
-    SetUniformUInt("material.diffuseSampler", material.diffuseSampler);
+    SetUniformInt("material.diffuseSampler", 0);
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, m_material.diffuseSampler);
     // GLint specularSampler; // TEXTURE1
-    SetUniformUInt("material.specularSampler", material.specularSampler);
+    SetUniformInt("material.specularSampler", 1);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, m_material.specularSampler);
+    CounterAdd(COUNTER_TEXTURE_BINDS, 2);
     // glm::vec3 ambient;
     SetUniformVec3("material.ambient", material.ambient);
     // glm::vec3 diffuse;
@@ -238,48 +203,88 @@ void ShaderProgram::SetMaterial(ShaderMaterial_t &material)
     SetUniformVec3("material.specular", material.specular);
     // GLfloat shininess;
     SetUniformFloat("material.shininess", material.shininess);
+    // GLfloat opacity;
+    SetUniformFloat("material.opacity", material.opacity);
     // GLint type;
     SetUniformInt("material.type", material.type);
-    UnbindVAO();
+}
+
+void ShaderProgram::SetLightClusters(const glm::vec2 &viewport,
+        float sliceScale, float sliceBias)
+{
+    Use();
+    SetUniformVec2("viewportSize", viewport);
+    SetUniformFloat("sliceScale", sliceScale);
+    SetUniformFloat("sliceBias", sliceBias);
+}
+
+void ShaderProgram::SetClustered(bool clustered)
+{
+    Use();
+    SetUniformInt("clustered", clustered ? 1 : 0);
+}
+
+void ShaderProgram::SetClusterSamplers()
+{
+    Use();
+    SetUniformInt("clusterLights", LIGHT_DATA_UNIT);
+    SetUniformInt("clusterGrid", LIGHT_CLUSTER_UNIT);
+    SetUniformInt("clusterIndices", LIGHT_INDEX_UNIT);
+}
+
+void ShaderProgram::SetInstanced(bool instanced)
+{
+    Use();
+    SetUniformInt("instanced", instanced ? 1 : 0);
 }
 
 void ShaderProgram::SetModelMatrix(const glm::mat4 &model)
 {
     m_modelMatrix = model;
-    BindVAO();
+    Use();
     SetUniformMat4("model", m_modelMatrix);
-    UnbindVAO();
 }
 
 void ShaderProgram::RotateModelMatrix(float angleRadians, const glm::vec3 &up)
 {
     m_modelMatrix = glm::rotate(m_modelMatrix, angleRadians, up);
-    BindVAO();
+    Use();
     SetUniformMat4("model", m_modelMatrix);
-    UnbindVAO();
 }
 
 void ShaderProgram::SetProjectionMatrix(const glm::mat4 &projection)
 {
     m_projectionMatrix = projection;
-    BindVAO();
+    Use();
     SetUniformMat4("projection", m_projectionMatrix);
-    UnbindVAO();
 }
 
 bool ShaderProgram::LoadShaderFromFile(const char* filename, GLenum type)
 {
+    PROFILE_FUNCTION();
     if (m_program == 0) {
         m_program = glCreateProgramObjectARB();
+        // Every model shader shares the geometry arena's VAOs
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_VERTEX,
+                "facetVertex");
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_NORMAL,
+                "facetNormal");
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_UV, "facetUV");
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_INSTANCE_MODEL,
+                "instanceModel");
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_INSTANCE_COLOR,
+                "instanceColor");
+        glBindAttribLocation(m_program, ATTRIB_LOCATION_COLOR,
+                "vertexColor");
     }
-    std::string target;
-    int64_t len = ReadFile(filename, target);
-    if (len<=0) {
+    MappedFile source;
+    if (!OpenAsset(filename, source) || source.GetSize() == 0) {
         Error("Failed to open file '%s'", filename);
         return false;
     }
     GLenum shaderObject = glCreateShaderObjectARB(type);
-    bool success = CompileShader(shaderObject, target, len);
+    bool success = CompileShader(shaderObject, source.GetChars(),
+            source.GetSize());
     if (!success) {
         Error("Failed to compile shader '%s'", filename);
         glDeleteShader(shaderObject);
@@ -288,6 +293,7 @@ bool ShaderProgram::LoadShaderFromFile(const char* filename, GLenum type)
     glAttachObjectARB(m_program, shaderObject);
     glLinkProgramARB(m_program);
     glDeleteShader(shaderObject);
+    m_uniformLocations.clear(); // Relinking may move uniforms
     return true;
 }
 
@@ -301,43 +307,13 @@ bool ShaderProgram::LoadFragmentShaderFromFile(const char* filename)
     return LoadShaderFromFile(filename, GL_FRAGMENT_SHADER);
 }
 
-void ShaderProgram::BindVAO()
+void ShaderProgram::Use()
 {
     if (!m_program) {
-        Warning("Tried to update vertex array object without program");
-        return;
-    }
-    glUseProgram(m_program);
-    if (m_vertexArray == 0) {
-        glGenVertexArrays(1, &m_vertexArray);
-    }
-    glBindVertexArray(m_vertexArray);
-}
-
-void ShaderProgram::UnbindVAO()
-{
-    glEnableVertexAttribArray(0);
-    glBindVertexArray(0);
-    glUseProgram(0);
-}
-
-void ShaderProgram::Render()
-{
-    if (m_program == 0) {
-        Warning("Attempted to render uninitialized shader '%s'",
-                m_name.c_str());
+        Warning("Tried to use shader '%s' without program", m_name.c_str());
         return;
     }
-    if (m_numElements == 0) {
-        Warning("Attempted to render shader with 0 elements '%s'",
-                m_name.c_str());
-    }
-
-    glUseProgram(m_program);
-    glBindVertexArray(m_vertexArray);
-    glDrawElements(GL_TRIANGLES, m_numElements, GL_UNSIGNED_INT, (void *)0);
-    glBindVertexArray(0);
-
+    UseProgramObject(m_program);
 }
 
 ShaderProgram::~ShaderProgram()
@@ -348,21 +324,19 @@ ShaderProgram::~ShaderProgram()
 
 void ShaderProgram::Cleanup()
 {
-    // It is safe to call any glDelete function on 0
     m_viewMatrix = glm::mat4(1.0f);
     m_modelMatrix = glm::mat4(1.0f);
     m_projectionMatrix = glm::mat4(1.0f);
-    m_numElements = 0;
+    // Programs that were never linked may outlive GL, as the static
+    // ones do when the program quits before making a context
+    if (m_program == 0) {
+        return;
+    }
+    if (m_program == currentProgram) {
+        UseProgramObject(0);
+    }
     glDeleteProgram(m_program);
     m_program = 0;
-    glDeleteBuffers(1, &m_uvBuffer);
-    m_uvBuffer = 0;
-    glDeleteBuffers(1, &m_vertexBuffer);
-    m_vertexBuffer = 0;
-    glDeleteBuffers(1, &m_elementBuffer);
-    m_elementBuffer = 0;
-    glDeleteVertexArrays(1, &m_vertexArray);
-    m_vertexArray = 0;
 }
 
 ShaderProgram& ShaderProgram::operator=(ShaderProgram &&other)
@@ -372,47 +346,34 @@ ShaderProgram& ShaderProgram::operator=(ShaderProgram &&other)
         // When a move is made of the program OpenGL
         // references need to be set to 0 before a
         // destructor is called on the `other`
-        std::swap(m_vertexArray, other.m_vertexArray);
-        std::swap(m_vertexBuffer, other.m_vertexBuffer);
-        std::swap(m_uvBuffer, other.m_uvBuffer);
-        std::swap(m_elementBuffer, other.m_elementBuffer);
         std::swap(m_program, other.m_program);
         std::swap(m_lights, other.m_lights);
+        std::swap(m_uniformLocations, other.m_uniformLocations);
         memcpy((void *)&m_material, (void *)&other.m_material,
                 sizeof(ShaderMaterial_t));
         m_viewMatrix = other.m_viewMatrix;
         m_cameraPosition = other.m_cameraPosition;
         m_projectionMatrix = other.m_projectionMatrix;
         m_modelMatrix = other.m_modelMatrix;
-        m_numElements = other.m_numElements;
         m_name = other.m_name;
     }
     return *this;
 }
 
 ShaderProgram::ShaderProgram(ShaderProgram &&other) : m_name(other.m_name),
-        m_vertexArray(other.m_vertexArray),
-        m_vertexBuffer(other.m_vertexBuffer),
-        m_normalBuffer(other.m_normalBuffer),
-        m_uvBuffer(other.m_uvBuffer),
-        m_elementBuffer(other.m_elementBuffer),
         m_program(other.m_program),
-        m_numElements(other.m_numElements),
         m_viewMatrix(other.m_viewMatrix),
         m_cameraPosition(other.m_cameraPosition),
         m_projectionMatrix(other.m_projectionMatrix),
         m_modelMatrix(other.m_modelMatrix),
         m_material(other.m_material),
-        m_lights(other.m_lights)
+        m_lights(other.m_lights),
+        m_uniformLocations(other.m_uniformLocations)
 {
     // Set new ShaderProgram to have
-    // references to the OpenGL buffers and program
+    // references to the OpenGL program
     // and unset GLuint references on `other` so that
     // when Cleanup() is called in destructor our
-    // program and buffers won't be destroyed
-    other.m_vertexBuffer = 0;
-    other.m_elementBuffer = 0;
-    other.m_uvBuffer = 0;
+    // program won't be destroyed
     other.m_program = 0;
-    other.m_vertexArray = 0;
 }
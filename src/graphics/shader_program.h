@@ -13,6 +13,7 @@ struct ShaderMaterial_t {
     glm::vec3 diffuse;
     glm::vec3 specular;
     GLfloat shininess;
+    GLfloat opacity; // Below 1 the material is drawn blended
     GLint type; // 0 = ambient, float diffuse
                 // 1 = Sampler Texture0(diffuse) Texture1(specular)
 };
@@ -44,34 +45,45 @@ class ShaderProgram
 public:
     ShaderProgram(const char *name);
 
-    void SetVertexBuffer(void *data, GLsizei size, GLenum storageHint);
-
-    void SetNormalBuffer(void *data, GLsizei size, GLenum storageHint);
-
-    void SetUVBuffer(void *data, GLsizei size, GLenum storageHint);
-
     void SetLight(const std::string &name, ShaderLight_t &light);
 
-    void SetElementBuffer(int numElements, void *data,
-            GLsizei size, GLenum storageHint);
-
     void SetShininess(GLfloat shininess);
 
     void SetMaterial(ShaderMaterial_t &material);
 
+    // Shades with the lights of LightTextures as well, for a viewport
+    // of `viewport` pixels and a LightGrid's depth slice parameters
+    void SetLightClusters(const glm::vec2 &viewport, float sliceScale,
+            float sliceBias);
+
+    // Turns the clustered lights on or off, they start off
+    void SetClustered(bool clustered);
+
+    // Points the cluster samplers at the LIGHT_*_UNIT texture units.
+    // Samplers of different types may not share a unit even when
+    // unused, so it must be done before the first draw.
+    void SetClusterSamplers();
+
     void SetModelMatrix(const glm::mat4 &model);
 
+    // Switches between the model uniform and per instance transforms
+    void SetInstanced(bool instanced);
+
     void RotateModelMatrix(float angleRadians, const glm::vec3 &up);
 
     void SetViewMatrix(const glm::mat4 &view, const glm::vec3 &camPos);
 
+    // For programs without a cameraPosition uniform
+    void SetViewMatrix(const glm::mat4 &view);
+
     void SetProjectionMatrix(const glm::mat4 &projection);
 
     bool LoadVertexShaderFromFile(const char *filename);
 
     bool LoadFragmentShaderFromFile(const char *filename);
 
-    void Render();
+    // Makes this the current program for uniform updates and draws
+    void Use();
 
     // Sans default constructor
     ShaderProgram() = delete;
@@ -86,42 +98,29 @@ public:
     ~ShaderProgram();
 
 private:
+    GLint GetUniformLocation(const std::string &varName,
+            const char *typeName);
+
     void SetUniformInt(const std::string &varName, GLint i);
 
     void SetUniformUInt(const std::string &varName, GLuint u);
 
+    void SetUniformVec2(const std::string &varName, const glm::vec2 &v);
+
     void SetUniformVec3(const std::string &varName, glm::vec3 &v);
 
     void SetUniformMat4(const std::string &varName, glm::mat4 &mat);
 
     void SetUniformFloat(const std::string &varName, GLfloat f);
 
-    void BindVAO();
-
-    void UnbindVAO();
-
-    GLuint CreateBuffer(GLenum type, void *data, GLsizei size, GLenum storageHint);
-
     bool LoadShaderFromFile(const char *filename, GLenum type);
     
     void Cleanup();
 
     std::string m_name;
 
-    GLuint m_vertexArray = 0;
-
-    GLuint m_vertexBuffer = 0;
-
-    GLuint m_normalBuffer = 0;
-
-    GLuint m_uvBuffer = 0;
-
-    GLuint m_elementBuffer = 0;
-
     GLenum m_program = 0;
 
-    unsigned int m_numElements = 0;
-
     glm::mat4 m_viewMatrix;
 
     glm::vec3 m_cameraPosition;
@@ -134,6 +133,8 @@ private:
 
     std::map<std::string, ShaderLight_t> m_lights;
 
+    std::map<std::string, GLint> m_uniformLocations;
+
 };
 
 #endif
@@ -0,0 +1,379 @@
+#include "simplify.h"
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include "util/job_system.h"
+
+// Collapses that turn a face's normal by more than ~80 degrees are
+// rejected, they fold the surface over itself
+#define MIN_NORMAL_DOT 0.2f
+// Fraction of the threshold a coarser level has to come in under
+#define LOD_HYSTERESIS 0.75f
+// Corners closer than this fraction of the mesh's size are welded,
+// ascii STL files round coordinates to a few digits and the faces
+// don't quite meet otherwise
+#define WELD_TOLERANCE 1e-3f
+
+// Symmetric 4x4 matrix, upper triangle by rows
+struct Quadric_t {
+    double a[10];
+};
+
+static void AddPlaneQuadric(Quadric_t &q, const glm::dvec3 &n, double d)
+{
+    q.a[0] += n.x*n.x; q.a[1] += n.x*n.y; q.a[2] += n.x*n.z; q.a[3] += n.x*d;
+    q.a[4] += n.y*n.y; q.a[5] += n.y*n.z; q.a[6] += n.y*d;
+    q.a[7] += n.z*n.z; q.a[8] += n.z*d;
+    q.a[9] += d*d;
+}
+
+static void AddQuadric(Quadric_t &q, const Quadric_t &other)
+{
+    for (int i=0; i<10; i++) {
+        q.a[i] += other.a[i];
+    }
+}
+
+// Sum of squared distances from `p` to the planes in the quadric
+static double EvaluateQuadric(const Quadric_t &q, const glm::vec3 &p)
+{
+    const double x = p.x;
+    const double y = p.y;
+    const double z = p.z;
+    return q.a[0]*x*x + 2.0*q.a[1]*x*y + 2.0*q.a[2]*x*z + 2.0*q.a[3]*x
+            + q.a[4]*y*y + 2.0*q.a[5]*y*z + 2.0*q.a[6]*y
+            + q.a[7]*z*z + 2.0*q.a[8]*z
+            + q.a[9];
+}
+
+struct WeldKey_t {
+    int32_t cell[3];
+    glm::vec3 normal;
+    glm::vec2 uv;
+
+    bool operator==(const WeldKey_t &other) const
+    {
+        return memcmp(this, &other, sizeof(WeldKey_t)) == 0;
+    }
+};
+
+struct WeldKeyHash {
+    size_t operator()(const WeldKey_t &key) const
+    {
+        uint32_t words[sizeof(WeldKey_t)/4];
+        memcpy(words, &key, sizeof(WeldKey_t));
+        uint32_t h = 2166136261u;
+        for (size_t i=0; i<sizeof(words)/sizeof(words[0]); i++) {
+            h = (h ^ words[i]) * 16777619u;
+        }
+        return h;
+    }
+};
+
+struct Collapse_t {
+    double cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+
+    bool operator>(const Collapse_t &other) const
+    {
+        return cost > other.cost;
+    }
+};
+
+static glm::vec3 FaceNormal(const glm::vec3 &a, const glm::vec3 &b,
+        const glm::vec3 &c)
+{
+    return glm::cross(b - a, c - a);
+}
+
+bool SimplifyMesh(const MeshData_t &mesh, size_t targetTriangles,
+        MeshData_t &out, float &error)
+{
+    const bool textured = mesh.uvs.size() > 0;
+    out = MeshData_t();
+    error = 0.0f;
+
+    // Weld identical corners so edges are shared between faces. Only
+    // the position counts for untextured meshes, their normals are
+    // per face and get recomputed.
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+    for (size_t i=0; i<mesh.vertices.size(); i++) {
+        min = glm::min(min, mesh.vertices[i]);
+        max = glm::max(max, mesh.vertices[i]);
+    }
+    float cellSize = WELD_TOLERANCE * glm::length(max - min);
+    if (!(cellSize > 0.0f)) {
+        cellSize = 1.0f;
+    }
+    std::unordered_map<WeldKey_t, uint32_t, WeldKeyHash> welded;
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> sources; // A mesh vertex for each welded one
+    std::vector<uint32_t> triangles;
+    triangles.reserve(mesh.elements.size());
+    for (size_t i=0; i<mesh.elements.size(); i++) {
+        const GLuint e = mesh.elements[i];
+        WeldKey_t key;
+        memset((void *)&key, 0, sizeof(WeldKey_t));
+        for (int j=0; j<3; j++) {
+            key.cell[j] = (int32_t)floorf(mesh.vertices[e][j]/cellSize + 0.5f);
+        }
+        if (textured) {
+            key.normal = mesh.normals[e];
+            key.uv = mesh.uvs[e];
+        }
+        auto it = welded.emplace(key, (uint32_t)positions.size());
+        if (it.second) {
+            positions.push_back(mesh.vertices[e]);
+            sources.push_back(e);
+        }
+        triangles.push_back(it.first->second);
+    }
+    const size_t numVertices = positions.size();
+    size_t numTriangles = triangles.size() / 3;
+    if (numTriangles <= targetTriangles || numVertices == 0) {
+        return false;
+    }
+
+    // Plane quadrics, and an edge count to find borders. Vertices on
+    // an edge with only one face are locked in place.
+    std::vector<Quadric_t> quadrics(numVertices);
+    memset((void *)&quadrics[0], 0, numVertices*sizeof(Quadric_t));
+    std::vector<std::vector<uint32_t>> vertexFaces(numVertices);
+    std::vector<bool> deadFaces(numTriangles, false);
+    std::unordered_map<uint64_t, uint32_t> edgeFaces;
+    for (size_t f=0; f<numTriangles; f++) {
+        const uint32_t *t = &triangles[3*f];
+        if (t[0] == t[1] || t[1] == t[2] || t[2] == t[0]) {
+            deadFaces[f] = true;
+            continue;
+        }
+        glm::dvec3 n = glm::dvec3(FaceNormal(positions[t[0]],
+                positions[t[1]], positions[t[2]]));
+        double length = glm::length(n);
+        if (length > 0.0) {
+            n /= length;
+            double d = -glm::dot(n, glm::dvec3(positions[t[0]]));
+            for (int j=0; j<3; j++) {
+                AddPlaneQuadric(quadrics[t[j]], n, d);
+            }
+        }
+        for (int j=0; j<3; j++) {
+            vertexFaces[t[j]].push_back(f);
+            uint32_t a = std::min(t[j], t[(j+1)%3]);
+            uint32_t b = std::max(t[j], t[(j+1)%3]);
+            edgeFaces[((uint64_t)a << 32) | b]++;
+        }
+    }
+    std::vector<bool> locked(numVertices, false);
+    for (auto it=edgeFaces.begin(); it!=edgeFaces.end(); it++) {
+        if (it->second == 1) {
+            locked[it->first >> 32] = true;
+            locked[it->first & 0xFFFFFFFF] = true;
+        }
+    }
+    size_t liveTriangles = 0;
+    for (size_t f=0; f<numTriangles; f++) {
+        liveTriangles += !deadFaces[f];
+    }
+
+    std::vector<uint32_t> versions(numVertices, 0);
+    std::vector<bool> deadVertices(numVertices, false);
+    std::priority_queue<Collapse_t, std::vector<Collapse_t>,
+            std::greater<Collapse_t>> heap;
+    auto pushCollapse = [&](uint32_t from, uint32_t to) {
+        if (locked[from]) {
+            return;
+        }
+        Quadric_t q = quadrics[from];
+        AddQuadric(q, quadrics[to]);
+        Collapse_t c;
+        c.cost = std::max(0.0, EvaluateQuadric(q, positions[to]));
+        c.from = from;
+        c.to = to;
+        c.fromVersion = versions[from];
+        c.toVersion = versions[to];
+        heap.push(c);
+    };
+    for (size_t f=0; f<numTriangles; f++) {
+        if (deadFaces[f]) {
+            continue;
+        }
+        for (int j=0; j<3; j++) {
+            pushCollapse(triangles[3*f+j], triangles[3*f+(j+1)%3]);
+            pushCollapse(triangles[3*f+(j+1)%3], triangles[3*f+j]);
+        }
+    }
+
+    double maxCost = 0.0;
+    while (liveTriangles > targetTriangles && !heap.empty()) {
+        const Collapse_t c = heap.top();
+        heap.pop();
+        if (deadVertices[c.from] || deadVertices[c.to]
+                || versions[c.from] != c.fromVersion
+                || versions[c.to] != c.toVersion) {
+            continue; // Stale, one of the ends changed since
+        }
+        // Moving `from` onto `to` must not flip any face that survives
+        bool flips = false;
+        for (size_t i=0; i<vertexFaces[c.from].size() && !flips; i++) {
+            const uint32_t f = vertexFaces[c.from][i];
+            const uint32_t *t = &triangles[3*f];
+            if (deadFaces[f] || t[0] == c.to || t[1] == c.to || t[2] == c.to) {
+                continue;
+            }
+            glm::vec3 p[3];
+            for (int j=0; j<3; j++) {
+                p[j] = positions[t[j]];
+            }
+            glm::vec3 before = FaceNormal(p[0], p[1], p[2]);
+            for (int j=0; j<3; j++) {
+                if (t[j] == c.from) {
+                    p[j] = positions[c.to];
+                }
+            }
+            glm::vec3 after = FaceNormal(p[0], p[1], p[2]);
+            float lengths = glm::length(before) * glm::length(after);
+            flips = lengths <= 0.0f
+                    || glm::dot(before, after) < MIN_NORMAL_DOT * lengths;
+        }
+        if (flips) {
+            continue;
+        }
+
+        for (size_t i=0; i<vertexFaces[c.from].size(); i++) {
+            const uint32_t f = vertexFaces[c.from][i];
+            uint32_t *t = &triangles[3*f];
+            if (deadFaces[f]) {
+                continue;
+            }
+            if (t[0] == c.to || t[1] == c.to || t[2] == c.to) {
+                deadFaces[f] = true;
+                liveTriangles--;
+                continue;
+            }
+            for (int j=0; j<3; j++) {
+                if (t[j] == c.from) {
+                    t[j] = c.to;
+                }
+            }
+            vertexFaces[c.to].push_back(f);
+        }
+        vertexFaces[c.from].clear();
+        deadVertices[c.from] = true;
+        AddQuadric(quadrics[c.to], quadrics[c.from]);
+        versions[c.to]++;
+        maxCost = std::max(maxCost, c.cost);
+
+        // Drop the faces that just died and requeue every edge around
+        // the survivor with its new quadric
+        std::vector<uint32_t> &faces = vertexFaces[c.to];
+        faces.erase(std::remove_if(faces.begin(), faces.end(),
+                [&](uint32_t f) { return (bool)deadFaces[f]; }), faces.end());
+        for (size_t i=0; i<faces.size(); i++) {
+            const uint32_t *t = &triangles[3*faces[i]];
+            for (int j=0; j<3; j++) {
+                if (t[j] != c.to) {
+                    pushCollapse(c.to, t[j]);
+                    pushCollapse(t[j], c.to);
+                }
+            }
+        }
+    }
+    if (liveTriangles == numTriangles) {
+        return false;
+    }
+    error = (float)sqrt(maxCost);
+
+    // Write out the surviving faces
+    std::vector<uint32_t> remap(numVertices, UINT32_MAX);
+    for (size_t f=0; f<numTriangles; f++) {
+        if (deadFaces[f]) {
+            continue;
+        }
+        const uint32_t *t = &triangles[3*f];
+        if (!textured) {
+            glm::vec3 n = FaceNormal(positions[t[0]], positions[t[1]],
+                    positions[t[2]]);
+            float length = glm::length(n);
+            n = length > 0.0f ? n / length : glm::vec3(0.0f, 0.0f, 1.0f);
+            for (int j=0; j<3; j++) {
+                out.elements.push_back(out.vertices.size());
+                out.vertices.push_back(positions[t[j]]);
+                out.normals.push_back(n);
+            }
+            continue;
+        }
+        for (int j=0; j<3; j++) {
+            if (remap[t[j]] == UINT32_MAX) {
+                remap[t[j]] = out.vertices.size();
+                out.vertices.push_back(positions[t[j]]);
+                out.normals.push_back(mesh.normals[sources[t[j]]]);
+                out.uvs.push_back(mesh.uvs[sources[t[j]]]);
+            }
+            out.elements.push_back(remap[t[j]]);
+        }
+    }
+    return true;
+}
+
+void BuildLodChain(const MeshData_t &mesh, const std::vector<float> &ratios,
+        std::vector<MeshLod_t> &lods)
+{
+    const size_t numTriangles = mesh.elements.size() / 3;
+    std::vector<MeshLod_t> levels(ratios.size());
+    std::vector<char> built(ratios.size(), false); // Not bool, jobs write it
+    JobCounter_t counter;
+    for (size_t i=0; i<ratios.size(); i++) {
+        RunJob([&, i]() {
+            size_t target = (size_t)(numTriangles * ratios[i]);
+            built[i] = SimplifyMesh(mesh, target, levels[i].mesh,
+                    levels[i].error);
+        }, &counter);
+    }
+    WaitForJobs(counter);
+
+    lods.clear();
+    size_t previous = numTriangles;
+    float previousError = 0.0f;
+    for (size_t i=0; i<levels.size(); i++) {
+        const size_t count = levels[i].mesh.elements.size() / 3;
+        if (!built[i] || count == 0 || count > previous - previous/10
+                || levels[i].error < previousError) {
+            continue;
+        }
+        previous = count;
+        previousError = levels[i].error;
+        lods.push_back(std::move(levels[i]));
+    }
+}
+
+uint32_t SelectLodLevel(const float *errors, uint32_t numLevels,
+        float pixelsPerUnit, float distance, float maxPixels,
+        uint32_t current)
+{
+    if (numLevels == 0) {
+        return 0;
+    }
+    const float scale = pixelsPerUnit / std::max(distance, 1e-3f);
+    if (current >= numLevels) {
+        current = numLevels - 1;
+    }
+    if (errors[current]*scale > maxPixels) {
+        while (current > 0 && errors[current]*scale > maxPixels) {
+            current--;
+        }
+        return current;
+    }
+    while (current+1 < numLevels
+            && errors[current+1]*scale <= maxPixels*LOD_HYSTERESIS) {
+        current++;
+    }
+    return current;
+}
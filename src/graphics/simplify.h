@@ -0,0 +1,42 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "graphics/mesh.h"
+
+#define MAX_LOD_LEVELS 4 // Full detail included
+
+// Reduces `mesh` to at most `targetTriangles` by collapsing edges in
+// order of quadric error (Garland & Heckbert). Vertices only ever
+// collapse onto a neighbour so their attributes never need
+// interpolating, and open borders and UV seams are kept as they are.
+// Meshes without UVs are welded by position alone and come back flat
+// shaded with one vertex per corner, like the STL loader makes them.
+// `error` receives the largest collapse error as a distance in model
+// units. Returns false if the mesh couldn't be reduced at all.
+bool SimplifyMesh(const MeshData_t &mesh, size_t targetTriangles,
+        MeshData_t &out, float &error);
+
+struct MeshLod_t {
+    MeshData_t mesh;
+    float error;
+};
+
+// Simplifies `mesh` once for every fraction of its triangle count in
+// `ratios`, each level in its own job. Levels that fail or don't
+// remove at least a tenth of the previous level's triangles are
+// dropped, so `lods` can come back shorter than `ratios`.
+void BuildLodChain(const MeshData_t &mesh, const std::vector<float> &ratios,
+        std::vector<MeshLod_t> &lods);
+
+// Picks the coarsest level whose error covers at most `maxPixels` on
+// screen. `errors` grows with the level and errors[0] is the full
+// mesh. `pixelsPerUnit` is the size of one world unit at distance 1.
+// Going coarser needs a margin below the threshold so objects sitting
+// near a switch distance don't flicker between two levels.
+uint32_t SelectLodLevel(const float *errors, uint32_t numLevels,
+        float pixelsPerUnit, float distance, float maxPixels,
+        uint32_t current);
+
+#endif
@@ -0,0 +1,290 @@
+#include "stats_overlay.h"
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <glm/gtc/matrix_transform.hpp>
+#include "graphics/mesh.h"
+#include "util/counters.h"
+#include "util/log.h"
+
+// Glyphs are 5x7 texels in cells of 6x8, the cell after the last
+// glyph is solid for the rectangles
+#define FONT_GLYPH_WIDTH 5
+#define FONT_GLYPH_HEIGHT 7
+#define FONT_CELL_WIDTH 6
+#define FONT_CELL_HEIGHT 8
+
+#define OVERLAY_MARGIN 8.0f
+#define OVERLAY_PADDING 6.0f
+#define OVERLAY_LINE_HEIGHT (FONT_CELL_HEIGHT*OVERLAY_TEXT_SCALE + 2.0f)
+#define OVERLAY_TARGET_MS (1000.0f / 60.0f)
+
+// Text is upper cased, anything else missing draws as a space
+static const char fontChars[] = " 0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+        ".:/-%(),=";
+
+// One row per byte, top first, the glyph's left column is bit 4
+static const uint8_t fontRows[][FONT_GLYPH_HEIGHT] = {
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 }, // ' '
+    { 0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E }, // 0
+    { 0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E }, // 1
+    { 0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F }, // 2
+    { 0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E }, // 3
+    { 0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02 }, // 4
+    { 0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E }, // 5
+    { 0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E }, // 6
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 }, // 7
+    { 0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E }, // 8
+    { 0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C }, // 9
+    { 0x0E, 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11 }, // A
+    { 0x1E, 0x11, 0x11, 0x1E, 0x11, 0x11, 0x1E }, // B
+    { 0x0E, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0E }, // C
+    { 0x1C, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1C }, // D
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x1F }, // E
+    { 0x1F, 0x10, 0x10, 0x1E, 0x10, 0x10, 0x10 }, // F
+    { 0x0E, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0F }, // G
+    { 0x11, 0x11, 0x11, 0x1F, 0x11, 0x11, 0x11 }, // H
+    { 0x0E, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0E }, // I
+    { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0C }, // J
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, // K
+    { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1F }, // L
+    { 0x11, 0x1B, 0x15, 0x15, 0x11, 0x11, 0x11 }, // M
+    { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 }, // N
+    { 0x0E, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // O
+    { 0x1E, 0x11, 0x11, 0x1E, 0x10, 0x10, 0x10 }, // P
+    { 0x0E, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0D }, // Q
+    { 0x1E, 0x11, 0x11, 0x1E, 0x14, 0x12, 0x11 }, // R
+    { 0x0F, 0x10, 0x10, 0x0E, 0x01, 0x01, 0x1E }, // S
+    { 0x1F, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 }, // T
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0E }, // U
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0A, 0x04 }, // V
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0A }, // W
+    { 0x11, 0x11, 0x0A, 0x04, 0x0A, 0x11, 0x11 }, // X
+    { 0x11, 0x11, 0x11, 0x0A, 0x04, 0x04, 0x04 }, // Y
+    { 0x1F, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1F }, // Z
+    { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0C, 0x0C }, // .
+    { 0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00 }, // :
+    { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 }, // /
+    { 0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00 }, // -
+    { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 }, // %
+    { 0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02 }, // (
+    { 0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08 }, // )
+    { 0x00, 0x00, 0x00, 0x00, 0x0C, 0x04, 0x08 }, // ,
+    { 0x00, 0x00, 0x1F, 0x00, 0x1F, 0x00, 0x00 }, // =
+};
+
+static const int numGlyphs = sizeof(fontRows) / sizeof(fontRows[0]);
+static const int fontWidth = (numGlyphs + 1) * FONT_CELL_WIDTH;
+
+static int FindGlyph(char c)
+{
+    const char *found = strchr(fontChars, toupper((unsigned char)c));
+    return found && c != '\0' ? found - fontChars : 0;
+}
+
+bool StatsOverlay::Init()
+{
+    if (!m_shader.LoadFragmentShaderFromFile("shaders/overlay.frs")
+            || !m_shader.LoadVertexShaderFromFile("shaders/overlay.vs")) {
+        return false;
+    }
+
+    std::vector<uint8_t> texels(fontWidth * FONT_CELL_HEIGHT, 0);
+    for (int glyph=0; glyph<numGlyphs; glyph++) {
+        for (int y=0; y<FONT_GLYPH_HEIGHT; y++) {
+            for (int x=0; x<FONT_GLYPH_WIDTH; x++) {
+                if (fontRows[glyph][y] & (0x10 >> x)) {
+                    texels[y*fontWidth + glyph*FONT_CELL_WIDTH + x] = 0xFF;
+                }
+            }
+        }
+    }
+    for (int y=0; y<FONT_CELL_HEIGHT; y++) {
+        memset(&texels[y*fontWidth + numGlyphs*FONT_CELL_WIDTH], 0xFF,
+                FONT_CELL_WIDTH);
+    }
+    glGenTextures(1, &m_fontTexture);
+    glBindTexture(GL_TEXTURE_2D, m_fontTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, fontWidth, FONT_CELL_HEIGHT, 0,
+            GL_RED, GL_UNSIGNED_BYTE, &texels[0]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, texels.size());
+
+    glGenVertexArrays(1, &m_vertexArray);
+    glGenBuffers(1, &m_vertexBuffer);
+    glBindVertexArray(m_vertexArray);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glEnableVertexAttribArray(ATTRIB_LOCATION_VERTEX);
+    glVertexAttribPointer(ATTRIB_LOCATION_VERTEX, 2, GL_FLOAT, GL_FALSE,
+            sizeof(Vertex_t), (void *)offsetof(Vertex_t, position));
+    glEnableVertexAttribArray(ATTRIB_LOCATION_UV);
+    glVertexAttribPointer(ATTRIB_LOCATION_UV, 2, GL_FLOAT, GL_FALSE,
+            sizeof(Vertex_t), (void *)offsetof(Vertex_t, uv));
+    glEnableVertexAttribArray(ATTRIB_LOCATION_COLOR);
+    glVertexAttribPointer(ATTRIB_LOCATION_COLOR, 4, GL_FLOAT, GL_FALSE,
+            sizeof(Vertex_t), (void *)offsetof(Vertex_t, color));
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    return true;
+}
+
+void StatsOverlay::AddQuad(const glm::vec2 &min, const glm::vec2 &max,
+        const glm::vec2 &uvMin, const glm::vec2 &uvMax,
+        const glm::vec4 &color)
+{
+    const Vertex_t topLeft = { min, uvMin, color };
+    const Vertex_t topRight = { glm::vec2(max.x, min.y),
+            glm::vec2(uvMax.x, uvMin.y), color };
+    const Vertex_t bottomLeft = { glm::vec2(min.x, max.y),
+            glm::vec2(uvMin.x, uvMax.y), color };
+    const Vertex_t bottomRight = { max, uvMax, color };
+    m_vertices.push_back(topLeft);
+    m_vertices.push_back(bottomLeft);
+    m_vertices.push_back(topRight);
+    m_vertices.push_back(topRight);
+    m_vertices.push_back(bottomLeft);
+    m_vertices.push_back(bottomRight);
+}
+
+void StatsOverlay::AddRect(const glm::vec2 &min, const glm::vec2 &max,
+        const glm::vec4 &color)
+{
+    // Middle of the solid cell
+    const glm::vec2 uv((numGlyphs*FONT_CELL_WIDTH + 0.5f*FONT_CELL_WIDTH)
+            / fontWidth, 0.5f);
+    AddQuad(min, max, uv, uv, color);
+}
+
+void StatsOverlay::AddText(const glm::vec2 &position, const char *text,
+        const glm::vec4 &color)
+{
+    const glm::vec2 size(FONT_GLYPH_WIDTH*OVERLAY_TEXT_SCALE,
+            FONT_GLYPH_HEIGHT*OVERLAY_TEXT_SCALE);
+    const glm::vec2 uvSize((float)FONT_GLYPH_WIDTH / fontWidth,
+            (float)FONT_GLYPH_HEIGHT / FONT_CELL_HEIGHT);
+    glm::vec2 pen = position;
+    for (const char *c=text; *c; c++) {
+        const int glyph = FindGlyph(*c);
+        if (glyph != 0) {
+            const glm::vec2 uv((float)glyph*FONT_CELL_WIDTH / fontWidth,
+                    0.0f);
+            AddQuad(pen, pen + size, uv, uv + uvSize, color);
+        }
+        pen.x += FONT_CELL_WIDTH*OVERLAY_TEXT_SCALE;
+    }
+}
+
+void StatsOverlay::Draw(int32_t width, int32_t height)
+{
+    if (!m_initialized && !m_failed) {
+        m_failed = !Init();
+        m_initialized = !m_failed;
+        if (m_failed) {
+            Error("Failed to load the stats overlay");
+        }
+    }
+    if (!m_initialized || width <= 0 || height <= 0) {
+        return;
+    }
+
+    const CounterFrame_t &frame = GetLastFrameCounters();
+    const uint32_t *values = frame.values;
+    char lines[4][64];
+    snprintf(lines[0], sizeof(lines[0]), "FPS %.0f  %.2f MS",
+            frame.frameMs > 0.0 ? 1000.0 / frame.frameMs : 0.0,
+            frame.frameMs);
+    snprintf(lines[1], sizeof(lines[1]), "DRAWS %u  TRIS %u",
+            values[COUNTER_DRAW_CALLS], values[COUNTER_TRIANGLES]);
+    snprintf(lines[2], sizeof(lines[2]), "PROGRAMS %u  TEXTURES %u",
+            values[COUNTER_PROGRAM_BINDS], values[COUNTER_TEXTURE_BINDS]);
+    snprintf(lines[3], sizeof(lines[3]), "UPLOADS %u  %.1f KB",
+            values[COUNTER_BUFFER_UPLOADS],
+            values[COUNTER_UPLOAD_BYTES] / 1024.0);
+
+    const int numLines = sizeof(lines) / sizeof(lines[0]);
+    size_t longestLine = 0;
+    for (int i=0; i<numLines; i++) {
+        longestLine = std::max(longestLine, strlen(lines[i]));
+    }
+    const float textWidth = longestLine*FONT_CELL_WIDTH*OVERLAY_TEXT_SCALE;
+    const float graphWidth = COUNTER_HISTORY_FRAMES; // A pixel a frame
+    const glm::vec2 panelMin(OVERLAY_MARGIN);
+    const glm::vec2 panelMax = panelMin + glm::vec2(std::max(textWidth,
+            graphWidth), numLines*OVERLAY_LINE_HEIGHT + OVERLAY_GRAPH_HEIGHT)
+            + 3.0f*OVERLAY_PADDING;
+
+    // The panel goes first so that everything else blends over it
+    m_vertices.clear();
+    AddRect(panelMin, panelMax, glm::vec4(0.0f, 0.0f, 0.0f, 0.6f));
+    glm::vec2 pen = panelMin + OVERLAY_PADDING;
+    for (int i=0; i<numLines; i++) {
+        AddText(pen, lines[i], glm::vec4(1.0f));
+        pen.y += OVERLAY_LINE_HEIGHT;
+    }
+
+    // Newest frame on the right
+    const glm::vec2 graphEnd = pen + glm::vec2(graphWidth,
+            OVERLAY_PADDING + OVERLAY_GRAPH_HEIGHT);
+    const size_t numFrames = GetFrameTimeHistorySize();
+    for (size_t i=0; i<numFrames; i++) {
+        const float ms = GetFrameTimeHistory(i);
+        glm::vec4 color(0.2f, 0.9f, 0.2f, 0.9f);
+        if (ms > 2.0f*OVERLAY_TARGET_MS) {
+            color = glm::vec4(0.9f, 0.2f, 0.2f, 0.9f);
+        } else if (ms > OVERLAY_TARGET_MS) {
+            color = glm::vec4(0.9f, 0.8f, 0.2f, 0.9f);
+        }
+        const float x = graphEnd.x - (numFrames - i);
+        const float barHeight = OVERLAY_GRAPH_HEIGHT
+                * std::min(ms / OVERLAY_GRAPH_MS, 1.0f);
+        AddRect(glm::vec2(x, graphEnd.y - barHeight),
+                glm::vec2(x + 1.0f, graphEnd.y), color);
+    }
+    // The line a 60Hz frame has to stay under
+    const float targetY = graphEnd.y - OVERLAY_GRAPH_HEIGHT
+            * OVERLAY_TARGET_MS / OVERLAY_GRAPH_MS;
+    AddRect(glm::vec2(pen.x, targetY), glm::vec2(graphEnd.x, targetY + 1.0f),
+            glm::vec4(1.0f, 1.0f, 1.0f, 0.5f));
+
+    m_shader.SetProjectionMatrix(glm::ortho(0.0f, (float)width,
+            (float)height, 0.0f));
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, m_fontTexture);
+    CounterAdd(COUNTER_TEXTURE_BINDS);
+    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    // Orphaned every frame, the last frame's draw may still read it
+    glBufferData(GL_ARRAY_BUFFER, m_vertices.size()*sizeof(Vertex_t),
+            &m_vertices[0], GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, m_vertices.size()*sizeof(Vertex_t));
+
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glBindVertexArray(m_vertexArray);
+    glDrawArrays(GL_TRIANGLES, 0, m_vertices.size());
+    glBindVertexArray(0);
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    CounterAdd(COUNTER_DRAW_CALLS);
+    CounterAdd(COUNTER_TRIANGLES, m_vertices.size()/3);
+}
+
+StatsOverlay::~StatsOverlay()
+{
+    if (m_vertexArray) {
+        glDeleteVertexArrays(1, &m_vertexArray);
+    }
+    if (m_vertexBuffer) {
+        glDeleteBuffers(1, &m_vertexBuffer);
+    }
+    if (m_fontTexture) {
+        glDeleteTextures(1, &m_fontTexture);
+    }
+}
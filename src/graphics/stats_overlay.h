@@ -0,0 +1,68 @@
+#ifndef STATS_OVERLAY_H
+#define STATS_OVERLAY_H
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+#include <GL/glew.h>
+#include "graphics/shader_program.h"
+
+// Screen pixels per font texel
+#define OVERLAY_TEXT_SCALE 2
+// Frame time the graph's full height stands for
+#define OVERLAY_GRAPH_MS 33.3f
+#define OVERLAY_GRAPH_HEIGHT 60.0f
+
+class StatsOverlay
+{
+    // Draws the last frame's counters and a graph of recent frame times
+    // over the top left of the frame, see util/counters.h. Everything
+    // is one vertex buffer and one draw call, text comes from a built
+    // in 5x7 font.
+public:
+    StatsOverlay() = default;
+
+    // Loads the shaders and the font the first time. Nothing is drawn
+    // when they fail to load.
+    void Draw(int32_t width, int32_t height);
+
+    // Copies are not allowed
+    StatsOverlay(const StatsOverlay &) = delete;
+    StatsOverlay& operator=(const StatsOverlay &) = delete;
+
+    ~StatsOverlay();
+
+private:
+    struct Vertex_t {
+        glm::vec2 position;
+        glm::vec2 uv;
+        glm::vec4 color;
+    };
+
+    bool Init();
+
+    void AddQuad(const glm::vec2 &min, const glm::vec2 &max,
+            const glm::vec2 &uvMin, const glm::vec2 &uvMax,
+            const glm::vec4 &color);
+
+    void AddRect(const glm::vec2 &min, const glm::vec2 &max,
+            const glm::vec4 &color);
+
+    void AddText(const glm::vec2 &position, const char *text,
+            const glm::vec4 &color);
+
+    ShaderProgram m_shader = ShaderProgram("overlay_shader");
+
+    GLuint m_vertexArray = 0;
+
+    GLuint m_vertexBuffer = 0;
+
+    GLuint m_fontTexture = 0;
+
+    bool m_initialized = false;
+
+    bool m_failed = false;
+
+    std::vector<Vertex_t> m_vertices;
+};
+
+#endif
@@ -1,56 +1,326 @@
 #include "event.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <GL/glew.h>
 #include "SDL.h"
 #include "window.h"
 #include "scene.h"
+#include "gui/input_record.h"
+#include "graphics/stats_overlay.h"
+#include "util/stats.h"
+#include "util/counters.h"
+#include "util/log.h"
+#include "util/profiler.h"
+
+// Simulated time each replayed or headless frame moves on by
+#define FIXED_FRAME_MICROSECONDS 16667
+#define FIXED_FRAME_SECONDS (FIXED_FRAME_MICROSECONDS / 1000000.0)
+
+static FrameScheduler frameScheduler;
+static InputRecorder recorder;
+static uint64_t recordStart = 0;
+static InputReplay replay;
+static FILE *frameTimesFile = NULL;
+static StatsOverlay statsOverlay;
+static bool showStatsOverlay = false;
+// Every frame's times, kept during replays and headless runs
+static std::vector<double> frameCpuMs;
+static std::vector<double> frameTotalMs;
+static std::vector<double> frameGpuMs;
+
+bool SetFrameMode(FrameMode_t mode, double targetFps)
+{
+    return frameScheduler.SetMode(mode, targetFps);
+}
+
+void SetStatsOverlay(bool visible)
+{
+    showStatsOverlay = visible;
+}
+
+// Over the scene, before the frame is swapped or saved
+static void DrawStatsOverlay()
+{
+    if (showStatsOverlay) {
+        statsOverlay.Draw(GetWindowWidth(), GetWindowHeight());
+    }
+}
+
+static void CycleFrameMode()
+{
+    FrameMode_t mode = (FrameMode_t)((frameScheduler.GetMode() + 1)
+            % FRAME_MODE_COUNT);
+    double targetFps = frameScheduler.GetTargetFps();
+    if (targetFps <= 0.0) {
+        targetFps = DEFAULT_TARGET_FPS;
+    }
+    // Adaptive vsync may fall back to plain vsync, go past it then
+    if (frameScheduler.GetMode() == FRAME_MODE_VSYNC
+            && mode == FRAME_MODE_ADAPTIVE_VSYNC) {
+        SetFrameMode(mode, targetFps);
+        if (frameScheduler.GetMode() != FRAME_MODE_VSYNC) {
+            return;
+        }
+        mode = FRAME_MODE_LIMITED;
+    }
+    SetFrameMode(mode, targetFps);
+}
+
+// False once the loop should stop
+static bool HandleEvent(const SDL_Event &event)
+{
+    static float oldx = 0.0f, oldy = 0.0f;
+    if (event.type == SDL_QUIT) {
+        return false;
+    } else if (event.type == SDL_WINDOWEVENT) {
+        switch (event.window.event) {
+        case SDL_WINDOWEVENT_SIZE_CHANGED:
+            WindowResize(event.window.data1,
+                event.window.data2); // TODO: Consolidate resize funcs
+            SceneWindowResize(event.window.data1,
+                event.window.data2);
+        }
+    } else if (event.type == SDL_KEYDOWN) {
+        switch (event.key.keysym.sym) {
+        case SDLK_ESCAPE:
+            return false;
+        case SDLK_v:
+            if (!event.key.repeat) {
+                CycleFrameMode();
+            }
+            break;
+        case SDLK_F3:
+            if (!event.key.repeat) {
+                SetStatsOverlay(!showStatsOverlay);
+            }
+            break;
+        case SDLK_t:
+            if (!event.key.repeat && !PROFILE_BEGIN_CAPTURE(
+                    PROFILE_DEFAULT_FILENAME, PROFILE_CAPTURE_FRAMES)) {
+                Warning("No capture started, one may be running or the "
+                        "build lacks the profiler (make PROFILE=1)");
+            }
+            break;
+        default:
+            KeyboardInput(event.key.keysym.scancode, SDL_KEYDOWN);
+            break;
+        }
+    } else if (event.type == SDL_KEYUP) {
+        KeyboardInput(event.key.keysym.scancode, SDL_KEYUP);
+    } else if (event.type == SDL_MOUSEBUTTONDOWN) {
+        // if (event.button.button & SDL_BUTTON_LMASK) {
+        SDL_ShowCursor(SDL_FALSE);
+        SDL_SetRelativeMouseMode(SDL_TRUE);
+        oldx = event.button.x;
+        oldy = event.button.y;
+        // }
+    } else if (event.type == SDL_MOUSEBUTTONUP) {
+        // if (event.button.button & SDL_BUTTON_LMASK) {
+        SDL_ShowCursor(SDL_TRUE);
+        SDL_SetRelativeMouseMode(SDL_FALSE);
+        SDL_WarpMouseInWindow(GetWindow(), oldx, oldy);
+        // }
+    } else if (event.type == SDL_MOUSEMOTION) {
+        if(event.motion.state) { // & SDL_BUTTON_LMASK
+            MouseMotion(event.motion.xrel, event.motion.yrel);
+        }
+    }
+    return true;
+}
+
+static uint32_t MicrosecondsSince(uint64_t counter)
+{
+    return (uint32_t)((SDL_GetPerformanceCounter() - counter) * 1000000
+            / SDL_GetPerformanceFrequency());
+}
+
+static double MillisecondsBetween(uint64_t start, uint64_t end)
+{
+    return (end - start) * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+bool StartRecording(const char *filename)
+{
+    if (!recorder.Open(filename)) {
+        return false;
+    }
+    recordStart = SDL_GetPerformanceCounter();
+    // Replays start out at the size the recording did
+    SDL_Event event;
+    memset(&event, 0, sizeof(event));
+    event.type = SDL_WINDOWEVENT;
+    event.window.event = SDL_WINDOWEVENT_SIZE_CHANGED;
+    event.window.data1 = GetWindowWidth();
+    event.window.data2 = GetWindowHeight();
+    recorder.Add(event, 0);
+    return true;
+}
+
+static bool OpenFrameTimes(const char *filename)
+{
+    frameTimesFile = fopen(filename, "w");
+    if (frameTimesFile == NULL) {
+        Error("Could not open '%s' for frame times", filename);
+        return false;
+    }
+    fprintf(frameTimesFile, "frame,cpu_ms,frame_ms,gpu_ms\n");
+    return true;
+}
+
+bool StartReplay(const char *filename, const char *timesFilename)
+{
+    if (!replay.Open(filename)) {
+        return false;
+    }
+    if (timesFilename && !OpenFrameTimes(timesFilename)) {
+        return false;
+    }
+    // As fast as it goes, and the same simulated time every frame
+    SetFrameMode(FRAME_MODE_UNCAPPED);
+    SceneSetFixedFrameTime(FIXED_FRAME_SECONDS);
+    return true;
+}
+
+static void PrintSummary(const char *name, const std::vector<double> &times)
+{
+    const TimeSummary_t s = SummarizeTimes(times);
+    printf("%-8s mean %8.3f  p50 %8.3f  p95 %8.3f  p99 %8.3f  "
+            "max %8.3f ms\n", name, s.mean, s.p50, s.p95, s.p99, s.max);
+}
+
+static void FinishFrameTimes()
+{
+    if (frameTimesFile) {
+        fclose(frameTimesFile);
+        frameTimesFile = NULL;
+    }
+    PrintSummary("cpu", frameCpuMs);
+    PrintSummary("frame", frameTotalMs);
+    if (frameGpuMs.size() > 0) {
+        PrintSummary("gpu", frameGpuMs);
+    }
+    fflush(stdout);
+}
+
+// Frame `frame` took `cpuMs` to build and submit and `frameMs` in all.
+// GPU times arrive a few frames late, each frame logs the latest.
+static void AddFrameTimes(size_t frame, double cpuMs, double frameMs)
+{
+    double prepassMs, shadingMs;
+    SceneGetPassTimes(prepassMs, shadingMs);
+    double gpuMs = -1.0;
+    if (shadingMs >= 0.0) {
+        gpuMs = std::max(prepassMs, 0.0) + shadingMs;
+        frameGpuMs.push_back(gpuMs);
+    }
+    frameCpuMs.push_back(cpuMs);
+    frameTotalMs.push_back(frameMs);
+    if (frameTimesFile) {
+        fprintf(frameTimesFile, "%lu,%.4f,%.4f,%.4f\n",
+                (unsigned long)frame, cpuMs, frameMs, gpuMs);
+    }
+}
 
 void RunEventLoop()
 {
     SDL_Event event;
-    float oldx = 0.0f, oldy = 0.0f;
+    std::vector<SDL_Event> replayEvents;
+    uint32_t replayMicroseconds = 0;
     while (true) {
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_QUIT) {
-                return;
-            } else if (event.type == SDL_WINDOWEVENT) {
-                switch (event.window.event) {
-                case SDL_WINDOWEVENT_SIZE_CHANGED:
-                    WindowResize(event.window.data1,
-                        event.window.data2); // TODO: Consolidate resize funcs
-                    SceneWindowResize(event.window.data1,
-                        event.window.data2);
-                }
-            } else if (event.type == SDL_KEYDOWN) {
-                switch (event.key.keysym.sym) {
-                case SDLK_ESCAPE:
-                    return;
-                default:
-                    KeyboardInput(event.key.keysym.scancode, SDL_KEYDOWN);
-                    break;
-                }
-            } else if (event.type == SDL_KEYUP) {
-                KeyboardInput(event.key.keysym.scancode, SDL_KEYUP);
-            } else if (event.type == SDL_MOUSEBUTTONDOWN) {
-                // if (event.button.button & SDL_BUTTON_LMASK) {
-                SDL_ShowCursor(SDL_FALSE);
-                SDL_SetRelativeMouseMode(SDL_TRUE);
-                oldx = event.button.x;
-                oldy = event.button.y;
-                // }
-            } else if (event.type == SDL_MOUSEBUTTONUP) {
-                // if (event.button.button & SDL_BUTTON_LMASK) {
-                SDL_ShowCursor(SDL_TRUE);
-                SDL_SetRelativeMouseMode(SDL_FALSE);
-                SDL_WarpMouseInWindow(GetWindow(), oldx, oldy);
-                // }
-            } else if (event.type == SDL_MOUSEMOTION) {
-                if(event.motion.state) { // & SDL_BUTTON_LMASK
-                    MouseMotion(event.motion.xrel, event.motion.yrel);
+        PROFILE_END_FRAME();
+        PROFILE_SCOPE("Frame");
+        // Input is read right before the frame that uses it
+        {
+            PROFILE_SCOPE("Wait");
+            frameScheduler.WaitForNextFrame();
+        }
+        const uint64_t frameStart = SDL_GetPerformanceCounter();
+        bool running = true;
+        while (running && SDL_PollEvent(&event)) {
+            PROFILE_SCOPE("Event");
+            if (replay.IsOpen() && IsRecordedEvent(event)) {
+                continue; // Only the recording moves things
+            }
+            if (recorder.IsOpen()) {
+                recorder.Add(event, MicrosecondsSince(recordStart));
+            }
+            running = HandleEvent(event);
+        }
+        if (replay.IsOpen()) {
+            replayMicroseconds += FIXED_FRAME_MICROSECONDS;
+            replayEvents.clear();
+            replay.Next(replayMicroseconds, replayEvents);
+            for (size_t i=0; i<replayEvents.size(); i++) {
+                if (replayEvents[i].type == SDL_WINDOWEVENT) {
+                    SDL_SetWindowSize(GetWindow(),
+                            replayEvents[i].window.data1,
+                            replayEvents[i].window.data2);
                 }
+                HandleEvent(replayEvents[i]);
+            }
+        }
+        if (!running) {
+            break;
+        }
+        ClearDepthBuffer();
+        SceneRender();
+        DrawStatsOverlay();
+        const uint64_t submitted = SDL_GetPerformanceCounter();
+        {
+            PROFILE_SCOPE("Swap");
+            SwapBuffer();
+        }
+        frameScheduler.EndFrame();
+        CountersEndFrame();
+        if (replay.IsOpen()) {
+            AddFrameTimes(frameCpuMs.size(),
+                    MillisecondsBetween(frameStart, submitted),
+                    MillisecondsBetween(frameStart,
+                    SDL_GetPerformanceCounter()));
+            if (replay.IsDone()) {
+                break;
             }
         }
+    }
+    if (recorder.IsOpen()) {
+        recorder.Close(MicrosecondsSince(recordStart));
+    }
+    if (replay.IsOpen()) {
+        Info("Replayed %lu frames", (unsigned long)frameCpuMs.size());
+        FinishFrameTimes();
+    }
+}
+
+void RunHeadlessFrames(uint32_t numFrames, const char *saveFilename,
+        const char *timesFilename)
+{
+    if (timesFilename && !OpenFrameTimes(timesFilename)) {
+        return;
+    }
+    SceneSetFixedFrameTime(FIXED_FRAME_SECONDS);
+    for (uint32_t i=0; i<numFrames; i++) {
+        PROFILE_END_FRAME();
+        PROFILE_SCOPE("Frame");
+        const uint64_t frameStart = SDL_GetPerformanceCounter();
         ClearDepthBuffer();
         SceneRender();
-        SwapBuffer();
-        SDL_Delay(10);
+        DrawStatsOverlay();
+        const uint64_t submitted = SDL_GetPerformanceCounter();
+        if (i+1 == numFrames && saveFilename) {
+            SaveFramebuffer(saveFilename);
+        }
+        {
+            PROFILE_SCOPE("Swap");
+            SwapBuffer();
+            // Without a swap to wait on the CPU could run frames ahead
+            glFinish();
+        }
+        CountersEndFrame();
+        AddFrameTimes(i, MillisecondsBetween(frameStart, submitted),
+                MillisecondsBetween(frameStart, SDL_GetPerformanceCounter()));
     }
+    Info("Rendered %u frames", numFrames);
+    FinishFrameTimes();
 }
@@ -1,6 +1,33 @@
 #ifndef EVENT_H
 #define EVENT_H
+#include <cstdint>
+#include "gui/frame_scheduler.h"
+
+// Rate the limiter starts at when V switches to it
+#define DEFAULT_TARGET_FPS 120.0
+#define DEFAULT_HEADLESS_FRAMES 60
+
+// Picks how the event loop paces frames, V cycles through the modes
+bool SetFrameMode(FrameMode_t mode, double targetFps=DEFAULT_TARGET_FPS);
+
+// Saves the input events the loop handles to `filename` until it ends
+bool StartRecording(const char *filename);
+
+// Feeds a recording back instead of live input, a frame at a time of
+// fixed simulated time and as fast as frames can be drawn. The loop
+// ends with the recording and prints a summary of the frame times,
+// per frame times go to `timesFilename` as CSV unless it is NULL.
+bool StartReplay(const char *filename, const char *timesFilename);
+
+// F3 shows and hides the counters and frame time graph
+void SetStatsOverlay(bool visible);
 
 void RunEventLoop();
 
+// Draws `numFrames` frames of fixed simulated time with no input, for
+// CreateHeadlessWindow. The last frame is saved to `saveFilename`
+// unless it is NULL, frame times are summarized like a replay's.
+void RunHeadlessFrames(uint32_t numFrames, const char *saveFilename,
+        const char *timesFilename);
+
 #endif
@@ -0,0 +1,153 @@
+#include "frame_scheduler.h"
+#include <cmath>
+#include <algorithm>
+#include <SDL.h>
+#include "util/log.h"
+
+// The OS sleep can overshoot by a scheduler tick, wake up this long
+// before a limited frame is due and spin for the rest
+#define FRAME_SPIN_MS 2.0
+// Frames more than this many periods late restart the pacing instead
+// of rushing to catch up
+#define FRAME_MAX_LATE_PERIODS 2
+
+const char* GetFrameModeName(FrameMode_t mode)
+{
+    switch (mode) {
+    case FRAME_MODE_UNCAPPED:
+        return "uncapped";
+    case FRAME_MODE_VSYNC:
+        return "vsync";
+    case FRAME_MODE_ADAPTIVE_VSYNC:
+        return "adaptive vsync";
+    case FRAME_MODE_LIMITED:
+        return "limited";
+    default:
+        return "unknown";
+    }
+}
+
+FrameScheduler::FrameScheduler()
+{
+    m_intervals.resize(FRAME_STATS_WINDOW, 0.0);
+}
+
+bool FrameScheduler::SetMode(FrameMode_t mode, double targetFps)
+{
+    m_frequency = SDL_GetPerformanceFrequency();
+    if (mode == FRAME_MODE_LIMITED && targetFps <= 0.0) {
+        Error("Frame limiter needs a positive target rate");
+        return false;
+    }
+    int interval = 0;
+    if (mode == FRAME_MODE_VSYNC) {
+        interval = 1;
+    } else if (mode == FRAME_MODE_ADAPTIVE_VSYNC) {
+        interval = -1;
+    }
+    if (SDL_GL_SetSwapInterval(interval) != 0) {
+        if (mode != FRAME_MODE_ADAPTIVE_VSYNC
+                || SDL_GL_SetSwapInterval(1) != 0) {
+            Error("Failed to set swap interval %d", interval);
+            Error(SDL_GetError());
+            return false;
+        }
+        Warning("Adaptive vsync unsupported, using vsync");
+        mode = FRAME_MODE_VSYNC;
+    }
+    m_mode = mode;
+    m_targetFps = mode == FRAME_MODE_LIMITED ? targetFps : 0.0;
+    m_period = 0;
+    if (m_targetFps > 0.0) {
+        m_period = (uint64_t)(m_frequency / m_targetFps);
+    }
+    m_deadline = 0;
+    // The old mode's intervals say nothing about this one
+    m_next = 0;
+    m_stats = { 0, 0.0, 0.0, 0.0, 0.0 };
+    if (m_mode == FRAME_MODE_LIMITED) {
+        Info("Frames %s to %.1f per second", GetFrameModeName(m_mode),
+                m_targetFps);
+    } else {
+        Info("Frames %s", GetFrameModeName(m_mode));
+    }
+    return true;
+}
+
+FrameMode_t FrameScheduler::GetMode() const
+{
+    return m_mode;
+}
+
+double FrameScheduler::GetTargetFps() const
+{
+    return m_targetFps;
+}
+
+void FrameScheduler::WaitForNextFrame()
+{
+    if (m_mode != FRAME_MODE_LIMITED) {
+        return; // The swap already waited if it had to
+    }
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (m_deadline == 0 || now > m_deadline
+            + FRAME_MAX_LATE_PERIODS*m_period) {
+        m_deadline = now;
+    }
+    const uint64_t spinTicks = (uint64_t)(FRAME_SPIN_MS * 0.001
+            * m_frequency);
+    if (m_deadline > now + spinTicks) {
+        const uint64_t sleepTicks = m_deadline - now - spinTicks;
+        SDL_Delay((Uint32)(sleepTicks * 1000 / m_frequency));
+    }
+    while (SDL_GetPerformanceCounter() < m_deadline) {
+        // Spin, the sleep above left at most FRAME_SPIN_MS
+    }
+    // Due times advance by whole periods so the rate doesn't drift
+    m_deadline += m_period;
+}
+
+void FrameScheduler::EndFrame()
+{
+    const uint64_t now = SDL_GetPerformanceCounter();
+    if (m_lastFrameEnd != 0) {
+        m_intervals[m_next % FRAME_STATS_WINDOW] =
+                (now - m_lastFrameEnd) * 1000.0 / m_frequency;
+        m_next++;
+        if (m_next % FRAME_STATS_WINDOW == 0) {
+            UpdateStats();
+            Debug("Frames: %.2fms mean, %.2fms jitter, %.2f-%.2fms",
+                    m_stats.meanMs, m_stats.jitterMs, m_stats.minMs,
+                    m_stats.maxMs);
+        }
+    }
+    m_lastFrameEnd = now;
+}
+
+void FrameScheduler::UpdateStats()
+{
+    const uint32_t count = std::min(m_next, (uint32_t)FRAME_STATS_WINDOW);
+    double sum = 0.0;
+    double minMs = m_intervals[0];
+    double maxMs = m_intervals[0];
+    for (uint32_t i=0; i<count; i++) {
+        sum += m_intervals[i];
+        minMs = std::min(minMs, m_intervals[i]);
+        maxMs = std::max(maxMs, m_intervals[i]);
+    }
+    const double mean = count > 0 ? sum / count : 0.0;
+    double variance = 0.0;
+    for (uint32_t i=0; i<count; i++) {
+        variance += (m_intervals[i] - mean) * (m_intervals[i] - mean);
+    }
+    m_stats.numFrames = count;
+    m_stats.meanMs = mean;
+    m_stats.jitterMs = count > 0 ? sqrt(variance / count) : 0.0;
+    m_stats.minMs = count > 0 ? minMs : 0.0;
+    m_stats.maxMs = count > 0 ? maxMs : 0.0;
+}
+
+const FrameStats_t& FrameScheduler::GetStats() const
+{
+    return m_stats;
+}
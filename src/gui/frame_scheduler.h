@@ -0,0 +1,77 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+#include <cstdint>
+#include <vector>
+
+// Frames whose intervals the stats cover
+#define FRAME_STATS_WINDOW 240
+
+enum FrameMode_t {
+    FRAME_MODE_UNCAPPED, // Render as fast as possible
+    FRAME_MODE_VSYNC, // Swaps wait for the display
+    FRAME_MODE_ADAPTIVE_VSYNC, // Like vsync, but late frames swap at once
+    FRAME_MODE_LIMITED, // Paced to a target rate by the CPU
+    FRAME_MODE_COUNT
+};
+
+struct FrameStats_t {
+    uint32_t numFrames; // Intervals measured so far, at most the window
+    double meanMs;
+    double jitterMs; // Standard deviation of the frame intervals
+    double minMs;
+    double maxMs;
+};
+
+class FrameScheduler
+{
+    // Decides when each frame starts. With vsync the swap paces the
+    // loop, the limiter instead sleeps until shortly before the next
+    // frame is due and spins on the performance counter for the rest.
+    // Input should be polled after WaitForNextFrame returns so it is
+    // as fresh as it can be when the frame is rendered.
+public:
+    FrameScheduler();
+
+    // Sets the swap interval `mode` needs, a GL context must exist.
+    // Adaptive vsync falls back to vsync where the driver lacks it.
+    bool SetMode(FrameMode_t mode, double targetFps=0.0);
+
+    FrameMode_t GetMode() const;
+
+    double GetTargetFps() const;
+
+    // Returns once the next frame is due
+    void WaitForNextFrame();
+
+    // Call after the frame's swap to record when it was presented
+    void EndFrame();
+
+    // Updated every FRAME_STATS_WINDOW frames, and logged then
+    const FrameStats_t& GetStats() const;
+
+private:
+    void UpdateStats();
+
+    FrameMode_t m_mode = FRAME_MODE_UNCAPPED;
+
+    double m_targetFps = 0.0;
+
+    uint64_t m_frequency = 1;
+
+    uint64_t m_period = 0; // Performance counter ticks per frame
+
+    uint64_t m_deadline = 0; // When the next limited frame is due
+
+    uint64_t m_lastFrameEnd = 0;
+
+    // Milliseconds between frame ends, a ring of FRAME_STATS_WINDOW
+    std::vector<double> m_intervals;
+
+    uint32_t m_next = 0;
+
+    FrameStats_t m_stats = { 0, 0.0, 0.0, 0.0, 0.0 };
+};
+
+const char* GetFrameModeName(FrameMode_t mode);
+
+#endif
@@ -0,0 +1,239 @@
+#include "headless.h"
+#include "util/log.h"
+#if defined(HEADLESS_EGL)
+#include <cstring>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#elif defined(HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+#if defined(HEADLESS_EGL)
+
+static EGLDisplay display = EGL_NO_DISPLAY;
+static EGLConfig config;
+static EGLContext context = EGL_NO_CONTEXT;
+static EGLContext sharedContext = EGL_NO_CONTEXT;
+
+static const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 2,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK,
+    EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+};
+
+// Mesa's surfaceless platform needs no GPU or display server, drivers
+// without it may still hand out a default display that works
+static EGLDisplay GetSurfacelessDisplay()
+{
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY,
+            EGL_EXTENSIONS);
+    if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress(
+                "eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            EGLDisplay surfaceless = getPlatformDisplay(
+                    EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+            if (surfaceless != EGL_NO_DISPLAY) {
+                return surfaceless;
+            }
+        }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+bool CreateHeadlessContext()
+{
+    display = GetSurfacelessDisplay();
+    EGLint major = 0, minor = 0;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major,
+            &minor)) {
+        Error("Failed to initialize an EGL display");
+        return false;
+    }
+    const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context")) {
+        Error("EGL display can't make a context current without a surface");
+        DestroyHeadlessContext();
+        return false;
+    }
+    if (!eglBindAPI(EGL_OPENGL_API)) {
+        Error("EGL display has no desktop OpenGL");
+        DestroyHeadlessContext();
+        return false;
+    }
+    // The default surface type is windows, which surfaceless lacks
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_DONT_CARE,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs)
+            || numConfigs < 1) {
+        Error("No EGL config renders OpenGL");
+        DestroyHeadlessContext();
+        return false;
+    }
+    context = eglCreateContext(display, config, EGL_NO_CONTEXT,
+            contextAttribs);
+    if (context == EGL_NO_CONTEXT) {
+        Error("Failed to create a GL 3.2 core context with EGL");
+        DestroyHeadlessContext();
+        return false;
+    }
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        Error("Failed to make the EGL context current");
+        DestroyHeadlessContext();
+        return false;
+    }
+    Info("Headless EGL %d.%d context", major, minor);
+    return true;
+}
+
+void DestroyHeadlessContext()
+{
+    if (display == EGL_NO_DISPLAY) {
+        return;
+    }
+    DestroyHeadlessSharedContext();
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (context != EGL_NO_CONTEXT) {
+        eglDestroyContext(display, context);
+        context = EGL_NO_CONTEXT;
+    }
+    eglTerminate(display);
+    display = EGL_NO_DISPLAY;
+}
+
+bool CreateHeadlessSharedContext()
+{
+    if (context == EGL_NO_CONTEXT) {
+        return false;
+    }
+    sharedContext = eglCreateContext(display, config, context,
+            contextAttribs);
+    if (sharedContext == EGL_NO_CONTEXT) {
+        Warning("EGL can't create a context sharing the headless one");
+        return false;
+    }
+    return true;
+}
+
+bool MakeHeadlessSharedContextCurrent(bool current)
+{
+    return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE,
+            current ? sharedContext : EGL_NO_CONTEXT);
+}
+
+void DestroyHeadlessSharedContext()
+{
+    if (sharedContext != EGL_NO_CONTEXT) {
+        eglDestroyContext(display, sharedContext);
+        sharedContext = EGL_NO_CONTEXT;
+    }
+}
+
+#elif defined(HEADLESS_OSMESA)
+
+static OSMesaContext context = NULL;
+static OSMesaContext sharedContext = NULL;
+// OSMesa must have a color buffer to make the context current,
+// frames go to framebuffer objects so a pixel is enough
+static GLubyte buffer[4];
+static GLubyte sharedBuffer[4];
+
+static const int attribs[] = {
+    OSMESA_FORMAT, OSMESA_RGBA,
+    OSMESA_DEPTH_BITS, 0,
+    OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+    OSMESA_CONTEXT_MAJOR_VERSION, 3,
+    OSMESA_CONTEXT_MINOR_VERSION, 2,
+    0
+};
+
+bool CreateHeadlessContext()
+{
+    context = OSMesaCreateContextAttribs(attribs, NULL);
+    if (context == NULL) {
+        Error("Failed to create a GL 3.2 core context with OSMesa");
+        return false;
+    }
+    if (!OSMesaMakeCurrent(context, buffer, GL_UNSIGNED_BYTE, 1, 1)) {
+        Error("Failed to make the OSMesa context current");
+        DestroyHeadlessContext();
+        return false;
+    }
+    Info("Headless OSMesa context");
+    return true;
+}
+
+void DestroyHeadlessContext()
+{
+    DestroyHeadlessSharedContext();
+    if (context) {
+        OSMesaDestroyContext(context);
+        context = NULL;
+    }
+}
+
+bool CreateHeadlessSharedContext()
+{
+    if (context == NULL) {
+        return false;
+    }
+    sharedContext = OSMesaCreateContextAttribs(attribs, context);
+    if (sharedContext == NULL) {
+        Warning("OSMesa can't create a context sharing the headless one");
+        return false;
+    }
+    return true;
+}
+
+bool MakeHeadlessSharedContextCurrent(bool current)
+{
+    if (!current) {
+        return OSMesaMakeCurrent(NULL, NULL, 0, 0, 0);
+    }
+    return OSMesaMakeCurrent(sharedContext, sharedBuffer, GL_UNSIGNED_BYTE,
+            1, 1);
+}
+
+void DestroyHeadlessSharedContext()
+{
+    if (sharedContext) {
+        OSMesaDestroyContext(sharedContext);
+        sharedContext = NULL;
+    }
+}
+
+#else
+
+bool CreateHeadlessContext()
+{
+    Error("Built without a headless backend, build with make "
+            "HEADLESS=egl or HEADLESS=osmesa");
+    return false;
+}
+
+void DestroyHeadlessContext()
+{
+}
+
+bool CreateHeadlessSharedContext()
+{
+    return false;
+}
+
+bool MakeHeadlessSharedContextCurrent(bool)
+{
+    return false;
+}
+
+void DestroyHeadlessSharedContext()
+{
+}
+
+#endif
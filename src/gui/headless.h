@@ -0,0 +1,22 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Makes a GL 3.2 core context current without a window or display,
+// for rendering into framebuffer objects on machines without either.
+// Built with HEADLESS_EGL (make HEADLESS=egl) it uses a surfaceless
+// EGL display (Mesa's llvmpipe renders it on the CPU), with
+// HEADLESS_OSMESA (make HEADLESS=osmesa) it uses OSMesa. Without
+// either it always fails.
+bool CreateHeadlessContext();
+
+void DestroyHeadlessContext();
+
+// A second context sharing objects with the headless one, see
+// CreateSharedContext
+bool CreateHeadlessSharedContext();
+
+bool MakeHeadlessSharedContextCurrent(bool current);
+
+void DestroyHeadlessSharedContext();
+
+#endif
@@ -0,0 +1,183 @@
+#include "input_record.h"
+#include <cstring>
+#include "util/log.h"
+
+bool IsRecordedEvent(const SDL_Event &event)
+{
+    switch (event.type) {
+    case SDL_KEYDOWN:
+    case SDL_KEYUP:
+        // Escape, V, T and F3 drive the event loop, the profiler and the
+        // stats overlay rather than the scene
+        return event.key.keysym.sym != SDLK_ESCAPE
+                && event.key.keysym.sym != SDLK_v
+                && event.key.keysym.sym != SDLK_t
+                && event.key.keysym.sym != SDLK_F3;
+    case SDL_MOUSEMOTION:
+        return true;
+    case SDL_WINDOWEVENT:
+        return event.window.event == SDL_WINDOWEVENT_SIZE_CHANGED;
+    default:
+        return false;
+    }
+}
+
+bool InputRecorder::Open(const char *filename)
+{
+    m_file = fopen(filename, "wb");
+    if (m_file == NULL) {
+        Error("Could not open '%s' to record input", filename);
+        return false;
+    }
+    const uint32_t header[2] = { INPUT_RECORD_MAGIC, INPUT_RECORD_VERSION };
+    if (fwrite(header, sizeof(header), 1, m_file) != 1) {
+        Error("Failed writing '%s'", filename);
+        fclose(m_file);
+        m_file = NULL;
+        return false;
+    }
+    Info("Recording input to '%s'", filename);
+    return true;
+}
+
+bool InputRecorder::IsOpen() const
+{
+    return m_file != NULL;
+}
+
+void InputRecorder::Add(const SDL_Event &event, uint32_t microseconds)
+{
+    if (!m_file || !IsRecordedEvent(event)) {
+        return;
+    }
+    InputEvent_t record;
+    memset(&record, 0, sizeof(record));
+    record.microseconds = microseconds;
+    if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
+        record.type = INPUT_EVENT_KEY;
+        record.state = event.type == SDL_KEYDOWN ? SDL_PRESSED : SDL_RELEASED;
+        record.code = (uint16_t)event.key.keysym.scancode;
+    } else if (event.type == SDL_MOUSEMOTION) {
+        record.type = INPUT_EVENT_MOUSE_MOTION;
+        record.state = (uint8_t)event.motion.state;
+        record.x = (int16_t)event.motion.xrel;
+        record.y = (int16_t)event.motion.yrel;
+    } else {
+        record.type = INPUT_EVENT_RESIZE;
+        record.x = (int16_t)event.window.data1;
+        record.y = (int16_t)event.window.data2;
+    }
+    Write(record);
+}
+
+void InputRecorder::Close(uint32_t microseconds)
+{
+    if (!m_file) {
+        return;
+    }
+    InputEvent_t record;
+    memset(&record, 0, sizeof(record));
+    record.microseconds = microseconds;
+    record.type = INPUT_EVENT_END;
+    Write(record);
+    fclose(m_file);
+    m_file = NULL;
+    Info("Recorded %.2fs of input", microseconds / 1000000.0);
+}
+
+void InputRecorder::Write(const InputEvent_t &record)
+{
+    if (fwrite(&record, sizeof(record), 1, m_file) != 1) {
+        Error("Failed writing input record, recording stopped");
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+InputRecorder::~InputRecorder()
+{
+    if (m_file) {
+        fclose(m_file);
+    }
+}
+
+bool InputReplay::Open(const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        Error("Could not open input recording '%s'", filename);
+        return false;
+    }
+    uint32_t header[2] = { 0, 0 };
+    if (fread(header, sizeof(header), 1, file) != 1
+            || header[0] != INPUT_RECORD_MAGIC
+            || header[1] != INPUT_RECORD_VERSION) {
+        Error("'%s' is not an input recording this build reads", filename);
+        fclose(file);
+        return false;
+    }
+    m_events.clear();
+    InputEvent_t record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        m_events.push_back(record);
+    }
+    fclose(file);
+    if (m_events.size() == 0 || m_events.back().type != INPUT_EVENT_END) {
+        Warning("Input recording '%s' was cut short", filename);
+    }
+    m_length = m_events.size() > 0 ? m_events.back().microseconds : 0;
+    m_next = 0;
+    m_open = true;
+    m_done = false;
+    Info("Replaying %.2fs of input from '%s'", m_length / 1000000.0,
+            filename);
+    return true;
+}
+
+bool InputReplay::IsOpen() const
+{
+    return m_open;
+}
+
+void InputReplay::Next(uint32_t microseconds, std::vector<SDL_Event> &events)
+{
+    while (m_next < m_events.size()
+            && m_events[m_next].microseconds <= microseconds) {
+        const InputEvent_t &record = m_events[m_next++];
+        SDL_Event event;
+        memset(&event, 0, sizeof(event));
+        if (record.type == INPUT_EVENT_KEY) {
+            event.type = record.state == SDL_PRESSED ? SDL_KEYDOWN : SDL_KEYUP;
+            event.key.state = record.state;
+            event.key.keysym.scancode = (SDL_Scancode)record.code;
+            event.key.keysym.sym = SDL_GetKeyFromScancode(
+                    event.key.keysym.scancode);
+        } else if (record.type == INPUT_EVENT_MOUSE_MOTION) {
+            event.type = SDL_MOUSEMOTION;
+            event.motion.state = record.state;
+            event.motion.xrel = record.x;
+            event.motion.yrel = record.y;
+        } else if (record.type == INPUT_EVENT_RESIZE) {
+            event.type = SDL_WINDOWEVENT;
+            event.window.event = SDL_WINDOWEVENT_SIZE_CHANGED;
+            event.window.data1 = record.x;
+            event.window.data2 = record.y;
+        } else {
+            continue;
+        }
+        events.push_back(event);
+    }
+    if (microseconds >= m_length) {
+        m_done = true;
+    }
+}
+
+bool InputReplay::IsDone() const
+{
+    return m_done;
+}
+
+uint32_t InputReplay::GetLength() const
+{
+    return m_length;
+}
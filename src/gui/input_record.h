@@ -0,0 +1,91 @@
+#ifndef INPUT_RECORD_H
+#define INPUT_RECORD_H
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <SDL.h>
+
+#define INPUT_RECORD_MAGIC 0x43455249 // "IREC"
+#define INPUT_RECORD_VERSION 1
+
+enum InputEventType_t {
+    INPUT_EVENT_KEY, // code = scancode, state = SDL_PRESSED or not
+    INPUT_EVENT_MOUSE_MOTION, // x, y relative, state = button mask
+    INPUT_EVENT_RESIZE, // x, y = width, height
+    INPUT_EVENT_END // Where the recording stopped
+};
+
+// One event as stored, 12 bytes in the machine's byte order after an
+// 8 byte header of INPUT_RECORD_MAGIC and INPUT_RECORD_VERSION
+struct InputEvent_t {
+    uint32_t microseconds; // Since the recording started
+    uint8_t type; // InputEventType_t
+    uint8_t state;
+    uint16_t code;
+    int16_t x;
+    int16_t y;
+};
+
+// False for events that aren't recorded, such as quitting
+bool IsRecordedEvent(const SDL_Event &event);
+
+class InputRecorder
+{
+    // Appends the input events the event loop handles to a file
+public:
+    InputRecorder() = default;
+
+    bool Open(const char *filename);
+
+    bool IsOpen() const;
+
+    // Ignores events IsRecordedEvent turns down
+    void Add(const SDL_Event &event, uint32_t microseconds);
+
+    // Marks the end and closes the file
+    void Close(uint32_t microseconds);
+
+    // Copies are not allowed
+    InputRecorder(const InputRecorder &) = delete;
+    InputRecorder& operator=(const InputRecorder &) = delete;
+
+    ~InputRecorder();
+
+private:
+    void Write(const InputEvent_t &record);
+
+    FILE *m_file = NULL;
+};
+
+class InputReplay
+{
+    // Reads a whole recording and hands its events back as SDL events
+    // as the replay's clock passes their time
+public:
+    InputReplay() = default;
+
+    bool Open(const char *filename);
+
+    bool IsOpen() const;
+
+    // Appends every event due by `microseconds` not handed out yet
+    void Next(uint32_t microseconds, std::vector<SDL_Event> &events);
+
+    // True once the clock has passed the end of the recording
+    bool IsDone() const;
+
+    uint32_t GetLength() const;
+
+private:
+    std::vector<InputEvent_t> m_events;
+
+    size_t m_next = 0;
+
+    uint32_t m_length = 0;
+
+    bool m_open = false;
+
+    bool m_done = false;
+};
+
+#endif
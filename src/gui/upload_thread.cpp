@@ -0,0 +1,143 @@
+#include "upload_thread.h"
+#include "gui/window.h"
+#include "util/log.h"
+#include "util/profiler.h"
+
+bool UploadThread::Start()
+{
+    if (m_running.load()) {
+        return true;
+    }
+    if (!CreateSharedContext()) {
+        return false;
+    }
+    m_quit = false;
+    m_started = false;
+    m_thread = std::thread(&UploadThread::Run, this);
+    bool current;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wake.wait(lock, [this]() { return m_started; });
+        current = m_current;
+    }
+    if (!current) {
+        Warning("Upload thread couldn't make its GL context current");
+        m_thread.join();
+        DestroySharedContext();
+        return false;
+    }
+    m_running.store(true);
+    return true;
+}
+
+void UploadThread::Stop()
+{
+    if (!m_running.load()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+    m_running.store(false);
+    // Whoever still holds a ticket may use its objects from now on
+    for (size_t i=0; i<m_fences.size(); i++) {
+        glClientWaitSync(m_fences[i].second, GL_SYNC_FLUSH_COMMANDS_BIT,
+                GL_TIMEOUT_IGNORED);
+        glDeleteSync(m_fences[i].second);
+    }
+    m_fences.clear();
+    m_lastDone = m_nextTicket - 1;
+    DestroySharedContext();
+}
+
+bool UploadThread::IsRunning() const
+{
+    return m_running.load();
+}
+
+uint64_t UploadThread::Submit(const UploadFn &upload)
+{
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ticket = m_nextTicket++;
+        m_queue.emplace_back(ticket, upload);
+    }
+    m_wake.notify_all();
+    return ticket;
+}
+
+bool UploadThread::IsDone(uint64_t ticket)
+{
+    if (ticket <= m_lastDone) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // The GPU runs the uploads in order, so their fences signal in order
+    while (m_fences.size() > 0) {
+        const GLsync fence = m_fences.front().second;
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            break;
+        }
+        glDeleteSync(fence);
+        m_lastDone = m_fences.front().first;
+        m_fences.pop_front();
+    }
+    return ticket <= m_lastDone;
+}
+
+void UploadThread::Run()
+{
+    PROFILE_THREAD_NAME("Upload");
+    const bool current = MakeSharedContextCurrent(true);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_started = true;
+        m_current = current;
+    }
+    m_wake.notify_all();
+    if (!current) {
+        return;
+    }
+    while (true) {
+        std::pair<uint64_t, UploadFn> upload;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]() {
+                return m_quit || m_queue.size() > 0;
+            });
+            if (m_queue.size() == 0) {
+                break; // Quitting with nothing left
+            }
+            upload = std::move(m_queue.front());
+            m_queue.pop_front();
+        }
+        {
+            PROFILE_SCOPE("Upload");
+            upload.second();
+        }
+        const GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        // Without a flush the fence may never reach the GPU for the
+        // GL thread to see it signal
+        glFlush();
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fences.emplace_back(upload.first, fence);
+    }
+    MakeSharedContextCurrent(false);
+}
+
+UploadThread::~UploadThread()
+{
+    // The contexts may already be gone, so no GL here
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_wake.notify_all();
+        m_thread.join();
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef UPLOAD_THREAD_H
+#define UPLOAD_THREAD_H
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+#include <GL/glew.h>
+
+class UploadThread
+{
+    // Runs uploads on a thread of its own with a GL context that shares
+    // objects with the one frames are drawn with. A fence follows every
+    // upload and the GL thread only uses what it made once that fence
+    // has signalled, so frames never wait on a large copy.
+    //
+    //   const uint64_t ticket = uploads.Submit([]() { glTexImage2D(); });
+    //   ...
+    //   if (uploads.IsDone(ticket)) { glBindTexture(); }
+public:
+    typedef std::function<void()> UploadFn;
+
+    UploadThread() = default;
+
+    // Creates the shared context and starts the thread, false where
+    // contexts can't share. GL thread only.
+    bool Start();
+
+    // Runs what is still queued, then stops the thread and lets go of
+    // the context. GL thread only.
+    void Stop();
+
+    bool IsRunning() const;
+
+    // Queues `upload` to run with the shared context current, returns
+    // the ticket to check it with. Any thread.
+    uint64_t Submit(const UploadFn &upload);
+
+    // True once the upload and everything queued before it finished
+    // on the GPU. Never waits. GL thread only.
+    bool IsDone(uint64_t ticket);
+
+    // Copies are not allowed
+    UploadThread(const UploadThread &) = delete;
+    UploadThread& operator=(const UploadThread &) = delete;
+
+    ~UploadThread();
+
+private:
+    void Run();
+
+    std::thread m_thread;
+
+    std::mutex m_mutex;
+
+    std::condition_variable m_wake;
+
+    std::deque<std::pair<uint64_t, UploadFn>> m_queue;
+
+    std::deque<std::pair<uint64_t, GLsync>> m_fences; // Submission order
+
+    uint64_t m_nextTicket = 1;
+
+    uint64_t m_lastDone = 0; // GL thread only
+
+    bool m_quit = false;
+
+    bool m_started = false; // The thread tried to make its context current
+
+    bool m_current = false;
+
+    std::atomic<bool> m_running{false};
+};
+
+#endif
@@ -1,13 +1,23 @@
 #include "window.h"
+#include <cstdio>
+#include <vector>
 #include <GL/glew.h>
+#include "gui/headless.h"
 #include "util/log.h"
 
 SDL_Window *window = NULL;
 
 SDL_GLContext glContext = NULL;
 
+static SDL_GLContext sharedContext = NULL;
+
 std::pair<uint32_t, uint32_t> windowDimensions = {0, 0};
 
+// Without a window frames are drawn into this framebuffer
+static bool headless = false;
+static GLuint headlessFramebuffer = 0;
+static GLuint headlessRenderbuffers[2] = { 0, 0 }; // Color, depth
+
 SDL_GLContext GetGLContext()
 {
     return glContext;
@@ -69,6 +79,11 @@ static bool SetupGLEW()
 #ifndef __APPLE__
     glewExperimental = GL_TRUE;
     GLenum err = glewInit();
+    // GLEW built for GLX looks for an X display after it has loaded
+    // the GL functions, headless contexts have none
+    if (err == GLEW_ERROR_NO_GLX_DISPLAY && headless) {
+        err = GLEW_OK;
+    }
     if (err != GLEW_OK) {
         Error("Failed to initialize GLEW");
         Error((const char *)glewGetErrorString(err));
@@ -78,6 +93,8 @@ static bool SetupGLEW()
     return true;
 }
 
+static void SetGLState();
+
 static bool SetGLAttributes()
 {
     if (SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3)) {
@@ -101,10 +118,12 @@ static bool SetGLAttributes()
         Fail("Failed to set GL_DEPTH_SIZE");
         return false;
     }
-    if (SDL_GL_SetSwapInterval(0)) {
-        Fail("Failed to disable vsync");
-        return false;
-    }
+    SetGLState();
+    return true;
+}
+
+static void SetGLState()
+{
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_CULL_FACE);
     glEnable(GL_BLEND);
@@ -112,7 +131,6 @@ static bool SetGLAttributes()
     glDepthFunc(GL_LESS);
     //glDepthFunc(GL_ALWAYS);
     //SetWireframe(true);
-    return true;
 }
 
 void SetWireframe(bool wireframe)
@@ -126,6 +144,10 @@ void SetWireframe(bool wireframe)
 
 void SwapBuffer()
 {
+    if (headless) {
+        glFlush(); // Nothing to present
+        return;
+    }
     SDL_GL_SwapWindow(window);
 }
 
@@ -142,6 +164,16 @@ static void ClearColorBuffer()
 
 void DestroyWindow()
 {
+    if (headless) {
+        if (headlessRenderbuffers[0] != 0) {
+            glDeleteFramebuffers(1, &headlessFramebuffer);
+            glDeleteRenderbuffers(2, headlessRenderbuffers);
+        }
+        DestroyHeadlessContext();
+        headless = false;
+        return;
+    }
+    DestroySharedContext();
     SDL_GL_DeleteContext(glContext);
     SDL_DestroyWindow(window);
     SDL_Quit();
@@ -174,3 +206,132 @@ bool CreateWindow()
 
     return true;
 }
+
+static bool CreateHeadlessFramebuffer(int32_t width, int32_t height)
+{
+    glGenRenderbuffers(2, headlessRenderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, headlessRenderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, headlessRenderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width,
+            height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &headlessFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, headlessFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+            GL_RENDERBUFFER, headlessRenderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+            GL_RENDERBUFFER, headlessRenderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        Error("Headless framebuffer of %dx%d is incomplete", width, height);
+        return false;
+    }
+    // Stays bound, every frame is drawn into it
+    return true;
+}
+
+bool CreateHeadlessWindow(int32_t width, int32_t height)
+{
+    headless = true;
+    if (!CreateHeadlessContext()) {
+        headless = false;
+        return false;
+    }
+    if (!SetupGLEW() || !CreateHeadlessFramebuffer(width, height)) {
+        DestroyWindow();
+        return false;
+    }
+    SetGLState();
+    WindowResize(width, height);
+    Info("Rendering %dx%d frames without a window, GL %s on %s", width,
+            height, (const char *)glGetString(GL_VERSION),
+            (const char *)glGetString(GL_RENDERER));
+
+    ClearColorBuffer();
+    return true;
+}
+
+bool IsHeadless()
+{
+    return headless;
+}
+
+bool CreateSharedContext()
+{
+    if (headless) {
+        return CreateHeadlessSharedContext();
+    }
+    if (SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1)) {
+        Warning("Failed to set GL_SHARE_WITH_CURRENT_CONTEXT: %s",
+                SDL_GetError());
+        return false;
+    }
+    sharedContext = SDL_GL_CreateContext(window);
+    SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+    if (sharedContext == NULL) {
+        Warning("Failed to create a shared GL context: %s", SDL_GetError());
+        SDL_GL_MakeCurrent(window, glContext);
+        return false;
+    }
+    // Creating it made it current
+    SDL_GL_MakeCurrent(window, glContext);
+    return true;
+}
+
+bool MakeSharedContextCurrent(bool current)
+{
+    if (headless) {
+        return MakeHeadlessSharedContextCurrent(current);
+    }
+    return SDL_GL_MakeCurrent(window, current ? sharedContext : NULL) == 0;
+}
+
+void DestroySharedContext()
+{
+    if (headless) {
+        DestroyHeadlessSharedContext();
+        return;
+    }
+    if (sharedContext) {
+        SDL_GL_DeleteContext(sharedContext);
+        sharedContext = NULL;
+    }
+}
+
+// Binary PPM, rows from the top
+bool SaveFramebuffer(const char *filename)
+{
+    const int32_t width = GetWindowWidth();
+    const int32_t height = GetWindowHeight();
+    std::vector<uint8_t> pixels(width*height*4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (!headless) {
+        glReadBuffer(GL_BACK);
+    }
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+            pixels.data());
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        Error("Could not open '%s' to save the frame", filename);
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<uint8_t> row(width*3);
+    bool ok = true;
+    for (int32_t y=height-1; y>=0 && ok; y--) {
+        for (int32_t x=0; x<width; x++) {
+            const uint8_t *pixel = &pixels[(y*width + x)*4];
+            row[x*3] = pixel[0];
+            row[x*3 + 1] = pixel[1];
+            row[x*3 + 2] = pixel[2];
+        }
+        ok = fwrite(row.data(), row.size(), 1, file) == 1;
+    }
+    fclose(file);
+    if (!ok) {
+        Error("Failed writing '%s'", filename);
+        return false;
+    }
+    Info("Saved the frame to '%s'", filename);
+    return true;
+}
@@ -25,6 +25,28 @@ bool CreateWindow();
 
 void DestroyWindow();
 
+// Draws into a framebuffer object of `width` by `height` instead of a
+// window, see CreateHeadlessContext. SwapBuffer only flushes then.
+bool CreateHeadlessWindow(int32_t width, int32_t height);
+
+bool IsHeadless();
+
+// A second context sharing objects with the one frames are drawn
+// with, for a thread of its own. Call on the GL thread after the
+// window is made. False where contexts can't share.
+bool CreateSharedContext();
+
+// Makes the shared context current on the calling thread, or with
+// `current` false lets go of it
+bool MakeSharedContextCurrent(bool current);
+
+// Once no thread has it current
+void DestroySharedContext();
+
+// Writes the frame drawn so far as a binary PPM image, before the
+// swap when there is a window
+bool SaveFramebuffer(const char *filename);
+
 void WindowResize(int32_t newWidth, int32_t newHeight);
 
 void SetWireframe(bool wireframe);
@@ -1,7 +1,227 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
 #include "gui/event.h"
 #include "gui/window.h"
 #include "scene.h"
+#include "benchmark.h"
 #include "util/log.h"
+#include "util/profiler.h"
+#include "util/counters.h"
+#include "util/archive.h"
+#include "util/job_system.h"
+
+struct Options_t {
+    FrameMode_t frameMode;
+    double targetFps;
+    const char *recordFile; // NULL unless input is recorded
+    const char *replayFile; // NULL unless input is replayed
+    const char *timesFile; // CSV of every replayed or headless frame
+    bool headless;
+    int32_t width; // Headless framebuffer size
+    int32_t height;
+    uint32_t numFrames; // Headless frames to draw
+    const char *saveFile; // Where the last headless frame goes
+    const char *benchScene; // NULL unless benchmarking
+    int gridColumns; // Benchmark scene layout, 0 for the scene's own
+    int gridRows;
+    const char *jsonFile; // Benchmark results, NULL for stdout
+    bool depthPrepass;
+    const char *traceFile; // Profiler capture from loading on
+    const char *statsFile; // Counter dumps, "-" for stdout
+    bool statsOverlay;
+    const char *archiveFile; // NULL for the default one, if it's there
+    bool noArchive;
+    unsigned numThreads; // Job system threads, 0 for one per core
+    bool uploadThread;
+};
+
+// Frames are paced by the display unless the command line says
+// --uncapped, --vsync, --adaptive-vsync or --fps <rate>. Input is
+// saved with --record <file> and played back with --replay <file>.
+// --headless draws --frames <n> frames of --resolution <w>x<h> with
+// no window and can --save <file> the last one. --frame-times <file>
+// writes a CSV of every replayed or headless frame's times.
+// --bench <scene> draws a headless orbit of a built in scene, with
+// its models in a --grid <n>x<m>, and prints JSON or saves it with
+// --json <file>. --depth-prepass starts with the pre-pass on.
+// --trace <file> captures the load and first frames with the profiler.
+// --stats <file> writes the counters as CSV every second, "-" writes
+// them to stdout. --overlay starts with the stats overlay shown.
+// Assets come from --archive <file>, or assets.pak when it is in the
+// working directory, and from loose files with --no-archive.
+// --threads <n> runs jobs on n threads, the main one included.
+// --upload-thread uploads models on a thread with a GL context of its
+// own where the platform lets contexts share.
+static bool ParseOptions(int argc, char **argv, Options_t &options)
+{
+    options.frameMode = FRAME_MODE_ADAPTIVE_VSYNC;
+    options.targetFps = DEFAULT_TARGET_FPS;
+    options.recordFile = NULL;
+    options.replayFile = NULL;
+    options.timesFile = NULL;
+    options.headless = false;
+    options.width = DEFAULT_WINDOW_WIDTH;
+    options.height = DEFAULT_WINDOW_HEIGHT;
+    options.numFrames = DEFAULT_HEADLESS_FRAMES;
+    options.saveFile = NULL;
+    options.benchScene = NULL;
+    options.gridColumns = 0;
+    options.gridRows = 0;
+    options.jsonFile = NULL;
+    options.depthPrepass = false;
+    options.traceFile = NULL;
+    options.statsFile = NULL;
+    options.statsOverlay = false;
+    options.archiveFile = NULL;
+    options.noArchive = false;
+    options.numThreads = 0;
+    options.uploadThread = false;
+    for (int i=1; i<argc; i++) {
+        const bool hasValue = i+1 < argc;
+        if (strcmp(argv[i], "--uncapped") == 0) {
+            options.frameMode = FRAME_MODE_UNCAPPED;
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            options.frameMode = FRAME_MODE_VSYNC;
+        } else if (strcmp(argv[i], "--adaptive-vsync") == 0) {
+            options.frameMode = FRAME_MODE_ADAPTIVE_VSYNC;
+        } else if (strcmp(argv[i], "--fps") == 0 && hasValue) {
+            options.frameMode = FRAME_MODE_LIMITED;
+            options.targetFps = atof(argv[++i]);
+            if (options.targetFps <= 0.0) {
+                Error("Bad frame rate '%s'", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--record") == 0 && hasValue) {
+            options.recordFile = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && hasValue) {
+            options.replayFile = argv[++i];
+        } else if (strcmp(argv[i], "--frame-times") == 0 && hasValue) {
+            options.timesFile = argv[++i];
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            options.headless = true;
+        } else if (strcmp(argv[i], "--resolution") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &options.width,
+                    &options.height) != 2 || options.width <= 0
+                    || options.height <= 0) {
+                Error("Bad resolution '%s', expected WxH", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            options.numFrames = (uint32_t)atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--save") == 0 && hasValue) {
+            options.saveFile = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && hasValue) {
+            options.benchScene = argv[++i];
+        } else if (strcmp(argv[i], "--grid") == 0 && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &options.gridColumns,
+                    &options.gridRows) != 2 || options.gridColumns <= 0
+                    || options.gridRows <= 0) {
+                Error("Bad grid '%s', expected NxM", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+            options.jsonFile = argv[++i];
+        } else if (strcmp(argv[i], "--depth-prepass") == 0) {
+            options.depthPrepass = true;
+        } else if (strcmp(argv[i], "--trace") == 0 && hasValue) {
+            options.traceFile = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && hasValue) {
+            options.statsFile = argv[++i];
+        } else if (strcmp(argv[i], "--archive") == 0 && hasValue) {
+            options.archiveFile = argv[++i];
+        } else if (strcmp(argv[i], "--no-archive") == 0) {
+            options.noArchive = true;
+        } else if (strcmp(argv[i], "--overlay") == 0) {
+            options.statsOverlay = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            const int numThreads = atoi(argv[++i]);
+            if (numThreads <= 0) {
+                Error("Bad thread count '%s'", argv[i]);
+                return false;
+            }
+            options.numThreads = numThreads;
+        } else if (strcmp(argv[i], "--upload-thread") == 0) {
+            options.uploadThread = true;
+        } else {
+            Error("Unknown option '%s'", argv[i]);
+            return false;
+        }
+    }
+    if (options.recordFile && options.replayFile) {
+        Error("Input can't be recorded while a recording is replayed");
+        return false;
+    }
+    if ((options.headless || options.benchScene)
+            && (options.recordFile || options.replayFile)) {
+        Error("Headless runs take no input to record or replay");
+        return false;
+    }
+    if (!options.benchScene && (options.gridColumns > 0
+            || options.jsonFile)) {
+        Error("--grid and --json only go with --bench");
+        return false;
+    }
+    if (options.archiveFile && options.noArchive) {
+        Error("--archive and --no-archive don't go together");
+        return false;
+    }
+    return true;
+}
+
+// False only if an archive asked for by name can't be mounted. A bad
+// default one is skipped for the loose files.
+static bool MountAssets(const Options_t &options)
+{
+    if (options.noArchive) {
+        return true;
+    }
+    if (options.archiveFile) {
+        return MountArchive(options.archiveFile);
+    }
+    FILE *file = fopen(ARCHIVE_DEFAULT_FILENAME, "rb");
+    if (file == NULL) {
+        return true;
+    }
+    fclose(file);
+    if (!MountArchive(ARCHIVE_DEFAULT_FILENAME)) {
+        Warning("Loading loose files instead of '%s'",
+                ARCHIVE_DEFAULT_FILENAME);
+    }
+    return true;
+}
+
+// Needs the GL context for the GPU's clock
+static void StartTrace(const char *filename, uint32_t numFrames)
+{
+    if (filename && !PROFILE_BEGIN_CAPTURE(filename, numFrames)) {
+        Warning("Not tracing, the build lacks the profiler (make PROFILE=1)");
+    }
+}
+
+static int RunHeadless(const Options_t &options)
+{
+    if (!CreateHeadlessWindow(options.width, options.height)) {
+        Error("Failed to create a headless context");
+        return -1;
+    }
+    StartTrace(options.traceFile, options.numFrames);
+    // Every model is in before the first frame, so runs match
+    if (!SceneInit() || !SceneFinishLoading()) {
+        Error("Failed to initialize the scene");
+        SceneShutdown();
+        DestroyWindow();
+        return -2;
+    }
+    SceneWindowResize(options.width, options.height);
+    SceneSetDepthPrepass(options.depthPrepass);
+    RunHeadlessFrames(options.numFrames, options.saveFile,
+            options.timesFile);
+    PROFILE_END_CAPTURE();
+    SceneShutdown();
+    DestroyWindow();
+    return EXIT_SUCCESS;
+}
 
 //#ifdef _WIN32
 // This undef workaround is because of SDL2 "magic"
@@ -10,16 +230,72 @@
 int main(int argc, char **argv)
 {
     Success("Hello, World!");
+    PROFILE_THREAD_NAME("Main");
+    Options_t options;
+    if (!ParseOptions(argc, argv, options) || !MountAssets(options)) {
+        return -3;
+    }
+    if (options.statsFile && !StartCounterDump(options.statsFile)) {
+        return -3;
+    }
+    StartJobSystem(options.numThreads);
+    Info("Running jobs on %u threads", GetNumJobThreads());
+    SceneSetUploadThread(options.uploadThread);
+    SetStatsOverlay(options.statsOverlay);
+    if (options.benchScene) {
+        BenchOptions_t bench;
+        bench.scene = options.benchScene;
+        bench.width = options.width;
+        bench.height = options.height;
+        bench.numFrames = options.numFrames;
+        bench.gridColumns = options.gridColumns;
+        bench.gridRows = options.gridRows;
+        bench.depthPrepass = options.depthPrepass;
+        bench.jsonFile = options.jsonFile;
+        bench.saveFile = options.saveFile;
+        bench.traceFile = options.traceFile;
+        const int ret = RunBenchmark(bench) ? EXIT_SUCCESS : -5;
+        StopCounterDump();
+        Success("Bye!");
+        return ret;
+    }
+    if (options.headless) {
+        const int ret = RunHeadless(options);
+        StopCounterDump();
+        Success("Bye!");
+        return ret;
+    }
     if (!CreateWindow()) {
         Error("Failed to create a window, "
             "that's going to be a hinderance.");
         return -1;
     }
+    StartTrace(options.traceFile, PROFILE_CAPTURE_FRAMES);
     if(!SceneInit()) {
         Error("Failed to initialize the scene");
         return -2;
     }
+    SceneSetDepthPrepass(options.depthPrepass);
+    if (!SetFrameMode(options.frameMode, options.targetFps)) {
+        Warning("Frames are paced however the driver defaults");
+    }
+    if (options.recordFile && !StartRecording(options.recordFile)) {
+        return -4;
+    }
+    if (options.replayFile) {
+        // A replay runs the same frames as the recording only with
+        // every model already in, like the headless runs
+        if (!SceneFinishLoading()) {
+            Warning("Some models failed to load, the replay may differ");
+        }
+        if (!StartReplay(options.replayFile, options.timesFile)) {
+            return -4;
+        }
+    }
     RunEventLoop();
+    PROFILE_END_CAPTURE();
+    StopCounterDump();
+    SceneShutdown();
     DestroyWindow();
     Success("Bye!");
     return EXIT_SUCCESS;
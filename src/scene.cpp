@@ -3,29 +3,82 @@
 #include <array>
 #include <string>
 #include <memory>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cassert>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 #include <GL/glew.h>
 #include "graphics/shader_program.h"
+#include "graphics/geometry_arena.h"
+#include "graphics/render_queue.h"
+#include "graphics/instance_buffer.h"
+#include "graphics/frustum.h"
+#include "graphics/bvh.h"
+#include "graphics/simplify.h"
+#include "graphics/mesh_optimize.h"
+#include "graphics/occlusion.h"
+#include "graphics/gpu_timer.h"
+#include "graphics/light_grid.h"
+#include "graphics/light_textures.h"
+#include "graphics/mesh.h"
 #include "util/log.h"
+#include "util/profiler.h"
+#include "util/counters.h"
 #include "util/stl_parser.h"
 #include "graphics/camera.h"
 #include "gui/window.h"
+#include "gui/upload_thread.h"
 #define TINYOBJLOADER_IMPLEMENTATION // define this in only *one* .cc
 #include "tiny_obj_loader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "util/stb_image.h"
 #include "util/file.h"
+#include "util/mapped_file.h"
+#include "util/archive.h"
+#include "util/obj_loader.h"
+#include "util/asset_streamer.h"
+#include "util/job_system.h"
 
 // TODO: Make aspect ratio dynamic on screen redraw
-#define FOV 45.0f
 #define DEFAULT_ASPECT_RATIO (16.0f/9.0f)
 #define PROJECTION_NEAR_CLIP 1.0f
 #define PROJECTION_FAR_CLIP 1000.0f
 #define MODELS_FOLDER_PREFIX "models/"
+// Largest simplification error allowed on screen before a finer LOD
+// is drawn
+#define LOD_MAX_PIXEL_ERROR 1.0f
+// Visible objects a LOD selection job takes
+#define LOD_SELECT_GRAIN 256
+// Occluders are the largest visible objects on screen, at most this
+// many a frame and only if their bounding sphere's radius is at least
+// this fraction of their distance
+#define MAX_OCCLUDERS 16
+#define OCCLUDER_MIN_SIZE 0.1f
+// Levels with more triangles aren't kept on the CPU for occlusion
+#define OCCLUDER_MAX_TRIANGLES 4096
+// Indices into shaderPrograms
+#define MODEL_SHADER 0
+#define DEPTH_SHADER 1
+// How often the GPU times of the passes are logged
+#define PASS_TIMING_LOG_FRAMES 300
+// How often light binning is logged
+#define LIGHT_GRID_LOG_FRAMES 300
+// GL work streaming models in may do each frame. Textures go up in
+// bands of rows so one big texture doesn't blow the budget.
+#define STREAM_BUDGET_MS 2.0
+#define STREAM_BUDGET_BYTES (4 << 20)
+#define STREAM_TEXTURE_BAND_BYTES (1 << 20)
 
-static const char *models[] = {
+// Loaded by SceneInit() when no other scene is given
+static const SceneDesc_t defaultScene = {
+    "default",
+    {
         //"models/block100.stl",
         //"models/bottle.stl",
         //"models/cube.stl",
@@ -38,52 +91,104 @@ static const char *models[] = {
         //"models/unit_circle_2x2.stl",
         //"models/suzanne.obj",
         "models/nanosuit/nanosuit.obj",
+    },
+    {
+        //{ "models/cube.stl", 100, 100, 3.0f },
+        //{ "models/suzanne.obj", 20, 20, 4.0f },
+    },
+    {
+        //{ 20, 20, 4.0f, 1.5f },
+    },
 };
 
+// Fractions of the full triangle count for the simplified levels
+static const std::vector<float> lodRatios = { 0.5f, 0.25f, 0.1f };
+
+// One program shades every model, objects only differ by their
+// material and where their geometry sits in the arena
+struct SceneObject_t {
+    MeshHandle mesh; // Level of detail picked for this frame
+    size_t material; // Index into sceneMaterials
+    InstanceBuffer *instances; // NULL unless drawn instanced
+    MeshHandle lods[MAX_LOD_LEVELS]; // lods[0] is the full mesh
+    float lodErrors[MAX_LOD_LEVELS]; // World units
+    uint32_t numLods;
+    uint32_t lod;
+    // Index into occluderMeshes per level, INVALID_OCCLUDER where the
+    // level has too many triangles or the object is instanced
+    uint32_t occluders[MAX_LOD_LEVELS];
+};
+
+#define INVALID_OCCLUDER 0xFFFFFFFF
+
 static std::vector<ShaderProgram> shaderPrograms;
-static std::vector<STLSolid_t> allSolids;
+static std::vector<ShaderMaterial_t> sceneMaterials;
+static std::vector<SceneObject_t> sceneObjects;
+static GeometryArena geometryArena;
+static RenderQueue renderQueue;
+static BoundsSoA sceneBounds; // World space, same index as sceneObjects
+static Bvh sceneBvh; // Over sceneBounds
+static std::vector<uint32_t> visibleObjects;
+static OcclusionCuller occlusionCuller;
+static std::vector<OccluderMesh_t> occluderMeshes;
+static std::vector<std::unique_ptr<InstanceBuffer>> instanceBuffers;
 static CameraView camera;
+static double fixedFrameTime = 0.0; // Seconds, 0 follows the clock
 static glm::mat4 projectionMatrix = glm::perspective(glm::radians(FOV),
         DEFAULT_ASPECT_RATIO, PROJECTION_NEAR_CLIP, PROJECTION_FAR_CLIP);
 static glm::mat4 modelMatrix = glm::mat4(1.0f);
 static std::pair<uint32_t, uint32_t>windowDimensions = std::make_pair(0, 0);
 static std::map<std::string, GLuint> textures;
+static std::map<std::string, size_t> texturedMaterials; // By material name
+static size_t untexturedMaterial = SIZE_MAX;
+// Opaque geometry is drawn to the depth buffer alone first so the
+// shading pass lights every pixel only once
+static bool depthPrepass = false;
+static GpuTimer prepassTimer;
+static GpuTimer shadingTimer;
+// Point and spot lights, binned into lightGrid every frame
+static std::vector<ShaderLight_t> sceneLights;
+static LightGrid lightGrid;
+static LightTextures lightTextures;
+static SceneLoadStats_t loadStats;
+static SceneFrameStats_t frameStats;
+// Models load on background threads, see SceneInit
+static AssetStreamer assetStreamer;
+static bool streaming = false; // Until every submitted model is in
+static bool loadFailed = false;
+static Uint64 loadStart = 0;
+// Runs the big copies of the loads off the GL thread when enabled
+static UploadThread uploadThread;
+static bool useUploadThread = false;
+static size_t sceneBvhObjects = 0; // Objects the BVH was built over
 
+static double MillisecondsSince(Uint64 start)
+{
+    return (SDL_GetPerformanceCounter() - start) * 1000.0
+            / SDL_GetPerformanceFrequency();
+}
 
-static bool CreateTexturedModelShaderProgram(const char *name,
-        std::vector<glm::vec3> &vertices, std::vector<GLuint> &elements,
-        std::vector<glm::vec3> &normals, std::vector<glm::vec2> &uvs,
-        GLuint diffuseTex, GLuint specularTex=0)
+static ShaderProgram* GetModelShaderProgram()
 {
-    shaderPrograms.push_back(ShaderProgram(name));
-    ShaderProgram *shader = &shaderPrograms[shaderPrograms.size()-1];
-    if (!shader->LoadFragmentShaderFromFile("shaders/model.frs")) {
-        return false;
+    if (shaderPrograms.size() > MODEL_SHADER) {
+        return &shaderPrograms[MODEL_SHADER];
     }
-    if (!shader->LoadVertexShaderFromFile("shaders/model.vs")) {
-        return false;
-    }
-    if (vertices.size() != normals.size()) {
-        Warning("vertices.size() != normals.size(): (%d, %d)",
-                vertices.size(), normals.size());
-        return false;
+    PROFILE_FUNCTION();
+    shaderPrograms.push_back(ShaderProgram("model_shader"));
+    ShaderProgram *shader = &shaderPrograms[shaderPrograms.size()-1];
+    if (!shader->LoadFragmentShaderFromFile("shaders/model.frs")
+            || !shader->LoadVertexShaderFromFile("shaders/model.vs")) {
+        shaderPrograms.clear();
+        return NULL;
     }
 
-    const size_t numFloats = vertices.size() * 3;
-    shader->SetVertexBuffer((void *)&vertices[0], sizeof(GLfloat)*numFloats,
-            GL_STATIC_DRAW);
-    shader->SetNormalBuffer((void *)&normals[0], sizeof(GLfloat)*numFloats,
-            GL_STATIC_DRAW);
-    shader->SetUVBuffer((void *)&uvs[0], sizeof(GLfloat)*uvs.size()*2,
-            GL_STATIC_DRAW);
-    shader->SetElementBuffer(elements.size(), (void *)&elements[0],
-            sizeof(GLuint)*elements.size(), GL_STATIC_DRAW);
-
     glm::mat4 viewMat = camera.GetViewMatrix();
     glm::vec3 cameraPosition = camera.GetPosition();
     shader->SetViewMatrix(viewMat, cameraPosition);
     shader->SetModelMatrix(modelMatrix);
+    shader->SetInstanced(false);
     shader->SetProjectionMatrix(projectionMatrix);
+    shader->SetClusterSamplers();
 
     ShaderLight_t s;
     s.direction = glm::vec3(-0.2f, -1.0f, -0.1f);
@@ -101,96 +206,318 @@ static bool CreateTexturedModelShaderProgram(const char *name,
     s2.type = 0;
     shader->SetLight("undersun", s2);
 
+    Debug("Set up shader 'model_shader'");
+    return shader;
+}
+
+static ShaderProgram* GetDepthShaderProgram()
+{
+    if (shaderPrograms.size() > DEPTH_SHADER) {
+        return &shaderPrograms[DEPTH_SHADER];
+    }
+    if (!GetModelShaderProgram()) {
+        return NULL;
+    }
+    PROFILE_FUNCTION();
+    shaderPrograms.push_back(ShaderProgram("depth_shader"));
+    ShaderProgram *shader = &shaderPrograms[DEPTH_SHADER];
+    if (!shader->LoadFragmentShaderFromFile("shaders/depth.frs")
+            || !shader->LoadVertexShaderFromFile("shaders/depth.vs")) {
+        shaderPrograms.pop_back();
+        return NULL;
+    }
+    shader->SetViewMatrix(camera.GetViewMatrix());
+    shader->SetModelMatrix(modelMatrix);
+    shader->SetInstanced(false);
+    shader->SetProjectionMatrix(projectionMatrix);
+    Debug("Set up shader 'depth_shader'");
+    return shader;
+}
+
+static size_t GetUntexturedMaterial()
+{
+    if (untexturedMaterial != SIZE_MAX) {
+        return untexturedMaterial;
+    }
+    ShaderMaterial_t t;
+    memset((void *)&t, 0, sizeof(ShaderMaterial_t));
+    t.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
+    t.diffuse = glm::vec3(0.1f, 0.7f, 0.5f);
+    t.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+    t.shininess = 32;
+    t.opacity = 1.0f;
+    t.type = 0;
+    untexturedMaterial = sceneMaterials.size();
+    sceneMaterials.push_back(t);
+    return untexturedMaterial;
+}
+
+static size_t GetTexturedMaterial(const std::string &matName,
+        GLfloat opacity, GLuint diffuseTex, GLuint specularTex=0)
+{
+    auto it = texturedMaterials.find(matName);
+    if (it != texturedMaterials.end()) {
+        return it->second;
+    }
     ShaderMaterial_t t;
-    //t.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
-    //t.diffuse = glm::vec3(0.1f, 0.7f, 0.5f);
-    //t.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+    memset((void *)&t, 0, sizeof(ShaderMaterial_t));
     t.shininess = 32;
+    t.opacity = opacity;
     t.type = 1;
     t.diffuseSampler = diffuseTex;
     t.specularSampler = diffuseTex;
-    if (specularTex == 0) {
+    if (specularTex != 0) {
         t.specularSampler = specularTex;
     }
-    shader->SetMaterial(t);
+    size_t material = sceneMaterials.size();
+    sceneMaterials.push_back(t);
+    texturedMaterials.emplace(matName, material);
+    return material;
+}
 
-    Debug("Set up shader '%s'", name);
-    return true;
+// Welds the mesh and reorders it for the post-transform cache
+static void OptimizeModelMesh(const char *name, MeshData_t &mesh)
+{
+    PROFILE_FUNCTION();
+    MeshOptimizeStats_t stats = OptimizeMesh(mesh);
+    Debug("'%s': %lu -> %lu vertices, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+            name, (unsigned long)stats.verticesBefore,
+            (unsigned long)stats.verticesAfter, stats.before.acmr,
+            stats.after.acmr, stats.before.atvr, stats.after.atvr);
+    Debug("'%s': ACMR %.3f in cache order, %.3f after overdraw order%s",
+            name, stats.cacheOrder.acmr, stats.after.acmr,
+            stats.overdrawOrder ? "" : " (rejected)");
 }
 
-static bool CreateModelShaderProgram(const char *name,
-        std::vector<glm::vec3> &vertices, std::vector<GLuint> &elements,
-        std::vector<glm::vec3> &normals)
+// Keeps the positions of a level for the occlusion culler if it is
+// small enough to be worth drawing in software
+static uint32_t AddOccluderMesh(const MeshData_t &mesh,
+        const InstanceBuffer *instances)
 {
-    shaderPrograms.push_back(ShaderProgram(name));
-    ShaderProgram *shader = &shaderPrograms[shaderPrograms.size()-1];
-    if (!shader->LoadFragmentShaderFromFile("shaders/model.frs")) {
-        return false;
-    }
-    if (!shader->LoadVertexShaderFromFile("shaders/model.vs")) {
-        return false;
+    if (instances || mesh.elements.size()/3 > OCCLUDER_MAX_TRIANGLES) {
+        return INVALID_OCCLUDER;
     }
-    if (vertices.size() != normals.size()) {
-        Warning("vertices.size() != normals.size(): (%d, %d)",
-                vertices.size(), normals.size());
-        return false;
+    OccluderMesh_t occluder;
+    occluder.vertices = mesh.vertices;
+    occluder.elements = mesh.elements;
+    occluderMeshes.push_back(std::move(occluder));
+    return occluderMeshes.size() - 1;
+}
+
+// A model as a loader thread leaves it for the GL thread
+struct LoadedTexture_t {
+    std::string name;
+    int width;
+    int height;
+    int comp; // 3 for RGB, 4 for RGBA
+    unsigned char *pixels; // From stbi, freed with the model
+    GLuint texture; // 0 until allocated, or if it was loaded before
+    bool published; // In `textures`, no longer the model's to delete
+};
+
+struct LoadedPart_t {
+    std::string name;
+    MeshData_t mesh; // Optimized
+    BoundingBox_t box; // Model space
+    BoundingSphere_t sphere;
+    std::vector<MeshLod_t> lods; // Optimized, coarser as they go
+    std::string material; // Empty for the untextured material
+    std::string texture;
+    float opacity;
+    // The mesh then its LODs, when the upload thread staged them
+    std::vector<StagedMesh_t> staged;
+};
+
+static void ReleaseStagedMeshes(LoadedPart_t &part)
+{
+    for (size_t i=0; i<part.staged.size(); i++) {
+        ReleaseStagedMesh(part.staged[i]);
     }
+}
 
-    size_t numFloats = vertices.size() * 3;
-    shader->SetVertexBuffer((void *)&vertices[0], sizeof(GLfloat)*numFloats,
-            GL_STATIC_DRAW);
-    shader->SetNormalBuffer((void *)&normals[0], sizeof(GLfloat)*numFloats,
-            GL_STATIC_DRAW);
-    shader->SetElementBuffer(elements.size(), (void *)&elements[0],
-            sizeof(GLuint)*elements.size(), GL_STATIC_DRAW);
-    glm::mat4 viewMat = camera.GetViewMatrix();
-    glm::vec3 cameraPosition = camera.GetPosition();
-    shader->SetViewMatrix(viewMat, cameraPosition);
-    shader->SetModelMatrix(modelMatrix);
-    shader->SetProjectionMatrix(projectionMatrix);
+struct LoadedModel_t {
+    InstanceBuffer *instances; // NULL unless drawn instanced
+    std::vector<LoadedTexture_t> textures;
+    std::vector<LoadedPart_t> parts;
+    double parseMs;
+    double textureMs; // Decoding, uploads are timed as they happen
+    double optimizeMs;
+    double uploadThreadMs; // Written by the upload thread alone
 
-    ShaderLight_t s;
-    s.direction = glm::vec3(-0.2f, -1.0f, -0.1f);
-    s.ambient = glm::vec3(0.3f, 0.24f, 0.14f);
-    s.diffuse = glm::vec3(0.7f, 0.42f, 0.26f);
-    s.specular = glm::vec3(0.5f, 0.5f, 0.5f);
-    s.type = 0;
-    shader->SetLight("sun", s);
+    LoadedModel_t() : instances(NULL), parseMs(0.0), textureMs(0.0),
+            optimizeMs(0.0), uploadThreadMs(0.0) {}
 
-    ShaderLight_t s2;
-    s2.direction = glm::vec3(0.2f, 1.0f, 0.1f);
-    s2.ambient = glm::vec3(0.0f, 0.0f, 0.0f);
-    s2.diffuse = glm::vec3(0.2f, 0.1f, 0.06f);
-    s2.specular = glm::vec3(0.0f, 0.0f, 0.0f);
-    s2.type = 0;
-    shader->SetLight("undersun", s2);
+    LoadedModel_t(const LoadedModel_t &) = delete;
+    LoadedModel_t& operator=(const LoadedModel_t &) = delete;
 
-    ShaderMaterial_t t;
-    t.ambient = glm::vec3(0.2f, 0.2f, 0.2f);
-    t.diffuse = glm::vec3(0.1f, 0.7f, 0.5f);
-    t.specular = glm::vec3(0.5f, 0.5f, 0.5f);
-    t.shininess = 32;
-    t.type = 0;
-    shader->SetMaterial(t);
+    // Also lets go of what the upload thread made for steps that never
+    // ran, as when the load failed. The last owner is the GL thread or
+    // the upload thread, which both have a context.
+    ~LoadedModel_t()
+    {
+        for (size_t i=0; i<textures.size(); i++) {
+            stbi_image_free(textures[i].pixels);
+            if (textures[i].texture != 0 && !textures[i].published) {
+                glDeleteTextures(1, &textures[i].texture);
+            }
+        }
+        for (size_t i=0; i<parts.size(); i++) {
+            ReleaseStagedMeshes(parts[i]);
+        }
+    }
+};
 
-    Debug("Set up shader '%s'", name);
-    return true;
+static size_t GetMeshBytes(const MeshData_t &mesh)
+{
+    return mesh.vertices.size()*sizeof(glm::vec3)
+            + mesh.normals.size()*sizeof(glm::vec3)
+            + mesh.uvs.size()*sizeof(glm::vec2)
+            + mesh.elements.size()*sizeof(GLuint);
 }
 
-static bool ParseSTLModel(const char* filename, std::vector<STLSolid_t> &solids)
+// Optimizes the mesh and builds its LOD chain, off the GL thread.
+// Meshes too big for 16-bit elements are cut into pieces that each
+// become an object of their own, the extra draws mostly merge again in
+// the render queue. The pieces and their levels are prepared in jobs.
+static void PrepareModelMesh(const char *name, MeshData_t &mesh,
+        const std::string &material, const std::string &texture,
+        float opacity, LoadedModel_t &model)
 {
-    bool ret = ParseSTLFile(filename, solids);
-    if (!ret) {
-        Error("Failed to parse STL file '%s'", filename);
+    PROFILE_FUNCTION();
+    const Uint64 start = SDL_GetPerformanceCounter();
+    OptimizeModelMesh(name, mesh);
+    std::vector<MeshData_t> chunks;
+    if (mesh.vertices.size() >= SHORT_ELEMENT_LIMIT) {
+        SplitMesh(mesh, SHORT_ELEMENT_LIMIT-1, chunks);
+        Debug("'%s': split into %lu pieces for 16-bit elements", name,
+                (unsigned long)chunks.size());
+    } else {
+        chunks.push_back(std::move(mesh));
+    }
+    std::vector<LoadedPart_t> parts(chunks.size());
+    ParallelFor(0, chunks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i=begin; i<end; i++) {
+            LoadedPart_t &part = parts[i];
+            part.name = name;
+            part.mesh = std::move(chunks[i]);
+            part.box = ComputeBoundingBox(part.mesh.vertices);
+            part.sphere = ComputeBoundingSphere(part.mesh.vertices,
+                    part.box);
+            BuildLodChain(part.mesh, lodRatios, part.lods);
+            ParallelFor(0, part.lods.size(), 1,
+                    [&part](size_t first, size_t last) {
+                        for (size_t j=first; j<last; j++) {
+                            OptimizeMesh(part.lods[j].mesh);
+                        }
+                    });
+            part.material = material;
+            part.texture = texture;
+            part.opacity = opacity;
+        }
+    });
+    for (size_t i=0; i<parts.size(); i++) {
+        model.parts.push_back(std::move(parts[i]));
+    }
+    model.optimizeMs += MillisecondsSince(start);
+}
+
+// Level 0 is the part's full mesh, from its staging buffer when the
+// upload thread made one
+static MeshHandle AddPartMesh(LoadedPart_t &part, size_t level)
+{
+    if (level < part.staged.size()) {
+        return geometryArena.AddStagedMesh(part.staged[level]);
+    }
+    return geometryArena.AddMesh(level == 0 ? part.mesh
+            : part.lods[level-1].mesh);
+}
+
+// Uploads a prepared piece of a model and adds it to the scene
+static bool AddModelObject(LoadedPart_t &part, InstanceBuffer *instances)
+{
+    PROFILE_FUNCTION();
+    if (!GetModelShaderProgram()) {
+        ReleaseStagedMeshes(part);
         return false;
     }
-    //Debug("Parsed model '%s' successfully, total models: %d", filename, solids.size());
-    if (solids.size() <= 0) {
-        return ret;
+    const char *name = part.name.c_str();
+    size_t material = GetUntexturedMaterial();
+    if (!part.material.empty()) {
+        auto texture = textures.find(part.texture);
+        material = GetTexturedMaterial(part.material, part.opacity,
+                texture != textures.end() ? texture->second : 0);
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    MeshHandle handle = AddPartMesh(part, 0);
+    loadStats.uploadMs += MillisecondsSince(start);
+    if (handle == INVALID_MESH_HANDLE) {
+        Error("Failed to add mesh '%s' to the geometry arena", name);
+        ReleaseStagedMeshes(part);
+        return false;
+    }
+    SceneObject_t object;
+    object.mesh = handle;
+    object.material = material;
+    object.instances = instances;
+    object.lods[0] = handle;
+    object.lodErrors[0] = 0.0f;
+    object.numLods = 1;
+    object.lod = 0;
+    for (int i=0; i<MAX_LOD_LEVELS; i++) {
+        object.occluders[i] = INVALID_OCCLUDER;
+    }
+    object.occluders[0] = AddOccluderMesh(part.mesh, instances);
+
+    const float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+            std::max(glm::length(glm::vec3(modelMatrix[1])),
+            glm::length(glm::vec3(modelMatrix[2]))));
+    const std::vector<MeshLod_t> &lods = part.lods;
+    for (size_t i=0; i<lods.size() && object.numLods<MAX_LOD_LEVELS; i++) {
+        start = SDL_GetPerformanceCounter();
+        MeshHandle lod = AddPartMesh(part, i+1);
+        loadStats.uploadMs += MillisecondsSince(start);
+        if (lod == INVALID_MESH_HANDLE) {
+            Warning("Failed to add LOD %lu of '%s'", (unsigned long)i+1, name);
+            break;
+        }
+        object.lods[object.numLods] = lod;
+        object.lodErrors[object.numLods] = lods[i].error * scale;
+        object.occluders[object.numLods] = AddOccluderMesh(lods[i].mesh,
+                instances);
+        object.numLods++;
+    }
+    ReleaseStagedMeshes(part); // Those of LODs that didn't fit
+    if (object.numLods > 1) {
+        Debug("'%s': %lu LODs, %lu to %lu triangles", name,
+                (unsigned long)object.numLods,
+                (unsigned long)part.mesh.elements.size()/3,
+                (unsigned long)lods.back().mesh.elements.size()/3);
+    }
+
+    const BoundingBox_t &box = part.box;
+    BoundingBox_t worldBox = TransformBoundingBox(box, modelMatrix);
+    BoundingSphere_t worldSphere;
+    worldSphere.center = glm::vec3(modelMatrix
+            * glm::vec4(part.sphere.center, 1.0f));
+    worldSphere.radius = part.sphere.radius * scale;
+    if (instances && instances->GetCount() > 0) {
+        // One box around every instance, an instanced draw is culled
+        // as a whole
+        worldBox = TransformBoundingBox(box,
+                modelMatrix * instances->Get(0).model);
+        for (size_t i=1; i<instances->GetCount(); i++) {
+            worldBox = MergeBoundingBoxes(worldBox, TransformBoundingBox(box,
+                    modelMatrix * instances->Get(i).model));
+        }
+        worldSphere.center = 0.5f*(worldBox.min + worldBox.max);
+        worldSphere.radius = 0.5f*glm::length(worldBox.max - worldBox.min);
     }
-    //Debug("Number of facets in solids[%d]: %lu", solids.size()-1,
-    //        solids[solids.size()-1].facets.size());
-    return ret;  
+    sceneBounds.Add(worldBox, worldSphere);
+    sceneObjects.push_back(object);
+    loadStats.numObjects++;
+    loadStats.numTriangles += (instances ? instances->GetCount() : 1)
+            * part.mesh.elements.size() / 3;
+    return true;
 }
 
 void SceneWindowResize(uint32_t width, uint32_t height)
@@ -204,84 +531,607 @@ void SceneWindowResize(uint32_t width, uint32_t height)
 
 }
 
+static void BuildSceneBvh()
+{
+    PROFILE_FUNCTION();
+    std::vector<BoundingBox_t> boxes(sceneBounds.GetSize());
+    for (size_t i=0; i<boxes.size(); i++) {
+        boxes[i] = sceneBounds.GetBox(i);
+    }
+    const Uint64 start = SDL_GetPerformanceCounter();
+    sceneBvh.Build(boxes);
+    BvhStats_t stats = sceneBvh.GetStats();
+    Debug("Scene BVH: %lu objects, %lu nodes, depth %u, built in %.2fms",
+            (unsigned long)boxes.size(), (unsigned long)stats.numNodes,
+            stats.maxDepth, (SDL_GetPerformanceCounter() - start) * 1000.0
+            / SDL_GetPerformanceFrequency());
+}
+
+// Fills visibleObjects with the objects whose bounds touch the view
+static void CullSceneObjects(const glm::mat4 &viewProjection)
+{
+    PROFILE_FUNCTION();
+    static size_t lastVisible = SIZE_MAX;
+    // UploadLoadedModels rebuilds it whenever objects were added
+    assert(sceneBvh.GetIndices().size() == sceneBounds.GetSize());
+    const Uint64 start = SDL_GetPerformanceCounter();
+
+    Frustum_t frustum = ExtractFrustumPlanes(viewProjection);
+    visibleObjects.clear();
+    size_t numVisible = sceneBvh.QueryFrustum(frustum, visibleObjects);
+
+    const double cullMicroseconds = (SDL_GetPerformanceCounter() - start)
+            * 1000000.0 / SDL_GetPerformanceFrequency();
+    if (numVisible != lastVisible) {
+        Debug("Frustum culling: %lu visible, %lu culled in %.1fus",
+                (unsigned long)numVisible,
+                (unsigned long)(sceneObjects.size() - numVisible),
+                cullMicroseconds);
+        lastVisible = numVisible;
+    }
+}
+
+// Draws the objects that cover the most of the screen into the
+// occlusion buffer and drops every visible object hidden behind them
+static void OcclusionCullSceneObjects(const glm::mat4 &viewProjection,
+        const glm::vec3 &cameraPosition)
+{
+    PROFILE_FUNCTION();
+    static size_t lastOccluded = SIZE_MAX;
+    static std::vector<std::pair<float, uint32_t>> candidates;
+
+    // Occluders get the coarsest level whose error stays under a pixel
+    // of the occlusion buffer, anything coarser could hide what is
+    // drawn around its edges
+    std::pair<int32_t, int32_t> dimensions = GetWindowDimensions();
+    const float aspect = (float)std::max(dimensions.first, 1)
+            / std::max(dimensions.second, 1);
+    const float pixelsPerUnit = std::max((float)OCCLUSION_HEIGHT,
+            OCCLUSION_WIDTH / aspect) / (2.0f * tanf(0.5f * glm::radians(FOV)));
+
+    candidates.clear();
+    for (size_t v=0; v<visibleObjects.size(); v++) {
+        const uint32_t i = visibleObjects[v];
+        if (sceneObjects[i].instances) {
+            continue;
+        }
+        BoundingSphere_t sphere = sceneBounds.GetSphere(i);
+        const float distance = glm::distance(sphere.center, cameraPosition);
+        if (sphere.radius < OCCLUDER_MIN_SIZE * distance) {
+            continue;
+        }
+        candidates.push_back(std::make_pair(sphere.radius
+                / std::max(distance, PROJECTION_NEAR_CLIP), i));
+    }
+    const size_t numOccluders = std::min(candidates.size(),
+            (size_t)MAX_OCCLUDERS);
+    std::partial_sort(candidates.begin(), candidates.begin() + numOccluders,
+            candidates.end(), std::greater<std::pair<float, uint32_t>>());
+
+    occlusionCuller.BeginFrame(viewProjection);
+    for (size_t c=0; c<numOccluders; c++) {
+        const uint32_t i = candidates[c].second;
+        const SceneObject_t &object = sceneObjects[i];
+        BoundingBox_t box = sceneBounds.GetBox(i);
+        glm::vec3 outside = glm::max(glm::max(box.min - cameraPosition,
+                cameraPosition - box.max), glm::vec3(0.0f));
+        const uint32_t level = SelectLodLevel(object.lodErrors,
+                object.numLods, pixelsPerUnit, glm::length(outside), 1.0f, 0);
+        if (object.occluders[level] != INVALID_OCCLUDER) {
+            occlusionCuller.AddOccluder(occluderMeshes[object.occluders[level]],
+                    modelMatrix);
+        }
+    }
+    occlusionCuller.RasterizeOccluders();
+    const size_t numOccluded = occlusionCuller.CullOccluded(sceneBounds,
+            visibleObjects);
+
+    const OcclusionStats_t &stats = occlusionCuller.GetStats();
+    if (numOccluded != lastOccluded) {
+        Debug("Occlusion culling: %lu occluders, %lu triangles, %lu/%lu "
+                "culled, raster %.1fus, test %.1fus",
+                (unsigned long)stats.numOccluders,
+                (unsigned long)stats.numTriangles,
+                (unsigned long)stats.numOccluded,
+                (unsigned long)stats.numTested, stats.rasterMicroseconds,
+                stats.testMicroseconds);
+        lastOccluded = numOccluded;
+    }
+}
+
+// Picks a level of detail for every visible object from how large its
+// simplification error would be on screen at its distance
+static void SelectSceneLods(const glm::vec3 &cameraPosition)
+{
+    PROFILE_FUNCTION();
+    static size_t lastTriangles = SIZE_MAX;
+    const float pixelsPerUnit = std::max(GetWindowDimensions().second, 1)
+            / (2.0f * tanf(0.5f * glm::radians(FOV)));
+    std::atomic<size_t> triangles(0);
+    ParallelFor(0, visibleObjects.size(), LOD_SELECT_GRAIN,
+            [&](size_t begin, size_t end) {
+        size_t partTriangles = 0;
+        for (size_t v=begin; v<end; v++) {
+            SceneObject_t &object = sceneObjects[visibleObjects[v]];
+            // Closest point of the box, instanced objects are picked for
+            // their nearest instance
+            BoundingBox_t box = sceneBounds.GetBox(visibleObjects[v]);
+            glm::vec3 outside = glm::max(glm::max(box.min - cameraPosition,
+                    cameraPosition - box.max), glm::vec3(0.0f));
+            object.lod = SelectLodLevel(object.lodErrors, object.numLods,
+                    pixelsPerUnit, glm::length(outside), LOD_MAX_PIXEL_ERROR,
+                    object.lod);
+            object.mesh = object.lods[object.lod];
+            size_t count = object.instances
+                    ? object.instances->GetCount() : 1;
+            partTriangles += count * geometryArena.GetMeshRange(object.mesh)
+                    .numElements / 3;
+        }
+        triangles += partTriangles;
+    });
+    frameStats.numVisible = visibleObjects.size();
+    frameStats.numTriangles = triangles;
+    if (triangles != lastTriangles) {
+        Debug("LOD: %lu triangles in view", (unsigned long)triangles);
+        lastTriangles = triangles;
+    }
+}
+
+// Writes the depth of every opaque object with color writes off. The
+// material doesn't matter here so draws merge across materials.
+static void DrawDepthPrepass(ShaderProgram &depthShader)
+{
+    PROFILE_FUNCTION();
+    static std::vector<MeshHandle> batch;
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    depthShader.Use();
+    bool instanced = false;
+    for (size_t i=0; i<renderQueue.GetSize(); i++) {
+        if (GetDrawKeyPass(renderQueue[i].key) != RENDER_PASS_OPAQUE) {
+            break; // Opaque draws sort first
+        }
+        const SceneObject_t &object = sceneObjects[renderQueue[i].draw];
+        const MeshRange_t &range = geometryArena.GetMeshRange(object.mesh);
+        batch.push_back(object.mesh);
+        if (i+1 < renderQueue.GetSize()
+                && GetDrawKeyPass(renderQueue[i+1].key) == RENDER_PASS_OPAQUE) {
+            const SceneObject_t &next = sceneObjects[renderQueue[i+1].draw];
+            const MeshRange_t &nextRange = geometryArena.GetMeshRange(
+                    next.mesh);
+            if (!object.instances && !next.instances
+                    && range.format == nextRange.format
+                    && range.elementType == nextRange.elementType) {
+                continue;
+            }
+        }
+        if ((object.instances != NULL) != instanced) {
+            instanced = !instanced;
+            depthShader.SetInstanced(instanced);
+        }
+        if (object.instances) {
+            geometryArena.BindInstanced(range.format,
+                    object.instances->GetBuffer(), true);
+            geometryArena.DrawInstanced(object.mesh,
+                    object.instances->GetCount());
+        } else {
+            geometryArena.Bind(range.format, true);
+            geometryArena.DrawBatch(batch);
+        }
+        frameStats.numDrawCalls++;
+        batch.clear();
+    }
+    if (instanced) {
+        depthShader.SetInstanced(false);
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+static void LogPassTimes(bool prepass)
+{
+    static uint32_t frame = 0;
+    if (++frame % PASS_TIMING_LOG_FRAMES != 0) {
+        return;
+    }
+    const double shadingMs = shadingTimer.GetMilliseconds();
+    if (shadingMs < 0.0) {
+        return; // No timer queries
+    }
+    if (prepass) {
+        Debug("GPU: depth pre-pass %.3fms, shading %.3fms",
+                prepassTimer.GetMilliseconds(), shadingMs);
+    } else {
+        Debug("GPU: shading %.3fms, no depth pre-pass", shadingMs);
+    }
+}
+
+// Lists the scene's point and spot lights per cluster of the view and
+// hands the lists to the model shader
+static void BinSceneLights(ShaderProgram &shader, const glm::mat4 &view)
+{
+    PROFILE_FUNCTION();
+    static uint32_t frame = 0;
+    static bool warned = false;
+    if (sceneLights.size() == 0) {
+        return;
+    }
+    std::pair<int32_t, int32_t> dimensions = GetWindowDimensions();
+    const glm::vec2 viewport = glm::vec2(std::max(dimensions.first, 1),
+            std::max(dimensions.second, 1));
+    lightGrid.SetProjection(glm::radians(FOV), viewport.x / viewport.y,
+            PROJECTION_NEAR_CLIP, PROJECTION_FAR_CLIP);
+    lightGrid.Build(sceneLights, view);
+    const bool clustered = lightTextures.Upload(sceneLights, lightGrid);
+    if (clustered) {
+        lightTextures.Bind();
+        shader.SetLightClusters(viewport, lightGrid.GetSliceScale(),
+                lightGrid.GetSliceBias());
+    } else if (!warned) {
+        Warning("Clustered lights unavailable, %lu lights are off",
+                (unsigned long)sceneLights.size());
+        warned = true;
+    }
+    shader.SetClustered(clustered);
+
+    if (++frame % LIGHT_GRID_LOG_FRAMES == 0) {
+        const LightGridStats_t &stats = lightGrid.GetStats();
+        Debug("Light grid: %lu of %lu lights in view, %lu clusters lit, "
+                "%.1f lights each, %lu at most, %.0fus",
+                (unsigned long)stats.numLights,
+                (unsigned long)sceneLights.size(),
+                (unsigned long)stats.numOccupied,
+                stats.numOccupied > 0
+                        ? (double)stats.numIndices / stats.numOccupied : 0.0,
+                (unsigned long)stats.maxPerCluster, stats.binMicroseconds);
+    }
+}
+
+// Keys every object by the state it needs and its distance to the
+// camera, then submits in key order. Neighbouring draws that share
+// a pass, material, vertex format and element type are merged into
+// one multi draw.
+static void SubmitSceneObjects(ShaderProgram &shader,
+        ShaderProgram *depthShader, const glm::vec3 &cameraPosition)
+{
+    PROFILE_FUNCTION();
+    static std::vector<MeshHandle> batch;
+    static RenderQueueStats_t lastStats = { 0, 0, 0 };
+
+    renderQueue.Clear();
+    for (size_t v=0; v<visibleObjects.size(); v++) {
+        const uint32_t i = visibleObjects[v];
+        const SceneObject_t &object = sceneObjects[i];
+        const ShaderMaterial_t &material = sceneMaterials[object.material];
+        DrawKeyFields_t fields;
+        fields.pass = RENDER_PASS_OPAQUE;
+        if (material.opacity < 1.0f) {
+            fields.pass = RENDER_PASS_BLENDED;
+        }
+        fields.program = 0;
+        fields.format = geometryArena.GetMeshRange(object.mesh).format;
+        if (object.instances) {
+            fields.format += VERTEX_FORMAT_COUNT;
+        }
+        fields.material = object.material;
+        fields.texture = material.diffuseSampler;
+        glm::vec3 center = glm::vec3(sceneBounds.centerX[i],
+                sceneBounds.centerY[i], sceneBounds.centerZ[i]);
+        fields.depth = glm::distance(cameraPosition, center)
+                / PROJECTION_FAR_CLIP;
+        renderQueue.Push(EncodeDrawKey(fields), i);
+    }
+    {
+        PROFILE_SCOPE("Sort");
+        renderQueue.Sort();
+    }
+
+    const RenderQueueStats_t &stats = renderQueue.GetStats();
+    frameStats.numStateChanges = stats.stateChangesSorted;
+    frameStats.numDrawCalls = 0;
+    if (stats.numDraws != lastStats.numDraws
+            || stats.stateChangesUnsorted != lastStats.stateChangesUnsorted
+            || stats.stateChangesSorted != lastStats.stateChangesSorted) {
+        Debug("Render queue: %lu draws, %lu state changes unsorted, "
+                "%lu sorted", (unsigned long)stats.numDraws,
+                (unsigned long)stats.stateChangesUnsorted,
+                (unsigned long)stats.stateChangesSorted);
+        lastStats = stats;
+    }
+
+    for (size_t i=0; i<instanceBuffers.size(); i++) {
+        instanceBuffers[i]->Upload();
+    }
+
+    const bool prepass = depthPrepass && depthShader;
+    if (prepass) {
+        PROFILE_GPU_SCOPE("Depth pre-pass");
+        prepassTimer.Begin();
+        DrawDepthPrepass(*depthShader);
+        prepassTimer.End();
+        // Only the nearest surface passes, and it's already written
+        glDepthMask(GL_FALSE);
+        glDepthFunc(GL_LEQUAL);
+    }
+
+    PROFILE_SCOPE("Shading pass");
+    PROFILE_GPU_SCOPE("Shading pass");
+    shadingTimer.Begin();
+    shader.Use();
+    size_t boundMaterial = SIZE_MAX;
+    bool blending = false;
+    bool instanced = false;
+    for (size_t i=0; i<renderQueue.GetSize(); i++) {
+        const SceneObject_t &object = sceneObjects[renderQueue[i].draw];
+        const MeshRange_t &range = geometryArena.GetMeshRange(object.mesh);
+        const uint32_t pass = GetDrawKeyPass(renderQueue[i].key);
+        batch.push_back(object.mesh);
+        if (i+1 < renderQueue.GetSize()) {
+            const SceneObject_t &next = sceneObjects[renderQueue[i+1].draw];
+            const MeshRange_t &nextRange = geometryArena.GetMeshRange(
+                    next.mesh);
+            if (!object.instances && !next.instances
+                    && next.material == object.material
+                    && GetDrawKeyPass(renderQueue[i+1].key) == pass
+                    && range.format == nextRange.format
+                    && range.elementType == nextRange.elementType) {
+                continue;
+            }
+        }
+        if (pass == RENDER_PASS_BLENDED && !blending) {
+            // Blended surfaces still test against the opaque ones
+            glDepthMask(GL_FALSE);
+            blending = true;
+        }
+        if (object.material != boundMaterial) {
+            shader.SetMaterial(sceneMaterials[object.material]);
+            boundMaterial = object.material;
+        }
+        if ((object.instances != NULL) != instanced) {
+            instanced = !instanced;
+            shader.SetInstanced(instanced);
+        }
+        if (object.instances) {
+            geometryArena.BindInstanced(range.format,
+                    object.instances->GetBuffer());
+            geometryArena.DrawInstanced(object.mesh,
+                    object.instances->GetCount());
+        } else {
+            geometryArena.Bind(range.format);
+            geometryArena.DrawBatch(batch);
+        }
+        frameStats.numDrawCalls++;
+        batch.clear();
+    }
+    if (blending || prepass) {
+        glDepthMask(GL_TRUE);
+    }
+    if (prepass) {
+        glDepthFunc(GL_LESS);
+    }
+    if (instanced) {
+        shader.SetInstanced(false);
+    }
+    geometryArena.Unbind();
+    shadingTimer.End();
+    LogPassTimes(prepass);
+}
+
+// Runs the GL steps of the loads under the frame's budget, or all of
+// them, and rebuilds the BVH over whatever they added
+static void UploadLoadedModels(bool all)
+{
+    PROFILE_FUNCTION();
+    if (!streaming) {
+        return;
+    }
+    if (all) {
+        if (!assetStreamer.Finish()) {
+            loadFailed = true;
+        }
+    } else {
+        assetStreamer.Upload(STREAM_BUDGET_MS, STREAM_BUDGET_BYTES);
+    }
+    if (sceneObjects.size() != sceneBvhObjects) {
+        const Uint64 start = SDL_GetPerformanceCounter();
+        BuildSceneBvh();
+        loadStats.bvhMs += MillisecondsSince(start);
+        sceneBvhObjects = sceneObjects.size();
+    }
+    if (all || !assetStreamer.IsBusy()) {
+        streaming = false;
+        uploadThread.Stop();
+        geometryArena.LogStats();
+        loadStats.totalMs = MillisecondsSince(loadStart);
+        Info("Loaded %lu objects in %.1fms: parse %.1fms, textures %.1fms, "
+                "optimize %.1fms, upload %.1fms",
+                (unsigned long)loadStats.numObjects, loadStats.totalMs,
+                loadStats.parseMs, loadStats.textureMs, loadStats.optimizeMs,
+                loadStats.uploadMs);
+        if (loadStats.uploadThreadMs > 0.0) {
+            Info("Upload thread copied for %.1fms", loadStats.uploadThreadMs);
+        }
+    }
+}
+
 void SceneRender()
 {
+    PROFILE_FUNCTION();
+    UploadLoadedModels(false);
     std::pair<uint32_t, uint32_t>currWinDim = GetWindowDimensions();
+    if (fixedFrameTime > 0.0) {
+        camera.Advance(fixedFrameTime);
+    } else {
+        camera.Update();
+    }
     glm::mat4 viewMat = camera.GetViewMatrix();
     glm::vec3 cameraPosition = camera.GetPosition();
 
-
-    //float dT = 0.001f;
-    for (auto it=shaderPrograms.begin(); it!=shaderPrograms.end(); it++) {
-        //it->RotateModelMatrix(dT, glm::vec3(0, 1, 0));
-        //it->RotateModelMatrix(-dT*0.3f, glm::vec3(1, 0, 0));
-        it->SetViewMatrix(viewMat, cameraPosition);
-        it->Render();
-        //dT = -dT;
+    if (shaderPrograms.size() > 0 && sceneObjects.size() > 0) {
+        ShaderProgram &shader = shaderPrograms[MODEL_SHADER];
+        shader.SetViewMatrix(viewMat, cameraPosition);
+        ShaderProgram *depthShader = NULL;
+        if (shaderPrograms.size() > DEPTH_SHADER) {
+            depthShader = &shaderPrograms[DEPTH_SHADER];
+            depthShader->SetViewMatrix(viewMat);
+        }
+        CullSceneObjects(projectionMatrix * viewMat);
+        OcclusionCullSceneObjects(projectionMatrix * viewMat, cameraPosition);
+        SelectSceneLods(cameraPosition);
+        BinSceneLights(shader, viewMat);
+        SubmitSceneObjects(shader, depthShader, cameraPosition);
     }
     if (windowDimensions != currWinDim) {
         windowDimensions = currWinDim;
     }
 }
 
-bool LoadSTLModel(const char* filename)
+static bool ParseSTLModel(const char *filename, LoadedModel_t &model)
 {
-    if (!ParseSTLModel(filename, allSolids) || allSolids.size() < 1) {
+    PROFILE_FUNCTION();
+    const Uint64 start = SDL_GetPerformanceCounter();
+    std::vector<STLSolid_t> solids;
+    if (!ParseSTLFile(filename, solids)) {
+        Error("Failed to parse STL file '%s'", filename);
         return false;
     }
-    std::vector<glm::vec3> normals;
-    std::vector<glm::vec3> vertices;
-    std::vector<GLuint> elements;
-
-    ConvertSolidToNormalVertexElements(allSolids[allSolids.size()-1], normals,
-            vertices, elements);
-    Debug("normals.size(): %lu, vertices.size(): %lu, elements.size(): %lu",
-            normals.size(), vertices.size(), elements.size());
-    if (!CreateModelShaderProgram("mesh_shader", vertices, elements, normals)) {
+    if (solids.size() < 1) {
         return false;
     }
+    MeshData_t mesh;
+
+    ConvertSolidToNormalVertexElements(solids[solids.size()-1],
+            mesh.normals, mesh.vertices, mesh.elements);
+    model.parseMs += MillisecondsSince(start);
+    Debug("normals.size(): %lu, vertices.size(): %lu, elements.size(): %lu",
+            mesh.normals.size(), mesh.vertices.size(), mesh.elements.size());
+    PrepareModelMesh(filename, mesh, "", "", 1.0f, model);
     return true;
 }
 
-static bool LoadTexture(const char* filename)
+static bool DecodeTexture(const char* filename, LoadedTexture_t &texture)
 {
-    int w = 0;
-    int h = 0;
-    int comp = 0;
-    unsigned char *image = stbi_load(filename, &w, &h, &comp,
-            STBI_default);
-    if (!image) {
+    PROFILE_FUNCTION();
+    texture.name = filename;
+    texture.width = 0;
+    texture.height = 0;
+    texture.comp = 0;
+    texture.pixels = NULL;
+    texture.texture = 0;
+    texture.published = false;
+    MappedFile file;
+    if (!OpenAsset(filename, file) || file.GetSize() > INT_MAX) {
         Error("Failed to load texture image '%s'", filename);
         return false;
     }
-
-    GLuint texID;
-    glGenTextures(1, &texID);
-    glBindTexture(GL_TEXTURE_2D, texID);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    switch (comp) { // vec3 RGB vec4 RGBA
-    case 3:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB,
-                GL_UNSIGNED_BYTE, image);
-        break;
-    case 4:
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA,
-                GL_UNSIGNED_BYTE, image);
-        break;
-    default:
+    texture.pixels = stbi_load_from_memory(file.GetData(), file.GetSize(),
+            &texture.width, &texture.height, &texture.comp, STBI_default);
+    if (!texture.pixels) {
+        Error("Failed to load texture image '%s'", filename);
+        return false;
+    }
+    if (texture.comp != 3 && texture.comp != 4) { // vec3 RGB vec4 RGBA
         Error("Invalid number of components in obj model texture '%s': %d",
-                filename, comp);
+                filename, texture.comp);
+        stbi_image_free(texture.pixels);
+        texture.pixels = NULL;
         return false;
     }
-    stbi_image_free(image);
+    return true;
+}
+
+// Makes the GL texture with room for every row, filled from `pixels`
+// unless they are NULL
+static void MakeTexture(LoadedTexture_t &texture, const unsigned char *pixels)
+{
+    const GLenum format = texture.comp == 4 ? GL_RGBA : GL_RGB;
+    glGenTextures(1, &texture.texture);
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows aren't padded
+    glTexImage2D(GL_TEXTURE_2D, 0, format, texture.width, texture.height,
+            0, format, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     glBindTexture(GL_TEXTURE_2D, 0);
-    textures.insert(std::make_pair(filename, texID));
+}
+
+// Gives the texture its storage, the rows are uploaded by the steps
+// after it
+static bool AllocateTexture(LoadedTexture_t &texture)
+{
+    PROFILE_FUNCTION();
+    if (textures.find(texture.name) != textures.end()) {
+        Debug("Skipping already loaded texture '%s'", texture.name.c_str());
+        return true;
+    }
+    const Uint64 start = SDL_GetPerformanceCounter();
+    MakeTexture(texture, NULL);
+    textures.insert(std::make_pair(texture.name, texture.texture));
+    texture.published = true;
+    loadStats.textureMs += MillisecondsSince(start);
+    Debug("Number of textures: %d", textures.size());
+    return true;
+}
+
+// Makes the whole texture on the upload thread, the GL thread adds it
+// with PublishTexture once it is done
+static void CreateTexture(LoadedModel_t &model, size_t index)
+{
+    const Uint64 start = SDL_GetPerformanceCounter();
+    LoadedTexture_t &texture = model.textures[index];
+    MakeTexture(texture, texture.pixels);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES,
+            (size_t)texture.width*texture.height*texture.comp);
+    model.uploadThreadMs += MillisecondsSince(start);
+}
 
+static bool PublishTexture(LoadedTexture_t &texture)
+{
+    if (textures.find(texture.name) != textures.end()) {
+        Debug("Skipping already loaded texture '%s'", texture.name.c_str());
+        glDeleteTextures(1, &texture.texture);
+        texture.texture = 0;
+        return true;
+    }
+    textures.insert(std::make_pair(texture.name, texture.texture));
+    texture.published = true;
     Debug("Number of textures: %d", textures.size());
     return true;
 }
 
+// Copies a part's meshes into staging buffers on the upload thread
+static void StageModelPart(LoadedModel_t &model, size_t index)
+{
+    const Uint64 start = SDL_GetPerformanceCounter();
+    LoadedPart_t &part = model.parts[index];
+    part.staged.resize(1 + part.lods.size());
+    StageMesh(part.mesh, part.staged[0]);
+    for (size_t i=0; i<part.lods.size(); i++) {
+        StageMesh(part.lods[i].mesh, part.staged[i+1]);
+    }
+    model.uploadThreadMs += MillisecondsSince(start);
+}
+
+static void UploadTextureRows(const LoadedTexture_t &texture, int firstRow,
+        int numRows)
+{
+    if (texture.texture == 0) {
+        return; // Loaded before
+    }
+    const Uint64 start = SDL_GetPerformanceCounter();
+    const size_t rowBytes = (size_t)texture.width*texture.comp;
+    glBindTexture(GL_TEXTURE_2D, texture.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // RGB rows aren't padded
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, firstRow, texture.width, numRows,
+            texture.comp == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE,
+            texture.pixels + firstRow*rowBytes);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    CounterAdd(COUNTER_BUFFER_UPLOADS);
+    CounterAdd(COUNTER_UPLOAD_BYTES, numRows*rowBytes);
+    loadStats.textureMs += MillisecondsSince(start);
+}
+
 // Check if `mesh_t` contains smoothing group id.
 // static bool hasSmoothingGroup(const tinyobj::shape_t& shape)
 // {
@@ -293,8 +1143,68 @@ static bool LoadTexture(const char* filename)
 //   return false;
 // }
 
-static bool LoadObjModel(const char* filename)
+// Builds the mesh of one shape and prepares it as parts of `model`,
+// on any thread
+static bool PrepareObjShape(const tinyobj::attrib_t &attrib,
+        const tinyobj::shape_t &shape,
+        const std::vector<tinyobj::material_t> &materials,
+        const std::string &baseDir, LoadedModel_t &model)
+{
+    MeshData_t mesh;
+    GLuint i = 0;
+    //ShaderMaterial_t material;
+    int matId =  shape.mesh.material_ids[0]; // assume same material
+                                             // for whole object
+    if (matId < 0 || (size_t)matId >= materials.size()) {
+        Error("Shape '%s' has no material", shape.name.c_str());
+        return false;
+    }
+    const tinyobj::material_t &mat = materials[matId];
+
+    const Uint64 start = SDL_GetPerformanceCounter();
+    for (size_t f=0; f<shape.mesh.indices.size(); f++) {
+        // // Index struct to support different indices for vtx/normal/texcoord.
+        // // -1 means not used.
+        // typedef struct {
+        //   int vertex_index;
+        //   int normal_index;
+        //   int texcoord_index;
+        // } index_t;
+        tinyobj::index_t idx = shape.mesh.indices[f];
+        if (idx.vertex_index == -1) {
+            Error("No vertex information for index");
+            return false;
+        }
+        if (idx.normal_index == -1) {
+            Error("No normal information for index");
+            return false;
+        }
+        if (idx.texcoord_index == -1) {
+            Error("No UV information for index with texture material");
+            return false;
+        }
+
+        mesh.elements.push_back(i++);
+        mesh.vertices.emplace_back(glm::vec3(attrib.vertices[3*idx.vertex_index+0],
+                attrib.vertices[3*idx.vertex_index+1],
+                attrib.vertices[3*idx.vertex_index+2]));
+        mesh.normals.emplace_back(glm::vec3(attrib.normals[3*idx.normal_index],
+                attrib.normals[3*idx.normal_index+1],
+                attrib.normals[3*idx.normal_index+2]));
+        mesh.uvs.emplace_back(glm::vec2(attrib.texcoords[2*idx.texcoord_index],
+                attrib.texcoords[2*idx.texcoord_index+1]));
+    }
+    model.parseMs += MillisecondsSince(start);
+
+    PrepareModelMesh(shape.name.c_str(), mesh, baseDir + mat.name,
+            baseDir + mat.diffuse_texname, mat.dissolve, model);
+
+    return true;
+}
+
+static bool ParseObjModel(const char* filename, LoadedModel_t &model)
 {
+    PROFILE_FUNCTION();
     Info("Parsing OBJ file '%s'", filename);
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
@@ -302,8 +1212,10 @@ static bool LoadObjModel(const char* filename)
     std::string warn;
     std::string err;
     std::string baseDir = GetBaseDir(filename);
-    bool res = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err,
-            filename, baseDir.c_str());
+    Uint64 start = SDL_GetPerformanceCounter();
+    bool res = LoadObjAsset(filename, &attrib, &shapes, &materials, &warn,
+            &err);
+    model.parseMs += MillisecondsSince(start);
 
     if (!warn.empty()) {
         Warning("%s", warn.c_str());
@@ -325,107 +1237,372 @@ static bool LoadObjModel(const char* filename)
             attrib.normals.size()/3, attrib.vertices.size()/3,
             attrib.texcoords.size()/2);
 
-    // Load any textures parsed
-    std::string texFilename;
+    // Decode any textures parsed, each in a job
+    std::vector<std::string> texFilenames;
     for (unsigned int i=0; i<materials.size(); i++) {
         if (materials[i].diffuse_texname.size() == 0) {
             continue;
         }
-        texFilename = baseDir+materials[i].diffuse_texname;
-        if (textures.find(texFilename) != textures.end()) {
-            Debug("Skipping alread loaded texture '%s'", texFilename.c_str());
+        std::string texFilename = baseDir+materials[i].diffuse_texname;
+        if (std::find(texFilenames.begin(), texFilenames.end(),
+                texFilename) != texFilenames.end()) {
             continue;
         }
         Debug("materials[%lu].diffuse_texname: %s",
                 i, materials[i].diffuse_texname.c_str());
-        if (!LoadTexture(texFilename.c_str())) {
-            return false;
+        texFilenames.push_back(texFilename);
+    }
+    start = SDL_GetPerformanceCounter();
+    model.textures.resize(texFilenames.size());
+    std::vector<char> decoded(texFilenames.size()); // Not bool, jobs write it
+    ParallelFor(0, texFilenames.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i=begin; i<end; i++) {
+            decoded[i] = DecodeTexture(texFilenames[i].c_str(),
+                    model.textures[i]);
         }
+    });
+    model.textureMs += MillisecondsSince(start);
+    if (std::find(decoded.begin(), decoded.end(), false) != decoded.end()) {
+        return false;
     }
 
-    for (auto shape : shapes) {
-        std::vector<glm::vec3> normals;
-        std::vector<glm::vec3> vertices;
-        std::vector<glm::vec2> uvs;
-        std::vector<GLuint> elements;
-        GLuint i = 0;
-        //ShaderMaterial_t material;
-        int matId =  shape.mesh.material_ids[0]; // assume same material
-                                                 // for whole object
-        tinyobj::material_t mat = materials[matId];
-
-        for (size_t f=0; f<shape.mesh.indices.size(); f++) {
-            // // Index struct to support different indices for vtx/normal/texcoord.
-            // // -1 means not used.
-            // typedef struct {
-            //   int vertex_index;
-            //   int normal_index;
-            //   int texcoord_index;
-            // } index_t;
-            tinyobj::index_t idx = shape.mesh.indices[f];
-            if (idx.vertex_index == -1) {
-                Error("No vertex information for index");
-                return false;
-            }
-            if (idx.normal_index == -1) {
-                Error("No normal information for index");
-                return false;
-            }
-            if (idx.texcoord_index == -1) {
-                Error("No UV information for index with texture material");
-                return false;
-            }
+    // Every shape becomes parts of its own, put back in order after
+    std::vector<LoadedModel_t> shapeModels(shapes.size());
+    std::vector<char> prepared(shapes.size()); // Not bool, jobs write it
+    ParallelFor(0, shapes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i=begin; i<end; i++) {
+            prepared[i] = PrepareObjShape(attrib, shapes[i], materials,
+                    baseDir, shapeModels[i]);
+        }
+    });
+    if (std::find(prepared.begin(), prepared.end(), false)
+            != prepared.end()) {
+        return false;
+    }
+    for (size_t i=0; i<shapeModels.size(); i++) {
+        for (size_t j=0; j<shapeModels[i].parts.size(); j++) {
+            model.parts.push_back(std::move(shapeModels[i].parts[j]));
+        }
+        model.parseMs += shapeModels[i].parseMs;
+        model.optimizeMs += shapeModels[i].optimizeMs;
+    }
 
-            elements.push_back(i++);
-            vertices.emplace_back(glm::vec3(attrib.vertices[3*idx.vertex_index+0],
-                    attrib.vertices[3*idx.vertex_index+1],
-                    attrib.vertices[3*idx.vertex_index+2]));
-            normals.emplace_back(glm::vec3(attrib.normals[idx.normal_index],
-                    attrib.normals[3*idx.normal_index+1],
-                    attrib.normals[3*idx.normal_index+2]));
-            uvs.emplace_back(glm::vec2(attrib.texcoords[2*idx.texcoord_index],
-                    attrib.texcoords[2*idx.texcoord_index+1]));
-        }
-
-        // Create shader program
-        std::string texName = baseDir + mat.diffuse_texname;
-        if (!CreateTexturedModelShaderProgram("obj_mesh_shader", vertices,
-                elements, normals, uvs, textures[texName], textures[texName])) {
+    return true;
+}
+
+// Reads, decodes and optimizes a model on a loader thread. What is
+// left for the GL thread goes in `steps`: each texture's storage and
+// then its rows a band at a time, then one step per piece of mesh.
+// With the upload thread running textures and meshes are copied
+// there and the steps only wait for them to be done.
+static bool LoadModel(const std::string &filename, InstanceBuffer *instances,
+        std::vector<UploadStep_t> &steps)
+{
+    PROFILE_FUNCTION();
+    std::string extension = filename;
+    extension = extension.substr(extension.find_last_of("."));
+    for(auto& c : extension) {
+       c = tolower(c);
+    }
+    std::shared_ptr<LoadedModel_t> model(new LoadedModel_t());
+    model->instances = instances;
+    if (extension.compare(".stl") == 0) {
+        if (!ParseSTLModel(filename.c_str(), *model)) {
             return false;
         }
+    } else if (extension.compare(".obj") == 0) {
+        if (!ParseObjModel(filename.c_str(), *model)) {
+            return false;
+        }
+    } else {
+        // default
+        Warning("No parser available for file type '%s' model '%s'",
+                extension.c_str(), filename.c_str());
+        return true;
     }
 
+    const bool threaded = uploadThread.IsRunning();
+    for (size_t i=0; i<model->textures.size(); i++) {
+        const LoadedTexture_t &texture = model->textures[i];
+        if (threaded) {
+            const uint64_t ticket = uploadThread.Submit([model, i]() {
+                CreateTexture(*model, i);
+            });
+            steps.push_back({ [model, i]() {
+                return PublishTexture(model->textures[i]);
+            }, 0, [ticket]() { return uploadThread.IsDone(ticket); } });
+            continue;
+        }
+        steps.push_back({ [model, i]() {
+            return AllocateTexture(model->textures[i]);
+        }, 0 });
+        const size_t rowBytes = (size_t)texture.width*texture.comp;
+        const int bandRows = std::max(1, (int)(STREAM_TEXTURE_BAND_BYTES
+                / rowBytes));
+        for (int row=0; row<texture.height; row+=bandRows) {
+            const int numRows = std::min(bandRows, texture.height - row);
+            steps.push_back({ [model, i, row, numRows]() {
+                UploadTextureRows(model->textures[i], row, numRows);
+                return true;
+            }, numRows*rowBytes });
+        }
+    }
+    for (size_t i=0; i<model->parts.size(); i++) {
+        const LoadedPart_t &part = model->parts[i];
+        size_t bytes = GetMeshBytes(part.mesh);
+        for (size_t j=0; j<part.lods.size(); j++) {
+            bytes += GetMeshBytes(part.lods[j].mesh);
+        }
+        std::function<bool()> ready;
+        if (threaded) {
+            const uint64_t ticket = uploadThread.Submit([model, i]() {
+                StageModelPart(*model, i);
+            });
+            ready = [ticket]() { return uploadThread.IsDone(ticket); };
+        }
+        steps.push_back({ [model, i]() {
+            return AddModelObject(model->parts[i], model->instances);
+        }, bytes, ready });
+    }
+    // After every step the upload thread had a part in
+    steps.push_back({ [model]() {
+        loadStats.parseMs += model->parseMs;
+        loadStats.textureMs += model->textureMs;
+        loadStats.optimizeMs += model->optimizeMs;
+        loadStats.uploadThreadMs += model->uploadThreadMs;
+        return true;
+    }, 0 });
     return true;
 }
 
-bool SceneInit()
+static void SubmitModel(const char *filename, InstanceBuffer *instances=NULL)
 {
-    for (unsigned int i=0; i<sizeof(models)/sizeof(const char *); i++) {
-        std::string extension = models[i];
-        extension = extension.substr(extension.find_last_of("."));
-        for(auto& c : extension) {
-           c = tolower(c);
+    const std::string name = filename; // The caller's string may not last
+    assetStreamer.Submit(name, [name, instances](
+            std::vector<UploadStep_t> &steps) {
+        return LoadModel(name, instances, steps);
+    });
+}
+
+static void SubmitModelGrid(const ModelGrid_t &grid)
+{
+    PROFILE_FUNCTION();
+    instanceBuffers.emplace_back(new InstanceBuffer());
+    InstanceBuffer *instances = instanceBuffers.back().get();
+    const glm::vec3 origin = glm::vec3(-0.5f*grid.spacing*(grid.columns-1),
+            0.0f, -0.5f*grid.spacing*(grid.rows-1));
+    for (int row=0; row<grid.rows; row++) {
+        for (int column=0; column<grid.columns; column++) {
+            glm::vec3 position = origin + glm::vec3(column*grid.spacing,
+                    0.0f, row*grid.spacing);
+            // Vary the tint a little so neighbours can be told apart
+            float shade = 0.8f + 0.2f*(float)((row + column) % 2);
+            instances->Add(glm::translate(glm::mat4(1.0f), position),
+                    glm::vec4(shade, shade, shade, 1.0f));
         }
-        if (extension.compare(".stl") == 0) {
-            if (!LoadSTLModel(models[i])) {
-                return false;
-            }
-        } else if (extension.compare(".obj") == 0) {
-            if (!LoadObjModel(models[i])) {
-                return false;
-            }
-        } else {
-            // default
-            Warning("No parser available for file type '%s' model '%s'",
-                    extension.c_str(), models[i]);
+    }
+    Info("Loading %dx%d grid of '%s'", grid.columns, grid.rows,
+            grid.filename);
+    SubmitModel(grid.filename, instances);
+}
+
+static void AddPointLightGrid(const PointLightGrid_t &grid)
+{
+    static const glm::vec3 colors[] = {
+        glm::vec3(1.0f, 0.2f, 0.2f), glm::vec3(0.2f, 1.0f, 0.2f),
+        glm::vec3(0.2f, 0.2f, 1.0f), glm::vec3(1.0f, 1.0f, 0.2f),
+        glm::vec3(0.2f, 1.0f, 1.0f), glm::vec3(1.0f, 0.2f, 1.0f),
+    };
+    const size_t numColors = sizeof(colors)/sizeof(colors[0]);
+    const glm::vec3 origin = glm::vec3(-0.5f*grid.spacing*(grid.columns-1),
+            grid.height, -0.5f*grid.spacing*(grid.rows-1));
+    for (int row=0; row<grid.rows; row++) {
+        for (int column=0; column<grid.columns; column++) {
+            ShaderLight_t light;
+            light.position = origin + glm::vec3(column*grid.spacing,
+                    0.0f, row*grid.spacing);
+            light.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+            const glm::vec3 color = colors[(row*grid.columns + column)
+                    % numColors];
+            light.ambient = glm::vec3(0.0f);
+            light.diffuse = 0.5f * color;
+            light.specular = 0.25f * color;
+            light.innerCutOff = 0.0f;
+            light.outerCutOff = 0.0f;
+            // Reaches about 8 units, see LightRange
+            light.constant = 1.0f;
+            light.linear = 0.7f;
+            light.quadratic = 1.8f;
+            light.type = 1;
+            sceneLights.push_back(light);
         }
     }
+}
 
+bool SceneInit()
+{
+    return SceneInit(defaultScene);
+}
+
+bool SceneInit(const SceneDesc_t &desc)
+{
+    PROFILE_FUNCTION();
+    loadStart = SDL_GetPerformanceCounter();
+    memset((void *)&loadStats, 0, sizeof(SceneLoadStats_t));
+    Info("Loading scene '%s'", desc.name);
+    if (useUploadThread) {
+        if (uploadThread.Start()) {
+            Info("Uploading on a thread with a shared GL context");
+        } else {
+            Warning("Uploading on the GL thread, contexts can't share");
+        }
+    }
+    // Every model is parsed at once on the workers while the shaders
+    // compile here, their GL steps still run in this order
+    streaming = true;
+    loadFailed = false;
+    for (size_t i=0; i<desc.models.size(); i++) {
+        SubmitModel(desc.models[i]);
+    }
+    for (size_t i=0; i<desc.modelGrids.size(); i++) {
+        SubmitModelGrid(desc.modelGrids[i]);
+    }
+    Uint64 start = SDL_GetPerformanceCounter();
+    GetModelShaderProgram(); // Models fail to load without it
+    loadStats.shaderMs += MillisecondsSince(start);
+    for (size_t i=0; i<desc.pointLightGrids.size(); i++) {
+        AddPointLightGrid(desc.pointLightGrids[i]);
+    }
+    loadStats.numLights = sceneLights.size();
+    if (sceneLights.size() > 0) {
+        Info("%lu clustered lights", (unsigned long)sceneLights.size());
+    }
+    start = SDL_GetPerformanceCounter();
+    if (!GetDepthShaderProgram()) {
+        Warning("Depth pre-pass unavailable");
+    }
+    loadStats.shaderMs += MillisecondsSince(start);
+    loadStats.readyMs = MillisecondsSince(loadStart);
+    Info("Drawing after %.1fms, models load in the background",
+            loadStats.readyMs);
     return true;
 }
 
+bool SceneFinishLoading()
+{
+    UploadLoadedModels(true);
+    return !loadFailed;
+}
+
+bool SceneIsLoading()
+{
+    return streaming;
+}
+
+void SceneSetUploadThread(bool enabled)
+{
+    useUploadThread = enabled;
+}
+
+void SceneUnload()
+{
+    PROFILE_FUNCTION();
+    if (streaming) {
+        SceneFinishLoading(); // Nothing may still add to the scene
+    }
+    for (size_t i=0; i<sceneObjects.size(); i++) {
+        const SceneObject_t &object = sceneObjects[i];
+        for (uint32_t lod=0; lod<object.numLods; lod++) {
+            geometryArena.RemoveMesh(object.lods[lod]);
+        }
+    }
+    geometryArena.Compact();
+    sceneObjects.clear();
+    sceneBounds.Clear();
+    sceneBvh.Clear();
+    sceneBvhObjects = 0;
+    visibleObjects.clear();
+    occluderMeshes.clear();
+    for (size_t i=0; i<instanceBuffers.size(); i++) {
+        geometryArena.ReleaseInstanced(instanceBuffers[i]->GetBuffer());
+    }
+    instanceBuffers.clear();
+    for (auto it=textures.begin(); it!=textures.end(); it++) {
+        glDeleteTextures(1, &it->second);
+    }
+    textures.clear();
+    texturedMaterials.clear();
+    sceneMaterials.clear();
+    untexturedMaterial = SIZE_MAX;
+    sceneLights.clear();
+}
+
+void SceneShutdown()
+{
+    SceneUnload();
+    uploadThread.Stop();
+}
+
+const SceneLoadStats_t& SceneGetLoadStats()
+{
+    return loadStats;
+}
+
+const SceneFrameStats_t& SceneGetFrameStats()
+{
+    return frameStats;
+}
+
+void SceneGetBounds(glm::vec3 &min, glm::vec3 &max)
+{
+    min = glm::vec3(0.0f);
+    max = glm::vec3(0.0f);
+    for (size_t i=0; i<sceneBounds.GetSize(); i++) {
+        BoundingBox_t box = sceneBounds.GetBox(i);
+        min = i == 0 ? box.min : glm::min(min, box.min);
+        max = i == 0 ? box.max : glm::max(max, box.max);
+    }
+}
+
+void SceneSetCamera(const glm::vec3 &position, const glm::vec3 &target)
+{
+    camera.LookAt(position, target);
+}
+
+void SceneSetDepthPrepass(bool enabled)
+{
+    if (enabled != depthPrepass) {
+        Info("Depth pre-pass %s", enabled ? "on" : "off");
+    }
+    depthPrepass = enabled;
+}
+
+bool SceneGetDepthPrepass()
+{
+    return depthPrepass;
+}
+
+void SceneGetPassTimes(double &prepassMs, double &shadingMs)
+{
+    prepassMs = depthPrepass ? prepassTimer.GetMilliseconds() : 0.0;
+    shadingMs = shadingTimer.GetMilliseconds();
+}
+
+void SceneSetFixedFrameTime(double seconds)
+{
+    fixedFrameTime = seconds;
+}
+
 void KeyboardInput(int code, int state)
 {
+    // P toggles the depth pre-pass, key repeats are ignored
+    static bool toggleDown = false;
+    if (code == SDL_SCANCODE_P) {
+        if (state == SDL_KEYDOWN && !toggleDown) {
+            SceneSetDepthPrepass(!depthPrepass);
+        }
+        toggleDown = state == SDL_KEYDOWN;
+    }
     camera.KeyboardInput(code, state);
 }
 
@@ -1,11 +1,119 @@
 #ifndef SCENE_H
 #define SCENE_H
 #include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <glm/glm.hpp>
+
+// Vertical field of view, degrees
+#define FOV 45.0f
+
+// Models repeated over a grid on the floor, every shape of a grid is
+// drawn with a single instanced draw call
+struct ModelGrid_t {
+    const char *filename;
+    int columns;
+    int rows;
+    float spacing;
+};
+
+// Colored point lights hung over the floor in a grid. Each fragment
+// only shades the lights of its cluster so hundreds of them cost
+// about as much as a few.
+struct PointLightGrid_t {
+    int columns;
+    int rows;
+    float spacing;
+    float height;
+};
+
+// Everything SceneInit loads
+struct SceneDesc_t {
+    const char *name;
+    std::vector<const char *> models; // Drawn once at the origin
+    std::vector<ModelGrid_t> modelGrids;
+    std::vector<PointLightGrid_t> pointLightGrids;
+};
+
+// What SceneInit loaded and how long each part of it took
+struct SceneLoadStats_t {
+    double parseMs; // Reading model files into meshes
+    double textureMs; // Decoding and uploading textures
+    double optimizeMs; // Welding, vertex cache order and LOD chains
+    double uploadMs; // Copying meshes into the geometry arena
+    double uploadThreadMs; // Uploads left to the upload thread
+    double bvhMs;
+    double shaderMs;
+    double readyMs; // Until SceneInit returned and frames could start
+    double totalMs; // Until the last model was in
+    size_t numObjects;
+    size_t numTriangles; // Full detail, instances counted once each
+    size_t numLights; // Clustered ones
+};
+
+// The latest frame's work
+struct SceneFrameStats_t {
+    size_t numVisible; // Objects left after culling
+    size_t numDrawCalls; // Pre-pass included, a multi draw is one
+    size_t numTriangles; // Shading pass, at the levels picked
+    size_t numStateChanges; // Between neighbouring draws of the queue
+};
 
 void SceneRender();
 
+// Loads the built in scene
 bool SceneInit();
 
+// Returns once the shaders are ready, the models are read on loader
+// threads and uploaded a little every SceneRender, appearing as they
+// come in. False if the scene can't be drawn at all.
+bool SceneInit(const SceneDesc_t &desc);
+
+// Waits for every model and uploads the rest at once, false if any
+// failed to load
+bool SceneFinishLoading();
+
+// True until every model of the scene is in
+bool SceneIsLoading();
+
+// Hands buffer and texture uploads of the next SceneInit to a thread
+// with a GL context of its own, where contexts can share
+void SceneSetUploadThread(bool enabled);
+
+// Lets go of every object, texture and light once the models still
+// loading are in. Their meshes leave the geometry arena, which is then
+// compacted. SceneInit may load a scene again after.
+void SceneUnload();
+
+// Unloads the scene and stops what still uses the GL context, before
+// the window goes
+void SceneShutdown();
+
+const SceneLoadStats_t& SceneGetLoadStats();
+
+const SceneFrameStats_t& SceneGetFrameStats();
+
+// World space box around everything loaded
+void SceneGetBounds(glm::vec3 &min, glm::vec3 &max);
+
+// Puts the camera at `position` looking at `target`, it stays there
+// until it is moved again
+void SceneSetCamera(const glm::vec3 &position, const glm::vec3 &target);
+
+// Selects whether the next frames draw a depth pre-pass before the
+// shading pass, P toggles it too
+void SceneSetDepthPrepass(bool enabled);
+
+bool SceneGetDepthPrepass();
+
+// GPU milliseconds of the latest measured frame, negative when timer
+// queries aren't supported. The pre-pass is 0 while it is off.
+void SceneGetPassTimes(double &prepassMs, double &shadingMs);
+
+// Every frame moves the camera on by `seconds` rather than the time
+// that really passed, 0 goes back to real time
+void SceneSetFixedFrameTime(double seconds);
+
 void KeyboardInput(int code, int state);
 
 void MouseMotion(int deltaX, int deltaY);
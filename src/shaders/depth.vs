@@ -0,0 +1,22 @@
+#version 130
+// Depth pre-pass, computes gl_Position exactly like model.vs so the
+// shading pass can depth test against it with GL_LEQUAL
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+uniform int instanced; // Non zero when instanceModel is set
+
+in vec3 facetVertex;
+in mat4 instanceModel;
+
+invariant gl_Position;
+
+void main()
+{
+    mat4 world = model;
+    if (instanced != 0) {
+        world = model * instanceModel;
+    }
+    gl_Position = projection * view * world * vec4(facetVertex, 1.0f);
+}
@@ -7,6 +7,7 @@ struct Material {
     vec3 diffuse;
     vec3 specular;
     float shininess;
+    float opacity;
     int type; // 0 = ambient, float diffuse
               // 1 = Sampler Texture0(diffuse) Texture1(specular)
 };
@@ -36,6 +37,7 @@ uniform mat4 view;
 uniform mat4 projection;
 uniform vec3 cameraPositon;
 uniform int numLights;
+uniform int instanced; // Non zero when instanceModel/Color are set
 #define MAX_LIGHTS 16
 uniform Light lights[MAX_LIGHTS];
 uniform Material material;
@@ -43,11 +45,17 @@ uniform Material material;
 in vec3 facetVertex;
 in vec3 facetNormal;
 in vec2 facetUV;
+in mat4 instanceModel;
+in vec4 instanceColor;
 
 //out vec3 inVertex;
 out vec3 inFragPos;
 out vec3 inNormal;
 out vec2 inUV;
+out vec4 inColor;
+
+// Matches depth.vs so a depth pre-pass can be tested with GL_LEQUAL
+invariant gl_Position;
 
 mat4 inverse(mat4 src)
 {
@@ -60,9 +68,15 @@ mat4 inverse(mat4 src)
 
 void main()
 {
-    inFragPos = vec3(model * vec4(facetVertex, 1.0));
+    mat4 world = model;
+    inColor = vec4(1.0);
+    if (instanced != 0) {
+        world = model * instanceModel;
+        inColor = instanceColor;
+    }
+    inFragPos = vec3(world * vec4(facetVertex, 1.0));
     //inVertex = facetVertex;
-    inNormal = normalize(mat3(transpose(inverse(model))) * facetNormal);
+    inNormal = normalize(mat3(transpose(inverse(world))) * facetNormal);
     inUV = vec2(facetUV.x, 1.0-facetUV.y); // y-coord flipped
-    gl_Position = projection * view * model * vec4(facetVertex, 1.0f);
+    gl_Position = projection * view * world * vec4(facetVertex, 1.0f);
 }
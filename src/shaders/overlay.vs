@@ -0,0 +1,19 @@
+#version 130
+// Text and graphs drawn over the frame, positions are in pixels from
+// the top left corner
+
+uniform mat4 projection;
+
+in vec2 facetVertex;
+in vec2 facetUV;
+in vec4 vertexColor;
+
+out vec2 uv;
+out vec4 color;
+
+void main()
+{
+    uv = facetUV;
+    color = vertexColor;
+    gl_Position = projection * vec4(facetVertex, 0.0, 1.0);
+}
@@ -0,0 +1,54 @@
+// Packs assets into an archive the program mounts at startup, see
+// util/archive.h. `make pack` runs it in the build directory over the
+// models and shaders, so entries are named the way they are loaded:
+//
+//   packer.elf [--store] <archive> <file>...
+//
+// --store leaves every entry uncompressed.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "util/archive.h"
+#include "util/log.h"
+
+int main(int argc, char **argv)
+{
+    bool compress = true;
+    int first = 1;
+    if (first < argc && strcmp(argv[first], "--store") == 0) {
+        compress = false;
+        first++;
+    }
+    if (argc - first < 2) {
+        Error("Usage: %s [--store] <archive> <file>...", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char *archiveFile = argv[first];
+    std::vector<ArchiveInput_t> inputs;
+    for (int i=first+1; i<argc; i++) {
+        inputs.push_back({ argv[i], argv[i] });
+    }
+    if (!WriteArchive(archiveFile, inputs, compress)) {
+        return EXIT_FAILURE;
+    }
+    // Read it back so a bad archive never reaches the program
+    Archive archive;
+    if (!archive.Open(archiveFile)) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i=0; i<inputs.size(); i++) {
+        MappedFile original;
+        MappedFile packed;
+        const ArchiveEntry_t *entry = archive.Find(inputs[i].name.c_str());
+        if (entry == NULL || !archive.Read(*entry, packed)
+                || !original.Open(inputs[i].filename.c_str())
+                || packed.GetSize() != original.GetSize()
+                || memcmp(packed.GetData(), original.GetData(),
+                    original.GetSize()) != 0) {
+            Error("'%s' did not survive packing", inputs[i].name.c_str());
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,285 @@
+#include "archive.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "util/compress.h"
+#include "util/log.h"
+
+static_assert(sizeof(ArchiveHeader_t) == 32, "Archive header is packed");
+static_assert(sizeof(ArchiveEntry_t) == 48, "Archive entries are packed");
+
+static Archive mountedArchive;
+
+// "./models/cube.stl" is "models/cube.stl"
+static const char* SkipDotSlash(const char *name)
+{
+    while (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    return name;
+}
+
+static uint64_t AlignUp(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+uint64_t HashArchiveName(const char *name, size_t length)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i=0; i<length; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+bool Archive::Open(const char *filename)
+{
+    Close();
+    if (!m_file.Open(filename)) {
+        return false;
+    }
+    const uint64_t size = m_file.GetSize();
+    const uint8_t *data = m_file.GetData();
+    ArchiveHeader_t header;
+    if (size < sizeof(header)) {
+        Error("Archive '%s' is too small", filename);
+        Close();
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(header.magic)) != 0
+            || header.version != ARCHIVE_VERSION) {
+        Error("'%s' is not a version %d archive", filename, ARCHIVE_VERSION);
+        Close();
+        return false;
+    }
+    if (header.tocOffset % sizeof(uint64_t) != 0 || header.tocOffset > size
+            || (size - header.tocOffset) / sizeof(ArchiveEntry_t)
+                < header.numEntries
+            || header.namesOffset > size
+            || size - header.namesOffset < header.namesSize) {
+        Error("Archive '%s' has a bad table of contents", filename);
+        Close();
+        return false;
+    }
+    m_entries = (const ArchiveEntry_t *)(data + header.tocOffset);
+    m_names = (const char *)(data + header.namesOffset);
+    m_numEntries = header.numEntries;
+    for (uint32_t i=0; i<m_numEntries; i++) {
+        const ArchiveEntry_t &entry = m_entries[i];
+        const bool compressed = entry.flags & ARCHIVE_ENTRY_COMPRESSED;
+        if ((uint64_t)entry.nameOffset + entry.nameLength > header.namesSize
+                || entry.offset > size
+                || size - entry.offset < entry.storedSize
+                || (!compressed && entry.storedSize != entry.size)
+                || entry.size > SIZE_MAX
+                || entry.hash != HashArchiveName(m_names + entry.nameOffset,
+                    entry.nameLength)
+                || (i > 0 && m_entries[i-1].hash > entry.hash)) {
+            Error("Archive '%s' has a bad entry %u", filename, i);
+            Close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void Archive::Close()
+{
+    m_file.Close();
+    m_entries = NULL;
+    m_names = NULL;
+    m_numEntries = 0;
+}
+
+const ArchiveEntry_t* Archive::Find(const char *name) const
+{
+    name = SkipDotSlash(name);
+    const size_t length = strlen(name);
+    const uint64_t hash = HashArchiveName(name, length);
+    const ArchiveEntry_t *end = m_entries + m_numEntries;
+    const ArchiveEntry_t *entry = std::lower_bound(m_entries, end, hash,
+            [](const ArchiveEntry_t &a, uint64_t b) { return a.hash < b; });
+    for (; entry != end && entry->hash == hash; entry++) {
+        if (entry->nameLength == length
+                && memcmp(m_names + entry->nameOffset, name, length) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+bool Archive::Read(const ArchiveEntry_t &entry, MappedFile &file) const
+{
+    const uint8_t *data = m_file.GetData() + entry.offset;
+    if (!(entry.flags & ARCHIVE_ENTRY_COMPRESSED)) {
+        file.OpenView(data, entry.size);
+        return true;
+    }
+    uint8_t *buffer = file.OpenBuffer(entry.size);
+    if (!LzDecompress(data, entry.storedSize, buffer, entry.size)) {
+        Error("Archive entry '%s' is corrupt", GetName(entry).c_str());
+        file.Close();
+        return false;
+    }
+    return true;
+}
+
+std::string Archive::GetName(const ArchiveEntry_t &entry) const
+{
+    return std::string(m_names + entry.nameOffset, entry.nameLength);
+}
+
+struct PackedEntry_t {
+    std::string name;
+    uint64_t hash;
+    uint64_t size;
+    uint32_t flags;
+    std::vector<uint8_t> data; // As stored
+};
+
+static bool PackEntry(const ArchiveInput_t &input, bool compress,
+        PackedEntry_t &packed)
+{
+    MappedFile file;
+    if (!file.Open(input.filename.c_str())) {
+        return false;
+    }
+    packed.name = SkipDotSlash(input.name.c_str());
+    packed.hash = HashArchiveName(packed.name.c_str(), packed.name.size());
+    packed.size = file.GetSize();
+    packed.flags = 0;
+    if (compress && packed.size > 0) {
+        packed.data.resize(LzCompressBound(packed.size));
+        const size_t compressedSize = LzCompress(file.GetData(),
+                packed.size, packed.data.data(), packed.data.size());
+        if (compressedSize <= packed.size
+                - packed.size / ARCHIVE_MIN_SAVING) {
+            packed.data.resize(compressedSize);
+            packed.flags |= ARCHIVE_ENTRY_COMPRESSED;
+            return true;
+        }
+    }
+    packed.data.assign(file.GetData(), file.GetData() + packed.size);
+    return true;
+}
+
+static bool WritePadding(FILE *f, uint64_t &written, uint64_t offset)
+{
+    static const uint8_t zeros[ARCHIVE_ALIGNMENT] = {};
+    while (written < offset) {
+        const size_t length = std::min(offset - written,
+                (uint64_t)sizeof(zeros));
+        if (fwrite(zeros, 1, length, f) != length) {
+            return false;
+        }
+        written += length;
+    }
+    return true;
+}
+
+bool WriteArchive(const char *filename,
+        const std::vector<ArchiveInput_t> &inputs, bool compress)
+{
+    std::vector<PackedEntry_t> packed(inputs.size());
+    for (size_t i=0; i<inputs.size(); i++) {
+        if (!PackEntry(inputs[i], compress, packed[i])) {
+            return false;
+        }
+    }
+    std::sort(packed.begin(), packed.end(),
+            [](const PackedEntry_t &a, const PackedEntry_t &b) {
+                return a.hash != b.hash ? a.hash < b.hash : a.name < b.name;
+            });
+    ArchiveHeader_t header;
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(header.magic));
+    header.version = ARCHIVE_VERSION;
+    header.numEntries = packed.size();
+    header.tocOffset = sizeof(header);
+    header.namesOffset = header.tocOffset
+            + packed.size() * sizeof(ArchiveEntry_t);
+    std::vector<ArchiveEntry_t> entries(packed.size());
+    std::string names;
+    for (size_t i=0; i<packed.size(); i++) {
+        if (i > 0 && packed[i].name == packed[i-1].name) {
+            Error("'%s' is packed twice", packed[i].name.c_str());
+            return false;
+        }
+        entries[i].hash = packed[i].hash;
+        entries[i].storedSize = packed[i].data.size();
+        entries[i].size = packed[i].size;
+        entries[i].nameOffset = names.size();
+        entries[i].nameLength = packed[i].name.size();
+        entries[i].flags = packed[i].flags;
+        entries[i].reserved = 0;
+        names += packed[i].name;
+    }
+    header.namesSize = names.size();
+    uint64_t offset = header.namesOffset + header.namesSize;
+    uint64_t totalSize = 0;
+    uint64_t totalStored = 0;
+    for (size_t i=0; i<entries.size(); i++) {
+        offset = AlignUp(offset, ARCHIVE_ALIGNMENT);
+        entries[i].offset = offset;
+        offset += entries[i].storedSize;
+        totalSize += entries[i].size;
+        totalStored += entries[i].storedSize;
+    }
+
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        Error("Could not open '%s' for the archive", filename);
+        return false;
+    }
+    uint64_t written = sizeof(header) + entries.size()
+            * sizeof(ArchiveEntry_t) + names.size();
+    bool success = fwrite(&header, sizeof(header), 1, f) == 1
+            && fwrite(entries.data(), sizeof(ArchiveEntry_t), entries.size(),
+                f) == entries.size()
+            && fwrite(names.data(), 1, names.size(), f) == names.size();
+    for (size_t i=0; success && i<entries.size(); i++) {
+        success = WritePadding(f, written, entries[i].offset)
+                && fwrite(packed[i].data.data(), 1, packed[i].data.size(),
+                    f) == packed[i].data.size();
+        written += packed[i].data.size();
+    }
+    success = fclose(f) == 0 && success;
+    if (!success) {
+        Error("Failed writing archive '%s'", filename);
+        remove(filename);
+        return false;
+    }
+    Success("Packed %u entries into '%s', %.1f KiB stored as %.1f KiB",
+            (uint32_t)entries.size(), filename, totalSize / 1024.0,
+            totalStored / 1024.0);
+    return true;
+}
+
+bool MountArchive(const char *filename)
+{
+    if (!mountedArchive.Open(filename)) {
+        return false;
+    }
+    Info("Mounted archive '%s' with %u entries", filename,
+            mountedArchive.GetNumEntries());
+    return true;
+}
+
+void UnmountArchive()
+{
+    mountedArchive.Close();
+}
+
+bool OpenAsset(const char *filename, MappedFile &file)
+{
+    if (mountedArchive.IsOpen()) {
+        const ArchiveEntry_t *entry = mountedArchive.Find(filename);
+        if (entry != NULL) {
+            return mountedArchive.Read(*entry, file);
+        }
+    }
+    return file.Open(filename);
+}
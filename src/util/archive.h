@@ -0,0 +1,105 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "util/mapped_file.h"
+
+// Mounted at startup when it is in the working directory
+#define ARCHIVE_DEFAULT_FILENAME "assets.pak"
+
+#define ARCHIVE_MAGIC "PAK1"
+#define ARCHIVE_VERSION 1
+// Entries start on page boundaries so stored ones map straight in
+#define ARCHIVE_ALIGNMENT 4096
+// Entries are stored compressed when that saves at least 1/8th
+#define ARCHIVE_MIN_SAVING 8
+
+#define ARCHIVE_ENTRY_COMPRESSED 0x1
+
+// The layout is this header, the table of contents, the names and then
+// the entries' data. Everything is little endian.
+struct ArchiveHeader_t {
+    char magic[4];
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t namesSize;
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+};
+
+// The table is sorted by hash and then name
+struct ArchiveEntry_t {
+    uint64_t hash; // HashArchiveName of the name
+    uint64_t offset;
+    uint64_t storedSize;
+    uint64_t size; // Once decompressed
+    uint32_t nameOffset; // Into the names, which are not terminated
+    uint32_t nameLength;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// FNV-1a
+uint64_t HashArchiveName(const char *name, size_t length);
+
+class Archive
+{
+    // Read only access to a packed archive. The archive is memory
+    // mapped, so finding an entry is a binary search over the table
+    // and reading a stored one copies nothing. All of it is safe to
+    // call from any thread once open.
+public:
+    Archive() = default;
+
+    // Checks the whole table, logs and returns false if it is bad
+    bool Open(const char *filename);
+
+    void Close();
+
+    bool IsOpen() const { return m_file.IsOpen(); }
+
+    // NULL when there is no entry called `name`
+    const ArchiveEntry_t* Find(const char *name) const;
+
+    // Views stored entries in place, decompresses compressed ones
+    bool Read(const ArchiveEntry_t &entry, MappedFile &file) const;
+
+    uint32_t GetNumEntries() const { return m_numEntries; }
+
+    std::string GetName(const ArchiveEntry_t &entry) const;
+
+    Archive(const Archive &) = delete;
+    Archive& operator=(const Archive &) = delete;
+
+private:
+    MappedFile m_file;
+
+    const ArchiveEntry_t *m_entries = NULL;
+
+    const char *m_names = NULL;
+
+    uint32_t m_numEntries = 0;
+};
+
+struct ArchiveInput_t {
+    std::string name; // What Find will be asked for
+    std::string filename; // Where it is read from
+};
+
+// Packs `inputs` into a new archive, compressing what is worth it
+// unless `compress` is false
+bool WriteArchive(const char *filename,
+        const std::vector<ArchiveInput_t> &inputs, bool compress);
+
+// The archive OpenAsset looks in first. False if it can't be opened.
+bool MountArchive(const char *filename);
+
+void UnmountArchive();
+
+// Opens an asset from the mounted archive, or the file system if it
+// isn't there. Every loader goes through this.
+bool OpenAsset(const char *filename, MappedFile &file);
+
+#endif
@@ -0,0 +1,118 @@
+#include "asset_streamer.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "util/log.h"
+#include "util/profiler.h"
+
+typedef std::chrono::steady_clock Clock;
+
+void AssetStreamer::Submit(const std::string &name, const LoadFn &load)
+{
+    Load_t *entry;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loads.emplace_back(new Load_t());
+        entry = m_loads.back().get();
+        entry->name = name;
+        entry->load = load;
+        entry->nextStep = 0;
+        entry->state = LOAD_QUEUED;
+    }
+    RunBackgroundJob([this, entry]() { RunLoad(entry); }, &m_jobs);
+}
+
+size_t AssetStreamer::Upload(double budgetMs, size_t budgetBytes)
+{
+    PROFILE_FUNCTION();
+    const Clock::time_point start = Clock::now();
+    size_t numSteps = 0;
+    size_t bytes = 0;
+    while (true) {
+        Load_t *load;
+        std::unique_ptr<Load_t> done;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_loads.size() == 0) {
+                break;
+            }
+            load = m_loads.front().get();
+            if (load->state == LOAD_FAILED || (load->state == LOAD_READY
+                    && load->nextStep == load->steps.size())) {
+                m_numFailed += load->state == LOAD_FAILED;
+                done = std::move(m_loads.front());
+                m_loads.pop_front();
+            } else if (load->state != LOAD_READY) {
+                break; // Later loads wait their turn
+            }
+        }
+        if (done) {
+            continue; // Freed outside the lock
+        }
+        // Only this thread touches the steps once the load is ready
+        UploadStep_t &step = load->steps[load->nextStep];
+        if (step.ready && !step.ready()) {
+            break;
+        }
+        const double elapsedMs = std::chrono::duration<double,
+                std::milli>(Clock::now() - start).count();
+        if (numSteps > 0 && (elapsedMs >= budgetMs
+                || bytes + step.bytes > budgetBytes)) {
+            break;
+        }
+        load->nextStep++;
+        numSteps++;
+        bytes += step.bytes;
+        const bool ok = step.run();
+        step = UploadStep_t(); // Lets go of what it held
+        if (!ok) {
+            Error("Failed to upload '%s'", load->name.c_str());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            load->state = LOAD_FAILED;
+        }
+    }
+    return numSteps;
+}
+
+bool AssetStreamer::Finish()
+{
+    PROFILE_FUNCTION();
+    WaitForJobs(m_jobs, true);
+    Upload(1e30, SIZE_MAX);
+    while (IsBusy()) {
+        std::this_thread::yield(); // Steps waiting on another thread
+        Upload(1e30, SIZE_MAX);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const bool ok = m_numFailed == 0;
+    m_numFailed = 0;
+    return ok;
+}
+
+bool AssetStreamer::IsBusy()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_loads.size() > 0;
+}
+
+void AssetStreamer::RunLoad(Load_t *load)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        load->state = LOAD_RUNNING;
+    }
+    // Quitting drops the loads that haven't started
+    const bool dropped = m_quit.load() || IsJobSystemStopping();
+    const bool ok = !dropped && load->load(load->steps);
+    if (!ok && !dropped) {
+        Error("Failed to load '%s'", load->name.c_str());
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    load->state = ok ? LOAD_READY : LOAD_FAILED;
+}
+
+AssetStreamer::~AssetStreamer()
+{
+    m_quit.store(true);
+    WaitForJobs(m_jobs, true);
+}
@@ -0,0 +1,86 @@
+#ifndef ASSET_STREAMER_H
+#define ASSET_STREAMER_H
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "util/job_system.h"
+
+// GL work a load hands back, run on the GL thread. `bytes` is roughly
+// what it uploads. Returning false drops the load's remaining steps.
+// A step with `ready` waits in line until that returns true, for
+// work handed to another thread.
+struct UploadStep_t {
+    std::function<bool()> run;
+    size_t bytes;
+    std::function<bool()> ready;
+};
+
+class AssetStreamer
+{
+    // Runs loads as background jobs and feeds the GL work they hand
+    // back to the GL thread a few steps a frame, so loading never holds
+    // up a frame for long. Steps run in the order the loads were
+    // submitted, whichever finishes first.
+public:
+    // Fills `steps` off the GL thread, false if the load failed
+    typedef std::function<bool(std::vector<UploadStep_t> &steps)> LoadFn;
+
+    AssetStreamer() = default;
+
+    void Submit(const std::string &name, const LoadFn &load);
+
+    // Runs the steps that are ready until `budgetMs` or `budgetBytes`
+    // are spent, the first step runs whatever its size. Returns the
+    // number of steps run. GL thread only.
+    size_t Upload(double budgetMs, size_t budgetBytes);
+
+    // Loads and uploads everything submitted, helping with the loads
+    // and waiting for steps that aren't ready, false if anything failed
+    // since the last call. GL thread only.
+    bool Finish();
+
+    // True while anything submitted has steps left to run
+    bool IsBusy();
+
+    // Copies are not allowed
+    AssetStreamer(const AssetStreamer &) = delete;
+    AssetStreamer& operator=(const AssetStreamer &) = delete;
+
+    // Waits for the loads, those that haven't started are dropped
+    ~AssetStreamer();
+
+private:
+    enum LoadState_t {
+        LOAD_QUEUED,
+        LOAD_RUNNING,
+        LOAD_READY,
+        LOAD_FAILED,
+    };
+
+    struct Load_t {
+        std::string name;
+        LoadFn load;
+        std::vector<UploadStep_t> steps;
+        size_t nextStep;
+        LoadState_t state;
+    };
+
+    void RunLoad(Load_t *load);
+
+    std::mutex m_mutex;
+
+    std::deque<std::unique_ptr<Load_t>> m_loads; // Submission order
+
+    JobCounter_t m_jobs; // Loads that haven't run
+
+    uint32_t m_numFailed = 0;
+
+    std::atomic<bool> m_quit{false};
+};
+
+#endif
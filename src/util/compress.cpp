@@ -0,0 +1,169 @@
+#include "compress.h"
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 16
+// The format's end rules: the last 5 bytes are always literals and the
+// last match starts at least 12 bytes before the end
+#define LZ_LAST_LITERALS 5
+#define LZ_MATCH_FIND_LIMIT 12
+// Lengths up to this fit in the token's nibble, longer ones carry on in
+// bytes after it
+#define LZ_NIBBLE_MAX 15
+
+static uint32_t Read32(const uint8_t *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static uint32_t Hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t* WriteLength(uint8_t *out, size_t length)
+{
+    length -= LZ_NIBBLE_MAX;
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+// A match of 0 bytes ends the block after the literals
+static uint8_t* WriteSequence(uint8_t *out, const uint8_t *literals,
+        size_t numLiterals, size_t offset, size_t matchLength)
+{
+    const size_t matchCode = matchLength > 0 ? matchLength - LZ_MIN_MATCH
+            : 0;
+    uint8_t *token = out++;
+    *token = (uint8_t)((std::min(numLiterals, (size_t)LZ_NIBBLE_MAX) << 4)
+            | std::min(matchCode, (size_t)LZ_NIBBLE_MAX));
+    if (numLiterals >= LZ_NIBBLE_MAX) {
+        out = WriteLength(out, numLiterals);
+    }
+    memcpy(out, literals, numLiterals);
+    out += numLiterals;
+    if (matchLength == 0) {
+        return out;
+    }
+    *out++ = (uint8_t)(offset & 0xff);
+    *out++ = (uint8_t)(offset >> 8);
+    if (matchCode >= LZ_NIBBLE_MAX) {
+        out = WriteLength(out, matchCode);
+    }
+    return out;
+}
+
+size_t LzCompressBound(size_t size)
+{
+    return size + size/255 + 16;
+}
+
+size_t LzCompress(const uint8_t *src, size_t size, uint8_t *dst,
+        size_t capacity)
+{
+    if (capacity < LzCompressBound(size)) {
+        return 0;
+    }
+    // Last position each hashed 4 bytes were seen at, checked before use
+    std::vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+    uint8_t *out = dst;
+    size_t anchor = 0; // Start of the literals not yet written
+    size_t pos = 0;
+    const size_t matchEnd = size - std::min(size, (size_t)LZ_LAST_LITERALS);
+    while (pos + LZ_MATCH_FIND_LIMIT <= size) {
+        const uint32_t value = Read32(src + pos);
+        const uint32_t hash = Hash(value);
+        const size_t candidate = table[hash];
+        table[hash] = (uint32_t)pos;
+        if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET
+                || Read32(src + candidate) != value) {
+            pos++;
+            continue;
+        }
+        size_t length = LZ_MIN_MATCH;
+        while (pos + length < matchEnd
+                && src[candidate + length] == src[pos + length]) {
+            length++;
+        }
+        out = WriteSequence(out, src + anchor, pos - anchor,
+                pos - candidate, length);
+        pos += length;
+        anchor = pos;
+    }
+    out = WriteSequence(out, src + anchor, size - anchor, 0, 0);
+    return out - dst;
+}
+
+static bool ReadLength(const uint8_t *&in, const uint8_t *end,
+        size_t &length)
+{
+    uint8_t byte;
+    do {
+        if (in >= end) {
+            return false;
+        }
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool LzDecompress(const uint8_t *src, size_t srcSize, uint8_t *dst,
+        size_t dstSize)
+{
+    const uint8_t *in = src;
+    const uint8_t *inEnd = src + srcSize;
+    uint8_t *out = dst;
+    uint8_t *outEnd = dst + dstSize;
+    while (in < inEnd) {
+        const uint8_t token = *in++;
+        size_t numLiterals = token >> 4;
+        if (numLiterals == LZ_NIBBLE_MAX
+                && !ReadLength(in, inEnd, numLiterals)) {
+            return false;
+        }
+        if (numLiterals > (size_t)(inEnd - in)
+                || numLiterals > (size_t)(outEnd - out)) {
+            return false;
+        }
+        memcpy(out, in, numLiterals);
+        in += numLiterals;
+        out += numLiterals;
+        if (in == inEnd) {
+            break; // The last sequence has no match
+        }
+        if (inEnd - in < 2) {
+            return false;
+        }
+        const size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        size_t length = token & LZ_NIBBLE_MAX;
+        if (length == LZ_NIBBLE_MAX && !ReadLength(in, inEnd, length)) {
+            return false;
+        }
+        length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - dst)
+                || length > (size_t)(outEnd - out)) {
+            return false;
+        }
+        const uint8_t *match = out - offset;
+        if (offset >= length) {
+            memcpy(out, match, length);
+        } else { // Overlaps what it writes, repeating the last bytes
+            for (size_t i=0; i<length; i++) {
+                out[i] = match[i];
+            }
+        }
+        out += length;
+    }
+    return out == outEnd;
+}
@@ -0,0 +1,23 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include <cstddef>
+#include <cstdint>
+
+// Byte oriented LZ77 in the LZ4 block format: each sequence is a token
+// holding the literal and match lengths, the literals, then a 16 bit
+// little endian offset back into the output. It decompresses at close
+// to memcpy speed, which is what archive entries need.
+
+// Largest compressed size of `size` bytes
+size_t LzCompressBound(size_t size);
+
+// Returns the compressed size, 0 when `capacity` is under the bound
+size_t LzCompress(const uint8_t *src, size_t size, uint8_t *dst,
+        size_t capacity);
+
+// False unless `src` decompresses to exactly `dstSize` bytes. Never
+// reads or writes outside either buffer, whatever `src` holds.
+bool LzDecompress(const uint8_t *src, size_t srcSize, uint8_t *dst,
+        size_t dstSize);
+
+#endif
@@ -0,0 +1,161 @@
+#include "counters.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include "util/log.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const char *counterNames[COUNTER_COUNT] = {
+    "draw_calls",
+    "triangles",
+    "program_binds",
+    "texture_binds",
+    "buffer_uploads",
+    "upload_bytes",
+};
+
+// 32 bits wide so the adds stay lock free on 32-bit builds
+static std::atomic<uint32_t> counters[COUNTER_COUNT];
+static CounterFrame_t lastFrame;
+static bool anyFrameEnded = false;
+static Clock::time_point lastFrameEnd;
+
+static double frameTimes[COUNTER_HISTORY_FRAMES];
+static size_t numFrameTimes = 0;
+static size_t nextFrameTime = 0;
+
+// Totals since the dump's last row
+static FILE *dumpFile = NULL;
+static Clock::time_point dumpStart;
+static Clock::time_point dumpRowStart;
+static uint32_t dumpFrames = 0;
+static double dumpFrameMs = 0.0;
+static double dumpMaxFrameMs = 0.0;
+static uint64_t dumpTotals[COUNTER_COUNT];
+
+static double SecondsBetween(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double>(end - start).count();
+}
+
+void CounterAdd(Counter_t counter, size_t amount)
+{
+    counters[counter].fetch_add((uint32_t)amount, std::memory_order_relaxed);
+}
+
+const char* GetCounterName(Counter_t counter)
+{
+    return counterNames[counter];
+}
+
+static void WriteDumpRow(Clock::time_point now)
+{
+    const double frames = std::max(dumpFrames, 1u);
+    fprintf(dumpFile, "%.3f,%u,%.2f,%.4f,%.4f",
+            SecondsBetween(dumpStart, now), dumpFrames,
+            dumpFrameMs > 0.0 ? 1000.0 * dumpFrames / dumpFrameMs : 0.0,
+            dumpFrameMs / frames, dumpMaxFrameMs);
+    for (int i=0; i<COUNTER_COUNT; i++) {
+        fprintf(dumpFile, ",%.1f", dumpTotals[i] / frames);
+    }
+    fprintf(dumpFile, "\n");
+    fflush(dumpFile);
+    dumpRowStart = now;
+    dumpFrames = 0;
+    dumpFrameMs = 0.0;
+    dumpMaxFrameMs = 0.0;
+    memset(dumpTotals, 0, sizeof(dumpTotals));
+}
+
+void CountersEndFrame()
+{
+    const Clock::time_point now = Clock::now();
+    const bool timed = anyFrameEnded; // The first frame has no start
+    lastFrame.frameMs = timed ? 1000.0 * SecondsBetween(lastFrameEnd, now)
+            : 0.0;
+    for (int i=0; i<COUNTER_COUNT; i++) {
+        lastFrame.values[i] = counters[i].exchange(0,
+                std::memory_order_relaxed);
+    }
+    if (timed) {
+        frameTimes[nextFrameTime] = lastFrame.frameMs;
+        nextFrameTime = (nextFrameTime + 1) % COUNTER_HISTORY_FRAMES;
+        numFrameTimes = std::min(numFrameTimes + 1,
+                (size_t)COUNTER_HISTORY_FRAMES);
+    }
+    anyFrameEnded = true;
+    lastFrameEnd = now;
+
+    if (dumpFile == NULL || !timed) {
+        return;
+    }
+    dumpFrames++;
+    dumpFrameMs += lastFrame.frameMs;
+    dumpMaxFrameMs = std::max(dumpMaxFrameMs, lastFrame.frameMs);
+    for (int i=0; i<COUNTER_COUNT; i++) {
+        dumpTotals[i] += lastFrame.values[i];
+    }
+    if (SecondsBetween(dumpRowStart, now) >= COUNTER_DUMP_SECONDS) {
+        WriteDumpRow(now);
+    }
+}
+
+const CounterFrame_t& GetLastFrameCounters()
+{
+    return lastFrame;
+}
+
+double GetFrameTimeHistory(size_t i)
+{
+    const size_t oldest = (nextFrameTime + COUNTER_HISTORY_FRAMES
+            - numFrameTimes) % COUNTER_HISTORY_FRAMES;
+    return frameTimes[(oldest + i) % COUNTER_HISTORY_FRAMES];
+}
+
+size_t GetFrameTimeHistorySize()
+{
+    return numFrameTimes;
+}
+
+bool StartCounterDump(const char *filename)
+{
+    StopCounterDump();
+    if (strcmp(filename, "-") == 0) {
+        dumpFile = stdout;
+    } else {
+        dumpFile = fopen(filename, "w");
+        if (dumpFile == NULL) {
+            Error("Could not open '%s' for the counters", filename);
+            return false;
+        }
+    }
+    fprintf(dumpFile, "time_s,frames,fps,frame_ms,max_frame_ms");
+    for (int i=0; i<COUNTER_COUNT; i++) {
+        fprintf(dumpFile, ",%s", counterNames[i]);
+    }
+    fprintf(dumpFile, "\n");
+    dumpStart = Clock::now();
+    dumpRowStart = dumpStart;
+    dumpFrames = 0;
+    dumpFrameMs = 0.0;
+    dumpMaxFrameMs = 0.0;
+    memset(dumpTotals, 0, sizeof(dumpTotals));
+    return true;
+}
+
+void StopCounterDump()
+{
+    if (dumpFile == NULL) {
+        return;
+    }
+    if (dumpFrames > 0) {
+        WriteDumpRow(Clock::now());
+    }
+    if (dumpFile != stdout) {
+        fclose(dumpFile);
+    }
+    dumpFile = NULL;
+}
@@ -0,0 +1,53 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+#include <cstddef>
+#include <cstdint>
+
+// Frame times kept for the overlay's graph
+#define COUNTER_HISTORY_FRAMES 240
+// Seconds between the rows StartCounterDump writes
+#define COUNTER_DUMP_SECONDS 1.0
+
+// Work the renderer does every frame. Whatever issues the GL call adds
+// to the counter, from any thread, and CountersEndFrame closes the
+// frame.
+enum Counter_t {
+    COUNTER_DRAW_CALLS = 0,
+    COUNTER_TRIANGLES,
+    COUNTER_PROGRAM_BINDS,
+    COUNTER_TEXTURE_BINDS,
+    COUNTER_BUFFER_UPLOADS, // Buffer and texture data sent to the GPU
+    COUNTER_UPLOAD_BYTES,
+    COUNTER_COUNT
+};
+
+struct CounterFrame_t {
+    double frameMs; // Since the frame before ended
+    uint32_t values[COUNTER_COUNT];
+};
+
+void CounterAdd(Counter_t counter, size_t amount=1);
+
+// Short lower case name, also the column name of dumps
+const char* GetCounterName(Counter_t counter);
+
+// Called once a frame after the swap. Takes the frame's counts, adds
+// its time to the history and writes a row of the dump when due.
+void CountersEndFrame();
+
+// Counts of the last frame that ended
+const CounterFrame_t& GetLastFrameCounters();
+
+// Frame times, oldest first, `i` below GetFrameTimeHistorySize()
+double GetFrameTimeHistory(size_t i);
+
+size_t GetFrameTimeHistorySize();
+
+// Every COUNTER_DUMP_SECONDS writes a CSV row of the frame rate, the
+// mean and max frame time and each counter's mean per frame. A
+// filename of "-" writes to stdout.
+bool StartCounterDump(const char *filename);
+
+void StopCounterDump();
+
+#endif
@@ -0,0 +1,421 @@
+#include "job_system.h"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include "util/profiler.h"
+
+// Times an idle thread looks for work again before it sleeps
+#define JOB_SPIN_COUNT 64
+// Parts per thread a ParallelFor with no grain is split into
+#define JOB_PARTS_PER_THREAD 4
+
+static_assert((JOB_DEQUE_SIZE & (JOB_DEQUE_SIZE - 1)) == 0,
+        "The job deque size must be a power of two");
+
+struct Job_t {
+    JobFn run;
+    JobCounter_t *counter;
+    bool background;
+};
+
+// The deque of Chase and Lev with the orderings of Le et al., only the
+// owner pushes and pops at the bottom, anyone steals from the top.
+// Positions wrap, their difference is what counts.
+struct JobDeque_t {
+    std::atomic<uint32_t> top;
+    char topPadding[64]; // Thieves and the owner write different lines
+    std::atomic<uint32_t> bottom;
+    char bottomPadding[64];
+    std::atomic<Job_t *> jobs[JOB_DEQUE_SIZE];
+};
+
+// Jobs and background jobs of one thread, or of the shared queue
+struct JobQueues_t {
+    JobDeque_t deques[2];
+};
+
+struct SharedQueues_t {
+    std::deque<Job_t *> jobs[2];
+    std::atomic<uint32_t> count[2];
+};
+
+static std::atomic<bool> running(false);
+static std::atomic<bool> quit(false);
+static unsigned numThreads = 1;
+static JobQueues_t *queues = NULL; // One per thread, the starter's first
+static std::vector<std::thread> workers;
+static thread_local int threadIndex = -1; // -1 outside the system
+static thread_local bool inBackground = false; // Running a background job
+
+// Jobs from threads outside the system or with a full deque
+static std::mutex sharedLock;
+static SharedQueues_t shared;
+
+// Held while a counter reaches zero and its waiting jobs are taken
+static std::mutex dependencyLock;
+
+// Bumped whenever there may be something new for a sleeper to see
+static std::mutex sleepLock;
+static std::condition_variable sleepCondition;
+static std::atomic<uint32_t> wakeGeneration(0);
+static std::atomic<uint32_t> numSleeping(0);
+
+static bool PushBottom(JobDeque_t &deque, Job_t *job)
+{
+    const uint32_t bottom = deque.bottom.load(std::memory_order_relaxed);
+    const uint32_t top = deque.top.load(std::memory_order_acquire);
+    if ((int32_t)(bottom - top) >= JOB_DEQUE_SIZE) {
+        return false;
+    }
+    deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)].store(job,
+            std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    return true;
+}
+
+static Job_t* PopBottom(JobDeque_t &deque)
+{
+    const uint32_t bottom = deque.bottom.load(std::memory_order_relaxed) - 1;
+    deque.bottom.store(bottom, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t top = deque.top.load(std::memory_order_relaxed);
+    if ((int32_t)(bottom - top) < 0) {
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+        return NULL; // Empty
+    }
+    Job_t *job = deque.jobs[bottom & (JOB_DEQUE_SIZE - 1)].load(
+            std::memory_order_relaxed);
+    if (bottom == top) {
+        // The last job, a thief may be taking it too
+        if (!deque.top.compare_exchange_strong(top, top + 1,
+                std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            job = NULL;
+        }
+        deque.bottom.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return job;
+}
+
+static Job_t* StealTop(JobDeque_t &deque)
+{
+    uint32_t top = deque.top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const uint32_t bottom = deque.bottom.load(std::memory_order_acquire);
+    if ((int32_t)(bottom - top) <= 0) {
+        return NULL;
+    }
+    Job_t *job = deque.jobs[top & (JOB_DEQUE_SIZE - 1)].load(
+            std::memory_order_relaxed);
+    if (!deque.top.compare_exchange_strong(top, top + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return NULL; // Another thread got it first
+    }
+    return job;
+}
+
+static void Wake()
+{
+    wakeGeneration.fetch_add(1);
+    if (numSleeping.load() == 0) {
+        return;
+    }
+    // Taking the lock means a sleeper is either waiting already or
+    // will see the new generation before it does
+    {
+        std::lock_guard<std::mutex> lock(sleepLock);
+    }
+    sleepCondition.notify_all();
+}
+
+static void Sleep(uint32_t generation)
+{
+    std::unique_lock<std::mutex> lock(sleepLock);
+    numSleeping.fetch_add(1);
+    sleepCondition.wait(lock, [generation]() {
+        return wakeGeneration.load() != generation;
+    });
+    numSleeping.fetch_sub(1);
+}
+
+static Job_t* PopShared(int kind)
+{
+    if (shared.count[kind].load(std::memory_order_acquire) == 0) {
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lock(sharedLock);
+    if (shared.jobs[kind].size() == 0) {
+        return NULL;
+    }
+    Job_t *job = shared.jobs[kind].front();
+    shared.jobs[kind].pop_front();
+    shared.count[kind].fetch_sub(1, std::memory_order_relaxed);
+    return job;
+}
+
+// Own jobs newest first, then shared ones, then the oldest of another
+// thread's. Background jobs only after all of those.
+static Job_t* FindJob(bool background)
+{
+    if (!running.load(std::memory_order_acquire)) {
+        return NULL;
+    }
+    const int self = threadIndex;
+    const unsigned first = self >= 0 ? self + 1 : 0;
+    for (int kind=0; kind<(background ? 2 : 1); kind++) {
+        Job_t *job;
+        if (self >= 0 && (job = PopBottom(queues[self].deques[kind]))
+                != NULL) {
+            return job;
+        }
+        if ((job = PopShared(kind)) != NULL) {
+            return job;
+        }
+        for (unsigned i=0; i<numThreads; i++) {
+            const unsigned victim = (first + i) % numThreads;
+            if ((int)victim != self && (job = StealTop(
+                    queues[victim].deques[kind])) != NULL) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void Push(Job_t *job);
+
+// Counts a job of `counter` as done, the one taking it to zero queues
+// the jobs waiting on it. Zero is only ever reached under
+// dependencyLock, so a waiter that takes the lock after seeing zero
+// knows the counter is no longer used.
+static void FinishJob(JobCounter_t *counter)
+{
+    uint32_t pending = counter->pending.load(std::memory_order_relaxed);
+    while (pending > 1) {
+        if (counter->pending.compare_exchange_weak(pending, pending - 1,
+                std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+    std::vector<Job_t *> ready;
+    {
+        std::lock_guard<std::mutex> lock(dependencyLock);
+        if (counter->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return; // More were counted meanwhile
+        }
+        ready.swap(counter->waiting);
+    }
+    for (size_t i=0; i<ready.size(); i++) {
+        Push(ready[i]);
+    }
+    Wake(); // For whoever waits on the counter
+}
+
+static void Execute(Job_t *job)
+{
+    const bool wasInBackground = inBackground;
+    inBackground = wasInBackground || job->background;
+    job->run();
+    inBackground = wasInBackground;
+    JobCounter_t *counter = job->counter;
+    delete job;
+    if (counter != NULL) {
+        FinishJob(counter);
+    }
+}
+
+static void Push(Job_t *job)
+{
+    // Without workers nothing else would run a background job
+    if (!running.load(std::memory_order_acquire)
+            || (job->background && numThreads == 1)) {
+        Execute(job);
+        return;
+    }
+    const int kind = job->background ? 1 : 0;
+    if (threadIndex < 0
+            || !PushBottom(queues[threadIndex].deques[kind], job)) {
+        std::lock_guard<std::mutex> lock(sharedLock);
+        shared.jobs[kind].push_back(job);
+        shared.count[kind].fetch_add(1, std::memory_order_release);
+    }
+    Wake();
+}
+
+static void WorkerLoop(unsigned index)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "Job %u", index);
+    PROFILE_THREAD_NAME(name);
+    threadIndex = index;
+    unsigned spins = 0;
+    while (true) {
+        const uint32_t generation = wakeGeneration.load();
+        Job_t *job = FindJob(true);
+        if (job != NULL) {
+            Execute(job);
+            spins = 0;
+        } else if (quit.load()) {
+            return;
+        } else if (spins < JOB_SPIN_COUNT) {
+            spins++;
+            std::this_thread::yield();
+        } else {
+            Sleep(generation);
+            spins = 0;
+        }
+    }
+}
+
+void StartJobSystem(unsigned threads)
+{
+    if (running.load()) {
+        return;
+    }
+    if (threads == 0) {
+        threads = std::min((unsigned)JOB_MAX_THREADS,
+                std::max(2u, std::thread::hardware_concurrency()));
+    }
+    static bool registered = false;
+    if (!registered) {
+        atexit(StopJobSystem);
+        registered = true;
+    }
+    numThreads = threads;
+    queues = new JobQueues_t[numThreads];
+    for (unsigned i=0; i<numThreads; i++) {
+        for (int kind=0; kind<2; kind++) {
+            queues[i].deques[kind].top.store(0, std::memory_order_relaxed);
+            queues[i].deques[kind].bottom.store(0,
+                    std::memory_order_relaxed);
+        }
+    }
+    threadIndex = 0;
+    quit.store(false);
+    running.store(true, std::memory_order_release);
+    for (unsigned i=1; i<numThreads; i++) {
+        workers.emplace_back(WorkerLoop, i);
+    }
+}
+
+void StopJobSystem()
+{
+    if (!running.load()) {
+        return;
+    }
+    quit.store(true);
+    Wake();
+    for (size_t i=0; i<workers.size(); i++) {
+        workers[i].join();
+    }
+    workers.clear();
+    // Whatever was queued after the workers left
+    Job_t *job;
+    while ((job = FindJob(true)) != NULL) {
+        Execute(job);
+    }
+    running.store(false, std::memory_order_release);
+    delete[] queues;
+    queues = NULL;
+    numThreads = 1;
+    threadIndex = -1;
+}
+
+bool IsJobSystemStopping()
+{
+    return quit.load();
+}
+
+unsigned GetNumJobThreads()
+{
+    return running.load(std::memory_order_acquire) ? numThreads : 1;
+}
+
+static void QueueJob(const JobFn &job, JobCounter_t *counter,
+        JobCounter_t *after, bool background)
+{
+    if (counter != NULL) {
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+    }
+    Job_t *entry = new Job_t{ job, counter, background };
+    if (after != NULL) {
+        std::lock_guard<std::mutex> lock(dependencyLock);
+        if (after->pending.load(std::memory_order_acquire) > 0) {
+            after->waiting.push_back(entry);
+            return;
+        }
+    }
+    Push(entry);
+}
+
+void RunJob(const JobFn &job, JobCounter_t *counter, JobCounter_t *after)
+{
+    QueueJob(job, counter, after, inBackground);
+}
+
+void RunBackgroundJob(const JobFn &job, JobCounter_t *counter)
+{
+    QueueJob(job, counter, NULL, true);
+}
+
+void WaitForJobs(JobCounter_t &counter, bool background)
+{
+    background = background || inBackground;
+    unsigned spins = 0;
+    while (counter.pending.load(std::memory_order_acquire) > 0) {
+        const uint32_t generation = wakeGeneration.load();
+        Job_t *job = FindJob(background);
+        if (job != NULL) {
+            Execute(job);
+            spins = 0;
+        } else if (counter.pending.load(std::memory_order_acquire) == 0) {
+            break;
+        } else if (spins < JOB_SPIN_COUNT) {
+            spins++;
+            std::this_thread::yield();
+        } else {
+            Sleep(generation);
+            spins = 0;
+        }
+    }
+    // Until the thread that finished the last job lets go of it
+    std::lock_guard<std::mutex> lock(dependencyLock);
+}
+
+// Queues the far half until the rest is no bigger than `grain`
+static void SplitRange(size_t begin, size_t end, size_t grain,
+        const RangeFn &range, JobCounter_t &counter)
+{
+    while (end - begin > grain) {
+        const size_t middle = begin + (end - begin) / 2;
+        RunJob([middle, end, grain, &range, &counter]() {
+            SplitRange(middle, end, grain, range, counter);
+        }, &counter);
+        end = middle;
+    }
+    range(begin, end);
+}
+
+void ParallelFor(size_t begin, size_t end, size_t grain,
+        const RangeFn &range)
+{
+    if (begin >= end) {
+        return;
+    }
+    const unsigned threads = GetNumJobThreads();
+    if (grain == 0) {
+        grain = std::max((size_t)1,
+                (end - begin) / (threads * JOB_PARTS_PER_THREAD));
+    }
+    if (threads == 1 || end - begin <= grain) {
+        range(begin, end);
+        return;
+    }
+    JobCounter_t counter;
+    SplitRange(begin, end, grain, range, counter);
+    WaitForJobs(counter);
+}
@@ -0,0 +1,88 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <functional>
+
+// Threads the job system starts with unless asked otherwise
+#define JOB_MAX_THREADS 8
+// Jobs a thread can have queued before new ones run straight away
+#define JOB_DEQUE_SIZE 4096
+
+// A work stealing scheduler shared by everything that runs in
+// parallel. Every thread in the system, the one that started it
+// included, keeps its own deque of jobs: it pushes and pops at one
+// end, idle threads steal from the other. Threads outside the system
+// hand their jobs to a shared queue instead.
+//
+//   JobCounter_t counter;
+//   RunJob([]() { ParseModel(); }, &counter);
+//   RunJob([]() { DecodeTexture(); }, &counter);
+//   WaitForJobs(counter); // Runs jobs itself until both are done
+//
+// Background jobs are for long work like loading that must not hold
+// up a frame. They are kept apart and only run by the workers, by
+// jobs spawned from other background jobs and by waits that ask for
+// them, so a frame waiting on its own jobs never picks one up. With
+// no workers they run where they are queued.
+//
+// Until StartJobSystem is called every job runs on the thread that
+// submits it, so tools and benchmarks work unchanged.
+
+typedef std::function<void()> JobFn;
+
+// Runs the part [begin, end) of a ParallelFor
+typedef std::function<void(size_t begin, size_t end)> RangeFn;
+
+struct Job_t;
+
+// Counts jobs that haven't finished. Jobs can be made to wait for one
+// to reach zero. It must outlive every job it counts or waits on.
+struct JobCounter_t {
+    std::atomic<uint32_t> pending;
+    std::vector<Job_t *> waiting; // Queued when pending reaches zero
+
+    JobCounter_t() : pending(0) {}
+
+    JobCounter_t(const JobCounter_t &) = delete;
+    JobCounter_t& operator=(const JobCounter_t &) = delete;
+};
+
+// Starts `numThreads` - 1 workers, the calling thread being the first
+// of them. 0 threads picks the number of cores capped to
+// JOB_MAX_THREADS, and at least one worker for background jobs. Does
+// nothing if it is already running.
+void StartJobSystem(unsigned numThreads=0);
+
+// Runs what is still queued and stops the workers, also done at exit
+void StopJobSystem();
+
+// True once StopJobSystem was called, long jobs may return early
+bool IsJobSystemStopping();
+
+// Threads that run jobs, 1 if the system isn't running
+unsigned GetNumJobThreads();
+
+// Queues `job`, counted by `counter` until it has run. With `after`
+// it only starts once that counter reaches zero. Jobs queued from a
+// background job are background jobs too.
+void RunJob(const JobFn &job, JobCounter_t *counter=NULL,
+        JobCounter_t *after=NULL);
+
+void RunBackgroundJob(const JobFn &job, JobCounter_t *counter=NULL);
+
+// Runs queued jobs, whichever they are, until `counter` reaches zero.
+// Background jobs are only run with `background` or from inside one.
+// Sleeps only when there is nothing left to run.
+void WaitForJobs(JobCounter_t &counter, bool background=false);
+
+// Calls `range` over parts of [begin, end) no smaller than `grain`,
+// on every thread, and returns when they have all run. Ranges are
+// split in halves and the far half queued, so idle threads steal the
+// biggest parts. A grain of 0 splits into a few parts per thread.
+void ParallelFor(size_t begin, size_t end, size_t grain,
+        const RangeFn &range);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef JSON_UTIL_H
+#define JSON_UTIL_H
+#include <cstdio>
+
+// Writes `str` quoted, with quotes, backslashes and control characters
+// escaped
+static inline void WriteJsonString(FILE *file, const char *str)
+{
+    fputc('"', file);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(file, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char)*str);
+        } else {
+            fputc(*str, file);
+        }
+    }
+    fputc('"', file);
+}
+
+#endif
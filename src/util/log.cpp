@@ -0,0 +1,351 @@
+#include "log.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+// Longest wait before the writer looks at the ring again
+#define LOG_FLUSH_MILLISECONDS 20
+// Lines are gathered up to this size before going to stderr
+#define LOG_WRITE_BUFFER_SIZE 16384
+
+typedef std::chrono::steady_clock Clock;
+
+// A slot is free for the message at position `sequence` and holds the
+// one at position `sequence - 1` once written, the bounded queue from
+// Dmitry Vyukov. Any thread may push, only the holder of drainLock
+// pops.
+struct LogSlot_t {
+    std::atomic<uint32_t> sequence;
+    uint8_t level;
+    uint32_t thread;
+    uint64_t microseconds; // Since logging started
+    char text[LOG_MESSAGE_SIZE];
+};
+
+static const char *levelPrefixes[] = { "[*]", "[>]", "[+]", "[!]", "[-]" };
+
+static LogSlot_t ring[LOG_RING_SLOTS];
+static std::atomic<uint32_t> head(0); // Next position to push
+static uint32_t tail = 0; // Next position to pop, under drainLock
+static std::mutex drainLock;
+static std::mutex wakeLock;
+static std::condition_variable wake;
+static std::thread *writer = NULL;
+static std::atomic<bool> running(false);
+static std::atomic<bool> stopping(false);
+static std::atomic<uint32_t> nextThread(1);
+
+// Rate limit state of the texts hashing to one entry, only touched
+// under drainLock. A text that lands on an entry another one holds
+// takes it over.
+struct LogRate_t {
+    uint64_t hash;
+    uint32_t second;
+    uint32_t count;
+    uint32_t dropped;
+    uint8_t level;
+    uint32_t thread;
+    char text[LOG_MESSAGE_SIZE]; // Kept from the first dropped copy
+};
+
+static LogRate_t rates[LOG_RATE_ENTRIES];
+static bool anyDropped = false; // Under drainLock
+static std::atomic<uint32_t> lost(0); // Pushed while the ring was full
+
+// Lines waiting to go to stderr, under drainLock
+static char buffer[LOG_WRITE_BUFFER_SIZE];
+static size_t used = 0;
+
+static const char* LevelPrefix(int level)
+{
+    if (level < LOG_LEVEL_DEBUG || level > LOG_LEVEL_ERROR) {
+        return "[?]";
+    }
+    return levelPrefixes[level];
+}
+
+static uint64_t MicrosecondsSinceStart()
+{
+    static const Clock::time_point start = Clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            Clock::now() - start).count();
+}
+
+static uint32_t ThisThread()
+{
+    static thread_local uint32_t thread = nextThread.fetch_add(1);
+    return thread;
+}
+
+static uint64_t HashText(const char *text)
+{
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    for (; *text != '\0'; text++) {
+        hash = (hash ^ (uint8_t)*text) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static size_t FormatLine(char *line, size_t size, int level,
+        uint64_t microseconds, uint32_t thread, uint32_t dropped,
+        const char *text)
+{
+    int length;
+    if (dropped > 0) {
+        length = snprintf(line, size, "%s %9.3f T%u %s (%u identical "
+                "dropped)\n", LevelPrefix(level), microseconds / 1e6,
+                thread, text, dropped);
+    } else {
+        length = snprintf(line, size, "%s %9.3f T%u %s\n",
+                LevelPrefix(level), microseconds / 1e6, thread, text);
+    }
+    if (length < 0) {
+        return 0;
+    }
+    return std::min((size_t)length, size - 1);
+}
+
+static void Append(int level, uint64_t microseconds, uint32_t thread,
+        uint32_t dropped, const char *text)
+{
+    char line[LOG_MESSAGE_SIZE + 96];
+    const size_t length = FormatLine(line, sizeof(line), level,
+            microseconds, thread, dropped, text);
+    if (used + length > sizeof(buffer)) {
+        fwrite(buffer, 1, used, stderr);
+        used = 0;
+    }
+    memcpy(buffer + used, line, length);
+    used += length;
+}
+
+static void Flush()
+{
+    if (used > 0) {
+        fwrite(buffer, 1, used, stderr);
+        fflush(stderr);
+        used = 0;
+    }
+}
+
+static void AppendDropped(LogRate_t &rate)
+{
+    char text[LOG_MESSAGE_SIZE + 32];
+    snprintf(text, sizeof(text), "Dropped %u more of: %s", rate.dropped,
+            rate.text);
+    Append(rate.level, MicrosecondsSinceStart(), rate.thread, 0, text);
+    rate.dropped = 0;
+}
+
+// Writes the message unless its text went over the rate limit in the
+// second it was logged, drainLock must be held
+static void WriteMessage(int level, uint64_t microseconds, uint32_t thread,
+        const char *text)
+{
+    const uint32_t second = microseconds / 1000000 + 1;
+    const uint64_t hash = HashText(text);
+    LogRate_t &rate = rates[hash % LOG_RATE_ENTRIES];
+    if (rate.hash != hash && rate.dropped > 0) {
+        AppendDropped(rate);
+    }
+    if (rate.hash != hash || rate.second != second) {
+        rate.hash = hash;
+        rate.second = second;
+        rate.count = 0;
+    }
+    if (rate.count >= LOG_RATE_LIMIT) {
+        if (rate.dropped++ == 0) {
+            rate.level = level;
+            rate.thread = thread;
+            memcpy(rate.text, text, sizeof(rate.text));
+        }
+        anyDropped = true;
+        return;
+    }
+    rate.count++;
+    Append(level, microseconds, thread, rate.dropped, text);
+    rate.dropped = 0;
+}
+
+// Writes the counts of texts that were dropped in a second that is now
+// over, or all of them, drainLock must be held
+static void ReportDropped(bool all)
+{
+    if (!anyDropped) {
+        return;
+    }
+    anyDropped = false;
+    const uint32_t second = MicrosecondsSinceStart() / 1000000 + 1;
+    for (uint32_t i=0; i<LOG_RATE_ENTRIES; i++) {
+        LogRate_t &rate = rates[i];
+        if (rate.dropped == 0) {
+            continue;
+        }
+        if (!all && rate.second == second) {
+            anyDropped = true; // Still counting, look again later
+            continue;
+        }
+        AppendDropped(rate);
+    }
+}
+
+// Writes every message pushed so far, drainLock must be held. Stops at
+// a slot a thread is still filling, the next drain gets it.
+static void DrainLocked(bool all)
+{
+    while (true) {
+        LogSlot_t &slot = ring[tail % LOG_RING_SLOTS];
+        const uint32_t sequence = slot.sequence.load(
+                std::memory_order_acquire);
+        if ((int32_t)(sequence - (tail + 1)) < 0) {
+            break;
+        }
+        WriteMessage(slot.level, slot.microseconds, slot.thread,
+                slot.text);
+        slot.sequence.store(tail + LOG_RING_SLOTS, std::memory_order_release);
+        tail++;
+    }
+    ReportDropped(all);
+    const uint32_t lostCount = lost.exchange(0, std::memory_order_relaxed);
+    if (lostCount > 0) {
+        char text[64];
+        snprintf(text, sizeof(text), "Log ring full, lost %u messages",
+                lostCount);
+        Append(LOG_LEVEL_WARNING, MicrosecondsSinceStart(), 0, 0, text);
+    }
+    Flush();
+}
+
+static void WriterLoop()
+{
+    while (!stopping.load(std::memory_order_acquire)) {
+        {
+            std::unique_lock<std::mutex> guard(wakeLock);
+            wake.wait_for(guard, std::chrono::milliseconds(
+                    LOG_FLUSH_MILLISECONDS));
+        }
+        std::lock_guard<std::mutex> guard(drainLock);
+        DrainLocked(false);
+    }
+}
+
+// Everything logged before exit is written before it returns
+static void StopLogging()
+{
+    stopping.store(true, std::memory_order_release);
+    wake.notify_one();
+    writer->join();
+    delete writer;
+    writer = NULL;
+    running.store(false, std::memory_order_release);
+    std::lock_guard<std::mutex> guard(drainLock);
+    DrainLocked(true);
+}
+
+static bool StartLogging()
+{
+    for (uint32_t i=0; i<LOG_RING_SLOTS; i++) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    MicrosecondsSinceStart();
+    writer = new std::thread(WriterLoop);
+    running.store(true, std::memory_order_release);
+    atexit(StopLogging);
+    return true;
+}
+
+// Cuts texts too long for a slot, marking the cut
+static void CopyText(char *slotText, const char *text)
+{
+    const size_t length = strlen(text);
+    if (length < LOG_MESSAGE_SIZE) {
+        memcpy(slotText, text, length + 1);
+        return;
+    }
+    memcpy(slotText, text, LOG_MESSAGE_SIZE - 4);
+    memcpy(slotText + LOG_MESSAGE_SIZE - 4, "...", 4);
+}
+
+static bool Push(int level, uint64_t microseconds, const char *text)
+{
+    uint32_t position = head.load(std::memory_order_relaxed);
+    LogSlot_t *slot;
+    while (true) {
+        slot = &ring[position % LOG_RING_SLOTS];
+        const uint32_t sequence = slot->sequence.load(
+                std::memory_order_acquire);
+        const int32_t difference = (int32_t)(sequence - position);
+        if (difference == 0) {
+            if (head.compare_exchange_weak(position, position + 1,
+                    std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return false; // Full
+        } else {
+            position = head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    slot->thread = ThisThread();
+    slot->microseconds = microseconds;
+    CopyText(slot->text, text);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+// Once the writer has stopped, writes the message straight away after
+// everything before it
+static void WriteNow(int level, uint64_t microseconds, const char *text)
+{
+    char slotText[LOG_MESSAGE_SIZE];
+    CopyText(slotText, text);
+    std::lock_guard<std::mutex> guard(drainLock);
+    DrainLocked(true);
+    WriteMessage(level, microseconds, ThisThread(), slotText);
+    Flush();
+}
+
+static void Log(int level, const char *text)
+{
+    static bool started = StartLogging();
+    (void)started;
+    const uint64_t microseconds = MicrosecondsSinceStart();
+    if (!running.load(std::memory_order_acquire)) {
+        WriteNow(level, microseconds, text);
+        return;
+    }
+    if (!Push(level, microseconds, text)) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (level >= LOG_LEVEL_WARNING) {
+        wake.notify_one();
+    }
+}
+
+void LogMessage(int level, const char *fmt, ...)
+{
+    char text[LOG_MESSAGE_SIZE];
+    va_list args;
+    va_start(args, fmt);
+    const int length = vsnprintf(text, sizeof(text), fmt, args);
+    va_end(args);
+    if (length >= (int)sizeof(text)) {
+        memcpy(text + sizeof(text) - 4, "...", 4);
+    }
+    Log(level, length < 0 ? fmt : text);
+}
+
+void LogMessage(int level, const std::string &str)
+{
+    Log(level, str.c_str());
+}
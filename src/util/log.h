@@ -1,87 +1,48 @@
 #ifndef LOG_H
 #define LOG_H
 #include <string>
-#include <cstdio>
-#include <cstdarg>
 
-static inline void Debug(const char *fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string format = fmt;
-    format.insert(0, "[*] ");
-    format.append("\n");
-    vfprintf(stderr, format.c_str(), args);
-    va_end(args);
-}
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_SUCCESS 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR 4
 
-static inline void Debug(const std::string &str)
-{
-    Debug(str.c_str());
-}
-
-static inline void Info(const char *fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string format = fmt;
-    format.insert(0, "[>] ");
-    format.append("\n");
-    vfprintf(stderr, format.c_str(), args);
-    va_end(args);
-}
-
-static inline void Info(const std::string &str)
-{
-    Info(str.c_str());
-}
-
-static inline void Warning(const char *fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string format = fmt;
-    format.insert(0, "[!] ");
-    format.append("\n");
-    vfprintf(stderr, format.c_str(), args);
-    va_end(args);
-}
-
-static inline void Warning(const std::string &str)
-{
-    Warning(str.c_str());
-}
-
-static inline void Error(const char *fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string format = fmt;
-    format.insert(0, "[-] ");
-    format.append("\n");
-    vfprintf(stderr, format.c_str(), args);
-    va_end(args);
-}
-
-static inline void Error(const std::string &str)
-{
-    Error(str.c_str());
-}
-
-static inline void Success(const char *fmt, ...)
-{
-    va_list args;
-    va_start(args, fmt);
-    std::string format = fmt;
-    format.insert(0, "[+] ");
-    format.append("\n");
-    vfprintf(stderr, format.c_str(), args);
-    va_end(args);
-}
+// Calls below this level compile to nothing, arguments included. Set
+// with make LOG_LEVEL=<level>.
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
 
-static inline void Success(const std::string &str)
-{
-    Success(str.c_str());
-}
+// Times the same text may be written in a second, the rest are dropped
+// and counted by the writer thread. The next copy to get through, or
+// the writer once the second is over, says how many were.
+#define LOG_RATE_LIMIT 20
+#define LOG_RATE_ENTRIES 256 // Distinct texts tracked at once
+
+// Messages are formatted on the calling thread into a ring of slots
+// and written to stderr by a background thread. Longer messages are
+// cut, and while the ring is full they are dropped and counted. Any
+// logged once the writer has stopped at exit are written on the spot.
+#define LOG_RING_SLOTS 1024 // A power of two
+#define LOG_MESSAGE_SIZE 240
+
+void LogMessage(int level, const char *fmt, ...);
+
+void LogMessage(int level, const std::string &str);
+
+#define LOG_AT_LEVEL(level, ...) \
+    do { \
+        if ((level) >= LOG_MIN_LEVEL) { \
+            LogMessage((level), __VA_ARGS__); \
+        } \
+    } while (0)
+
+// printf style, or a std::string printed as is
+#define Debug(...) LOG_AT_LEVEL(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define Info(...) LOG_AT_LEVEL(LOG_LEVEL_INFO, __VA_ARGS__)
+#define Success(...) LOG_AT_LEVEL(LOG_LEVEL_SUCCESS, __VA_ARGS__)
+#define Warning(...) LOG_AT_LEVEL(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define Error(...) LOG_AT_LEVEL(LOG_LEVEL_ERROR, __VA_ARGS__)
 
 #endif
@@ -0,0 +1,110 @@
+#include "mapped_file.h"
+#include <cstdio>
+#include "util/log.h"
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+bool MappedFile::Open(const char *filename)
+{
+    Close();
+#ifndef _WIN32
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        Error("Could not open file '%s'", filename);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        close(fd);
+        return Read(filename);
+    }
+    m_size = info.st_size;
+    if (m_size == 0) {
+        close(fd); // Nothing to map
+        m_open = true;
+        return true;
+    }
+    void *data = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open
+    if (data == MAP_FAILED) {
+        Debug("Could not map '%s', reading it instead", filename);
+        m_size = 0;
+        return Read(filename);
+    }
+    // Parsers go through front to back, and all of it soon
+    madvise(data, m_size, MADV_SEQUENTIAL);
+    madvise(data, m_size, MADV_WILLNEED);
+    m_data = (const uint8_t *)data;
+    m_mapped = true;
+    m_open = true;
+    return true;
+#else
+    return Read(filename);
+#endif
+}
+
+bool MappedFile::Read(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        Error("Could not open file '%s'", filename);
+        return false;
+    }
+    uint8_t chunk[65536];
+    size_t length;
+    while ((length = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        m_buffer.insert(m_buffer.end(), chunk, chunk + length);
+    }
+    const bool failed = ferror(f) != 0;
+    fclose(f);
+    if (failed) {
+        Error("Failed reading file '%s'", filename);
+        m_buffer.clear();
+        return false;
+    }
+    m_data = m_buffer.empty() ? NULL : m_buffer.data();
+    m_size = m_buffer.size();
+    m_open = true;
+    return true;
+}
+
+void MappedFile::OpenView(const uint8_t *data, size_t size)
+{
+    Close();
+    m_data = data;
+    m_size = size;
+    m_open = true;
+}
+
+uint8_t* MappedFile::OpenBuffer(size_t size)
+{
+    Close();
+    m_buffer.resize(size);
+    m_data = m_buffer.empty() ? NULL : m_buffer.data();
+    m_size = size;
+    m_open = true;
+    return m_buffer.data();
+}
+
+void MappedFile::Close()
+{
+#ifndef _WIN32
+    if (m_mapped) {
+        munmap((void *)m_data, m_size);
+    }
+#endif
+    std::vector<uint8_t>().swap(m_buffer);
+    m_data = NULL;
+    m_size = 0;
+    m_mapped = false;
+    m_open = false;
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
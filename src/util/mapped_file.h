@@ -0,0 +1,97 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+#include <cstddef>
+#include <cstdint>
+#include <streambuf>
+#include <vector>
+
+class MappedFile
+{
+    // Read only view of a whole file. The file is memory mapped where
+    // possible so parsers read it in place, with the pages read ahead
+    // sequentially. Otherwise, and on Windows, it is read into a heap
+    // buffer instead.
+public:
+    MappedFile() = default;
+
+    // Unmaps any file open before. Logs and returns false on failure.
+    bool Open(const char *filename);
+
+    // Views `size` bytes someone else owns, such as an archive entry
+    void OpenView(const uint8_t *data, size_t size);
+
+    // Owns a buffer of `size` bytes for the caller to fill in
+    uint8_t* OpenBuffer(size_t size);
+
+    void Close();
+
+    const uint8_t* GetData() const { return m_data; }
+
+    const char* GetChars() const { return (const char *)m_data; }
+
+    size_t GetSize() const { return m_size; }
+
+    bool IsOpen() const { return m_open; }
+
+    // False for views, buffers and when the fallback read the file
+    bool IsMapped() const { return m_mapped; }
+
+    // Copies are not allowed
+    MappedFile(const MappedFile &) = delete;
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    ~MappedFile();
+
+private:
+    bool Read(const char *filename);
+
+    const uint8_t *m_data = NULL;
+
+    size_t m_size = 0;
+
+    bool m_mapped = false;
+
+    bool m_open = false; // Empty files are open with no data
+
+    std::vector<uint8_t> m_buffer; // For the fallback and OpenBuffer
+};
+
+class MemoryStreamBuf : public std::streambuf
+{
+    // Lets std::istream parsers read a span in place, wrap it with
+    // std::istream stream(&buf). The span must outlive the stream.
+public:
+    MemoryStreamBuf(const char *data, size_t size)
+    {
+        char *begin = const_cast<char *>(data); // Never written to
+        setg(begin, begin, begin + size);
+    }
+
+protected:
+    pos_type seekoff(off_type offset, std::ios_base::seekdir dir,
+            std::ios_base::openmode which) override
+    {
+        char *position = gptr();
+        if (dir == std::ios_base::beg) {
+            position = eback() + offset;
+        } else if (dir == std::ios_base::cur) {
+            position += offset;
+        } else {
+            position = egptr() + offset;
+        }
+        if (!(which & std::ios_base::in) || position < eback()
+                || position > egptr()) {
+            return pos_type(off_type(-1));
+        }
+        setg(eback(), position, egptr());
+        return pos_type(position - eback());
+    }
+
+    pos_type seekpos(pos_type position, std::ios_base::openmode which)
+            override
+    {
+        return seekoff(off_type(position), std::ios_base::beg, which);
+    }
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+#include <istream>
+#include <string>
+#include <vector>
+// Its implementation half has no include guard, so the file defining
+// TINYOBJLOADER_IMPLEMENTATION must include it before this
+#ifndef TINY_OBJ_LOADER_H_
+#include "tiny_obj_loader.h"
+#endif
+#include "util/archive.h"
+#include "util/file.h"
+#include "util/mapped_file.h"
+
+// Reads .mtl files through OpenAsset, so they come from the archive too
+class AssetMaterialReader : public tinyobj::MaterialReader
+{
+public:
+    explicit AssetMaterialReader(const std::string &baseDir)
+        : m_baseDir(baseDir) {}
+
+    bool operator()(const std::string &matId,
+            std::vector<tinyobj::material_t> *materials,
+            std::map<std::string, int> *matMap, std::string *warn,
+            std::string *err) override
+    {
+        MappedFile file;
+        if (!OpenAsset((m_baseDir + matId).c_str(), file)) {
+            if (warn) {
+                *warn += "Material file '" + m_baseDir + matId
+                        + "' not found\n";
+            }
+            return false;
+        }
+        MemoryStreamBuf buffer(file.GetChars(), file.GetSize());
+        std::istream stream(&buffer);
+        tinyobj::LoadMtl(matMap, materials, &stream, warn, err);
+        return true;
+    }
+
+private:
+    std::string m_baseDir;
+};
+
+// tinyobj::LoadObj parsing the file in place
+static inline bool LoadObjAsset(const char *filename,
+        tinyobj::attrib_t *attrib, std::vector<tinyobj::shape_t> *shapes,
+        std::vector<tinyobj::material_t> *materials, std::string *warn,
+        std::string *err)
+{
+    MappedFile file;
+    if (!OpenAsset(filename, file)) {
+        return false;
+    }
+    MemoryStreamBuf buffer(file.GetChars(), file.GetSize());
+    std::istream stream(&buffer);
+    AssetMaterialReader materialReader(GetBaseDir(filename));
+    return tinyobj::LoadObj(attrib, shapes, materials, warn, err, &stream,
+            &materialReader);
+}
+
+#endif
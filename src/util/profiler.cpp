@@ -0,0 +1,265 @@
+#include "profiler.h"
+#ifdef ENABLE_PROFILER
+#include <cstdio>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include "util/json.h"
+#include "util/log.h"
+
+// Track of the GPU zones, CPU threads are numbered from 1
+#define PROFILE_GPU_TRACK 0
+
+struct ProfileEvent_t {
+    const char *name;
+    uint64_t start; // Nanoseconds since the capture began
+    uint64_t end;
+};
+
+// Zones a thread has recorded. Only the thread itself adds to it, the
+// lock is for the GL thread reading it when the capture is written.
+struct ProfileThread_t {
+    uint32_t id;
+    std::string name;
+    std::mutex lock;
+    std::vector<ProfileEvent_t> events;
+};
+
+struct GpuZone_t {
+    const char *name;
+    GLuint queries[2]; // Timestamps at the start and the end
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> capturing(false);
+static Clock::time_point captureStart;
+static std::string captureFilename;
+static uint32_t captureFrames = 0; // Left to record
+static std::mutex threadsLock;
+static std::vector<std::unique_ptr<ProfileThread_t>> threads;
+static thread_local ProfileThread_t *thisThread = NULL;
+
+// Zones of this frame and the last. The last frame's queries are read
+// when this one ends, by then the GPU has usually finished them.
+static std::vector<GpuZone_t> gpuZones[2];
+static uint32_t gpuFrame = 0;
+static std::vector<GLuint> freeQueries;
+static std::vector<ProfileEvent_t> gpuEvents;
+static GLint64 gpuCaptureStart = 0; // GL timestamp when capturing began
+
+static uint64_t Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - captureStart).count();
+}
+
+static bool TimestampsSupported()
+{
+    return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+static ProfileThread_t* GetThread()
+{
+    if (thisThread == NULL) {
+        std::lock_guard<std::mutex> guard(threadsLock);
+        threads.emplace_back(new ProfileThread_t());
+        thisThread = threads.back().get();
+        thisThread->id = threads.size();
+        thisThread->name = "Thread " + std::to_string(thisThread->id);
+    }
+    return thisThread;
+}
+
+ProfileScope::ProfileScope(const char *name) : m_name(name), m_start(0),
+        m_active(capturing.load(std::memory_order_acquire))
+{
+    if (m_active) {
+        m_start = Now();
+    }
+}
+
+ProfileScope::~ProfileScope()
+{
+    if (!m_active) {
+        return;
+    }
+    const uint64_t end = Now();
+    ProfileThread_t *thread = GetThread();
+    std::lock_guard<std::mutex> guard(thread->lock);
+    thread->events.push_back({ m_name, m_start, end });
+}
+
+static GLuint GetQuery()
+{
+    GLuint query;
+    if (freeQueries.size() > 0) {
+        query = freeQueries.back();
+        freeQueries.pop_back();
+    } else {
+        glGenQueries(1, &query);
+    }
+    return query;
+}
+
+GpuProfileScope::GpuProfileScope(const char *name) : m_zone(0),
+        m_active(capturing.load(std::memory_order_relaxed)
+        && TimestampsSupported())
+{
+    if (!m_active) {
+        return;
+    }
+    std::vector<GpuZone_t> &zones = gpuZones[gpuFrame % 2];
+    GpuZone_t zone = { name, { GetQuery(), GetQuery() } };
+    glQueryCounter(zone.queries[0], GL_TIMESTAMP);
+    m_zone = zones.size();
+    zones.push_back(zone);
+}
+
+GpuProfileScope::~GpuProfileScope()
+{
+    if (m_active) {
+        glQueryCounter(gpuZones[gpuFrame % 2][m_zone].queries[1],
+                GL_TIMESTAMP);
+    }
+}
+
+// Waits for the queries of `zones` if they aren't done and turns them
+// into events on the CPU's timeline
+static void ResolveGpuZones(std::vector<GpuZone_t> &zones)
+{
+    for (size_t i=0; i<zones.size(); i++) {
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(zones[i].queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(zones[i].queries[1], GL_QUERY_RESULT, &end);
+        freeQueries.push_back(zones[i].queries[0]);
+        freeQueries.push_back(zones[i].queries[1]);
+        if ((GLint64)start < gpuCaptureStart || end < start) {
+            continue;
+        }
+        gpuEvents.push_back({ zones[i].name, start - gpuCaptureStart,
+                end - gpuCaptureStart });
+    }
+    zones.clear();
+}
+
+void ProfilerSetThreadName(const char *name)
+{
+    ProfileThread_t *thread = GetThread();
+    std::lock_guard<std::mutex> guard(thread->lock);
+    thread->name = name;
+}
+
+bool ProfilerBeginCapture(const char *filename, uint32_t numFrames)
+{
+    if (capturing.load() || numFrames == 0) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> guard(threadsLock);
+        for (size_t i=0; i<threads.size(); i++) {
+            std::lock_guard<std::mutex> threadGuard(threads[i]->lock);
+            threads[i]->events.clear();
+        }
+    }
+    gpuEvents.clear();
+    captureFilename = filename;
+    // The frame it starts in isn't a whole one and doesn't count
+    captureFrames = numFrames + 1;
+    if (TimestampsSupported()) {
+        glGetInteger64v(GL_TIMESTAMP, &gpuCaptureStart);
+    }
+    captureStart = Clock::now();
+    GetThread(); // The GL thread gets the first track
+    capturing.store(true, std::memory_order_release);
+    Info("Capturing %u frames to '%s'", numFrames, filename);
+    return true;
+}
+
+static void WriteEvent(FILE *file, const ProfileEvent_t &event,
+        uint32_t track, bool &first)
+{
+    fprintf(file, "%s\n{\"name\":", first ? "" : ",");
+    WriteJsonString(file, event.name);
+    fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,"
+            "\"dur\":%.3f}", track, event.start / 1000.0,
+            (event.end - event.start) / 1000.0);
+    first = false;
+}
+
+static void WriteTrackName(FILE *file, uint32_t track, const char *name,
+        bool &first)
+{
+    fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+            "\"tid\":%u,\"args\":{\"name\":", first ? "" : ",", track);
+    WriteJsonString(file, name);
+    fprintf(file, "}}");
+    first = false;
+}
+
+static bool WriteCapture()
+{
+    FILE *file = fopen(captureFilename.c_str(), "w");
+    if (file == NULL) {
+        Error("Could not open '%s' for the trace", captureFilename.c_str());
+        return false;
+    }
+    size_t numEvents = gpuEvents.size();
+    bool first = true;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    WriteTrackName(file, PROFILE_GPU_TRACK, "GPU", first);
+    for (size_t i=0; i<gpuEvents.size(); i++) {
+        WriteEvent(file, gpuEvents[i], PROFILE_GPU_TRACK, first);
+    }
+    std::lock_guard<std::mutex> guard(threadsLock);
+    for (size_t t=0; t<threads.size(); t++) {
+        ProfileThread_t &thread = *threads[t];
+        std::lock_guard<std::mutex> threadGuard(thread.lock);
+        WriteTrackName(file, thread.id, thread.name.c_str(), first);
+        for (size_t i=0; i<thread.events.size(); i++) {
+            WriteEvent(file, thread.events[i], thread.id, first);
+        }
+        numEvents += thread.events.size();
+        thread.events.clear();
+    }
+    fprintf(file, "\n]}\n");
+    bool ok = !ferror(file);
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        Error("Failed writing the trace '%s'", captureFilename.c_str());
+        return false;
+    }
+    Info("Wrote %lu zones to '%s'", (unsigned long)numEvents,
+            captureFilename.c_str());
+    return true;
+}
+
+void ProfilerEndFrame()
+{
+    if (!capturing.load(std::memory_order_relaxed)) {
+        return;
+    }
+    ResolveGpuZones(gpuZones[(gpuFrame + 1) % 2]);
+    gpuFrame++;
+    if (--captureFrames == 0) {
+        ProfilerEndCapture();
+    }
+}
+
+void ProfilerEndCapture()
+{
+    if (!capturing.load()) {
+        return;
+    }
+    capturing.store(false);
+    ResolveGpuZones(gpuZones[0]);
+    ResolveGpuZones(gpuZones[1]);
+    WriteCapture();
+    gpuEvents.clear();
+}
+
+#endif
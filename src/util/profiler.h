@@ -0,0 +1,89 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+#include <cstdint>
+
+// Frames a capture covers unless asked otherwise
+#define PROFILE_CAPTURE_FRAMES 120
+// Where captures started with T go
+#define PROFILE_DEFAULT_FILENAME "trace.json"
+
+// Timed zones for captures in Chrome's trace event format, open the
+// file in chrome://tracing or Perfetto. Without ENABLE_PROFILER
+// (make PROFILE=1) every macro below compiles to nothing.
+//
+//   PROFILE_SCOPE("Name") times the rest of the block on this thread
+//   PROFILE_FUNCTION() is PROFILE_SCOPE with the function's name
+//   PROFILE_GPU_SCOPE("Name") times the GL commands of the block with
+//       a pair of timestamp queries, on the GL thread
+//   PROFILE_THREAD_NAME("Name") labels the calling thread's track
+//   PROFILE_BEGIN_CAPTURE(file, frames) records the next `frames`
+//       frames and writes them to `file`, false if it can't
+//   PROFILE_END_FRAME() must be called once a frame on the GL thread
+//   PROFILE_END_CAPTURE() writes a running capture out early
+//
+// Names must be string literals or otherwise outlive the capture.
+#ifdef ENABLE_PROFILER
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *name);
+    ~ProfileScope();
+
+    ProfileScope(const ProfileScope &) = delete;
+    ProfileScope& operator=(const ProfileScope &) = delete;
+
+private:
+    const char *m_name;
+    uint64_t m_start;
+    bool m_active; // False unless a capture was running at the start
+};
+
+class GpuProfileScope
+{
+public:
+    explicit GpuProfileScope(const char *name);
+    ~GpuProfileScope();
+
+    GpuProfileScope(const GpuProfileScope &) = delete;
+    GpuProfileScope& operator=(const GpuProfileScope &) = delete;
+
+private:
+    uint32_t m_zone; // Index into this frame's GPU zones
+    bool m_active;
+};
+
+void ProfilerSetThreadName(const char *name);
+
+bool ProfilerBeginCapture(const char *filename, uint32_t numFrames);
+
+void ProfilerEndFrame();
+
+void ProfilerEndCapture();
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) \
+        ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+#define PROFILE_GPU_SCOPE(name) \
+        GpuProfileScope PROFILE_CONCAT(gpuProfileScope, __LINE__)(name)
+#define PROFILE_THREAD_NAME(name) ProfilerSetThreadName(name)
+#define PROFILE_BEGIN_CAPTURE(filename, frames) \
+        ProfilerBeginCapture(filename, frames)
+#define PROFILE_END_FRAME() ProfilerEndFrame()
+#define PROFILE_END_CAPTURE() ProfilerEndCapture()
+
+#else
+
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_FUNCTION() do {} while (0)
+#define PROFILE_GPU_SCOPE(name) do {} while (0)
+#define PROFILE_THREAD_NAME(name) do {} while (0)
+#define PROFILE_BEGIN_CAPTURE(filename, frames) false
+#define PROFILE_END_FRAME() do {} while (0)
+#define PROFILE_END_CAPTURE() do {} while (0)
+
+#endif
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef STATS_UTIL_H
+#define STATS_UTIL_H
+#include <cmath>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+struct TimeSummary_t {
+    size_t count;
+    double mean;
+    double p50;
+    double p95;
+    double p99;
+    double max;
+};
+
+// Nearest rank percentile of sorted `samples`, `p` in [0, 100]
+static inline double SortedPercentile(const std::vector<double> &samples,
+        double p)
+{
+    if (samples.size() == 0) {
+        return 0.0;
+    }
+    size_t rank = (size_t)std::ceil(p / 100.0 * samples.size());
+    rank = std::max((size_t)1, std::min(rank, samples.size()));
+    return samples[rank - 1];
+}
+
+// Takes a copy to sort
+static inline TimeSummary_t SummarizeTimes(std::vector<double> samples)
+{
+    TimeSummary_t summary = { samples.size(), 0.0, 0.0, 0.0, 0.0, 0.0 };
+    if (samples.size() == 0) {
+        return summary;
+    }
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (size_t i=0; i<samples.size(); i++) {
+        sum += samples[i];
+    }
+    summary.mean = sum / samples.size();
+    summary.p50 = SortedPercentile(samples, 50.0);
+    summary.p95 = SortedPercentile(samples, 95.0);
+    summary.p99 = SortedPercentile(samples, 99.0);
+    summary.max = samples.back();
+    return summary;
+}
+
+#endif
@@ -2,8 +2,10 @@
 #include <cstring>
 #include <sstream>
 #include <cctype>
-#include "util/file.h"
+#include <algorithm>
+#include "util/archive.h"
 #include "util/strtrim.h"
+#include "util/log.h"
 /*
 i strongly recommend using std::string_view here in place of strings/streams.
 taking input as a std::string_view (passed by value) allows both std::strings and
@@ -75,9 +77,11 @@ static bool ReadVec3FromString(const std::string &str, glm::vec3 &vec)
 //    endfacet
 //    ... more facets ...
 // endsolid
-bool ParseSTLAscii(std::string &str, std::vector<STLSolid_t> &solids)
+bool ParseSTLAscii(const char *data, size_t size,
+        std::vector<STLSolid_t> &solids)
 {
-    std::istringstream strStream(str);
+    MemoryStreamBuf buffer(data, size);
+    std::istream strStream(&buffer);
     std::string line;
     STLSolid_t currentSolid;
     STLFacet_t currentFacet;
@@ -175,16 +179,18 @@ struct internalSTLFacet_t
 //              some variantes of STL store color
 //              information in the attribute byte
 //              count
-bool ParseSTLBinary(std::string &str, std::vector<STLSolid_t> &solids)
+bool ParseSTLBinary(const char *data, size_t size,
+        std::vector<STLSolid_t> &solids)
 {
-    Uint32 totalSize = str.size();
+    Uint32 totalSize = size;
     Uint32 offset = 0;
     do {
         if (totalSize - offset < sizeof(internalSTLSolid_t)) {
             Error("Malformed STL Header TotalSize < HeaderSize");
             return false;
         }
-        internalSTLSolid_t *stlHeader = (internalSTLSolid_t *)&str[offset];
+        const internalSTLSolid_t *stlHeader =
+                (const internalSTLSolid_t *)(data + offset);
         STLSolid_t solid;
         solid.header.resize(80);
         memcpy(&solid.header[0], stlHeader->header, 80);
@@ -195,7 +201,8 @@ bool ParseSTLBinary(std::string &str, std::vector<STLSolid_t> &solids)
             return false;
         }
         //Debug("Solid has %ld Facets.", stlHeader->numFacets);
-        internalSTLFacet_t *facets = (internalSTLFacet_t *)&str[offset];
+        const internalSTLFacet_t *facets =
+                (const internalSTLFacet_t *)(data + offset);
         for (unsigned int i=0; i<stlHeader->numFacets; i++) {
             STLFacet_t tmpFacet;
             tmpFacet.normal = glm::vec3(facets[0].normal[0],
@@ -208,7 +215,7 @@ bool ParseSTLBinary(std::string &str, std::vector<STLSolid_t> &solids)
             solid.facets.push_back(tmpFacet);
             //Debug("Added facet size: %d", solid.facets.size());
             offset += STL_FACET_SIZE;
-            facets = (internalSTLFacet_t *)&str[offset];
+            facets = (const internalSTLFacet_t *)(data + offset);
         }
         solids.push_back(solid);
     } while (totalSize - offset > sizeof(internalSTLSolid_t));
@@ -218,14 +225,13 @@ bool ParseSTLBinary(std::string &str, std::vector<STLSolid_t> &solids)
 
 bool ParseSTLFile(const char *filename, std::vector<STLSolid_t> &solids)
 {
-    std::string target;
-    // Enhancement: loop through file while it is open, instead of
-    //              reading the entire file into a string
-    Sint64 len = ReadFile(filename, target);
-    if (len <= 0) {
+    // Parsed in place, the file is never copied whole
+    MappedFile file;
+    if (!OpenAsset(filename, file)) {
         Error("Failed to open STL file '%s'", filename);
         return false;
     }
+    const size_t len = file.GetSize();
     if (len < 5) {
         Error("Malformed STL file '%s' is too small", filename);
         return false;
@@ -234,12 +240,13 @@ bool ParseSTLFile(const char *filename, std::vector<STLSolid_t> &solids)
     // by checking for the magic string 'solid'. 32 is arbitrary and
     // is a design choice to consider stl files with extranious whitespace
     // are not valid
-    if (trim_copy(target.substr(0, 32)).compare(0, 5, "solid") == 0) {
+    const std::string start(file.GetChars(), std::min(len, (size_t)32));
+    if (trim_copy(start).compare(0, 5, "solid") == 0) {
         Info("Parsing Ascii STL file '%s'", filename);
-        return ParseSTLAscii(target, solids);
+        return ParseSTLAscii(file.GetChars(), len, solids);
     }
     Info("Parsing Binary STL file '%s'", filename);
-    return ParseSTLBinary(target, solids);
+    return ParseSTLBinary(file.GetChars(), len, solids);
 }
 
 